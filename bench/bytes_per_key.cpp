@@ -0,0 +1,173 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Benchmark for memory used per key in a store.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench_util.h"
+#include "processor.h"
+#include "timing_wheel.h"
+#include "key_hash.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/identity.hpp>
+
+#include <iostream>
+#include <cstdio>
+
+using std::string;
+using std::make_shared;
+using throng::ctx;
+using throng::node_id;
+using throng::vector_clock;
+using throng::store_config;
+using throng::internal::processor;
+using throng::internal::ctx_internal;
+using throng::internal::timing_wheel;
+using throng::bench::get_live_bytes;
+
+static string make_key(size_t i) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "tenant-%04zu/epg-%04zu/endpoint-%08zu",
+             i % 1000, (i / 1000) % 1000, i);
+    return buf;
+}
+
+namespace {
+
+/*
+ * The item layout the processor used before items moved to flat
+ * records in an item_table: a hashed multi_index of pointers to
+ * separately allocated details, each holding its key and a vector
+ * of values.  Kept here so the two layouts can be compared.
+ */
+typedef std::chrono::steady_clock::time_point time_point;
+
+struct legacy_item_details : public timing_wheel::entry {
+    legacy_item_details(string key_, uint64_t key_hash_)
+        : key(std::move(key_)), key_hash(key_hash_) { }
+
+    string key;
+    uint64_t key_hash;
+    std::vector<throng::versioned<string>> values;
+    time_point last_update;
+    time_point last_refresh;
+    time_point last_resolve;
+    bool local = false;
+};
+
+struct legacy_item {
+    legacy_item(string key_, uint64_t key_hash_)
+        : details(new legacy_item_details(std::move(key_), key_hash_)) { }
+
+    legacy_item(legacy_item&&) = default;
+
+    std::unique_ptr<legacy_item_details> details;
+};
+
+struct legacy_item_hash {
+    size_t operator()(const legacy_item& i) const {
+        return i.details->key_hash;
+    }
+};
+
+struct legacy_item_equal {
+    bool operator()(const legacy_item& a, const legacy_item& b) const {
+        return a.details->key == b.details->key;
+    }
+};
+
+typedef boost::multi_index::multi_index_container<
+    legacy_item,
+    boost::multi_index::indexed_by<
+        boost::multi_index::hashed_unique<
+            boost::multi_index::identity<legacy_item>,
+            legacy_item_hash, legacy_item_equal>
+        >
+    > legacy_item_map_t;
+
+} /* anonymous namespace */
+
+/*
+ * Fill a store with endpoint-like keys and small values and report
+ * the heap bytes used for each key, including all index and
+ * allocator overhead.  The legacy layout stores the same items in
+ * the processor's earlier item container, without a processor.
+ *
+ * Arguments: [number of keys] [value size] [hash|radix|legacy]
+ */
+BENCHMARK(bytes_per_key, "heap bytes used per stored key") {
+    size_t count = args.size() > 0 ? std::stoul(args[0]) : 1000000;
+    size_t value_size = args.size() > 1 ? std::stoul(args[1]) : 32;
+    string layout = args.size() > 2 ? args[2] : "hash";
+    store_config config;
+    if (layout == "radix")
+        config.key_index = throng::key_index_type::RADIX_TREE;
+
+    auto db_path = boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("throng-bench-%%%%-%%%%");
+    {
+        std::unique_ptr<ctx> c(ctx::new_ctx(db_path.string()));
+        node_id id = {1, 2, 3};
+        vector_clock clock = vector_clock().incremented(id);
+        string value(value_size, 'v');
+
+        size_t payload = 0;
+        size_t before = get_live_bytes();
+        auto report = [&]() {
+            size_t used = get_live_bytes() - before;
+            std::cout << "layout:          " << layout << std::endl
+                      << "keys:            " << count << std::endl
+                      << "payload/key:     "
+                      << (double)payload / count << std::endl
+                      << "bytes/key:       "
+                      << (double)used / count << std::endl
+                      << "overhead/key:    "
+                      << (double)(used - payload) / count << std::endl;
+        };
+
+        if (layout == "legacy") {
+            legacy_item_map_t items;
+            for (size_t i = 0; i < count; i++) {
+                string key = make_key(i);
+                payload += key.size() + value.size();
+                uint64_t hash =
+                    throng::internal::hash_key(config.key_hash, key);
+                legacy_item item(std::move(key), hash);
+                item.details->values.push_back
+                    ({ make_shared<string>(value), clock });
+                items.insert(std::move(item));
+            }
+            report();
+        } else {
+            processor p(dynamic_cast<ctx_internal&>(*c), "bench", config);
+            for (size_t i = 0; i < count; i++) {
+                string key = make_key(i);
+                payload += key.size() + value.size();
+                p.put(key, { make_shared<string>(value), clock });
+            }
+            report();
+        }
+    }
+    boost::filesystem::remove_all(db_path);
+    return 0;
+}
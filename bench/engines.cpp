@@ -0,0 +1,251 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Benchmark comparing the storage engines
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench_util.h"
+#include "in_memory_storage_engine.h"
+#include "leveldb_storage_engine.h"
+#include "log_storage_engine.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <cmath>
+#include <cstdio>
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+using std::make_shared;
+using throng::store;
+using throng::versioned;
+using throng::vector_clock;
+using throng::internal::in_memory_storage_engine;
+using throng::internal::leveldb_storage_engine;
+using throng::internal::log_storage_engine;
+
+typedef store<string, string> store_t;
+typedef versioned<string> versioned_t;
+
+namespace {
+
+// Keys are in groups of this many sharing a prefix, for scans
+const size_t GROUP_SIZE = 100;
+
+/**
+ * Zipfian distribution over [0, n), as generated by YCSB, with
+ * popular items scattered across the range
+ */
+class zipfian {
+public:
+    zipfian(size_t n_, double theta_)
+        : n(n_), theta(theta_), zetan(zeta(n_)),
+          alpha(1.0 / (1.0 - theta_)),
+          eta((1.0 - std::pow(2.0 / n_, 1.0 - theta_)) /
+              (1.0 - zeta(2) / zetan)) { }
+
+    size_t next(std::mt19937_64& rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan;
+        size_t rank;
+        if (uz < 1.0)
+            rank = 0;
+        else if (uz < 1.0 + std::pow(0.5, theta))
+            rank = 1;
+        else
+            rank = (size_t)(n * std::pow(eta * u - eta + 1.0, alpha));
+        return (size_t)((std::min(rank, n - 1) * 0x9e3779b97f4a7c15ull) % n);
+    }
+
+private:
+    size_t n;
+    double theta;
+    double zetan;
+    double alpha;
+    double eta;
+
+    double zeta(size_t count) const {
+        double sum = 0;
+        for (size_t i = 1; i <= count; i++)
+            sum += 1.0 / std::pow((double)i, theta);
+        return sum;
+    }
+};
+
+struct workload {
+    const char* name;
+    // fraction of operations that read a key
+    double reads;
+    // fraction of operations that scan a group of keys
+    double scans;
+    // true to choose keys with a zipfian distribution
+    bool skewed;
+};
+
+const workload WORKLOADS[] = {
+    { "uniform", 0.5, 0.0, false },
+    { "zipfian", 0.9, 0.0, true },
+    { "scan", 0.0, 0.9, false },
+};
+
+unique_ptr<store_t> open_engine(const string& name,
+                                const boost::filesystem::path& dir,
+                                bool sync) {
+    if (name == "memory")
+        return unique_ptr<store_t>(new in_memory_storage_engine("bench"));
+    if (name == "log")
+        return unique_ptr<store_t>
+            (new log_storage_engine("bench", (dir / "log").string(),
+                                    64 * 1024 * 1024, 0.5, sync));
+    if (name == "leveldb")
+        return unique_ptr<store_t>
+            (new leveldb_storage_engine("bench", (dir / "leveldb").string(),
+                                        sync));
+    return nullptr;
+}
+
+double percentile(const vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t i = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return sorted[i] / 1000.0;
+}
+
+void run(const string& engine, const workload& w,
+         const vector<string>& keys, size_t operations,
+         size_t value_size, bool sync) {
+    typedef std::chrono::steady_clock clock;
+    auto dir = boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("throng-bench-%%%%-%%%%");
+    {
+        unique_ptr<store_t> s = open_engine(engine, dir, sync);
+        auto value = make_shared<const string>(value_size, 'v');
+        vector<vector_clock> clocks(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            clocks[i] = clocks[i].incremented({1});
+            s->put(keys[i], versioned_t(value, clocks[i]));
+        }
+
+        std::mt19937_64 rng(42);
+        zipfian skew(keys.size(), 0.99);
+        std::uniform_int_distribution<size_t> uniform(0, keys.size() - 1);
+        std::uniform_real_distribution<double> op(0, 1);
+        vector<uint64_t> latencies;
+        latencies.reserve(operations);
+        size_t visited = 0;
+
+        auto start = clock::now();
+        for (size_t n = 0; n < operations; n++) {
+            size_t i = w.skewed ? skew.next(rng) : uniform(rng);
+            double r = op(rng);
+            auto t = clock::now();
+            if (r < w.reads) {
+                s->get(keys[i]);
+            } else if (r < w.reads + w.scans) {
+                s->visit_prefix(keys[i].substr(0, keys[i].find('/') + 1),
+                                [&visited](const string&,
+                                           const vector<versioned_t>&) {
+                                    visited += 1;
+                                });
+            } else {
+                clocks[i] = clocks[i].incremented({1});
+                s->put(keys[i], versioned_t(value, clocks[i]));
+            }
+            latencies.push_back(std::chrono::duration_cast
+                                <std::chrono::nanoseconds>
+                                (clock::now() - t).count());
+        }
+        double seconds = std::chrono::duration<double>
+            (clock::now() - start).count();
+
+        std::sort(latencies.begin(), latencies.end());
+        char line[160];
+        snprintf(line, sizeof(line),
+                 "%-8s %-8s %12.0f %9.1f %9.1f %9.1f %9.1f",
+                 engine.c_str(), w.name, operations / seconds,
+                 percentile(latencies, 0.5), percentile(latencies, 0.99),
+                 percentile(latencies, 0.999),
+                 latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+        std::cout << line << std::endl;
+    }
+    boost::filesystem::remove_all(dir);
+}
+
+} /* anonymous namespace */
+
+/*
+ * Load each storage engine with the same keys, then run workloads
+ * against it from a single thread and report the throughput and the
+ * latency percentiles in microseconds, one line per engine and
+ * workload.  The workloads are:
+ *
+ *   uniform  half reads, half writes, keys chosen uniformly
+ *   zipfian  90% reads, 10% writes, keys chosen with a zipfian
+ *            distribution
+ *   scan     90% scans of the 100 keys sharing a prefix, 10% writes
+ *
+ * Arguments: [number of keys] [operations per workload] [value size]
+ *            [sync: 0 or 1] [engines, comma-separated]
+ */
+BENCHMARK(engines, "throughput and latency of the storage engines") {
+    size_t count = args.size() > 0 ? std::stoul(args[0]) : 100000;
+    size_t operations = args.size() > 1 ? std::stoul(args[1]) : 200000;
+    size_t value_size = args.size() > 2 ? std::stoul(args[2]) : 100;
+    bool sync = args.size() > 3 && args[3] == "1";
+    string engine_list = args.size() > 4 ? args[4] : "memory,log,leveldb";
+
+    vector<string> engines;
+    std::istringstream in(engine_list);
+    for (string e; std::getline(in, e, ','); ) {
+        if (e != "memory" && e != "log" && e != "leveldb") {
+            std::cerr << "Unknown engine " << e << std::endl;
+            return 1;
+        }
+        engines.push_back(e);
+    }
+
+    vector<string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "group-%06zu/key-%08zu",
+                 i / GROUP_SIZE, i);
+        keys.emplace_back(buf);
+    }
+
+    std::cout << "keys: " << count << ", operations: " << operations
+              << ", value size: " << value_size << ", sync: " << sync
+              << std::endl;
+    char header[160];
+    snprintf(header, sizeof(header), "%-8s %-8s %12s %9s %9s %9s %9s",
+             "engine", "workload", "ops/s", "p50 us", "p99 us",
+             "p99.9 us", "max us");
+    std::cout << header << std::endl;
+    for (auto& e : engines) {
+        for (auto& w : WORKLOADS)
+            run(e, w, keys, operations, value_size, sync);
+    }
+    return 0;
+}
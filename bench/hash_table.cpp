@@ -0,0 +1,155 @@
+/*
+ * Benchmark for the in-memory storage engine hash table
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench_util.h"
+#include "in_memory_storage_engine.h"
+#include "stored_values.h"
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <unordered_map>
+#include <cstdio>
+
+using std::string;
+using std::vector;
+using std::make_shared;
+using throng::versioned;
+using throng::vector_clock;
+using throng::internal::in_memory_storage_engine;
+using throng::internal::apply_write;
+using throng::bench::get_live_bytes;
+
+typedef versioned<string> versioned_t;
+
+namespace {
+
+/**
+ * The previous in-memory storage engine: a node-based hash map
+ * behind a single lock
+ */
+class unordered_map_engine {
+public:
+    vector<versioned_t> get(const string& key) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = records.find(key);
+        if (it == records.end()) return vector<versioned_t>();
+        return it->second;
+    }
+
+    bool put(const string& key, const versioned_t& value) {
+        std::lock_guard<std::mutex> guard(lock);
+        return apply_write(records[key], value);
+    }
+
+private:
+    std::mutex lock;
+    std::unordered_map<string, vector<versioned_t>> records;
+};
+
+template <typename Engine>
+void run(const char* label, const vector<string>& keys,
+         const versioned_t& value, size_t threads) {
+    typedef std::chrono::steady_clock clock;
+    size_t before = get_live_bytes();
+    Engine* e = new Engine;
+
+    // Insert from a single thread so that the time includes every
+    // resize of the table, and track the slowest insert
+    auto start = clock::now();
+    clock::duration slowest(0);
+    for (auto& key : keys) {
+        auto t = clock::now();
+        e->put(key, value);
+        slowest = std::max(slowest, clock::now() - t);
+    }
+    auto insert_time = clock::now() - start;
+    size_t bytes = get_live_bytes() - before;
+
+    // Read every key from each thread, each starting at a different
+    // offset
+    start = clock::now();
+    vector<std::thread> readers;
+    for (size_t t = 0; t < threads; t++) {
+        readers.emplace_back([&keys, e, t, threads]() {
+                size_t n = keys.size();
+                for (size_t i = 0; i < n; i++)
+                    e->get(keys[(i + t * n / threads) % n]);
+            });
+    }
+    for (auto& r : readers)
+        r.join();
+    auto read_time = clock::now() - start;
+    delete e;
+
+    using std::chrono::nanoseconds;
+    using std::chrono::microseconds;
+    double n = (double)keys.size();
+    std::cout << label << std::endl
+              << "  insert ns/op:      "
+              << std::chrono::duration_cast<nanoseconds>
+                 (insert_time).count() / n << std::endl
+              << "  slowest insert us: "
+              << std::chrono::duration_cast<microseconds>
+                 (slowest).count() << std::endl
+              << "  get ns/op:         "
+              << std::chrono::duration_cast<nanoseconds>
+                 (read_time).count() / (n * threads) << std::endl
+              << "  bytes/key:         " << bytes / n << std::endl;
+}
+
+struct flat_engine : public in_memory_storage_engine {
+    flat_engine() : in_memory_storage_engine("bench") { }
+};
+
+} /* anonymous namespace */
+
+/*
+ * Fill the in-memory storage engine and a single-lock
+ * std::unordered_map with the same keys, then read every key back
+ * from a number of threads concurrently.  Reports the time per
+ * operation, the slowest single insert, which includes the largest
+ * resize, and the heap bytes used per key.
+ *
+ * Arguments: [number of keys] [reader threads]
+ */
+BENCHMARK(hash_table, "in-memory engine against std::unordered_map") {
+    size_t count = args.size() > 0 ? std::stoul(args[0]) : 1000000;
+    size_t threads = args.size() > 1 ? std::stoul(args[1]) : 4;
+
+    vector<string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "tenant-%04zu/epg-%04zu/endpoint-%08zu",
+                 i % 1000, (i / 1000) % 1000, i);
+        keys.emplace_back(buf);
+    }
+    versioned_t value(make_shared<string>(32, 'v'),
+                      vector_clock().incremented({1, 2, 3}));
+
+    run<unordered_map_engine>("std::unordered_map, one lock", keys, value,
+                              threads);
+    run<flat_engine>("in_memory_storage_engine", keys, value, threads);
+    return 0;
+}
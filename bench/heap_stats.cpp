@@ -0,0 +1,78 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Heap accounting for throng benchmarks.  Replaces the global
+ * operator new and delete so that benchmarks can measure the memory
+ * used by the library.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench_util.h"
+
+#include <malloc.h>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+static std::atomic<size_t> live_bytes(0);
+static std::atomic<uint64_t> alloc_count(0);
+
+void* operator new(size_t size) {
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    live_bytes += malloc_usable_size(p);
+    alloc_count += 1;
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    if (!p) return;
+    live_bytes -= malloc_usable_size(p);
+    std::free(p);
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete[](void* p) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+namespace throng {
+namespace bench {
+
+size_t get_live_bytes() {
+    return live_bytes.load();
+}
+
+uint64_t get_alloc_count() {
+    return alloc_count.load();
+}
+
+} /* namespace bench */
+} /* namespace throng */
@@ -0,0 +1,69 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file bench_util.h
+ * @brief Utilities for throng benchmarks
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_BENCH_UTIL_H
+#define THRONG_BENCH_UTIL_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace throng {
+namespace bench {
+
+/**
+ * Get the number of heap bytes currently allocated through operator
+ * new, including the allocator's rounding of each allocation.
+ */
+size_t get_live_bytes();
+
+/**
+ * Get the total number of calls to operator new since the program
+ * started
+ */
+uint64_t get_alloc_count();
+
+/**
+ * A benchmark entry point.  The arguments are the command-line
+ * arguments following the benchmark name.
+ */
+typedef int (*bench_fn)(const std::vector<std::string>& args);
+
+/**
+ * Register a benchmark with the given name.  Use via the
+ * BENCHMARK macro.
+ */
+struct bench_registration {
+    bench_registration(const char* name, const char* description,
+                       bench_fn fn);
+};
+
+#define BENCHMARK(name, description)                                   \
+    static int bench_##name(const std::vector<std::string>& args);     \
+    static throng::bench::bench_registration                           \
+    bench_reg_##name(#name, description, bench_##name);                \
+    static int bench_##name(const std::vector<std::string>& args)
+
+} /* namespace bench */
+} /* namespace throng */
+
+#endif /* THRONG_BENCH_UTIL_H */
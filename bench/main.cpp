@@ -0,0 +1,69 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Driver for throng benchmarks.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench_util.h"
+
+#include <google/protobuf/stubs/common.h>
+
+#include <map>
+#include <iostream>
+
+namespace throng {
+namespace bench {
+
+struct bench_info {
+    const char* description;
+    bench_fn fn;
+};
+
+static std::map<std::string, bench_info>& get_benchmarks() {
+    static std::map<std::string, bench_info> benchmarks;
+    return benchmarks;
+}
+
+bench_registration::bench_registration(const char* name,
+                                       const char* description,
+                                       bench_fn fn) {
+    get_benchmarks()[name] = bench_info { description, fn };
+}
+
+} /* namespace bench */
+} /* namespace throng */
+
+using throng::bench::get_benchmarks;
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || get_benchmarks().count(argv[1]) == 0) {
+        std::cerr << "Usage: " << argv[0] << " <benchmark> [args...]"
+                  << std::endl << std::endl << "Benchmarks:" << std::endl;
+        for (auto& b : get_benchmarks())
+            std::cerr << "  " << b.first << ": "
+                      << b.second.description << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> args(argv + 2, argv + argc);
+    int r = get_benchmarks()[argv[1]].fn(args);
+    google::protobuf::ShutdownProtobufLibrary();
+    return r;
+}
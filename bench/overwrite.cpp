@@ -0,0 +1,102 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Benchmark for overwriting existing keys
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench_util.h"
+#include "processor.h"
+
+#include <boost/filesystem.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+
+using std::string;
+using std::vector;
+using std::make_shared;
+using throng::ctx;
+using throng::node_id;
+using throng::versioned;
+using throng::vector_clock;
+using throng::store_config;
+using throng::internal::processor;
+using throng::internal::ctx_internal;
+using throng::bench::get_alloc_count;
+
+/*
+ * Overwrite every key in a full store with a newer version of its
+ * value and report the heap allocations and time for each write.
+ * The values are created up front, so the allocations are only those
+ * made by the store.
+ *
+ * Arguments: [number of keys] [rounds] [value size]
+ */
+BENCHMARK(overwrite, "allocations and time per overwrite of a key") {
+    size_t count = args.size() > 0 ? std::stoul(args[0]) : 100000;
+    size_t rounds = args.size() > 1 ? std::stoul(args[1]) : 10;
+    size_t value_size = args.size() > 2 ? std::stoul(args[2]) : 32;
+
+    vector<string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "tenant-%04zu/epg-%04zu/endpoint-%08zu",
+                 i % 1000, (i / 1000) % 1000, i);
+        keys.emplace_back(buf);
+    }
+
+    node_id id = {1, 2, 3};
+    vector<versioned<string>> versions;
+    vector_clock clock;
+    for (size_t r = 0; r <= rounds; r++) {
+        clock = clock.incremented(id);
+        versions.emplace_back(make_shared<string>(value_size, 'v'), clock);
+    }
+
+    auto db_path = boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("throng-bench-%%%%-%%%%");
+    {
+        std::unique_ptr<ctx> c(ctx::new_ctx(db_path.string()));
+        processor p(dynamic_cast<ctx_internal&>(*c), "bench",
+                    store_config());
+        for (auto& key : keys)
+            p.put(key, versions[0]);
+
+        uint64_t allocs = get_alloc_count();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 1; r <= rounds; r++) {
+            for (auto& key : keys)
+                p.put(key, versions[r]);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        allocs = get_alloc_count() - allocs;
+        double ops = (double)count * rounds;
+
+        std::cout << "writes:          " << (uint64_t)ops << std::endl
+                  << "allocs/op:       " << allocs / ops << std::endl
+                  << "ns/op:           "
+                  << std::chrono::duration_cast<std::chrono::nanoseconds>
+                     (elapsed).count() / ops << std::endl;
+    }
+    boost::filesystem::remove_all(db_path);
+    return 0;
+}
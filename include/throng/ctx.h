@@ -25,12 +25,41 @@
 #include "throng/store.h"
 #include "throng/serializer.h"
 #include "throng/store_config.h"
+#include "throng/value_codec.h"
 
 #include <string>
 #include <memory>
+#include <future>
+#include <chrono>
 
 namespace throng {
 
+/**
+ * Statistics for the in-memory data of a persistent store that has a
+ * memory limit
+ */
+struct cache_stats {
+    /**
+     * Reads of keys found in memory
+     */
+    uint64_t hits = 0;
+
+    /**
+     * Reads and writes of keys not in memory that went to storage
+     */
+    uint64_t misses = 0;
+
+    /**
+     * Items read back into memory from storage
+     */
+    uint64_t admissions = 0;
+
+    /**
+     * Items evicted from memory to stay within the memory limit
+     */
+    uint64_t evictions = 0;
+};
+
 /**
  * Provides configuration and state management for the throng cluster
  */
@@ -70,6 +99,19 @@ public:
      */
     virtual void add_seed(std::string hostname, uint16_t port) = 0;
 
+    /**
+     * Set how outgoing messages are coalesced into writes on each
+     * connection to another node.  Must be called before start.
+     *
+     * @param max_batch_size the number of bytes of queued messages at
+     * which a batch is written without waiting any longer
+     * @param max_latency the longest time a message waits for more
+     * messages to join its batch, or zero to write each batch as soon
+     * as the previous write completes
+     */
+    virtual void set_write_options(size_t max_batch_size,
+                                   std::chrono::microseconds max_latency) = 0;
+
     /**
      * Register a store with the specified name and default
      * configuration.  The default config will be a
@@ -112,11 +154,39 @@ public:
      * A listener to get notifications for changes to keys in the
      * store.  It takes arguments of the changed key, and a bool that
      * indicates that the change notification occurred because of a
-     * local write to the store.
+     * local write to the store.  In a store with an object timeout,
+     * objects written by the local node are also notified
+     * periodically, unchanged, so that they are refreshed on remote
+     * replicas.
      */
     typedef std::function<void(const std::string& key, bool local)>
     raw_listener_t;
 
+    /**
+     * An inconsistency resolver for raw values.  It takes a set of
+     * concurrent values and returns a single value.
+     */
+    typedef std::function<versioned<std::string>
+                          (const std::vector<versioned<std::string>>&)>
+    raw_resolver_t;
+
+    /**
+     * Set the inconsistency resolver that the specified store uses to
+     * compact concurrent values when a write leaves more of them than
+     * store_config::sibling_limit.  Note that this is almost never
+     * what you want.  Instead, use store_client::register_resolver.
+     *
+     * The resolver is called while the store is locked, and must not
+     * access the store.
+     *
+     * @param store_name the name of the store
+     * @param resolver the resolver, or an empty function to disable
+     * compaction
+     * @throws error::unknown_store if there is no such store
+     */
+    virtual void set_raw_resolver(const std::string& store_name,
+                                  raw_resolver_t resolver) = 0;
+
     /**
      * Register a listener to get raw notifications for the specified
      * store.  Note that this is almost never what you want.  Instead,
@@ -139,6 +209,108 @@ public:
      */
     virtual store<std::string,std::string>&
     get_raw_store(const std::string& name) = 0;
+
+    /**
+     * Get the number of bytes of memory used for the data in a store,
+     * including keys, values, version metadata, index structures and
+     * writes queued for storage.  This is the quantity limited by
+     * store_config::memory_limit, whose documentation lists what it
+     * does not include.
+     *
+     * @param store_name the name of the store
+     * @return the number of bytes
+     * @throws error::unknown_store if there is no such store
+     */
+    virtual size_t get_memory_usage(const std::string& store_name) = 0;
+
+    /**
+     * Get statistics for the items of a store held in memory
+     *
+     * @param store_name the name of the store
+     * @return the statistics
+     * @throws error::unknown_store if there is no such store
+     */
+    virtual cache_stats get_cache_stats(const std::string& store_name) = 0;
+
+    /**
+     * Get the codec for the values in a store, as set by
+     * store_config::compression.  Store clients apply it themselves;
+     * users of the raw store see values in their encoded form.
+     *
+     * @param store_name the name of the store
+     * @return the codec, or nullptr if values are not encoded
+     * @throws error::unknown_store if there is no such store
+     */
+    virtual std::shared_ptr<value_codec>
+    get_value_codec(const std::string& store_name) = 0;
+
+    /**
+     * Take a raw snapshot of the underlying store.  Note that this is
+     * almost never what you want.  Instead, use
+     * store_client::snapshot to get typed access to a snapshot.
+     *
+     * @param store_name the name of the store
+     * @return a new snapshot of the store
+     * @throws error::unknown_store if there is no such store
+     */
+    virtual std::unique_ptr<store_snapshot<std::string, std::string>>
+    snapshot(const std::string& store_name) = 0;
+
+    /**
+     * Get the raw changes to the underlying store after the given
+     * sequence number.  Note that this is almost never what you
+     * want.  Instead, use store_client::changes_since.
+     *
+     * @param store_name the name of the store
+     * @param epoch the epoch returned with the sequence number, or
+     * zero with a sequence number of zero to start
+     * @param seq the sequence number after which to get changes
+     * @param limit the maximum number of keys to return
+     * @return the changes
+     * @throws error::unknown_store if there is no such store
+     */
+    virtual store_changes<std::string, std::string>
+    changes_since(const std::string& store_name, uint64_t epoch,
+                  uint64_t seq, size_t limit) = 0;
+
+    /**
+     * Write the contents of a store to a snapshot file in the
+     * background.  The file holds the store as of the time of the
+     * call, sorted by key, and can be loaded into a store on any
+     * node with load_snapshot_file.  The file appears at the path
+     * only once it is complete.  Values compressed by the store's
+     * value codec stay compressed and name their dictionary by its
+     * content, so reading them on a node without that dictionary
+     * fails with error::serialization rather than returning wrong
+     * bytes.
+     *
+     * @param store_name the name of the store
+     * @param path the path for the file
+     * @param compress true to compress the file
+     * @return a future for the number of items written, which holds
+     * error::storage if the file could not be written
+     * @throws error::unknown_store if there is no such store
+     */
+    virtual std::future<size_t>
+    write_snapshot_file(const std::string& store_name,
+                        const std::string& path, bool compress = true) = 0;
+
+    /**
+     * Load the contents of a snapshot file written by
+     * write_snapshot_file into a store.  Each item is merged with the
+     * values already in the store as for a put, but items are loaded
+     * in bulk and listeners are not notified.
+     *
+     * @param store_name the name of the store
+     * @param path the path to the file
+     * @return the number of items in the file
+     * @throws error::unknown_store if there is no such store
+     * @throws error::storage if the file cannot be read or is corrupt
+     * @throws error::memory_limit_exceeded if the store reached its
+     * memory limit before the whole file was loaded
+     */
+    virtual size_t load_snapshot_file(const std::string& store_name,
+                                      const std::string& path) = 0;
 };
 
 } /* namespace throng */
@@ -108,6 +108,38 @@ public:
                   ": " + std::to_string(elements) + " remaining") { }
 };
 
+/**
+ * Thrown when the storage for a persistent store fails
+ */
+class storage: public exception
+{
+public:
+    /**
+     * Create a new exception with the provided message
+     *
+     * @param store_name the name of the store
+     * @param message the error message
+     */
+    storage(const std::string& store_name, const std::string& message) :
+        exception(store_name + ": " + message) { }
+};
+
+/**
+ * Thrown when a write to a store would exceed the memory limit for
+ * the store and there is no data that can be evicted to make room
+ */
+class memory_limit_exceeded: public exception
+{
+public:
+    /**
+     * Create a new exception with the provided message
+     *
+     * @param store_name The name of the store
+     */
+    memory_limit_exceeded(const std::string& store_name) :
+        exception("Memory limit exceeded for " + store_name) { }
+};
+
 } /* namespace error */
 } /* namespace throng */
 
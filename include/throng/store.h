@@ -26,10 +26,159 @@
 #include "throng/serializer.h"
 
 #include <vector>
+#include <algorithm>
 #include <functional>
+#include <memory>
+#include <utility>
+#include <cstdint>
 
 namespace throng {
 
+/**
+ * A group of writes to apply to a store together with store::write.
+ * Writes are applied in the order they were added.  A batch can be
+ * marked atomic, in which case a store applies either all of the
+ * writes or none of them, and readers see either all of them or
+ * none.
+ */
+template <typename K, typename V>
+class write_batch {
+public:
+    /**
+     * The type of versioned value used by the store
+     */
+    typedef versioned<V> versioned_t;
+
+    /**
+     * A write in the batch
+     */
+    struct operation {
+        K key;
+        /**
+         * The value to write, or for an erase, a value holding only
+         * the version to erase through
+         */
+        versioned_t value;
+        /**
+         * True if the write is an erase rather than a put
+         */
+        bool erase;
+    };
+
+    /**
+     * Create an empty batch
+     *
+     * @param atomic_ true if the batch must be applied atomically
+     */
+    explicit write_batch(bool atomic_ = false) : atomic(atomic_) { }
+
+    /**
+     * Add a write of a value to the batch
+     *
+     * @param key the key to write
+     * @param value the value to write
+     */
+    void put(K key, versioned_t value) {
+        operations.push_back({ std::move(key), std::move(value), false });
+    }
+
+    /**
+     * Add a delete to the batch, which writes a tombstone with the
+     * given version
+     *
+     * @param key the key to delete
+     * @param version the version of the tombstone
+     */
+    void remove(K key, vector_clock version) {
+        operations.push_back({ std::move(key),
+                               versioned_t(nullptr, std::move(version)),
+                               false });
+    }
+
+    /**
+     * Add an erase to the batch, which removes values from the store
+     * as for store::erase
+     *
+     * @param key the key to erase
+     * @param version the version through which to erase values
+     */
+    void erase(K key, vector_clock version) {
+        operations.push_back({ std::move(key),
+                               versioned_t(nullptr, std::move(version)),
+                               true });
+    }
+
+    /**
+     * Add the writes in another batch to the end of this one
+     *
+     * @param other the batch whose writes to add
+     */
+    void append(const write_batch& other) {
+        operations.insert(operations.end(), other.operations.begin(),
+                          other.operations.end());
+    }
+
+    /**
+     * Get the writes in the batch, in order
+     */
+    const std::vector<operation>& get_operations() const {
+        return operations;
+    }
+
+    /**
+     * Check whether the batch must be applied atomically
+     */
+    bool is_atomic() const { return atomic; }
+
+    /**
+     * Set whether the batch must be applied atomically
+     */
+    void set_atomic(bool atomic_) { atomic = atomic_; }
+
+    /**
+     * Get the number of writes in the batch
+     */
+    size_t size() const { return operations.size(); }
+
+    /**
+     * Check whether the batch has no writes
+     */
+    bool empty() const { return operations.empty(); }
+
+    /**
+     * Remove all writes from the batch
+     */
+    void clear() { operations.clear(); }
+
+    /**
+     * Remove the writes after the first count writes
+     *
+     * @param count the number of writes to keep
+     */
+    void truncate(size_t count) {
+        if (count < operations.size())
+            operations.erase(operations.begin() + count, operations.end());
+    }
+
+private:
+    bool atomic;
+    std::vector<operation> operations;
+};
+
+/**
+ * Check whether a key begins with a prefix, as used by the default
+ * store::visit_prefix.  Key types without a string-like compare can
+ * provide an overload found by argument-dependent lookup.
+ *
+ * @param key the key to check
+ * @param prefix the prefix to match
+ * @return true if the key begins with the prefix
+ */
+template <typename K>
+bool key_has_prefix(const K& key, const K& prefix) {
+    return key.compare(0, prefix.size(), prefix) == 0;
+}
+
 /**
  * A store is an interface that defines methods for accessing data
  * from the throng distributed database.  Note that this allows access
@@ -68,6 +217,42 @@ public:
      */
     virtual bool put(const K& key, const versioned_t& value) = 0;
 
+    /**
+     * Remove the values for a key whose versions are equal to or
+     * before the given version, leaving no tombstone.  Values that
+     * are concurrent with or after it are kept.  This reclaims the
+     * space of deleted and expired keys once they no longer need to
+     * be replicated.  The default implementation removes nothing.
+     *
+     * @param key the key to erase
+     * @param version the version through which to erase values
+     * @return true if any values were removed
+     */
+    virtual bool erase(const K& /* key */,
+                       const vector_clock& /* version */) {
+        return false;
+    }
+
+    /**
+     * Apply a batch of writes.  Each write is applied as for put or
+     * erase, and writes that are obsolete are skipped.  Storage
+     * engines map the batch to a single native write where they can.
+     * The default implementation applies the writes one at a time,
+     * and so cannot apply an atomic batch atomically.
+     *
+     * @param batch the writes to apply
+     * @return the number of writes that were applied
+     */
+    virtual size_t write(const write_batch<K, V>& batch) {
+        size_t applied = 0;
+        for (auto& op : batch.get_operations()) {
+            if (op.erase ? erase(op.key, op.value.get_version())
+                : put(op.key, op.value))
+                applied += 1;
+        }
+        return applied;
+    }
+
     /**
      * A visitor function to visit all values in the store
      */
@@ -81,6 +266,38 @@ public:
      */
     virtual void visit(store_visitor visitor) = 0;
 
+    /**
+     * Visit all keys in the store that begin with the given prefix
+     * and apply the given function.  Stores with an ordered key index
+     * visit only the matching keys.  The default implementation
+     * visits every key and skips those without the prefix.
+     *
+     * @param prefix the key prefix to match
+     * @param visitor the function to apply
+     */
+    virtual void visit_prefix(const K& prefix, store_visitor visitor) {
+        visit([&prefix, &visitor](const K& key,
+                                  const std::vector<versioned_t>& values) {
+                if (key_has_prefix(key, prefix))
+                    visitor(key, values);
+            });
+    }
+
+    /**
+     * Visit one of a number of disjoint partitions of the store, so
+     * that several threads can visit the whole store in parallel.
+     * Every key is in exactly one partition.  The default
+     * implementation places every key in the first partition.
+     *
+     * @param partition the partition to visit, less than partitions
+     * @param partitions the number of partitions
+     * @param visitor the function to apply
+     */
+    virtual void visit_partition(size_t partition, size_t /* partitions */,
+                                 store_visitor visitor) {
+        if (partition == 0) visit(visitor);
+    }
+
     /**
      * Get the name for this store.
      *
@@ -89,6 +306,109 @@ public:
     virtual const std::string& get_name() const = 0;
 };
 
+/**
+ * A set of changes to a store since some sequence number, returned
+ * by the change log APIs.  Each changed key appears once with its
+ * current values; a key with no values, or only deleted values, has
+ * been removed.
+ */
+template <typename K, typename V>
+struct store_changes {
+    /**
+     * The sequence number to pass to get the changes after these
+     */
+    uint64_t next_seq = 0;
+
+    /**
+     * The epoch of the change log, to pass along with next_seq.
+     * Sequence numbers start again in each run of the store, so a
+     * sequence number from a different epoch causes a reset.
+     */
+    uint64_t epoch = 0;
+
+    /**
+     * True if the change log no longer covered the requested
+     * sequence number, or it was from a different epoch.  In that
+     * case changes contains every key in the store as of next_seq,
+     * and the consumer should discard any keys it holds that are not
+     * in it.
+     */
+    bool reset = false;
+
+    /**
+     * True if more changes are available after next_seq
+     */
+    bool more = false;
+
+    /**
+     * The changed keys with their current values
+     */
+    std::vector<std::pair<K, std::vector<versioned<V>>>> changes;
+};
+
+/**
+ * An immutable point-in-time view of a store.  Reads from a snapshot
+ * see the data as it was when the snapshot was taken, while writes to
+ * the store continue.  Old versions of the data are kept only as long
+ * as a snapshot that can see them exists, so snapshots should be
+ * released promptly.  A snapshot must not outlive its store.
+ */
+template <typename K, typename V>
+class store_snapshot {
+public:
+    virtual ~store_snapshot() {};
+
+    /**
+     * The type of versioned value used by the store
+     */
+    typedef versioned<V> versioned_t;
+
+    /**
+     * A visitor function to visit all values in the snapshot
+     */
+    typedef typename store<K, V>::store_visitor store_visitor;
+
+    /**
+     * Get the set of values associated with a given key in the
+     * snapshot, or an empty vector if there are no such values.
+     *
+     * @param key the key to retrieve
+     * @return a vector of values
+     */
+    virtual std::vector<versioned_t> get(const K& key) = 0;
+
+    /**
+     * Visit all keys in the snapshot and apply the given function.
+     * Writes to the store are not blocked while the function runs.
+     *
+     * @param visitor the function to apply
+     */
+    virtual void visit(store_visitor visitor) = 0;
+
+    /**
+     * Visit all keys in the snapshot in key order and apply the given
+     * function.  By default the items are collected and sorted first,
+     * which holds all of them in memory; snapshots that can visit in
+     * order without doing so override this.
+     *
+     * @param visitor the function to apply
+     */
+    virtual void visit_sorted(store_visitor visitor) {
+        std::vector<std::pair<K, std::vector<versioned_t>>> items;
+        visit([&items](const K& key,
+                       const std::vector<versioned_t>& values) {
+                items.emplace_back(key, values);
+            });
+        std::sort(items.begin(), items.end(),
+                  [](const std::pair<K, std::vector<versioned_t>>& a,
+                     const std::pair<K, std::vector<versioned_t>>& b) {
+                      return a.first < b.first;
+                  });
+        for (auto& i : items)
+            visitor(i.first, i.second);
+    }
+};
+
 } /* namespace throng */
 
 #endif /* THRONG_STORE_H */
@@ -141,7 +141,7 @@ public:
         vector_clock new_version(old_value.get_version()
                                  .incremented(context.get_local_node_id()));
         if (!delegate.put(key_ser.serialize(key),
-                          versioned<std::string>(value_ser.serialize_ptr(new_value),
+                          versioned<std::string>(encode(value_ser.serialize_ptr(new_value)),
                                                  std::move(new_version))))
             throw error::obsolete_version();
     }
@@ -184,6 +184,185 @@ public:
        delegate.visit(sv);
     }
 
+    /**
+     * Visit all keys in the store whose serialized form begins with
+     * the serialized form of the given prefix and apply the given
+     * function.  This is useful with key serializers that preserve
+     * prefixes, such as the default string serializer.
+     *
+     * @param prefix the key prefix to match
+     * @param visitor the function to apply
+     */
+    void visit_prefix(const K& prefix, visitor_type visitor) {
+        auto sv =
+            [&visitor, this](const std::string& k,
+                             const std::vector<versioned<std::string>>& vs) {
+           visitor(key_ser.deserialize(k), resolve_values(vs));
+       };
+       delegate.visit_prefix(key_ser.serialize(prefix), sv);
+    }
+
+    /**
+     * A typed point-in-time view of the store, obtained with
+     * store_client::snapshot.  The snapshot must not outlive the
+     * store client.
+     */
+    class snapshot_view {
+    public:
+        /**
+         * Get the value for the given key in the snapshot
+         *
+         * @param key the key to retrieve
+         * @return the resolved value
+         */
+        versioned<V> get(const K& key) const {
+            return client.resolve_values(raw->get(client.key_ser
+                                                  .serialize(key)));
+        }
+
+        /**
+         * Visit all keys in the snapshot and apply the given
+         * function.  Writes to the store are not blocked while the
+         * function runs.
+         *
+         * @param visitor the function to apply
+         */
+        void visit(visitor_type visitor) {
+            const store_client& c = client;
+            auto sv =
+                [&visitor, &c](const std::string& k,
+                               const std::vector<versioned<std::string>>& vs) {
+                visitor(c.key_ser.deserialize(k), c.resolve_values(vs));
+            };
+            raw->visit(sv);
+        }
+
+    private:
+        friend class store_client;
+
+        snapshot_view(const store_client& client_,
+                      std::unique_ptr<store_snapshot<std::string,
+                                                     std::string>> raw_)
+            : client(client_), raw(std::move(raw_)) { }
+
+        const store_client& client;
+        std::unique_ptr<store_snapshot<std::string, std::string>> raw;
+    };
+
+    /**
+     * Take a consistent point-in-time snapshot of the store.  Reading
+     * many keys through a snapshot gives a consistent view without
+     * blocking writes to the store.  Release the snapshot promptly,
+     * since old versions of the data are kept while it exists.
+     *
+     * @return the new snapshot
+     */
+    std::unique_ptr<snapshot_view> snapshot() const {
+        return std::unique_ptr<snapshot_view>
+            (new snapshot_view(*this, context.snapshot(delegate.get_name())));
+    }
+
+    /**
+     * A set of changes to the store, returned by changes_since
+     */
+    struct change_set {
+        /**
+         * The sequence number to pass to the next call to
+         * changes_since
+         */
+        uint64_t next_seq = 0;
+
+        /**
+         * The epoch to pass to the next call to changes_since
+         */
+        uint64_t epoch = 0;
+
+        /**
+         * True if the consumer fell too far behind the change log,
+         * or the store has restarted since the last call.
+         * In that case changes contains every key in the store, and
+         * the consumer should discard any keys it holds that are not
+         * in it.
+         */
+        bool reset = false;
+
+        /**
+         * True if more changes are available after next_seq
+         */
+        bool more = false;
+
+        /**
+         * The changed keys with their current resolved values.  A
+         * missing value means the key was deleted.
+         */
+        std::vector<std::pair<K, versioned<V>>> changes;
+    };
+
+    /**
+     * Get the keys that changed in the store after the given
+     * sequence number, so that a consumer that missed notifications
+     * or restarted can catch up in time proportional to the number of
+     * changes.  Start with an epoch and sequence number of zero and
+     * pass the epoch and next_seq from each result to the next call.
+     *
+     * @param epoch the epoch from the previous result
+     * @param seq the sequence number after which to get changes
+     * @param limit the maximum number of keys to return, unless the
+     * result is a reset
+     * @return the changes
+     */
+    change_set changes_since(uint64_t epoch, uint64_t seq,
+                             size_t limit = 1024) const {
+        store_changes<std::string, std::string> raw =
+            context.changes_since(delegate.get_name(), epoch, seq, limit);
+        change_set result;
+        result.next_seq = raw.next_seq;
+        result.epoch = raw.epoch;
+        result.reset = raw.reset;
+        result.more = raw.more;
+        result.changes.reserve(raw.changes.size());
+        for (auto& c : raw.changes)
+            result.changes.emplace_back(key_ser.deserialize(c.first),
+                                        resolve_values(c.second));
+        return result;
+    }
+
+    /**
+     * Register the inconsistency resolver for this client with the
+     * store, so that writes that leave more than
+     * store_config::sibling_limit concurrent values for a key merge
+     * them into one.  Readers then no longer need to deserialize and
+     * resolve every concurrent value.  The resolver must be
+     * deterministic, and must not access the store.
+     */
+    void register_resolver() {
+        resolver_type r = resolver;
+        VS vs = value_ser;
+        std::shared_ptr<value_codec> c = codec;
+        context.set_raw_resolver(delegate.get_name(),
+             [r, vs, c](const std::vector<versioned<std::string>>& raw)
+                 -> versioned<std::string> {
+                 std::vector<versioned<V>> items;
+                 items.reserve(raw.size());
+                 for (auto& rv : raw) {
+                     if (rv)
+                         items.emplace_back(vs.deserialize(c ? c->decode(rv.get_ptr())
+                                                           : rv.get_ptr()),
+                                            rv.get_version());
+                     else
+                         items.emplace_back(nullptr, rv.get_version());
+                 }
+                 versioned<V> merged = r(items);
+                 if (!merged)
+                     return { nullptr, merged.get_version() };
+                 auto merged_ser = vs.serialize_ptr(merged.get());
+                 // The resolver runs under the store's lock
+                 return { c ? c->encode_nonblocking(merged_ser)
+                            : merged_ser,
+                          merged.get_version() };
+             });
+    }
+
     /**
      * Get the name for this store.
      *
@@ -219,7 +398,18 @@ private:
                  store<std::string, std::string>& delegate_,
                  resolver_type resolver_):
         context(context_), delegate(delegate_),
-        resolver(std::move(resolver_)) { }
+        resolver(std::move(resolver_)),
+        codec(context_.get_value_codec(delegate_.get_name())) { }
+
+    std::shared_ptr<const std::string>
+    encode(std::shared_ptr<const std::string> value) const {
+        return codec ? codec->encode(value) : value;
+    }
+
+    std::shared_ptr<const std::string>
+    decode(const std::shared_ptr<const std::string>& value) const {
+        return codec ? codec->decode(value) : value;
+    }
 
     versioned<V>
     resolve_values(const std::vector<versioned<std::string>> vs) const {
@@ -229,7 +419,7 @@ private:
         result.reserve(vs.size());
         for (auto& vv : vs) {
             if (vv) {
-                result.emplace_back(value_ser.deserialize(vv.get_ptr()),
+                result.emplace_back(value_ser.deserialize(decode(vv.get_ptr())),
                                     vv.get_version());
             } else {
                 result.emplace_back(nullptr, vv.get_version());
@@ -241,6 +431,7 @@ private:
     ctx& context;
     store<std::string, std::string>& delegate;
     resolver_type resolver;
+    std::shared_ptr<value_codec> codec;
     KS key_ser;
     VS value_ser;
 };
@@ -23,9 +23,93 @@
 #define THRONG_STORE_CONFIG_H
 
 #include <chrono>
+#include <cstdint>
+#include <cstddef>
 
 namespace throng {
 
+/**
+ * Hash functions that can be used to hash the keys in a store.  Key
+ * hashes are computed once when a key is first stored and are used
+ * both for indexing the key locally and for placing the key into
+ * buckets, so the output is stable across hosts and releases.
+ */
+enum class key_hash_type : uint8_t {
+    /** 64-bit XXH3 with the default secret and a zero seed */
+    XXH3,
+    /** XXH64 with a zero seed */
+    XXH64
+};
+
+/**
+ * Index structures that can be used to look up the keys in a store
+ */
+enum class key_index_type : uint8_t {
+    /** An unordered hash index on the key hash */
+    HASH,
+    /**
+     * An ordered, prefix-compressed radix tree.  Keys sharing a
+     * prefix share the path to it, and keys can be visited in order
+     * or by prefix without scanning the whole store.
+     */
+    RADIX_TREE
+};
+
+/**
+ * How writes to a persistent store are committed to storage.  Writes
+ * are always applied to the in-memory state first; commits to storage
+ * happen in groups outside the store's lock.
+ */
+enum class durability_mode : uint8_t {
+    /**
+     * Commit in the background as soon as possible.  Writes made
+     * while a commit is running are grouped into the next commit.
+     * Commits are not synced to disk, so a crash of the host can lose
+     * writes the operating system has not yet written out.
+     */
+    ASYNC,
+    /**
+     * Commit in the background in groups, at most commit_interval
+     * after the first write of a group.  Each group is synced to
+     * disk as it is committed, so a crash can lose at most the writes
+     * from the last commit interval.
+     */
+    BATCHED,
+    /**
+     * A write returns only once it has been committed and synced to
+     * disk.  Concurrent writers share commits.
+     */
+    SYNC
+};
+
+/**
+ * Storage engines that can hold the data for a persistent store
+ */
+enum class storage_engine_type : uint8_t {
+    /** A LevelDB database, which keeps keys in order */
+    LEVELDB,
+    /**
+     * An append-only log of segment files with an in-memory index of
+     * the keys.  Writes are sequential and reads take a single
+     * lookup, which suits stores whose keys are overwritten often.
+     * Every key is held in memory.
+     */
+    LOG
+};
+
+/**
+ * Compression for the values in a store
+ */
+enum class value_compression : uint8_t {
+    /** Values are kept as serialized */
+    NONE,
+    /**
+     * Values are compressed with zlib, using a dictionary trained
+     * from a sample of the values written to the store
+     */
+    ZLIB
+};
+
 /**
  * Configuration for a store
  */
@@ -36,6 +120,66 @@ struct store_config {
      */
     bool persistent = false;
 
+    /**
+     * The storage engine for a persistent store
+     */
+    storage_engine_type storage_engine = storage_engine_type::LEVELDB;
+
+    /**
+     * For storage_engine_type::LOG, the size of each segment file
+     */
+    size_t log_segment_size = 64 * 1024 * 1024;
+
+    /**
+     * For storage_engine_type::LOG, the fraction of a full segment
+     * that must be overwritten data before the segment is compacted
+     */
+    double log_garbage_ratio = 0.5;
+
+    /**
+     * How writes to a persistent store are committed to storage
+     */
+    durability_mode durability = durability_mode::BATCHED;
+
+    /**
+     * For durability_mode::BATCHED, the maximum time a write waits
+     * before it is committed
+     */
+    std::chrono::milliseconds commit_interval = std::chrono::milliseconds(10);
+
+    /**
+     * The maximum number of bytes of writes queued for storage.  Once
+     * the queue is this large, writers commit it before queuing more,
+     * and fail with error::storage if the commit fails.  Zero means
+     * no limit.
+     */
+    size_t write_queue_limit = 64 * 1024 * 1024;
+
+    /**
+     * The number of threads used to load the contents of a
+     * persistent store into memory when the store starts.  Once the
+     * whole store is in memory, reads are served without accessing
+     * storage.  Zero disables loading, so reads of keys not yet in
+     * memory go to storage.
+     */
+    size_t restore_threads = 4;
+
+    /**
+     * For a persistent store that is restored on start, the target
+     * false-positive rate of the filter over the keys in storage.
+     * Reads of keys not in memory consult the filter and skip
+     * storage for keys that are not there.
+     */
+    double key_filter_fp_rate = 0.01;
+
+    /**
+     * The maximum number of bytes of memory for the filter over the
+     * keys in storage, or zero to disable the filter.  Once the
+     * filter reaches this size its false-positive rate rises as more
+     * keys are added.
+     */
+    size_t key_filter_memory_limit = 16 * 1024 * 1024;
+
     /**
      * The number of replicas for objects written to this store.
      */
@@ -60,7 +204,8 @@ struct store_config {
      * The timeout for an object that has not been updated for some
      * period of time.  This is useful for objects that might be
      * written to a store but correspond to stale state.  Data written
-     * by the local node is automatically refreshed.
+     * by the local node is automatically refreshed, by notifying
+     * local listeners at half the timeout.
      */
     std::chrono::seconds object_timeout = std::chrono::seconds::zero();
 
@@ -73,6 +218,97 @@ struct store_config {
      */
     std::chrono::seconds tombstone_timeout = std::chrono::hours(24);
 
+    /**
+     * The hash function used for keys in this store.  All nodes in
+     * the cluster must use the same hash function for a given store.
+     */
+    key_hash_type key_hash = key_hash_type::XXH3;
+
+    /**
+     * The index used to look up keys in this store.  This is a local
+     * choice and can differ between nodes.
+     */
+    key_index_type key_index = key_index_type::HASH;
+
+    /**
+     * True to keep a single copy in memory of values that are
+     * identical across keys.  Values are interned by content, and the
+     * items holding the same value share it until the last of them
+     * changes.  This saves memory when many keys hold the same
+     * large values, at the cost of hashing each value written and a
+     * small overhead for values that are not repeated.  Values
+     * smaller than 64 bytes are never shared.
+     */
+    bool dedup_values = false;
+
+    /**
+     * The maximum number of bytes of memory to use for the data in
+     * this store, or zero for no limit.  When a write would exceed
+     * the limit, data not owned by the local node is evicted in
+     * least-recently-used order; if there is not enough such data the
+     * write fails with error::memory_limit_exceeded.
+     *
+     * The limit covers the allocated blocks of the items in memory,
+     * with their keys, values and versions, the key index, shared
+     * values, and writes queued for storage.  It does not cover
+     * memory that evicting items cannot release: free blocks the
+     * allocator keeps in partly used slabs, the change log (bounded
+     * by change_log_size), superseded versions kept for live
+     * snapshots, and the key filter (bounded by
+     * key_filter_memory_limit).
+     */
+    size_t memory_limit = 0;
+
+    /**
+     * For a persistent store with a memory limit, true to keep only
+     * recently used items in memory.  When the limit is reached, the
+     * least recently used items are evicted whether or not the local
+     * node owns them, once their writes are committed to storage, and
+     * they are read back into memory when next accessed.  Items owned
+     * by the local node stay in memory if the store has an object
+     * timeout, since they must be refreshed.  Snapshots and change
+     * feeds of a tiered store cover only the items in memory.
+     */
+    bool tiered = false;
+
+    /**
+     * How values are compressed.  Store clients compress values when
+     * writing them and decompress them only when deserializing them,
+     * so values stay compressed in memory and in storage.  All nodes
+     * and all store clients for a store must use the same setting.
+     */
+    value_compression compression = value_compression::NONE;
+
+    /**
+     * The number of values written to the store that are sampled to
+     * train the compression dictionary.  Values written before the
+     * dictionary is trained are compressed without one.  The
+     * dictionary is kept with a persistent store's data.  Zero
+     * disables the dictionary.
+     */
+    size_t compression_training_samples = 1000;
+
+    /**
+     * The maximum size in bytes of the compression dictionary.  zlib
+     * uses at most the last 32KB.
+     */
+    size_t compression_dictionary_size = 32 * 1024;
+
+    /**
+     * The number of changes kept in the in-memory change log for
+     * incremental consumers.  Consumers that fall further behind
+     * than this are resynchronized from a snapshot.  Zero disables
+     * the log.
+     */
+    size_t change_log_size = 16384;
+
+    /**
+     * The maximum number of concurrent values kept for a key when an
+     * inconsistency resolver is registered for the store.  A write
+     * that leaves more values than this merges them into one with
+     * the resolver.
+     */
+    size_t sibling_limit = 4;
 };
 
 } /* namespace throng */
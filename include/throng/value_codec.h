@@ -0,0 +1,77 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file value_codec.h
+ * @brief Interface definition file for value_codec
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_VALUE_CODEC_H
+#define THRONG_VALUE_CODEC_H
+
+#include <string>
+#include <memory>
+
+namespace throng {
+
+/**
+ * Maps serialized values to the form in which a store keeps them, in
+ * memory and in storage, and back.  Store clients encode values
+ * after serializing them and decode values only when deserializing
+ * them.
+ */
+class value_codec {
+public:
+    virtual ~value_codec() {}
+
+    /**
+     * Encode a serialized value for the store
+     *
+     * @param value the serialized value
+     * @return the encoded value, which may be the same as the input
+     */
+    virtual std::shared_ptr<const std::string>
+    encode(const std::shared_ptr<const std::string>& value) = 0;
+
+    /**
+     * Encode a serialized value as encode does, but without any work
+     * that may wait for storage, such as training or saving state.
+     * The store encodes values this way while holding its lock, for
+     * example for the values merged by a resolver.
+     *
+     * @param value the serialized value
+     * @return the encoded value, which may be the same as the input
+     */
+    virtual std::shared_ptr<const std::string>
+    encode_nonblocking(const std::shared_ptr<const std::string>& value) {
+        return encode(value);
+    }
+
+    /**
+     * Decode a value from the store.  Values that were not encoded
+     * are returned unchanged.
+     *
+     * @param value the value from the store
+     * @return the serialized value
+     * @throws error::serialization if the value cannot be decoded
+     */
+    virtual std::shared_ptr<const std::string>
+    decode(const std::shared_ptr<const std::string>& value) const = 0;
+};
+
+} /* namespace throng */
+
+#endif /* THRONG_VALUE_CODEC_H */
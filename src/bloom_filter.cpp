@@ -0,0 +1,131 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for bloom_filter class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bloom_filter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace throng {
+namespace internal {
+
+// Each layer's false-positive rate is this fraction of the one
+// before, so the rates of all layers sum to at most the target
+static const double TIGHTENING_RATIO = 0.5;
+
+// The smallest layer, in bits
+static const uint64_t MIN_BITS = 512;
+
+// Derive the two hashes for double hashing from a key hash.  The key
+// hash is mixed first since the configured key hash need not
+// distribute its bits evenly.
+static void probe_hashes(uint64_t hash, uint64_t& h1, uint64_t& h2) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    h1 = hash;
+    // An odd step visits distinct bits of the power-of-two layer
+    h2 = (hash >> 32 | hash << 32) | 1;
+}
+
+bloom_filter::bloom_filter(size_t capacity, double fp_rate_,
+                           size_t memory_limit_)
+    : fp_rate(std::min(std::max(fp_rate_, 1e-9), 0.5)),
+      memory_limit(memory_limit_) {
+    // The first layer is always created, shrunk to fit the memory
+    // limit if necessary
+    if (!add_layer(std::max(capacity, (size_t)1),
+                   fp_rate * (1 - TIGHTENING_RATIO))) {
+        uint64_t bits = MIN_BITS;
+        while (bits * 2 <= memory_limit * 8) bits *= 2;
+        layers.push_back({ std::vector<uint64_t>(bits / 64), bits - 1, 2,
+                           capacity, 0 });
+        memory = bits / 8;
+    }
+}
+
+bool bloom_filter::add_layer(size_t capacity, double layer_fp_rate) {
+    // The optimal size is -n ln p / (ln 2)^2 bits with -log2 p probes
+    double ln2 = std::log(2.0);
+    double ideal = std::ceil(-(double)capacity * std::log(layer_fp_rate) /
+                             (ln2 * ln2));
+    uint64_t bits = MIN_BITS;
+    while ((double)bits < ideal) bits *= 2;
+    if (memory + bits / 8 > memory_limit)
+        return false;
+
+    unsigned probes =
+        (unsigned)std::max(1.0, std::round(-std::log2(layer_fp_rate)));
+    layers.push_back({ std::vector<uint64_t>(bits / 64), bits - 1, probes,
+                       capacity, 0 });
+    memory += bits / 8;
+    return true;
+}
+
+void bloom_filter::insert(uint64_t hash) {
+    // Keys are rewritten far more often than they are created, so
+    // adding a key the filter already matches would only fill the
+    // layers faster
+    if (may_contain(hash)) return;
+
+    layer* l = &layers.back();
+    if (l->count >= l->capacity) {
+        double next_fp = fp_rate * (1 - TIGHTENING_RATIO) *
+            std::pow(TIGHTENING_RATIO, (double)layers.size());
+        if (add_layer(l->capacity * 2, next_fp))
+            l = &layers.back();
+    }
+
+    uint64_t h1, h2;
+    probe_hashes(hash, h1, h2);
+    for (unsigned i = 0; i < l->probes; ++i) {
+        uint64_t bit = (h1 + i * h2) & l->mask;
+        l->bits[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+    l->count += 1;
+    count += 1;
+}
+
+bool bloom_filter::may_contain(uint64_t hash) const {
+    uint64_t h1, h2;
+    probe_hashes(hash, h1, h2);
+    for (auto& l : layers) {
+        unsigned i = 0;
+        for (; i < l.probes; ++i) {
+            uint64_t bit = (h1 + i * h2) & l.mask;
+            if (!(l.bits[bit / 64] & ((uint64_t)1 << (bit % 64))))
+                break;
+        }
+        if (i == l.probes) return true;
+    }
+    return false;
+}
+
+bool bloom_filter::is_saturated() const {
+    return layers.back().count > layers.back().capacity;
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -28,11 +28,14 @@
 #include "store_registry.h"
 #include "rpc_service.h"
 #include "rpc_handler_node.h"
+#include "snapshot_file.h"
 
+#include <atomic>
 #include <vector>
 #include <utility>
 #include <mutex>
 #include <thread>
+#include <future>
 
 //#include <leveldb/db.h>
 
@@ -64,6 +67,9 @@ public:
                                  std::string hostname, uint16_t port,
                                  bool master_eligible = true) override;
     virtual void add_seed(std::string hostname, uint16_t port) override;
+    virtual void
+    set_write_options(size_t max_batch_size,
+                      std::chrono::microseconds max_latency) override;
     virtual void register_store(const std::string& name) override;
     virtual void register_store(const std::string& name,
                                 const store_config& config) override;
@@ -72,8 +78,26 @@ public:
     virtual node_id get_local_node_id() override;
     virtual void add_raw_listener(const std::string& store_name,
                                   raw_listener_t listener) override;
+    virtual void set_raw_resolver(const std::string& store_name,
+                                  raw_resolver_t resolver) override;
     virtual store<std::string,std::string>&
     get_raw_store(const std::string& name) override;
+    virtual size_t get_memory_usage(const std::string& store_name) override;
+    virtual cache_stats
+    get_cache_stats(const std::string& store_name) override;
+    virtual std::shared_ptr<value_codec>
+    get_value_codec(const std::string& store_name) override;
+    virtual std::unique_ptr<store_snapshot<std::string, std::string>>
+    snapshot(const std::string& store_name) override;
+    virtual store_changes<std::string, std::string>
+    changes_since(const std::string& store_name, uint64_t epoch,
+                  uint64_t seq, size_t limit) override;
+    virtual std::future<size_t>
+    write_snapshot_file(const std::string& store_name,
+                        const std::string& path,
+                        bool compress = true) override;
+    virtual size_t load_snapshot_file(const std::string& store_name,
+                                      const std::string& path) override;
 
     // ************
     // ctx_internal
@@ -93,6 +117,23 @@ private:
     unique_ptr<io_service::work> work;
     std::vector<std::thread> workers;
 
+    /**
+     * A thread writing a snapshot file, with a flag it sets once the
+     * file is written
+     */
+    struct snapshot_writer {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> done;
+    };
+
+    /**
+     * Threads writing snapshot files, which hold snapshots of stores
+     * in the registry and so are joined before it is destroyed.
+     * Finished threads are joined when the next one is started.
+     */
+    std::mutex snapshot_writer_mutex;
+    std::vector<snapshot_writer> snapshot_writers;
+
     rpc_service::handler_factory_t handler_factory;
     rpc_service rpc;
 
@@ -104,6 +145,7 @@ private:
     rpc_service::seed_t local_seed;
     bool master_eligible = true;
     vector<seed_t> seeds;
+    rpc_connection::write_options write_options;
     //unique_ptr<leveldb::DB> systemDb;
 };
 
@@ -123,6 +165,11 @@ ctx_impl::ctx_impl(string db_path)
 }
 
 ctx_impl::~ctx_impl() {
+    {
+        std::lock_guard<std::mutex> guard(snapshot_writer_mutex);
+        for (auto& w : snapshot_writers)
+            w.thread.join();
+    }
     stop();
 }
 
@@ -160,6 +207,13 @@ void ctx_impl::add_seed(std::string hostname, uint16_t port) {
     seeds.emplace_back(std::move(hostname), port);
 }
 
+void ctx_impl::set_write_options(size_t max_batch_size,
+                                 std::chrono::microseconds max_latency) {
+    std::unique_lock<std::mutex> guard(config_mutex);
+    write_options.max_batch_size = max_batch_size;
+    write_options.max_latency = max_latency;
+}
+
 void ctx_impl::register_store(const std::string& name) {
     register_store(name, store_config {});
 }
@@ -192,7 +246,9 @@ void ctx_impl::start(size_t worker_pool_size) {
             });
     }
 
+    registry.start();
     rpc.set_seeds(seeds);
+    rpc.set_write_options(write_options);
     rpc.start();
 
 //    leveldb::Options options;
@@ -219,6 +275,7 @@ void ctx_impl::stop() {
     LOG(INFO) << "Stopping distributed policy engine";
 
     rpc.stop();
+    registry.stop();
     work.reset();
 
     for (auto& t : workers)
@@ -230,11 +287,80 @@ store<string,string>& ctx_impl::get_raw_store(const string& name) {
     return registry.get(name);
 }
 
+size_t ctx_impl::get_memory_usage(const string& store_name) {
+    return registry.get(store_name).get_memory_usage();
+}
+
+cache_stats ctx_impl::get_cache_stats(const string& store_name) {
+    return registry.get(store_name).get_cache_stats();
+}
+
+std::shared_ptr<value_codec> ctx_impl::get_value_codec(const string& store_name) {
+    return registry.get_codec(store_name);
+}
+
+unique_ptr<store_snapshot<string, string>>
+ctx_impl::snapshot(const string& store_name) {
+    return registry.get(store_name).snapshot();
+}
+
+store_changes<string, string>
+ctx_impl::changes_since(const string& store_name, uint64_t epoch,
+                        uint64_t seq, size_t limit) {
+    return registry.get(store_name).changes_since(epoch, seq, limit);
+}
+
+std::future<size_t>
+ctx_impl::write_snapshot_file(const string& store_name,
+                              const string& path, bool compress) {
+    // Take the snapshot now so that the file reflects the store as
+    // of the call
+    std::shared_ptr<store_snapshot<string, string>> snap =
+        registry.get(store_name).snapshot();
+    std::packaged_task<size_t()> task([snap, path, compress]() {
+            return internal::write_snapshot_file(path, *snap, compress);
+        });
+    std::future<size_t> result = task.get_future();
+
+    std::lock_guard<std::mutex> guard(snapshot_writer_mutex);
+    for (auto it = snapshot_writers.begin(); it != snapshot_writers.end(); ) {
+        if (*it->done) {
+            it->thread.join();
+            it = snapshot_writers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    auto done = std::make_shared<std::atomic<bool>>(false);
+    std::thread thread([done](std::packaged_task<size_t()> t) {
+            t();
+            *done = true;
+        }, std::move(task));
+    snapshot_writers.push_back({ std::move(thread), std::move(done) });
+    return result;
+}
+
+size_t ctx_impl::load_snapshot_file(const string& store_name,
+                                    const string& path) {
+    processor& p = registry.get(store_name);
+    snapshot_file_reader reader(path);
+    size_t count = p.load(reader, reader.get_item_count());
+    LOG(INFO) << store_name << ": Loaded " << count
+              << " items from " << path;
+    return count;
+}
+
 void ctx_impl::add_raw_listener(const std::string& store_name,
                                 raw_listener_t listener) {
     registry.get(store_name).add_listener(listener);
 }
 
+void ctx_impl::set_raw_resolver(const std::string& store_name,
+                                raw_resolver_t resolver) {
+    registry.get(store_name).set_resolver(std::move(resolver));
+}
+
 node_id ctx_impl::get_local_node_id() {
     std::unique_lock<std::mutex> guard(config_mutex);
     return local_node_id;
@@ -22,6 +22,8 @@
 #endif
 
 #include "in_memory_storage_engine.h"
+#include "stored_values.h"
+#include "key_hash.h"
 
 #include <utility>
 
@@ -31,48 +33,131 @@ namespace internal {
 using std::vector;
 using std::string;
 
+typedef versioned<string> versioned_t;
+
+static uint64_t hash(const string& key) {
+    return hash_key(key_hash_type::XXH3, key);
+}
+
 vector<versioned<string>>
 in_memory_storage_engine::get(const string& key) {
-    std::lock_guard<std::mutex> guard(lock);
-    vector<versioned<string>> result;
-    auto it = records.find(key);
-    if (it == records.end()) return result;
-    for (auto& v : it->second.values) {
-        result.push_back(v);
-    }
-    return result;
+    uint64_t h = hash(key);
+    stripe& s = get_stripe(h);
+    std::lock_guard<std::mutex> guard(s.lock);
+    vector<versioned_t>* values = s.records.find(key, h);
+    if (!values) return vector<versioned_t>();
+    return *values;
 }
 
 bool in_memory_storage_engine::put(const string& key,
                                    const versioned<string>& value) {
-    std::lock_guard<std::mutex> guard(lock);
-
-    record& rs = records[key];
-    std::vector<versioned_t> new_values;
-
-    for (auto vit = rs.values.begin(); vit != rs.values.end(); vit++) {
-        vector_clock::occurred o =
-            value.get_version().compare(vit->get_version());
-
-        switch (o) {
-        case vector_clock::occurred::BEFORE:
-        case vector_clock::occurred::EQUAL:
-            return false;
-        case vector_clock::occurred::AFTER:
-            break;
-        default:
-            new_values.push_back(*vit);
-            break;
+    uint64_t h = hash(key);
+    stripe& s = get_stripe(h);
+    std::lock_guard<std::mutex> guard(s.lock);
+    return apply_write(*s.records.insert(key, h).first, value);
+}
+
+bool in_memory_storage_engine::erase(const string& key,
+                                     const vector_clock& version) {
+    uint64_t h = hash(key);
+    stripe& s = get_stripe(h);
+    std::lock_guard<std::mutex> guard(s.lock);
+    vector<versioned_t>* values = s.records.find(key, h);
+    if (!values || !apply_erase(*values, version)) return false;
+    if (values->empty()) s.records.erase(key, h);
+    return true;
+}
+
+size_t
+in_memory_storage_engine::write(const write_batch<string, string>& batch) {
+    typedef write_batch<string, string>::operation operation;
+    // Group the writes by stripe, keeping their order within each
+    std::array<vector<std::pair<const operation*, uint64_t>>, STRIPES> ops;
+    for (auto& op : batch.get_operations()) {
+        uint64_t h = hash(op.key);
+        ops[h >> 60].emplace_back(&op, h);
+    }
+
+    size_t applied = 0;
+    auto apply = [&](size_t i) {
+        for (auto& o : ops[i]) {
+            auto& records = stripes[i].records;
+            const operation& op = *o.first;
+            vector<versioned_t>* values = op.erase
+                ? records.find(op.key, o.second)
+                : records.insert(op.key, o.second).first;
+            if (!values || !apply_operation(*values, op)) continue;
+            if (values->empty()) records.erase(op.key, o.second);
+            applied += 1;
+        }
+    };
+
+    if (batch.is_atomic()) {
+        // Lock in stripe order so concurrent batches cannot deadlock
+        std::array<std::unique_lock<std::mutex>, STRIPES> locks;
+        for (size_t i = 0; i < STRIPES; ++i) {
+            if (!ops[i].empty())
+                locks[i] = std::unique_lock<std::mutex>(stripes[i].lock);
+        }
+        for (size_t i = 0; i < STRIPES; ++i)
+            apply(i);
+    } else {
+        for (size_t i = 0; i < STRIPES; ++i) {
+            if (ops[i].empty()) continue;
+            std::lock_guard<std::mutex> guard(stripes[i].lock);
+            apply(i);
         }
     }
-    new_values.push_back({ value });
-    rs.values.swap(new_values);
-    return true;
+    return applied;
+}
+
+size_t in_memory_storage_engine::size() {
+    size_t result = 0;
+    for (auto& s : stripes) {
+        std::lock_guard<std::mutex> guard(s.lock);
+        result += s.records.size();
+    }
+    return result;
 }
 
 const string& in_memory_storage_engine::get_name() const {
     return name;
 }
 
+// Visit the keys in a stripe with the given prefix, copying them out
+// under the lock and calling the visitor without it
+void in_memory_storage_engine::visit_stripe(stripe& s, const string& prefix,
+                                            store_visitor& visitor) {
+    vector<std::pair<string, vector<versioned_t>>> items;
+    {
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.records.for_each([&](const string& key,
+                               const vector<versioned_t>& values) {
+                if (!values.empty() &&
+                    key.compare(0, prefix.size(), prefix) == 0)
+                    items.emplace_back(key, values);
+            });
+    }
+    for (auto& i : items)
+        visitor(i.first, i.second);
+}
+
+void in_memory_storage_engine::visit(store_visitor visitor) {
+    visit_prefix("", visitor);
+}
+
+void in_memory_storage_engine::visit_prefix(const string& prefix,
+                                            store_visitor visitor) {
+    for (auto& s : stripes)
+        visit_stripe(s, prefix, visitor);
+}
+
+void in_memory_storage_engine::visit_partition(size_t partition,
+                                               size_t partitions,
+                                               store_visitor visitor) {
+    for (size_t i = partition; i < STRIPES; i += partitions)
+        visit_stripe(stripes[i], "", visitor);
+}
+
 } /* namespace internal */
 } /* namespace throng */
@@ -0,0 +1,111 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file bloom_filter.h
+ * @brief Interface definition file for bloom_filter
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_BLOOM_FILTER_H
+#define THRONG_BLOOM_FILTER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace throng {
+namespace internal {
+
+/**
+ * A Bloom filter over 64-bit key hashes that grows as keys are
+ * added.  The filter is a series of layers, each twice the capacity
+ * of the one before with a tighter false-positive rate, so that the
+ * overall rate stays within the target however many keys are added.
+ * Once another layer would exceed the memory limit, keys are added
+ * to the last layer beyond its capacity and the false-positive rate
+ * rises instead.
+ *
+ * The filter is not thread-safe; callers must provide their own
+ * synchronization.
+ */
+class bloom_filter {
+public:
+    /**
+     * Create an empty filter
+     *
+     * @param capacity the number of keys the first layer holds
+     * @param fp_rate_ the target false-positive rate
+     * @param memory_limit_ the maximum number of bytes for the bits
+     * of the filter
+     */
+    bloom_filter(size_t capacity, double fp_rate_, size_t memory_limit_);
+
+    /**
+     * Add a key to the filter, unless the filter may already contain
+     * it
+     *
+     * @param hash the hash of the key
+     */
+    void insert(uint64_t hash);
+
+    /**
+     * Check whether a key may have been added to the filter
+     *
+     * @param hash the hash of the key
+     * @return false if the key was definitely not added
+     */
+    bool may_contain(uint64_t hash) const;
+
+    /**
+     * Get the number of keys added to the filter.  Keys that the
+     * filter already matched when they were added are not counted.
+     */
+    size_t size() const { return count; }
+
+    /**
+     * Get the number of bytes used for the bits of the filter
+     */
+    size_t get_memory_usage() const { return memory; }
+
+    /**
+     * Check whether the filter has reached its memory limit and holds
+     * more keys than its layers were sized for, so that its
+     * false-positive rate is above the target
+     */
+    bool is_saturated() const;
+
+private:
+    struct layer {
+        std::vector<uint64_t> bits;
+        uint64_t mask;
+        unsigned probes;
+        size_t capacity;
+        size_t count;
+    };
+
+    double fp_rate;
+    size_t memory_limit;
+    size_t memory = 0;
+    size_t count = 0;
+    std::vector<layer> layers;
+
+    bool add_layer(size_t capacity, double layer_fp_rate);
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_BLOOM_FILTER_H */
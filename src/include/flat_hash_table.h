@@ -0,0 +1,369 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file flat_hash_table.h
+ * @brief Interface definition file for flat_hash_table
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_FLAT_HASH_TABLE_H
+#define THRONG_FLAT_HASH_TABLE_H
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace throng {
+namespace internal {
+
+/**
+ * A hash table from string keys to values using open addressing.
+ * Slots are arranged in groups of 16, each with a byte of control
+ * metadata per slot holding 7 bits of the key's hash.  A probe
+ * compares the hash bits against a whole group of control bytes at
+ * once, with SSE2 where it is available, and compares keys only for
+ * slots whose hash bits match.  Groups are probed in triangular
+ * order, which visits every group of the power-of-two table.
+ *
+ * When the table grows, the existing slots are moved to the new
+ * table a few groups at a time by later insertions and removals,
+ * rather than all at once, so that no single operation pays for
+ * moving the whole table.  Lookups check both tables while a move is
+ * in progress.
+ *
+ * Callers supply the 64-bit hash of each key.  The table is not
+ * thread-safe; callers must provide their own synchronization.
+ */
+template <typename V>
+class flat_hash_table {
+public:
+    flat_hash_table() { }
+    flat_hash_table(const flat_hash_table&) = delete;
+    flat_hash_table& operator=(const flat_hash_table&) = delete;
+    ~flat_hash_table() { }
+
+    /**
+     * Find the value for a key
+     *
+     * @param key the key
+     * @param hash the hash of the key
+     * @return the value or nullptr if there is no such key
+     */
+    V* find(const std::string& key, uint64_t hash) {
+        size_t i = current.find(key, hash);
+        if (i != npos) return &current.slots[i].value;
+        if (old.capacity) {
+            i = old.find(key, hash);
+            if (i != npos) return &old.slots[i].value;
+        }
+        return nullptr;
+    }
+
+    /**
+     * Find the value for a key, inserting a default-constructed
+     * value if there is none.  Pointers to values remain valid only
+     * until the next insertion or removal.
+     *
+     * @param key the key
+     * @param hash the hash of the key
+     * @return the value, and true if it was inserted
+     */
+    std::pair<V*, bool> insert(const std::string& key, uint64_t hash) {
+        migrate();
+        size_t i = current.find(key, hash);
+        if (i != npos) return { &current.slots[i].value, false };
+        if (old.capacity) {
+            // Move the item now so the pointer stays valid for as
+            // long as pointers into the current table do
+            size_t j = old.find(key, hash);
+            if (j != npos) {
+                slot& s = old.slots[j];
+                i = current.emplace(std::move(s.key), s.hash,
+                                    std::move(s.value));
+                old.erase(j);
+                return { &current.slots[i].value, false };
+            }
+        }
+        if (current.needs_grow())
+            grow();
+        i = current.emplace(key, hash, V());
+        return { &current.slots[i].value, true };
+    }
+
+    /**
+     * Remove the value for a key if present
+     *
+     * @param key the key
+     * @param hash the hash of the key
+     * @return true if a value was removed
+     */
+    bool erase(const std::string& key, uint64_t hash) {
+        migrate();
+        size_t i = current.find(key, hash);
+        if (i != npos) {
+            current.erase(i);
+            return true;
+        }
+        if (old.capacity) {
+            i = old.find(key, hash);
+            if (i != npos) {
+                old.erase(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Apply a function to every key and value in the table, in no
+     * particular order.  The function must not modify the table.
+     *
+     * @param fn the function, called with the key and the value
+     */
+    template <typename F>
+    void for_each(F fn) const {
+        current.for_each(fn);
+        old.for_each(fn);
+    }
+
+    /**
+     * Get the number of items in the table
+     */
+    size_t size() const { return current.size + old.size; }
+
+    /**
+     * Get the number of slots in the table, including those of the
+     * table being moved from
+     */
+    size_t capacity() const { return current.capacity + old.capacity; }
+
+private:
+    static const size_t GROUP = 16;
+    static const size_t npos = (size_t)-1;
+
+    // Number of groups moved by each insertion or removal while the
+    // table grows.  Each group can be moved at most once per grow,
+    // and the new table has room for the old one to be moved before
+    // insertions can fill it.
+    static const size_t MIGRATE_GROUPS = 2;
+
+    static const int8_t EMPTY = -128;
+    static const int8_t DELETED = -2;
+
+    struct slot {
+        std::string key;
+        uint64_t hash;
+        V value;
+    };
+
+    static size_t h1(uint64_t hash) { return (size_t)(hash >> 7); }
+    static int8_t h2(uint64_t hash) { return (int8_t)(hash & 0x7f); }
+
+    // Bit i set when control byte i of the group equals b
+    static uint32_t match(const int8_t* group, int8_t b) {
+#ifdef __SSE2__
+        __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+        return (uint32_t)_mm_movemask_epi8
+            (_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b)));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP; ++i)
+            if (group[i] == b) mask |= 1u << i;
+        return mask;
+#endif
+    }
+
+    // Bit i set when control byte i of the group is empty or deleted
+    static uint32_t match_free(const int8_t* group) {
+#ifdef __SSE2__
+        // Only EMPTY and DELETED have the high bit set
+        __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+        return (uint32_t)_mm_movemask_epi8(ctrl);
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP; ++i)
+            if (group[i] < 0) mask |= 1u << i;
+        return mask;
+#endif
+    }
+
+    static unsigned lowest_bit(uint32_t mask) {
+        return (unsigned)__builtin_ctz(mask);
+    }
+
+    struct table {
+        std::unique_ptr<int8_t[]> ctrl;
+        slot* slots = nullptr;
+        size_t capacity = 0;
+        size_t size = 0;
+        size_t deleted = 0;
+
+        table() { }
+        table(const table&) = delete;
+        table& operator=(const table&) = delete;
+        ~table() { reset(); }
+
+        void allocate(size_t capacity_) {
+            reset();
+            capacity = capacity_;
+            ctrl.reset(new int8_t[capacity]);
+            std::memset(ctrl.get(), EMPTY, capacity);
+            slots = std::allocator<slot>().allocate(capacity);
+        }
+
+        void reset() {
+            for (size_t i = 0; i < capacity; ++i) {
+                if (ctrl[i] >= 0) slots[i].~slot();
+            }
+            if (slots) std::allocator<slot>().deallocate(slots, capacity);
+            slots = nullptr;
+            ctrl.reset();
+            capacity = size = deleted = 0;
+        }
+
+        void swap(table& o) {
+            std::swap(ctrl, o.ctrl);
+            std::swap(slots, o.slots);
+            std::swap(capacity, o.capacity);
+            std::swap(size, o.size);
+            std::swap(deleted, o.deleted);
+        }
+
+        bool needs_grow() const {
+            return (size + deleted + 1) * 8 > capacity * 7;
+        }
+
+        size_t find(const std::string& key, uint64_t hash) const {
+            if (capacity == 0) return npos;
+            size_t mask = capacity / GROUP - 1;
+            size_t g = h1(hash) & mask;
+            int8_t tag = h2(hash);
+            for (size_t step = 1; ; ++step) {
+                const int8_t* group = &ctrl[g * GROUP];
+                for (uint32_t m = match(group, tag); m; m &= m - 1) {
+                    size_t i = g * GROUP + lowest_bit(m);
+                    if (slots[i].hash == hash && slots[i].key == key)
+                        return i;
+                }
+                if (match(group, EMPTY)) return npos;
+                if (step > mask) return npos;
+                g = (g + step) & mask;
+            }
+        }
+
+        // Insert a key known not to be in the table, which must have
+        // a free slot
+        template <typename K, typename T>
+        size_t emplace(K&& key, uint64_t hash, T&& value) {
+            size_t mask = capacity / GROUP - 1;
+            size_t g = h1(hash) & mask;
+            for (size_t step = 1; ; ++step) {
+                uint32_t m = match_free(&ctrl[g * GROUP]);
+                if (m) {
+                    size_t i = g * GROUP + lowest_bit(m);
+                    if (ctrl[i] == DELETED) deleted -= 1;
+                    new (&slots[i]) slot { std::forward<K>(key), hash,
+                                           std::forward<T>(value) };
+                    ctrl[i] = h2(hash);
+                    size += 1;
+                    return i;
+                }
+                g = (g + step) & mask;
+            }
+        }
+
+        void erase(size_t i) {
+            slots[i].~slot();
+            size -= 1;
+            // A probe stops at a group with an empty slot, so the
+            // slot can be marked empty if its group already has one
+            size_t g = i - i % GROUP;
+            if (match(&ctrl[g], EMPTY)) {
+                ctrl[i] = EMPTY;
+            } else {
+                ctrl[i] = DELETED;
+                deleted += 1;
+            }
+        }
+
+        template <typename F>
+        void for_each(F& fn) const {
+            for (size_t i = 0; i < capacity; ++i) {
+                if (ctrl[i] >= 0)
+                    fn(slots[i].key, slots[i].value);
+            }
+        }
+    };
+
+    table current;
+
+    /**
+     * The table being moved into current while the table grows
+     */
+    table old;
+
+    /**
+     * The next group of old to move
+     */
+    size_t migrate_pos = 0;
+
+    // Move a few groups of the old table into the current one
+    void migrate(size_t groups = MIGRATE_GROUPS) {
+        if (!old.capacity) return;
+        size_t end = std::min(old.capacity, migrate_pos + groups * GROUP);
+        for (; migrate_pos < end; ++migrate_pos) {
+            if (old.ctrl[migrate_pos] < 0) continue;
+            slot& s = old.slots[migrate_pos];
+            current.emplace(std::move(s.key), s.hash, std::move(s.value));
+            old.erase(migrate_pos);
+        }
+        if (migrate_pos == old.capacity) {
+            old.reset();
+            migrate_pos = 0;
+        }
+    }
+
+    void grow() {
+        // Finish any move still in progress before starting another
+        if (old.capacity)
+            migrate(old.capacity / GROUP);
+
+        // Rehash in place into a table of the same size if most of
+        // the used slots are deleted rather than live
+        size_t capacity = current.capacity == 0 ? GROUP
+            : current.size * 2 < current.capacity ? current.capacity
+            : current.capacity * 2;
+        old.swap(current);
+        current.allocate(capacity);
+        migrate_pos = 0;
+        if (capacity == old.capacity)
+            migrate(old.capacity / GROUP);
+    }
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_FLAT_HASH_TABLE_H */
@@ -23,16 +23,21 @@
 #define THRONG_IN_MEMORY_STORAGE_ENGINE_H
 
 #include "throng/store.h"
+#include "flat_hash_table.h"
 
 #include <mutex>
-#include <unordered_map>
+#include <array>
 
 namespace throng {
 namespace internal {
 
 /**
  * The in-memory storage engine implements a storage engine that
- * stores its data in-memory non-persistently.
+ * stores its data in-memory non-persistently.  The keys are divided
+ * by hash among a fixed number of stripes, each an open-addressing
+ * hash table with its own lock, so that operations on different
+ * stripes do not contend and growing a table pauses only its own
+ * stripe.
  */
 class in_memory_storage_engine : public store<std::string, std::string> {
 public:
@@ -45,6 +50,13 @@ public:
         : name(std::move(name_)) { }
     virtual ~in_memory_storage_engine() {};
 
+    /**
+     * Get the number of keys in the store
+     *
+     * @return the number of keys
+     */
+    size_t size();
+
     // ********************
     // store<string,string>
     // ********************
@@ -61,6 +73,16 @@ public:
 
     virtual bool put(const std::string& key,
                      const versioned_t& value) override;
+    virtual bool erase(const std::string& key,
+                       const vector_clock& version) override;
+
+    /**
+     * Apply the writes with one lock acquisition per stripe touched.
+     * An atomic batch holds the locks of all its stripes at once, so
+     * no reader sees part of it.
+     */
+    virtual size_t
+    write(const write_batch<std::string, std::string>& batch) override;
 
     /**
      * Get the name for this store.
@@ -69,15 +91,30 @@ public:
      */
     virtual const std::string& get_name() const override;
 
+    virtual void visit(store_visitor visitor) override;
+    virtual void visit_prefix(const std::string& prefix,
+                              store_visitor visitor) override;
+    virtual void visit_partition(size_t partition, size_t partitions,
+                                 store_visitor visitor) override;
+
 private:
     std::string name;
-    std::mutex lock;
 
-    struct record {
-        std::vector<versioned_t> values;
+    static const size_t STRIPES = 16;
+
+    /**
+     * A lock and the hash table for the keys whose hash selects it
+     */
+    struct stripe {
+        std::mutex lock;
+        flat_hash_table<std::vector<versioned_t>> records;
     };
 
-    std::unordered_map<std::string, record> records;
+    std::array<stripe, STRIPES> stripes;
+
+    stripe& get_stripe(uint64_t hash) { return stripes[hash >> 60]; }
+    void visit_stripe(stripe& s, const std::string& prefix,
+                      store_visitor& visitor);
 };
 
 } /* namespace internal */
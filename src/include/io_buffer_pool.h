@@ -0,0 +1,162 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file io_buffer_pool.h
+ * @brief Interface definition file for io_buffer_pool
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_IO_BUFFER_POOL_H
+#define THRONG_IO_BUFFER_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace throng {
+namespace internal {
+
+/**
+ * A pool of buffers for network I/O, shared by connections so that
+ * sending and receiving messages does not allocate memory for each
+ * message.  Buffer sizes are rounded up to a power of two, and
+ * released buffers are kept on a free list for their size class, up
+ * to a limit on the total bytes kept.  Buffers larger than the
+ * largest size class are allocated and freed each time.
+ *
+ * The pool is thread-safe.  It must be created with make_shared,
+ * since each buffer keeps the pool alive until it is released.
+ */
+class io_buffer_pool : public std::enable_shared_from_this<io_buffer_pool> {
+public:
+    /**
+     * A buffer acquired from the pool, which returns it to the pool
+     * when destroyed or reset
+     */
+    class buffer {
+    public:
+        /**
+         * Create an empty buffer not associated with any pool
+         */
+        buffer() { }
+        buffer(buffer&& other);
+        buffer& operator=(buffer&& other);
+        buffer(const buffer&) = delete;
+        buffer& operator=(const buffer&) = delete;
+        ~buffer() { reset(); }
+
+        /**
+         * Get the memory for the buffer
+         */
+        uint8_t* data() const { return block; }
+
+        /**
+         * Get the size requested when the buffer was acquired
+         */
+        size_t size() const { return len; }
+
+        /**
+         * Get the usable size of the buffer, which is at least its
+         * size
+         */
+        size_t capacity() const { return cap; }
+
+        /**
+         * Return the buffer to its pool, leaving this empty
+         */
+        void reset();
+
+    private:
+        friend class io_buffer_pool;
+
+        std::shared_ptr<io_buffer_pool> pool;
+        uint8_t* block = nullptr;
+        size_t len = 0;
+        size_t cap = 0;
+    };
+
+    /**
+     * Statistics for the pool
+     */
+    struct stats {
+        /** Buffers allocated from the heap */
+        uint64_t allocations;
+        /** Buffers acquired from a free list */
+        uint64_t reuses;
+        /** Released buffers freed rather than kept */
+        uint64_t discards;
+        /** Buffers currently acquired */
+        size_t outstanding;
+        /** Bytes in buffers currently acquired */
+        size_t outstanding_bytes;
+        /** Buffers kept on free lists */
+        size_t cached;
+        /** Bytes in buffers kept on free lists */
+        size_t cached_bytes;
+    };
+
+    /**
+     * The smallest buffer capacity
+     */
+    static const size_t MIN_BUFFER_SIZE = 256;
+
+    /**
+     * Create an empty pool
+     *
+     * @param max_buffer_size_ the largest capacity kept for reuse,
+     * which is rounded up to a power of two
+     * @param max_cached_bytes_ the largest total capacity of the
+     * buffers kept for reuse
+     */
+    io_buffer_pool(size_t max_buffer_size_ = 1024 * 1024,
+                   size_t max_cached_bytes_ = 16 * 1024 * 1024);
+    io_buffer_pool(const io_buffer_pool&) = delete;
+    io_buffer_pool& operator=(const io_buffer_pool&) = delete;
+    ~io_buffer_pool();
+
+    /**
+     * Acquire a buffer with at least the given size
+     *
+     * @param size the size of the buffer
+     * @return the buffer
+     */
+    buffer acquire(size_t size);
+
+    /**
+     * Get the current statistics for the pool
+     *
+     * @return the statistics
+     */
+    stats get_stats() const;
+
+private:
+    size_t max_class;
+    size_t max_cached_bytes;
+
+    mutable std::mutex mutex;
+    // Free buffers for each size class, from MIN_BUFFER_SIZE up
+    std::vector<std::vector<uint8_t*>> free_lists;
+    stats counters;
+
+    void release(uint8_t* block, size_t cap);
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_IO_BUFFER_POOL_H */
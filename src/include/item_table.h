@@ -0,0 +1,449 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file item_table.h
+ * @brief Interface definition file for item_table
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_ITEM_TABLE_H
+#define THRONG_ITEM_TABLE_H
+
+#include "throng/versioned.h"
+#include "throng/store_config.h"
+#include "slab_allocator.h"
+#include "radix_tree.h"
+#include "value_pool.h"
+#include "timing_wheel.h"
+
+#include <boost/intrusive/unordered_set.hpp>
+#include <boost/intrusive/list.hpp>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+namespace throng {
+namespace internal {
+
+/**
+ * A compact hash table of the items in a store.  Each item is a
+ * single record allocated from a slab allocator that holds the item
+ * metadata, the key, and all of its values with their vector clocks
+ * encoded contiguously.  The hash index links the records directly,
+ * so a lookup follows a single pointer from the bucket array and
+ * there are no other per-item heap allocations.
+ *
+ * The records can instead be indexed by an ordered radix tree,
+ * which supports visiting the items in key order or by key prefix.
+ *
+ * Values can instead be interned in a value_pool, so that items with
+ * identical values share one copy and their records hold only a
+ * reference to it.
+ *
+ * Values are decoded on access.  The table is not thread-safe;
+ * callers must provide their own synchronization.
+ */
+class item_table {
+public:
+    /**
+     * The type of values stored in the table
+     */
+    typedef versioned<std::string> versioned_t;
+
+    /**
+     * A time for item metadata
+     */
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    /**
+     * Tag for the LRU list hook in a record
+     */
+    struct lru_tag {};
+
+    /**
+     * A hook for keeping records on a list in least-recently-used
+     * order.  Records unlink themselves when they are destroyed.
+     */
+    typedef boost::intrusive::list_base_hook<
+        boost::intrusive::tag<lru_tag>,
+        boost::intrusive::link_mode<boost::intrusive::auto_unlink>
+        > lru_hook;
+
+    /**
+     * An item in the table.  Records can be scheduled in a
+     * timing_wheel for periodic processing and placed on an LRU
+     * list; a record is removed from both when it is erased from the
+     * table.
+     */
+    class record : public timing_wheel::entry,
+                   public lru_hook,
+                   public boost::intrusive::unordered_set_base_hook<> {
+    public:
+        /**
+         * Get the key for the item
+         *
+         * @return a copy of the key
+         */
+        std::string get_key() const {
+            return std::string(key_data(), key_len);
+        }
+
+        /**
+         * Copy the key for the item into the given string, reusing
+         * its storage
+         *
+         * @param key the string to copy into
+         */
+        void get_key(std::string& key) const {
+            key.assign(key_data(), key_len);
+        }
+
+        /**
+         * Get the stored hash of the key
+         *
+         * @return the hash
+         */
+        uint64_t get_key_hash() const { return key_hash; }
+
+        /**
+         * Decode the values for the item
+         *
+         * @return the values
+         */
+        std::vector<versioned_t> get_values() const;
+
+        /**
+         * Compare the given clock to the clock of one of the item's
+         * values, without decoding the value
+         *
+         * @param i the index of the value
+         * @param clock the clock to compare
+         * @return how the given clock compares to the clock of the
+         * value, as for vector_clock::compare
+         */
+        vector_clock::occurred compare_version(size_t i,
+                                               const vector_clock& clock) const;
+
+        /**
+         * Get the number of values for the item
+         *
+         * @return the number of values
+         */
+        size_t get_value_count() const { return value_count; }
+
+        /**
+         * Get the number of bytes allocated for the record, including
+         * its key and values
+         *
+         * @return the size of the record
+         */
+        size_t get_size() const { return capacity; }
+
+        /**
+         * Check whether the item is a tombstone, which means that none
+         * of its values are set
+         *
+         * @return true if the item is a tombstone
+         */
+        bool is_tombstone() const { return !has_live_value; }
+
+        /**
+         * Compare the key for the item to the given key
+         *
+         * @param key the key to compare to
+         * @return true if the keys are equal
+         */
+        bool key_equals(const std::string& key) const {
+            return key.size() == key_len &&
+                key.compare(0, key_len, key_data(), key_len) == 0;
+        }
+
+        /**
+         * Check whether the key for the item begins with the given
+         * prefix
+         *
+         * @param prefix the prefix to check
+         * @return true if the key begins with the prefix
+         */
+        bool key_has_prefix(const std::string& prefix) const {
+            return prefix.size() <= key_len &&
+                prefix.compare(0, prefix.size(), key_data(),
+                               prefix.size()) == 0;
+        }
+
+        /**
+         * The last time the item was written or refreshed by its owner
+         */
+        time_point last_update;
+
+        /**
+         * The last time the local node refreshed the item
+         */
+        time_point last_refresh;
+
+        /**
+         * True if the item was written by the local node
+         */
+        bool local = false;
+
+        /**
+         * The sequence number of the last change to the item's
+         * values, assigned by the owner of the table
+         */
+        uint64_t seq = 0;
+
+    private:
+        friend class item_table;
+
+        record(uint64_t key_hash_, uint32_t key_len_, uint32_t capacity_)
+            : key_hash(key_hash_), key_len(key_len_), capacity(capacity_) { }
+
+        uint64_t key_hash;
+        uint32_t key_len;
+        uint32_t data_len = 0;
+        uint32_t capacity;
+        uint16_t value_count = 0;
+        bool has_live_value = false;
+
+        const char* key_data() const {
+            return reinterpret_cast<const char*>(this + 1);
+        }
+        char* key_data() {
+            return reinterpret_cast<char*>(this + 1);
+        }
+        const char* value_data() const { return key_data() + key_len; }
+        char* value_data() { return key_data() + key_len; }
+    };
+
+    /**
+     * Create a new empty table
+     *
+     * @param index_type the index to use for looking up keys
+     * @param dedup true to intern values in a value_pool
+     */
+    item_table(key_index_type index_type = key_index_type::HASH,
+               bool dedup = false);
+    item_table(const item_table&) = delete;
+    item_table& operator=(const item_table&) = delete;
+    ~item_table();
+
+    /**
+     * Find the item for the given key
+     *
+     * @param key the key to find
+     * @param hash the hash of the key
+     * @return the item or nullptr if there is no such item
+     */
+    record* find(const std::string& key, uint64_t hash);
+
+    /**
+     * Insert a new item with no values.  There must not already be
+     * an item with the same key.
+     *
+     * @param key the key for the item
+     * @param hash the hash of the key
+     * @return the new item
+     */
+    record* insert(const std::string& key, uint64_t hash);
+
+    /**
+     * Size the index to hold at least the given number of items
+     * without growing
+     *
+     * @param count the number of items
+     */
+    void reserve(size_t count);
+
+    /**
+     * Replace the values for an item.  The record is rewritten in
+     * place if the new values fit into the same block; otherwise it
+     * is moved to a new block, which unschedules it from its timing
+     * wheel and removes it from any LRU list.
+     *
+     * @param r the item to update
+     * @param values the new values
+     * @return the updated item, which might be at a new address
+     */
+    record* set_values(record* r, const std::vector<versioned_t>& values);
+
+    /**
+     * Replace the values for an item with a single value, as for
+     * set_values
+     *
+     * @param r the item to update
+     * @param value the new value
+     * @return the updated item, which might be at a new address
+     */
+    record* set_value(record* r, const versioned_t& value);
+
+    /**
+     * Remove an item from the table and free it
+     *
+     * @param r the item to remove
+     */
+    void erase(record* r);
+
+    /**
+     * Apply a function to every item in the table.  With a radix tree
+     * index the items are visited in key order.  The function must
+     * not modify the table.
+     *
+     * @param fn the function to apply
+     */
+    template <typename F>
+    void for_each(F fn) const {
+        if (tree) {
+            tree->for_each([&fn](void* r) {
+                    fn(*static_cast<const record*>(r));
+                });
+        } else {
+            for (const record& r : index) fn(r);
+        }
+    }
+
+    /**
+     * Apply a function to every item whose key begins with the given
+     * prefix.  With a radix tree index only the matching items are
+     * visited, in key order; otherwise the whole table is scanned.
+     * The function must not modify the table.
+     *
+     * @param prefix the key prefix
+     * @param fn the function to apply
+     */
+    template <typename F>
+    void for_each_prefix(const std::string& prefix, F fn) const {
+        if (tree) {
+            tree->for_each_prefix(prefix.data(), prefix.size(),
+                                  [&fn](void* r) {
+                    fn(*static_cast<const record*>(r));
+                });
+        } else {
+            for (const record& r : index)
+                if (r.key_has_prefix(prefix)) fn(r);
+        }
+    }
+
+    /**
+     * Get the number of items in the table
+     *
+     * @return the number of items
+     */
+    size_t size() const { return tree ? tree->size() : index.size(); }
+
+    /**
+     * Get the number of bytes of memory used by the table, including
+     * all records, interned values and index structures.  Only
+     * allocated blocks are counted, not the free blocks the allocator
+     * keeps in its slabs, so that erasing a record always lowers the
+     * total by the record's size.
+     *
+     * @return the number of bytes
+     */
+    size_t get_memory_usage() const;
+
+    /**
+     * Get the number of bytes that a record with the given key and
+     * values would use, including any values it would add to the
+     * value pool
+     *
+     * @param key the key
+     * @param values the values
+     * @return the size of the record
+     */
+    size_t get_record_size(const std::string& key,
+                           const std::vector<versioned_t>& values) const;
+
+    /**
+     * Get the number of bytes that a record with the given key and a
+     * single value would use, as for the other get_record_size
+     *
+     * @param key the key
+     * @param value the value
+     * @return the size of the record
+     */
+    size_t get_record_size(const std::string& key,
+                           const versioned_t& value) const;
+
+    /**
+     * Get the pool of interned values
+     *
+     * @return the pool, or nullptr if values are not interned
+     */
+    const value_pool* get_value_pool() const { return pool.get(); }
+
+    /**
+     * Get the allocator used for the records
+     *
+     * @return the allocator
+     */
+    const slab_allocator& get_allocator() const { return allocator; }
+
+private:
+    struct record_hash {
+        size_t operator()(const record& r) const { return r.key_hash; }
+    };
+
+    struct record_equal {
+        bool operator()(const record& a, const record& b) const {
+            return a.key_hash == b.key_hash && a.key_len == b.key_len &&
+                std::char_traits<char>::compare(a.key_data(), b.key_data(),
+                                                a.key_len) == 0;
+        }
+    };
+
+    typedef boost::intrusive::unordered_set<
+        record,
+        boost::intrusive::hash<record_hash>,
+        boost::intrusive::equal<record_equal>,
+        boost::intrusive::power_2_buckets<true>
+        > index_t;
+
+    slab_allocator allocator;
+    std::unique_ptr<index_t::bucket_type[]> buckets;
+    size_t bucket_count;
+    index_t index;
+
+    /**
+     * The radix tree index, if used in place of the hash index
+     */
+    std::unique_ptr<radix_tree> tree;
+
+    /**
+     * The interned values, if values are interned
+     */
+    std::unique_ptr<value_pool> pool;
+
+    static radix_tree::key_ref record_key(const void* r);
+
+    record* allocate(uint64_t hash, const char* key, uint32_t key_len,
+                     size_t data_len);
+    void free(record* r);
+    record* resize(record* r, size_t data_len);
+    bool is_pooled(const versioned_t& v) const;
+    size_t get_value_size(const versioned_t& v, size_t& pooled) const;
+    value_pool::entry* acquire(const versioned_t& v);
+    void get_entries(const record* r,
+                     std::vector<value_pool::entry*>& entries) const;
+    void release(const std::vector<value_pool::entry*>& entries);
+    void rehash(size_t new_count);
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_ITEM_TABLE_H */
@@ -0,0 +1,69 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file key_hash.h
+ * @brief Interface definition file for key hash functions
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_KEY_HASH_H
+#define THRONG_KEY_HASH_H
+
+#include "throng/store_config.h"
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace throng {
+namespace internal {
+
+/**
+ * Compute the 64-bit XXH3 hash of the input with a zero seed and the
+ * default secret.  The result is identical to XXH3_64bits() from the
+ * reference xxHash implementation on any host.
+ *
+ * @param data the data to hash
+ * @param len the length of the data
+ * @return the hash value
+ */
+uint64_t xxh3_64(const void* data, size_t len);
+
+/**
+ * Compute the XXH64 hash of the input with the given seed.  The
+ * result is identical to XXH64() from the reference xxHash
+ * implementation on any host.
+ *
+ * @param data the data to hash
+ * @param len the length of the data
+ * @param seed the seed
+ * @return the hash value
+ */
+uint64_t xxh64(const void* data, size_t len, uint64_t seed = 0);
+
+/**
+ * Hash a key using the specified hash function
+ *
+ * @param type the hash function to use
+ * @param key the key to hash
+ * @return the hash value
+ */
+uint64_t hash_key(key_hash_type type, const std::string& key);
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_KEY_HASH_H */
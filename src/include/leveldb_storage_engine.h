@@ -0,0 +1,105 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file leveldb_storage_engine.h
+ * @brief Interface definition file for leveldb_storage_engine
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_LEVELDB_STORAGE_ENGINE_H
+#define THRONG_LEVELDB_STORAGE_ENGINE_H
+
+#include "throng/store.h"
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace leveldb {
+class DB;
+}
+
+namespace throng {
+namespace internal {
+
+/**
+ * A persistent storage engine that stores its data in a LevelDB
+ * database.  Each key is stored with all of its concurrent values
+ * encoded as a message::keyed_values.  Keys are kept in order, so
+ * visiting by prefix reads only the matching keys.
+ */
+class leveldb_storage_engine : public store<std::string, std::string> {
+public:
+    /**
+     * Open or create the database for a storage engine
+     *
+     * @param name_ the name for the storage engine
+     * @param path the directory for the database
+     * @param sync_ true to sync each write to disk before it
+     * completes
+     * @throws error::storage if the database cannot be opened
+     */
+    leveldb_storage_engine(std::string name_, const std::string& path,
+                           bool sync_ = false);
+    virtual ~leveldb_storage_engine();
+
+    // ********************
+    // store<string,string>
+    // ********************
+
+    virtual std::vector<versioned_t>
+    get(const std::string& key) override;
+    virtual bool put(const std::string& key,
+                     const versioned_t& value) override;
+    virtual bool erase(const std::string& key,
+                       const vector_clock& version) override;
+
+    /**
+     * Apply the writes in a single LevelDB write batch, which is
+     * always atomic
+     *
+     * @throws error::storage if the batch cannot be written
+     */
+    virtual size_t
+    write(const write_batch<std::string, std::string>& batch) override;
+    virtual const std::string& get_name() const override;
+    virtual void visit(store_visitor visitor) override;
+    virtual void visit_prefix(const std::string& prefix,
+                              store_visitor visitor) override;
+    virtual void visit_partition(size_t partition, size_t partitions,
+                                 store_visitor visitor) override;
+
+private:
+    std::string name;
+    bool sync;
+    std::unique_ptr<leveldb::DB> db;
+
+    /**
+     * Serializes read-modify-write cycles for updating the values of
+     * a key.  Reads do not need it.
+     */
+    std::mutex write_mutex;
+
+    std::vector<versioned_t> read(const std::string& key);
+    void visit_range(const std::string& begin, const std::string& end,
+                     store_visitor visitor);
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_LEVELDB_STORAGE_ENGINE_H */
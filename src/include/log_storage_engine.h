@@ -0,0 +1,185 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file log_storage_engine.h
+ * @brief Interface definition file for log_storage_engine
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_LOG_STORAGE_ENGINE_H
+#define THRONG_LOG_STORAGE_ENGINE_H
+
+#include "throng/store.h"
+
+#include <boost/filesystem/path.hpp>
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+namespace throng {
+namespace internal {
+
+/**
+ * A persistent storage engine that appends every write to a log.  The
+ * log is a sequence of fixed-size segment files, each holding
+ * CRC-framed records of a key with all of its values.  An in-memory
+ * hash index maps each key to its latest record, and segments are
+ * memory-mapped, so a read is a single lookup.
+ *
+ * Once a full segment holds more than a configured fraction of
+ * overwritten records, a background thread copies its live records
+ * to the end of the log and removes it.  On open, the segments are
+ * scanned in order to rebuild the index, stopping at the first
+ * record that fails its CRC in each segment.
+ *
+ * A write batch is appended as consecutive records with a single
+ * write.  The records of an atomic batch are framed by a batch header
+ * with a CRC over all of them, so that recovery applies either the
+ * whole batch or none of it.
+ */
+class log_storage_engine : public store<std::string, std::string> {
+public:
+    /**
+     * Open or create the log for a storage engine
+     *
+     * @param name_ the name for the storage engine
+     * @param path the directory for the segment files
+     * @param segment_size_ the size of each segment file
+     * @param garbage_ratio_ the fraction of a segment that must be
+     * overwritten records before it is compacted
+     * @param sync_ true to sync each write to disk before it
+     * completes
+     * @throws error::storage if the log cannot be opened
+     */
+    log_storage_engine(std::string name_, const std::string& path,
+                       size_t segment_size_ = 64 * 1024 * 1024,
+                       double garbage_ratio_ = 0.5,
+                       bool sync_ = false);
+    virtual ~log_storage_engine();
+
+    /**
+     * Compact every full segment that has reached the garbage ratio
+     * now, rather than waiting for the background thread
+     */
+    void compact();
+
+    /**
+     * Get the number of segment files in the log
+     *
+     * @return the number of segments
+     */
+    size_t get_segment_count();
+
+    // ********************
+    // store<string,string>
+    // ********************
+
+    virtual std::vector<versioned_t>
+    get(const std::string& key) override;
+    virtual bool put(const std::string& key,
+                     const versioned_t& value) override;
+    virtual bool erase(const std::string& key,
+                       const vector_clock& version) override;
+    virtual size_t
+    write(const write_batch<std::string, std::string>& batch) override;
+    virtual const std::string& get_name() const override;
+    virtual void visit(store_visitor visitor) override;
+    virtual void visit_prefix(const std::string& prefix,
+                              store_visitor visitor) override;
+    virtual void visit_partition(size_t partition, size_t partitions,
+                                 store_visitor visitor) override;
+
+private:
+    class segment;
+    typedef std::shared_ptr<segment> segment_p;
+
+    /**
+     * The location of the latest record for a key
+     */
+    struct location {
+        uint32_t segment_id;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    std::string name;
+    boost::filesystem::path dir;
+    size_t segment_size;
+    double garbage_ratio;
+    bool sync;
+
+    /**
+     * Protects the index and the segments
+     */
+    std::mutex log_mutex;
+
+    std::unordered_map<std::string, location> index;
+
+    /**
+     * The delete record for each key whose latest record deletes it
+     */
+    std::unordered_map<std::string, location> deleted;
+
+    /**
+     * The segments by ID.  The file of a compacted segment is deleted
+     * right away, and the segment is unmapped once no reader holds a
+     * reference to it.
+     */
+    std::map<uint32_t, segment_p> segments;
+
+    /**
+     * The segment to which records are appended
+     */
+    segment_p active;
+
+    /**
+     * Serializes compactions
+     */
+    std::mutex compact_mutex;
+
+    /**
+     * Protects the state for waking the compaction thread
+     */
+    std::mutex signal_mutex;
+    std::condition_variable signal_cond;
+    bool compact_pending = false;
+    bool closing = false;
+    std::thread compact_thread;
+
+    void recover();
+    void run_compactions();
+    void request_compaction();
+    segment_p new_segment(size_t min_size);
+    location append(const char* data, size_t size);
+    void release(const location& loc);
+    void set_location(const std::string& key, const location& loc,
+                      bool deletes);
+    bool needs_compaction(const segment& s) const;
+    void compact_segment(const segment_p& s);
+    static std::vector<versioned_t> read(const segment& s,
+                                         const location& loc);
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_LOG_STORAGE_ENGINE_H */
@@ -23,17 +23,19 @@
 #define THRONG_PROCESSOR_H
 
 #include "ctx_internal.h"
+#include "timing_wheel.h"
+#include "item_table.h"
+#include "write_behind.h"
+#include "bloom_filter.h"
 
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/multi_index/hashed_index.hpp>
-#include <boost/multi_index/member.hpp>
-#include <boost/uuid/sha1.hpp>
 #include <boost/asio/steady_timer.hpp>
 
 #include <mutex>
-#include <unordered_map>
+#include <memory>
 #include <chrono>
+#include <set>
+#include <deque>
+#include <unordered_map>
 
 namespace throng {
 namespace internal {
@@ -56,7 +58,13 @@ public:
               std::unique_ptr<store<std::string, std::string>> delegate_,
               store_config config_)
         : ctx(ctx_), name(delegate_->get_name()), config(std::move(config_)),
-          delegate(std::move(delegate_)) { }
+          delegate(std::move(delegate_)),
+          tiered(config.tiered && config.memory_limit > 0) {
+        if (config.restore_threads > 0 && config.key_filter_memory_limit > 0)
+            key_filter.reset(new bloom_filter(KEY_FILTER_CAPACITY,
+                                              config.key_filter_fp_rate,
+                                              config.key_filter_memory_limit));
+    }
 
     /**
      * Construct a new processor with in-memory storage using the given name
@@ -93,6 +101,14 @@ public:
         listeners.push_back(std::move(listener));
     }
 
+    /**
+     * Set the resolver used to compact concurrent values on write
+     *
+     * @param resolver the resolver, or an empty function to disable
+     * compaction
+     */
+    void set_resolver(ctx::raw_resolver_t resolver);
+
     // ********************
     // store<string,string>
     // ********************
@@ -101,8 +117,106 @@ public:
     get(const std::string& key) override;
     virtual bool put(const std::string& key,
                      const versioned_t& value) override;
+
+    /**
+     * Remove the erased values from memory and queue the erase for
+     * the delegate
+     */
+    virtual bool erase(const std::string& key,
+                       const vector_clock& version) override;
+
+    /**
+     * Apply a batch of local writes under a single acquisition of
+     * the store lock, and queue the applied writes for the delegate
+     * as one batch.  If the memory limit is reached partway through,
+     * the writes before it remain applied, unless the batch is
+     * atomic, in which case they are rolled back and nothing reaches
+     * the delegate or the listeners.
+     *
+     * @throws error::memory_limit_exceeded if a write would exceed
+     * the memory limit for the store
+     */
+    virtual size_t
+    write(const write_batch<std::string, std::string>& batch) override;
     virtual const std::string& get_name() const override;
     virtual void visit(store_visitor visitor) override;
+    virtual void visit_prefix(const std::string& prefix,
+                              store_visitor visitor) override;
+
+    /**
+     * Put the given value into the store, recording whether the
+     * write originated from the local node.  Values written locally
+     * are owned by this node and are refreshed rather than expired
+     * when the store has an object timeout.
+     *
+     * @param key the key to store
+     * @param value the value to store
+     * @param local true if the write originated from the local node
+     * @return true if the value was successfully written, or false if
+     * the new value is obsolete
+     * @throws error::memory_limit_exceeded if the write would exceed
+     * the memory limit for the store
+     * @throws error::storage if the durability mode is
+     * durability_mode::SYNC and the write could not be committed, or
+     * if the queue of writes for storage is full and could not be
+     * committed
+     */
+    bool put(const std::string& key, const versioned_t& value, bool local);
+
+    /**
+     * Get the number of bytes of memory used for the data in the
+     * store, including writes queued for storage.  This is what
+     * store_config::memory_limit limits.
+     *
+     * @return the number of bytes
+     */
+    size_t get_memory_usage();
+
+    /**
+     * Get statistics for the items held in memory
+     *
+     * @return the statistics
+     */
+    cache_stats get_cache_stats();
+
+    /**
+     * Load every item from a source into the store, merging the
+     * values with any already present as for put.  Loaded items are
+     * written through to the delegate but listeners are not
+     * notified; incremental consumers see them as changes.
+     *
+     * @param source the source of the items
+     * @param size_hint the expected number of items, used to size
+     * the index before loading
+     * @return the number of items read from the source
+     * @throws error::memory_limit_exceeded if the memory limit was
+     * reached before all items were loaded
+     */
+    size_t load(store_snapshot<std::string, std::string>& source,
+                size_t size_hint = 0);
+
+    /**
+     * Take a snapshot of the in-memory state of the store.  The
+     * snapshot must not outlive the processor.
+     *
+     * @return the new snapshot
+     */
+    std::unique_ptr<store_snapshot<std::string, std::string>> snapshot();
+
+    /**
+     * Get the changes to the store after the given sequence number.
+     * If the change log no longer covers the sequence number, or the
+     * epoch is from a previous run of the store, the result is a
+     * snapshot of the whole store.
+     *
+     * @param epoch the epoch returned with the sequence number, or
+     * zero with a sequence number of zero to start
+     * @param seq the sequence number after which to get changes
+     * @param limit the maximum number of keys to return
+     * @return the changes
+     */
+    store_changes<std::string, std::string>
+    changes_since(uint64_t epoch, uint64_t seq, size_t limit);
 
 private:
     /**
@@ -127,89 +241,246 @@ private:
      */
     std::unique_ptr<store<std::string, std::string>> delegate;
 
+    /**
+     * Queue of writes to commit to the delegate while the processor
+     * is running.  Writes made while it is stopped go directly to the
+     * delegate.
+     */
+    std::shared_ptr<write_behind> writer;
+
     /**
      * Listeners that will be notified when data in the store is
      * updated
      */
     std::vector<ctx::raw_listener_t> listeners;
 
+    /**
+     * If set, used to merge concurrent values for a key once there
+     * are more than config.sibling_limit of them
+     */
+    ctx::raw_resolver_t resolver;
+
     /**
      * True if the store is still running
      */
     volatile bool running = false;
 
+    /**
+     * True once the contents of the delegate have been loaded
+     */
+    bool restored = false;
+
+    /**
+     * True while every item in the delegate is also in memory, so
+     * that a key not found in memory does not exist.  Cleared when an
+     * item is evicted.  Protected by item_mutex.
+     */
+    bool complete = false;
+
+    /**
+     * The initial number of keys the key filter is sized for
+     */
+    static const size_t KEY_FILTER_CAPACITY = 16384;
+
+    /**
+     * A filter over the keys written to the delegate, built as the
+     * delegate is restored and updated on every write to it.  Keys
+     * erased from the delegate, when items expire or tombstones are
+     * collected, stay in the filter, since a Bloom filter cannot
+     * remove them; reads of those keys go to the delegate until the
+     * filter is rebuilt on the next restore.  Protected by
+     * item_mutex.
+     */
+    std::unique_ptr<bloom_filter> key_filter;
+
+    /**
+     * True once the key filter holds every key in the delegate, so
+     * that reads of keys it does not contain can skip the delegate.
+     * Protected by item_mutex.
+     */
+    bool key_filter_ready = false;
+
     typedef std::chrono::steady_clock::time_point time_point;
 
-    struct item_details {
-        uint32_t key_hash[5];
+    typedef item_table::record record;
+
+    /**
+     * Mutex for synchronization of store data
+     */
+    std::mutex item_mutex;
+
+    /**
+     * The data in the store along with the necessary metadata
+     */
+    item_table items { config.key_index, config.dedup_values };
+
+    /**
+     * Deadlines for expiring and refreshing items
+     */
+    timing_wheel item_timers { std::chrono::milliseconds(100) };
+
+    typedef boost::intrusive::list<
+        record,
+        boost::intrusive::base_hook<item_table::lru_hook>,
+        boost::intrusive::constant_time_size<false>
+        > lru_list;
+
+    /**
+     * Items not owned by the local node, which can be evicted when
+     * the store reaches its memory limit, least recently used first
+     */
+    lru_list evictable;
+
+    /**
+     * True if items are evicted to the delegate and read back into
+     * memory when accessed, as for store_config::tiered
+     */
+    bool tiered = false;
+
+    /**
+     * For a store with a memory limit, the writer sequence number of
+     * each group of writes queued for the delegate and not yet known
+     * to be committed, with the first change sequence number in the
+     * group.  Items changed since the oldest such group may not be in
+     * the delegate yet, so are not evicted.
+     */
+    std::deque<std::pair<uint64_t, uint64_t>> unflushed;
+
+    /**
+     * Statistics for the items in memory.  Protected by item_mutex.
+     */
+    cache_stats stats;
+
+    /**
+     * The sequence number of the last change to any item
+     */
+    uint64_t change_seq = 0;
+
+    /**
+     * A random identifier for this run of the change log, since
+     * sequence numbers start again from zero in each run
+     */
+    uint64_t change_epoch = new_epoch();
+
+    /**
+     * Sequence numbers of the live snapshots.  A snapshot sees each
+     * item as of the last change with a sequence number no greater
+     * than its own.
+     */
+    std::multiset<uint64_t> snapshots;
+
+    /**
+     * A superseded version of an item, visible to snapshots with
+     * sequence numbers in [from, to).  No values means the item did
+     * not exist.
+     */
+    struct old_version {
+        uint64_t from;
+        uint64_t to;
         std::vector<versioned_t> values;
-        time_point last_refresh;
-        time_point last_resolve;
     };
 
-    struct item {
-        item(std::string key_, time_point next_time_)
-            : details(new item_details()),
-              key(std::move(key_)), next_time(next_time_) {
-            boost::uuids::detail::sha1 sha1;
-            sha1.process_bytes(key.c_str(), key.size());
-            sha1.get_digest(details->key_hash);
-        }
+    /**
+     * Superseded versions of items that live snapshots can still see,
+     * oldest first
+     */
+    std::unordered_map<std::string, std::deque<old_version>> history;
 
-        item() = delete;
-        item(const item&) = delete;
-        item& operator=(const item&) = delete;
-        item(item&&) = default;
-        item& operator=(item&&) = default;
+    /**
+     * The keys in history in the order their versions were
+     * superseded, for reclaiming old versions
+     */
+    std::deque<std::pair<uint64_t, std::string>> history_order;
 
-        std::unique_ptr<item_details> details;
+    class snapshot_impl;
 
+    /**
+     * An item read from the delegate or another source, to be merged
+     * into the store
+     */
+    struct loaded_item {
         std::string key;
-        time_point next_time;
+        uint64_t hash;
+        std::vector<versioned_t> values;
     };
 
-    // tag for next_time index
-    struct next_time_tag{};
-    // tag for key index
-    struct key_tag{};
-
-    struct item_indexes :
-        boost::multi_index::indexed_by<
-        boost::multi_index::hashed_unique<
-            boost::multi_index::tag<key_tag>,
-            boost::multi_index::member<item,
-                                       std::string,
-                                       &item::key> > ,
-        boost::multi_index::ordered_non_unique<
-            boost::multi_index::tag<next_time_tag>,
-            boost::multi_index::member<item,
-                                       time_point,
-                                       &item::next_time> >
-        > {};
-
-    typedef boost::multi_index::multi_index_container<
-        item, item_indexes
-        > item_map_t;
+    /**
+     * A ring of the keys changed by each change still in the log,
+     * with no gaps in sequence, oldest first starting at
+     * change_log_head.  Once the ring is full the oldest entry is
+     * overwritten in place, reusing its key storage.
+     */
+    std::vector<std::pair<uint64_t, std::string>> change_log;
 
     /**
-     * Mutex for synchronization of store data
+     * The index of the oldest entry in change_log
      */
-    std::mutex item_mutex;
+    size_t change_log_head = 0;
 
     /**
-     * The data in the store along with the necessary metadata
+     * The sequence number of the last change dropped from the log
      */
-    item_map_t item_map;
+    uint64_t truncated_seq = 0;
 
     std::unique_ptr<boost::asio::steady_timer> proc_timer;
 
-    typedef item_map_t::index<next_time_tag>::type item_map_by_time;
+    /**
+     * The time for which proc_timer is currently armed, or
+     * time_point::max() if it is not armed
+     */
+    time_point proc_timer_deadline = time_point::max();
+
+    void restore();
+    bool load_batch(std::vector<loaded_item>& batch, bool persist);
+    record* page_in(const std::string& key, uint64_t hash,
+                    const std::vector<versioned_t>& values);
+    void fault_in(const std::string& key, uint64_t hash);
+    void wait_for_writer();
+    size_t memory_used() const;
+    bool release_writes();
+    void track_unflushed(uint64_t seq, uint64_t first_change);
+    bool is_clean(const record& r);
+    void visit_tiered(const std::string& prefix, store_visitor& visitor);
+    void arm_proc_timer(time_point deadline);
+    /**
+     * The state of an item before a write in an atomic batch, to
+     * restore if a later write in the batch fails
+     */
+    struct saved_item {
+        std::string key;
+        uint64_t hash;
+        bool existed;
+        std::vector<versioned_t> values;
+        time_point last_update;
+        time_point last_refresh;
+        bool local;
+    };
 
     void on_proc_timer(const boost::system::error_code& ec);
-    void process(item_map_by_time::iterator& it);
+    void process(record& r, time_point now);
+    void unstore(const record& r);
+    bool apply_erase(const std::string& key, uint64_t hash,
+                     const vector_clock& version);
+    void reschedule(record& r);
+    time_point get_next_time(const record& r) const;
     void notify(const std::string& key, bool local);
-    bool doput(item_details& rs,
+    void touch(record& r);
+    void keep_history(const record& r, uint64_t to);
+    uint64_t next_change(const record& r);
+    static uint64_t new_epoch();
+    std::vector<versioned_t> get_at(const std::string& key, uint64_t hash,
+                                    uint64_t seq);
+    void visit_at(uint64_t seq, store_visitor visitor, bool sorted = false);
+    void release_snapshot(uint64_t seq);
+    bool reserve(const record& r, size_t size);
+    bool apply_put(const std::string& key, uint64_t hash,
+                   const versioned_t& value, bool local,
+                   versioned_t& written);
+    bool doput(std::vector<versioned_t>& values,
                const versioned<std::string>& value);
+    bool compact(std::vector<versioned_t>& values);
+    saved_item save_item(const std::string& key, uint64_t hash);
+    void restore_item(const saved_item& s);
 };
 
 } /* namespace internal */
@@ -0,0 +1,185 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file radix_tree.h
+ * @brief Interface definition file for radix_tree
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_RADIX_TREE_H
+#define THRONG_RADIX_TREE_H
+
+#include "slab_allocator.h"
+
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+namespace throng {
+namespace internal {
+
+/**
+ * An ordered index from byte-string keys to values, implemented as
+ * an adaptive radix tree.  Inner nodes grow and shrink between
+ * four node sizes according to their fan-out, and chains of
+ * single-child nodes are collapsed into a compressed prefix on the
+ * next branching node, so keys sharing long hierarchical prefixes
+ * are stored once along the shared path.
+ *
+ * The tree does not store keys itself.  Values are pointers to
+ * objects that contain their own key, which the tree retrieves
+ * through a key function when it needs to verify or split a path.
+ * Value pointers must be at least 2-byte aligned.  Inner nodes are
+ * allocated from a slab allocator supplied by the caller, which must
+ * outlive the tree.
+ *
+ * The tree is not thread-safe; callers must provide their own
+ * synchronization.
+ */
+class radix_tree {
+public:
+    /**
+     * A reference to the key of a value
+     */
+    struct key_ref {
+        const char* data;
+        size_t size;
+    };
+
+    /**
+     * A function that returns the key for a value in the tree
+     */
+    typedef key_ref (*key_fn)(const void* value);
+
+    /**
+     * A function to apply to values in the tree
+     */
+    typedef std::function<void(void* value)> visit_fn;
+
+    /**
+     * Create a new empty tree
+     *
+     * @param allocator the allocator for inner nodes
+     * @param get_key the key function for values
+     */
+    radix_tree(slab_allocator& allocator, key_fn get_key);
+    radix_tree(const radix_tree&) = delete;
+    radix_tree& operator=(const radix_tree&) = delete;
+    ~radix_tree();
+
+    /**
+     * Find the value for a key
+     *
+     * @param key the key data
+     * @param len the length of the key
+     * @return the value or nullptr if there is no such key
+     */
+    void* find(const char* key, size_t len) const;
+
+    /**
+     * Insert a value.  There must not already be a value with the
+     * same key.
+     *
+     * @param value the value to insert
+     */
+    void insert(void* value);
+
+    /**
+     * Replace the value stored for a key with a new value with the
+     * same key
+     *
+     * @param old_value the value currently in the tree
+     * @param new_value the new value
+     */
+    void replace(const void* old_value, void* new_value);
+
+    /**
+     * Remove the value with the given key if present
+     *
+     * @param key the key data
+     * @param len the length of the key
+     * @return true if a value was removed
+     */
+    bool erase(const char* key, size_t len);
+
+    /**
+     * Apply a function to every value in the tree in key order.  The
+     * function must not modify the tree.
+     *
+     * @param fn the function to apply
+     */
+    void for_each(const visit_fn& fn) const;
+
+    /**
+     * Apply a function in key order to every value whose key begins
+     * with the given prefix.  The function must not modify the tree.
+     *
+     * @param prefix the prefix data
+     * @param len the length of the prefix
+     * @param fn the function to apply
+     */
+    void for_each_prefix(const char* prefix, size_t len,
+                         const visit_fn& fn) const;
+
+    /**
+     * Get the number of values in the tree
+     *
+     * @return the number of values
+     */
+    size_t size() const { return count; }
+
+private:
+    /**
+     * A tagged pointer to either an inner node or, if the low bit is
+     * set, a value.  Zero for an empty slot.
+     */
+    typedef uintptr_t child_t;
+
+    struct node;
+    struct node4;
+    struct node16;
+    struct node48;
+    struct node256;
+
+    slab_allocator& allocator;
+    key_fn get_key;
+    child_t root = 0;
+    size_t count = 0;
+
+    key_ref key_of(child_t c) const;
+    child_t minimum(child_t c) const;
+    uint32_t prefix_mismatch(const node* n, const char* key, size_t len,
+                             size_t depth) const;
+    child_t* find_slot(const char* key, size_t len) const;
+    void add_child(child_t* ref, uint8_t byte, child_t child);
+    bool erase(child_t* ref, const char* key, size_t len, size_t depth);
+    void shrink(child_t* ref);
+    void visit(child_t c, const visit_fn& fn) const;
+    void destroy(child_t c);
+
+    node* new_node(uint8_t type);
+    void free_node(node* n);
+
+    static size_t node_size(uint8_t type);
+    static child_t* find_child(node* n, uint8_t byte);
+    static child_t first_child(const node* n, uint8_t* byte);
+    static void remove_child(node* n, uint8_t byte);
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_RADIX_TREE_H */
@@ -0,0 +1,131 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file receive_buffer.h
+ * @brief Interface definition file for receive_buffer
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_RECEIVE_BUFFER_H
+#define THRONG_RECEIVE_BUFFER_H
+
+#include "io_buffer_pool.h"
+
+#include <boost/asio/buffer.hpp>
+
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace throng {
+namespace internal {
+
+/**
+ * A buffer for bytes received from a stream of length-prefixed
+ * frames.  Each read fills as much of the free space as the socket
+ * has available, and every complete frame can then be taken from the
+ * buffer in place, without copying.  A partial frame left at the end
+ * is moved to the start of the buffer before the next read.  The
+ * buffer grows when a frame is larger than the space for it, and
+ * goes back to the read size once the large frame has been taken.
+ * Its memory comes from a shared pool.
+ *
+ * Each frame is a 4-byte big-endian length followed by that many
+ * bytes.
+ */
+class receive_buffer {
+public:
+    /**
+     * The size of the length prefix of each frame
+     */
+    static const size_t HEADER_SIZE = 4;
+
+    /**
+     * The result of looking for the next frame
+     */
+    enum class frame_status {
+        /** A complete frame was found */
+        COMPLETE,
+        /** More bytes must be read to complete the frame */
+        INCOMPLETE,
+        /** The frame is larger than the maximum frame size */
+        OVERSIZED
+    };
+
+    /**
+     * Create an empty buffer
+     *
+     * @param pool_ the pool from which to allocate memory
+     * @param max_frame_size_ the largest frame body accepted
+     * @param read_size_ the least free space to offer for each read
+     */
+    explicit receive_buffer(std::shared_ptr<io_buffer_pool> pool_,
+                            size_t max_frame_size_ = 64 * 1024 * 1024,
+                            size_t read_size_ = 64 * 1024);
+
+    /**
+     * Get the free space to read into, making room first if needed.
+     * The space is at least the read size, or whatever remains of a
+     * larger frame.  It is invalidated by the next call.
+     *
+     * @return the free space
+     */
+    boost::asio::mutable_buffers_1 prepare();
+
+    /**
+     * Add bytes read into the space from prepare
+     *
+     * @param len the number of bytes read
+     */
+    void commit(size_t len) { end += len; }
+
+    /**
+     * Take the next frame from the buffer if it is complete.  The
+     * frame body stays valid until the next call to prepare.
+     *
+     * @param data set to the start of the frame body
+     * @param len set to the length of the frame body
+     * @return the status of the next frame.  The frame is only taken
+     * if it is complete.
+     */
+    frame_status next_frame(const uint8_t*& data, size_t& len);
+
+    /**
+     * Get the number of bytes received but not yet taken as frames
+     */
+    size_t size() const { return end - begin; }
+
+    /**
+     * Get the number of bytes allocated for the buffer
+     */
+    size_t capacity() const { return storage.capacity(); }
+
+private:
+    std::shared_ptr<io_buffer_pool> pool;
+    size_t max_frame_size;
+    size_t read_size;
+    io_buffer_pool::buffer storage;
+    size_t begin = 0;
+    size_t end = 0;
+
+    size_t frame_size() const;
+    void reallocate(size_t new_size);
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_RECEIVE_BUFFER_H */
@@ -24,6 +24,8 @@
 
 #include "ctx_internal.h"
 #include "rpc_handler.h"
+#include "receive_buffer.h"
+#include "io_buffer_pool.h"
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/strand.hpp>
@@ -31,6 +33,10 @@
 
 #include <memory>
 #include <atomic>
+#include <mutex>
+#include <chrono>
+#include <deque>
+#include <vector>
 
 namespace throng {
 namespace internal {
@@ -47,19 +53,46 @@ public:
     typedef std::function<void(const std::shared_ptr<rpc_connection>& conn)>
     stop_handler_type;
 
+    /**
+     * Options controlling how outgoing messages are coalesced into
+     * writes on the socket
+     */
+    struct write_options {
+        write_options() : max_batch_size(256 * 1024), max_latency(0) { }
+
+        /**
+         * The number of bytes of queued messages at which a batch is
+         * written without waiting any longer.  A single message larger
+         * than this is written in a batch of its own.
+         */
+        size_t max_batch_size;
+
+        /**
+         * The longest time a message waits in the queue for more
+         * messages to join its batch.  With zero, a batch is written
+         * as soon as the previous write completes.
+         */
+        std::chrono::microseconds max_latency;
+    };
+
     /**
      * Create a new RPC connection using the specified handler
      *
      * @param ctx the internal context
      * @param conn_id the ID for this connection
      * @param handler the handler for this connection
+     * @param buffer_pool the pool for buffers to send and receive
+     * messages
      * @param stop_handler a function to be called when the
      * connection is stopped
+     * @param options options for coalescing outgoing messages
      */
     rpc_connection(ctx_internal& ctx,
                    uint64_t conn_id,
                    std::shared_ptr<rpc_handler> handler,
-                   stop_handler_type stop_handler = stop_handler_type{});
+                   std::shared_ptr<io_buffer_pool> buffer_pool,
+                   stop_handler_type stop_handler = stop_handler_type{},
+                   write_options options = write_options());
     rpc_connection(const rpc_connection&) = delete;
     rpc_connection& operator=(const rpc_connection&) = delete;
 
@@ -104,7 +137,9 @@ public:
     /**
      * Send a message over this connection.  If the transaction ID is
      * not already set, one will be allocated from a sequential
-     * counter for the connection.
+     * counter for the connection.  The message is queued and written
+     * along with any other queued messages, in order, with at most
+     * one write in progress on the socket.
      *
      * @param m the message to send
      */
@@ -143,9 +178,33 @@ private:
     time_point last_write;
     std::unique_ptr<boost::asio::steady_timer> timeout;
 
-    std::vector<uint8_t> buffer;
+    std::shared_ptr<io_buffer_pool> buffer_pool;
+    receive_buffer read_buffer;
+    // Reused for each message received, to keep its allocations
+    message::rpc_message read_msg;
+
+    typedef io_buffer_pool::buffer frame_t;
+    write_options options;
+    // Frames waiting to be written.  The writer runs on the strand
+    // and is active from when a frame is queued while it is idle
+    // until it finds the queue empty.
+    std::mutex write_mutex;
+    std::deque<frame_t> write_queue;
+    size_t queued_bytes = 0;
+    time_point oldest_queued;
+    bool write_active = false;
+    // Frames being written, used only by the writer
+    std::vector<frame_t> writing;
+    boost::asio::steady_timer write_timer;
+    // True while the writer waits on the timer for a batch to fill,
+    // used only on the strand
+    bool write_waiting = false;
 
     void read_message();
+    bool handle_frames();
+    void schedule_write();
+    void take_batch();
+    void clear_write_queue();
 };
 
 typedef std::shared_ptr<rpc_connection> rpc_connection_p;
@@ -24,6 +24,7 @@
 
 #include "ctx_internal.h"
 #include "singleton_task.h"
+#include "rpc_connection.h"
 #include "throng_messages.pb.h"
 
 #include <boost/asio/ip/tcp.hpp>
@@ -39,8 +40,6 @@
 namespace throng {
 namespace internal {
 
-class rpc_connection;
-typedef std::shared_ptr<rpc_connection> rpc_connection_p;
 class rpc_handler;
 
 /**
@@ -86,6 +85,24 @@ public:
      */
     void set_seeds(std::vector<seed_t> seeds_) { seeds = std::move(seeds_); }
 
+    /**
+     * Set the options for coalescing outgoing messages on connections
+     * created after this call
+     *
+     * @param options_ the write options
+     */
+    void set_write_options(const rpc_connection::write_options& options_) {
+        write_options = options_;
+    }
+
+    /**
+     * Get the pool of buffers shared by the connections for sending
+     * and receiving messages
+     *
+     * @return the buffer pool
+     */
+    io_buffer_pool& get_buffer_pool() { return *buffer_pool; }
+
     /**
      * Check if there is a ready connection for the requested node
      *
@@ -124,6 +141,8 @@ private:
     std::unique_ptr<neigh_client_t> neigh_client;
 
     std::vector<seed_t> seeds;
+    rpc_connection::write_options write_options;
+    std::shared_ptr<io_buffer_pool> buffer_pool;
     decltype(seeds)::iterator seed_iter;
     uint64_t bootstrap_conn_id = std::numeric_limits<uint64_t>::max();
 
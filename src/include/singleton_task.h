@@ -27,6 +27,8 @@
 #include <boost/asio/steady_timer.hpp>
 
 #include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <memory>
 #include <chrono>
 
@@ -77,17 +79,31 @@ public:
                   duration_type max_delay = duration_type(0));
 
     /**
-     * Cancel the running task and do not reschedule it.
+     * Cancel the task and do not reschedule it.  If an instance of
+     * the task is running on another thread, wait for it to finish,
+     * so that the task does not run once this returns.
      */
     void cancel();
 
 private:
-    std::mutex task_mutex;
-    std::function<void()> task;
-    boost::asio::steady_timer task_timer;
+    /**
+     * State shared with queued task instances, which may run after
+     * the singleton task is destroyed and must then find that they
+     * were canceled
+     */
+    struct task_state {
+        std::mutex task_mutex;
+        std::condition_variable task_done;
+        std::function<void()> task;
+
+        bool task_should_run = false;
+        bool task_running = false;
+        bool task_canceling = false;
+        std::thread::id task_thread;
+    };
 
-    bool task_should_run = false;
-    bool task_running = false;
+    std::shared_ptr<task_state> state;
+    boost::asio::steady_timer task_timer;
 
     typedef std::chrono::steady_clock::time_point time_point;
 
@@ -99,7 +115,10 @@ private:
         void run();
         void sched();
 
+        // only used while the task is scheduled or running, when
+        // the parent is known to be alive
         singleton_task& parent;
+        std::shared_ptr<task_state> state;
         bool canceled = false;
         time_point first_sched;
         time_point next_sched;
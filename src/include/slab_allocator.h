@@ -0,0 +1,152 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file slab_allocator.h
+ * @brief Interface definition file for slab_allocator
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_SLAB_ALLOCATOR_H
+#define THRONG_SLAB_ALLOCATOR_H
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+namespace throng {
+namespace internal {
+
+/**
+ * An allocator for many small objects of varying size.  Requests are
+ * rounded up to one of a fixed set of size classes, and the blocks
+ * for each size class are carved out of large slabs, so there is no
+ * per-allocation header and no general-purpose heap involvement for
+ * small objects.  Freed blocks are kept on a free list for their
+ * slab and reused.  A slab whose blocks have all been freed is
+ * returned to the system, except for one spare slab kept to absorb
+ * churn.
+ *
+ * Requests larger than MAX_BLOCK_SIZE are passed through to the
+ * heap.  All blocks are aligned to 8 bytes.  The allocator is not
+ * thread-safe; callers must provide their own synchronization.
+ */
+class slab_allocator {
+public:
+    /**
+     * The largest request served from a slab
+     */
+    static const size_t MAX_BLOCK_SIZE = 4096;
+
+    /**
+     * Create a new allocator
+     *
+     * @param slab_size the size of each slab allocated from the heap
+     */
+    slab_allocator(size_t slab_size = 256 * 1024);
+    slab_allocator(const slab_allocator&) = delete;
+    slab_allocator& operator=(const slab_allocator&) = delete;
+    ~slab_allocator();
+
+    /**
+     * Allocate a block of at least the given size
+     *
+     * @param size the size of the block
+     * @return a pointer to the block
+     * @throws std::bad_alloc if memory could not be allocated
+     */
+    void* allocate(size_t size);
+
+    /**
+     * Return a block to the allocator
+     *
+     * @param p the block to free
+     * @param size the size passed to allocate for the block, or any
+     * size with the same block_size
+     */
+    void deallocate(void* p, size_t size);
+
+    /**
+     * Get the actual size of the block that would be allocated for a
+     * request of the given size
+     *
+     * @param size the requested size
+     * @return the usable size of the block
+     */
+    static size_t block_size(size_t size);
+
+    /**
+     * Get the number of bytes obtained from the heap, including
+     * slabs and large blocks
+     *
+     * @return the number of bytes
+     */
+    size_t get_reserved_bytes() const { return reserved_bytes; }
+
+    /**
+     * Get the number of bytes in blocks that are currently allocated
+     *
+     * @return the number of bytes
+     */
+    size_t get_used_bytes() const { return used_bytes; }
+
+private:
+    struct free_block {
+        free_block* next;
+    };
+
+    /**
+     * A slab carved into blocks of one size class
+     */
+    struct slab {
+        std::unique_ptr<char[]> memory;
+        unsigned size_class;
+        size_t live = 0;
+        free_block* free_list = nullptr;
+        char* next;
+        char* end;
+
+        /**
+         * Links in the list of slabs of the size class that have a
+         * block available
+         */
+        slab* prev_available = nullptr;
+        slab* next_available = nullptr;
+    };
+
+    struct size_class {
+        slab* available = nullptr;
+    };
+
+    size_t slab_size;
+    std::vector<size_class> classes;
+    std::map<const char*, std::unique_ptr<slab>> slabs;
+    std::unique_ptr<char[]> spare;
+    size_t reserved_bytes = 0;
+    size_t used_bytes = 0;
+
+    slab* new_slab(unsigned c);
+    void free_slab(std::map<const char*,
+                   std::unique_ptr<slab>>::iterator it);
+    void link_available(slab* s);
+    void unlink_available(slab* s);
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_SLAB_ALLOCATOR_H */
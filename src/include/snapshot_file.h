@@ -0,0 +1,165 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file snapshot_file.h
+ * @brief Interface definition file for snapshot files
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_SNAPSHOT_FILE_H
+#define THRONG_SNAPSHOT_FILE_H
+
+#include "throng/store.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace throng {
+namespace internal {
+
+/**
+ * Write the contents of a store snapshot to a snapshot file, sorted
+ * by key.  The file is written to a temporary path, synced, and then
+ * renamed into place, so a reader never sees a partial file.
+ *
+ * A snapshot file is a header, a sequence of blocks of items, an
+ * index of the first key of each block, and a footer locating the
+ * index.  Each block has a CRC and is optionally compressed with
+ * zlib.  Values held by more than one item are written once, in a
+ * block of shared values after the items, and the items refer to
+ * them by hash.  Integers are little-endian.
+ *
+ * The snapshot is visited twice, once to find the values held by
+ * more than one item and once to write the items in key order, so
+ * that only the hashes of large values and the shared values are
+ * held in memory besides what the snapshot's sorted visit needs.
+ *
+ * @param path the path for the file
+ * @param source the snapshot to write
+ * @param compress true to compress the blocks
+ * @return the number of items written
+ * @throws error::storage if the file cannot be written
+ */
+size_t write_snapshot_file(const std::string& path,
+                           store_snapshot<std::string, std::string>& source,
+                           bool compress = true);
+
+/**
+ * A snapshot file opened for reading.  The index is read when the
+ * file is opened; each lookup reads and decodes a single block.
+ */
+class snapshot_file_reader : public store_snapshot<std::string, std::string> {
+public:
+    /**
+     * Open a snapshot file and read its index
+     *
+     * @param path_ the path to the file
+     * @throws error::storage if the file cannot be read or is not a
+     * valid snapshot file
+     */
+    explicit snapshot_file_reader(std::string path_);
+    virtual ~snapshot_file_reader();
+
+    /**
+     * Get the number of items in the file
+     *
+     * @return the number of items
+     */
+    uint64_t get_item_count() const { return item_count; }
+
+    /**
+     * Get the number of values written once for several items.  The
+     * items read from the file share a single copy of each.
+     *
+     * @return the number of shared values
+     */
+    size_t get_shared_count() const { return shared.size(); }
+
+    // ****************************
+    // store_snapshot<string,string>
+    // ****************************
+
+    /**
+     * @throws error::storage if the block holding the key is corrupt
+     */
+    virtual std::vector<versioned_t> get(const std::string& key) override;
+
+    /**
+     * Visit all items in key order
+     *
+     * @throws error::storage if a block is corrupt
+     */
+    virtual void visit(store_visitor visitor) override;
+
+    /**
+     * Visit all items in key order, as visit does
+     *
+     * @throws error::storage if a block is corrupt
+     */
+    virtual void visit_sorted(store_visitor visitor) override {
+        visit(visitor);
+    }
+
+private:
+    /**
+     * An entry in the index of blocks
+     */
+    struct block_ref {
+        std::string first_key;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    /**
+     * An item in a decoded block
+     */
+    struct item {
+        const char* key;
+        uint32_t key_len;
+        const char* values;
+        uint32_t values_len;
+        const char* refs;
+        uint32_t ref_count;
+    };
+
+    std::string path;
+    int fd = -1;
+    uint32_t version = 0;
+    bool compressed = false;
+    uint64_t item_count = 0;
+    std::vector<block_ref> blocks;
+
+    /**
+     * The shared values by hash
+     */
+    std::unordered_map<uint64_t,
+                       std::shared_ptr<const std::string>> shared;
+
+    void read_at(uint64_t offset, char* data, size_t size);
+    void read_block(const block_ref& b, std::string& data);
+    void read_shared(const block_ref& b, uint32_t count);
+    std::vector<versioned_t> decode_item(const item& i);
+    template <typename F>
+    void for_each_item(const std::string& data, F fn);
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_SNAPSHOT_FILE_H */
@@ -23,6 +23,7 @@
 #define THRONG_STORE_REGISTRY_H
 
 #include "throng/store_config.h"
+#include "throng/value_codec.h"
 #include "processor.h"
 #include "ctx_internal.h"
 
@@ -67,6 +68,16 @@ public:
      */
     processor& get(const std::string& name);
 
+    /**
+     * Get the value codec for the store with the specified name
+     *
+     * @param name the name of the store
+     * @return the codec, or nullptr if the store does not encode
+     * values
+     * @throws error::unknown_store if there is no such store
+     */
+    std::shared_ptr<value_codec> get_codec(const std::string& name);
+
     /**
      * Start all store processors
      */
@@ -93,6 +104,20 @@ private:
      */
     std::unordered_map<std::string,
                        std::unique_ptr<processor>> stores;
+
+    /**
+     * Value codecs for the stores that encode values
+     */
+    std::unordered_map<std::string,
+                       std::shared_ptr<value_codec>> codecs;
+
+    /**
+     * Get the directory for the persistent data for a store
+     *
+     * @param name the name of the store
+     * @return the path to the directory
+     */
+    boost::filesystem::path get_store_path(const std::string& name) const;
 };
 
 } /* namespace internal */
@@ -0,0 +1,92 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file stored_values.h
+ * @brief Interface definition file for stored values
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_STORED_VALUES_H
+#define THRONG_STORED_VALUES_H
+
+#include "throng/versioned.h"
+#include "throng/store.h"
+
+#include <string>
+#include <vector>
+
+namespace throng {
+namespace internal {
+
+/**
+ * Encode the values for a key for a persistent storage engine, as a
+ * message::keyed_values.  The key is not included; engines store it
+ * alongside.  A tombstone is a value with no value field.
+ *
+ * @param values the values to encode
+ * @return the encoded values
+ */
+std::string encode_values(const std::vector<versioned<std::string>>& values);
+
+/**
+ * Decode values encoded with encode_values
+ *
+ * @param data the encoded values
+ * @param size the size of the encoded values
+ * @return the values
+ * @throws error::serialization if the values cannot be decoded
+ */
+std::vector<versioned<std::string>> decode_values(const char* data,
+                                                  size_t size);
+
+/**
+ * Apply a write to the values for a key, replacing the values it
+ * supersedes and keeping the values that are concurrent with it
+ *
+ * @param values the values for the key
+ * @param value the value to write
+ * @return true if the write was applied, or false if it is obsolete
+ */
+bool apply_write(std::vector<versioned<std::string>>& values,
+                 const versioned<std::string>& value);
+
+/**
+ * Apply an erase to the values for a key, removing the values whose
+ * versions are equal to or before the given version
+ *
+ * @param values the values for the key
+ * @param version the version through which to erase values
+ * @return true if any values were removed
+ */
+bool apply_erase(std::vector<versioned<std::string>>& values,
+                 const vector_clock& version);
+
+/**
+ * Apply a write or an erase from a write batch to the values for a
+ * key
+ *
+ * @param values the values for the key
+ * @param op the operation to apply
+ * @return true if the operation changed the values
+ */
+bool apply_operation(std::vector<versioned<std::string>>& values,
+                     const write_batch<std::string,
+                                       std::string>::operation& op);
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_STORED_VALUES_H */
@@ -0,0 +1,186 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file timing_wheel.h
+ * @brief Interface definition file for timing_wheel
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_TIMING_WHEEL_H
+#define THRONG_TIMING_WHEEL_H
+
+#include <boost/intrusive/list.hpp>
+
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+namespace throng {
+namespace internal {
+
+/**
+ * A hierarchical timing wheel that schedules a very large number of
+ * deadlines with constant-time insert and cancel.  Deadlines are
+ * rounded up to a fixed tick resolution.  The wheel has several
+ * levels of 64 slots each; entries far in the future are placed in a
+ * coarse slot and cascaded into finer slots as time advances.
+ *
+ * Entries are intrusive: the object being scheduled derives from
+ * timing_wheel::entry, and is unscheduled automatically when it is
+ * destroyed.  The wheel is not thread-safe; callers must provide
+ * their own synchronization.
+ */
+class timing_wheel {
+public:
+    /**
+     * The clock used for deadlines
+     */
+    typedef std::chrono::steady_clock clock;
+
+    /**
+     * A deadline for an entry
+     */
+    typedef clock::time_point time_point;
+
+    /**
+     * A duration for the tick resolution
+     */
+    typedef clock::duration duration;
+
+    /**
+     * Base class for objects that can be scheduled in the wheel
+     */
+    class entry : public boost::intrusive::list_base_hook<
+        boost::intrusive::link_mode<boost::intrusive::auto_unlink>> {
+    public:
+        /**
+         * Check whether the entry is currently scheduled
+         *
+         * @return true if the entry is in a timing wheel
+         */
+        bool is_scheduled() const { return is_linked(); }
+
+        /**
+         * Remove the entry from the wheel if it is scheduled
+         */
+        void cancel() { unlink(); }
+
+        /**
+         * Get the deadline for the entry.  Only meaningful if the
+         * entry is scheduled or has just expired.
+         *
+         * @return the deadline
+         */
+        time_point get_deadline() const { return deadline; }
+
+    private:
+        friend class timing_wheel;
+        time_point deadline;
+    };
+
+    /**
+     * Create a new timing wheel
+     *
+     * @param resolution the duration of a single tick
+     * @param origin the time corresponding to the first tick
+     */
+    timing_wheel(duration resolution,
+                 time_point origin = clock::now());
+    timing_wheel(const timing_wheel&) = delete;
+    timing_wheel& operator=(const timing_wheel&) = delete;
+    ~timing_wheel();
+
+    /**
+     * Schedule the entry to expire at the given deadline.  If the
+     * entry is already scheduled it is moved.  Deadlines in the past
+     * will expire on the next call to advance.
+     *
+     * @param e the entry to schedule
+     * @param deadline the time at which the entry should expire
+     */
+    void schedule(entry& e, time_point deadline);
+
+    /**
+     * A callback for an expired entry.  The entry is no longer
+     * scheduled when the callback is invoked, and the callback may
+     * reschedule or destroy it.
+     */
+    typedef std::function<void(entry& e)> expire_fn;
+
+    /**
+     * Advance the wheel to the given time and expire all entries
+     * with a deadline at or before that time.
+     *
+     * @param now the time to advance to
+     * @param callback the callback for each expired entry
+     * @param limit the maximum number of entries to expire
+     * @return true if there are still expired entries remaining
+     * because the limit was reached
+     */
+    bool advance(time_point now, const expire_fn& callback,
+                 size_t limit = SIZE_MAX);
+
+    /**
+     * Get the time at which the wheel next needs to be advanced.
+     * This is the deadline of the earliest non-empty slot, or the
+     * time at which a coarser slot must be cascaded.
+     *
+     * @return the next time, or time_point::max() if the wheel is
+     * empty
+     */
+    time_point next_deadline();
+
+private:
+    typedef boost::intrusive::list<
+        entry, boost::intrusive::constant_time_size<false>> slot_list;
+
+    static const unsigned SLOT_BITS = 6;
+    static const unsigned SLOTS = 1 << SLOT_BITS;
+    static const unsigned LEVELS = 4;
+
+    duration resolution;
+    time_point origin;
+
+    /**
+     * The next tick to be processed.  All ticks before this one have
+     * been expired.
+     */
+    uint64_t current_tick = 0;
+
+    slot_list slots[LEVELS][SLOTS];
+
+    /**
+     * Bitmaps of possibly non-empty slots for each level.  Bits are
+     * cleared lazily since cancel does not know its slot.
+     */
+    uint64_t occupied[LEVELS] = {};
+
+    /**
+     * Entries beyond the range of the top level
+     */
+    slot_list overflow;
+
+    uint64_t to_tick(time_point t) const;
+    time_point to_time(uint64_t tick) const;
+    void insert(entry& e, uint64_t tick);
+    void cascade(slot_list& list);
+    uint64_t next_event_tick();
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_TIMING_WHEEL_H */
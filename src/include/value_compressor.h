@@ -0,0 +1,177 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file value_compressor.h
+ * @brief Interface definition file for value_compressor
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_VALUE_COMPRESSOR_H
+#define THRONG_VALUE_COMPRESSOR_H
+
+#include "throng/value_codec.h"
+
+#include <boost/filesystem/path.hpp>
+
+#include <mutex>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct z_stream_s;
+
+namespace throng {
+namespace internal {
+
+/**
+ * Build a compression dictionary from sample values.  The dictionary
+ * is made of the segments of the samples that cover the most
+ * substrings common to many samples, with the most valuable segments
+ * last, where zlib references them most cheaply.
+ *
+ * @param samples the sample values
+ * @param size the maximum size of the dictionary
+ * @return the dictionary
+ */
+std::string train_dictionary(const std::vector<std::string>& samples,
+                             size_t size);
+
+/**
+ * A value codec that compresses values with zlib using preset
+ * dictionaries.  Until a dictionary has been trained, values are
+ * compressed without one and copies of them are kept as training
+ * samples.  Once enough samples are collected, a dictionary is
+ * trained and used for all later values.  Dictionaries are
+ * identified by a hash of their content, and each compressed value
+ * records the one it was compressed with, so dictionaries are kept
+ * for as long as any value might use them.  A value read on a node
+ * that has a different dictionary cannot be mistaken for one that
+ * was compressed with it.
+ *
+ * An encoded value is a header of a two byte magic number, a method
+ * byte, the dictionary number and the size of the value as varints,
+ * and then the value itself, or the adler32 checksum of the value
+ * as four little-endian bytes followed by the raw deflate stream.
+ * Values that do not compress are kept unencoded unless they begin
+ * with the magic number.
+ */
+class value_compressor : public value_codec {
+public:
+    /**
+     * Create a compressor for a store
+     *
+     * @param store_name_ the name of the store, for errors and logs
+     * @param dir_ the directory in which to keep dictionaries, which
+     * are loaded when the compressor is created, or empty to keep
+     * them only in memory
+     * @param training_samples_ the number of values to sample before
+     * training a dictionary, or zero to never train one
+     * @param dictionary_size_ the maximum dictionary size
+     * @throws error::storage if the dictionaries cannot be loaded
+     */
+    value_compressor(std::string store_name_, boost::filesystem::path dir_,
+                     size_t training_samples_, size_t dictionary_size_);
+    virtual ~value_compressor();
+
+    /**
+     * Get the number of the dictionary used for new values
+     *
+     * @return the dictionary number, or zero if there is none
+     */
+    uint32_t get_dictionary_id();
+
+    /**
+     * Get the number that identifies a dictionary, which is derived
+     * from its content
+     *
+     * @param dictionary the dictionary
+     * @return the nonzero dictionary number
+     */
+    static uint32_t dictionary_id(const std::string& dictionary);
+
+    /**
+     * Add a dictionary and use it for new values, saving it if the
+     * compressor has a directory
+     *
+     * @param dictionary the dictionary
+     * @return the number of the dictionary
+     * @throws error::storage if the dictionary cannot be saved, or
+     * its number is taken by a different dictionary
+     */
+    uint32_t add_dictionary(std::string dictionary);
+
+    // ***********
+    // value_codec
+    // ***********
+
+    virtual std::shared_ptr<const std::string>
+    encode(const std::shared_ptr<const std::string>& value) override;
+    virtual std::shared_ptr<const std::string>
+    encode_nonblocking(const std::shared_ptr<const std::string>& value)
+        override;
+    virtual std::shared_ptr<const std::string>
+    decode(const std::shared_ptr<const std::string>& value) const override;
+
+private:
+    typedef std::shared_ptr<const std::string> dictionary_p;
+
+    std::string store_name;
+    boost::filesystem::path dir;
+    size_t training_samples;
+    size_t dictionary_size;
+
+    /**
+     * Serializes adding dictionaries, whose files are written without
+     * holding dict_mutex
+     */
+    std::mutex save_mutex;
+
+    /**
+     * Protects the dictionaries and the training samples
+     */
+    mutable std::mutex dict_mutex;
+    std::map<uint32_t, dictionary_p> dictionaries;
+    uint32_t current_id = 0;
+    uint32_t next_seq = 1;
+    std::vector<std::string> samples;
+    bool training_done = false;
+
+    /**
+     * Idle zlib streams, reused to avoid allocating their state for
+     * every value
+     */
+    mutable std::mutex stream_mutex;
+    mutable std::vector<z_stream_s*> deflaters;
+    mutable std::vector<z_stream_s*> inflaters;
+
+    void load_dictionaries();
+    void write_file(const boost::filesystem::path& file,
+                    const std::string& data);
+    std::vector<std::string> sample(const std::string& value);
+    std::shared_ptr<const std::string>
+    encode(const std::shared_ptr<const std::string>& value,
+           bool sample_value);
+    void train(const std::vector<std::string>& training);
+    z_stream_s* get_stream(bool deflate) const;
+    void release_stream(z_stream_s* s, bool deflate) const;
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_VALUE_COMPRESSOR_H */
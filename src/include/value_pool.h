@@ -0,0 +1,171 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file value_pool.h
+ * @brief Interface definition file for value_pool
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_VALUE_POOL_H
+#define THRONG_VALUE_POOL_H
+
+#include <boost/intrusive/unordered_set.hpp>
+
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace throng {
+namespace internal {
+
+/**
+ * A table of values interned by their content, so that items with
+ * byte-identical values share a single copy.  Each entry counts the
+ * references to it and is removed when the last one is released.
+ * Values shorter than the minimum size are not worth the cost of an
+ * entry and are not interned.
+ *
+ * The pool is not thread-safe; callers must provide their own
+ * synchronization.  The values themselves are immutable and can be
+ * used after their entries are released.
+ */
+class value_pool {
+public:
+    /**
+     * An interned value
+     */
+    class entry : public boost::intrusive::unordered_set_base_hook<> {
+    public:
+        /**
+         * Get the value
+         *
+         * @return the value
+         */
+        const std::shared_ptr<const std::string>& get_value() const {
+            return value;
+        }
+
+        /**
+         * Get the number of references to the entry
+         *
+         * @return the reference count
+         */
+        size_t get_refs() const { return refs; }
+
+    private:
+        friend class value_pool;
+
+        entry(std::shared_ptr<const std::string> value_, uint64_t hash_)
+            : value(std::move(value_)), hash(hash_) { }
+
+        std::shared_ptr<const std::string> value;
+        uint64_t hash;
+        size_t refs = 0;
+    };
+
+    /**
+     * Create an empty pool
+     *
+     * @param min_size_ the size below which values are not interned
+     */
+    explicit value_pool(size_t min_size_ = 64);
+    value_pool(const value_pool&) = delete;
+    value_pool& operator=(const value_pool&) = delete;
+    ~value_pool();
+
+    /**
+     * Check whether a value is large enough to be interned
+     *
+     * @param value the value
+     * @return true if acquire would intern the value
+     */
+    bool is_shareable(const std::string& value) const {
+        return value.size() >= min_size;
+    }
+
+    /**
+     * Get the number of bytes of memory that interning a value would
+     * add to the pool
+     *
+     * @param value the value, which must be shareable
+     * @return zero if the value is already interned, or the size of a
+     * new entry for it
+     */
+    size_t get_added_size(const std::string& value) const;
+
+    /**
+     * Find the entry for a value, adding one if there is none, and
+     * add a reference to it
+     *
+     * @param value the value, which must be shareable.  A new entry
+     * keeps this pointer rather than copying the value.
+     * @return the entry
+     */
+    entry* acquire(const std::shared_ptr<const std::string>& value);
+
+    /**
+     * Release a reference to an entry, removing the entry if it was
+     * the last
+     *
+     * @param e the entry
+     */
+    void release(entry* e);
+
+    /**
+     * Get the number of entries in the pool
+     */
+    size_t size() const { return index.size(); }
+
+    /**
+     * Get the number of bytes of memory used by the pool, including
+     * the values
+     */
+    size_t get_memory_usage() const { return memory_usage; }
+
+private:
+    struct entry_hash {
+        size_t operator()(const entry& e) const { return e.hash; }
+    };
+
+    struct entry_equal {
+        bool operator()(const entry& a, const entry& b) const {
+            return a.hash == b.hash && *a.value == *b.value;
+        }
+    };
+
+    typedef boost::intrusive::unordered_set<
+        entry,
+        boost::intrusive::hash<entry_hash>,
+        boost::intrusive::equal<entry_equal>,
+        boost::intrusive::power_2_buckets<true>
+        > index_t;
+
+    size_t min_size;
+    std::unique_ptr<index_t::bucket_type[]> buckets;
+    size_t bucket_count;
+    index_t index;
+    size_t memory_usage;
+
+    const entry* find(const std::string& value, uint64_t hash) const;
+    static size_t entry_size(const std::string& value);
+    void rehash(size_t new_count);
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_VALUE_POOL_H */
@@ -0,0 +1,232 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file write_behind.h
+ * @brief Interface definition file for write_behind
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_WRITE_BEHIND_H
+#define THRONG_WRITE_BEHIND_H
+
+#include "throng/store.h"
+#include "throng/store_config.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <vector>
+#include <string>
+#include <chrono>
+
+namespace throng {
+namespace internal {
+
+/**
+ * Queues writes for a delegate store and commits them in groups, so
+ * that writers do not wait for the storage engine.  Depending on the
+ * durability mode, groups are committed by a dedicated background
+ * thread or by the writers themselves, with one writer committing
+ * the writes queued by all others that are waiting.  Each group is
+ * committed to the delegate as a single write batch.
+ *
+ * A group that the delegate fails to write is retried before any
+ * later writes.  Once it has failed the same way COMMIT_ATTEMPTS
+ * times, its writes are committed one at a time and those the
+ * delegate rejects are discarded, so that the rest are not held up
+ * behind them.  The writes of an atomic group are all discarded.
+ *
+ * Once the queued writes reach the size limit, writers commit the
+ * queue themselves before queuing more.
+ */
+class write_behind {
+public:
+    /**
+     * Create a new write-behind queue
+     *
+     * @param delegate the store to commit writes to
+     * @param mode the durability mode
+     * @param commit_interval the maximum delay for a write in
+     * durability_mode::BATCHED
+     * @param queue_limit the number of bytes of queued writes past
+     * which writers must wait for a commit, or zero for no limit
+     */
+    write_behind(store<std::string, std::string>& delegate,
+                 durability_mode mode,
+                 std::chrono::milliseconds commit_interval,
+                 size_t queue_limit = 0);
+    write_behind(const write_behind&) = delete;
+    write_behind& operator=(const write_behind&) = delete;
+
+    /**
+     * Commit any remaining writes and destroy the queue
+     */
+    ~write_behind();
+
+    /**
+     * Queue a write for the delegate.  Unless the durability mode is
+     * durability_mode::SYNC, the write will be committed in the
+     * background.
+     *
+     * @param key the key to write
+     * @param value the value to write
+     * @return a sequence number for the write to pass to sync
+     */
+    uint64_t enqueue(const std::string& key,
+                     const versioned<std::string>& value);
+
+    /**
+     * Queue all of the writes in a batch for the delegate.  The
+     * writes are committed in the same group.
+     *
+     * @param batch the writes to queue
+     * @return a sequence number for the last write to pass to sync
+     */
+    uint64_t enqueue(const write_batch<std::string, std::string>& batch);
+
+    /**
+     * If the queue has reached its size limit, commit it in the
+     * calling thread.  Call before queuing writes, without holding
+     * locks that a commit might wait for.
+     *
+     * @throws error::storage if the queue is full and cannot be
+     * committed
+     */
+    void wait_for_space();
+
+    /**
+     * Wait until the writes with the given sequence numbers have
+     * been committed, committing them and any other queued writes in
+     * the calling thread if needed
+     *
+     * @param seq the sequence number returned by enqueue
+     * @param count the number of writes queued with seq, for a batch
+     * @throws error::storage if the delegate could not write the
+     * group containing the writes, or discarded one of them
+     */
+    void sync(uint64_t seq, size_t count = 1);
+
+    /**
+     * Commit all queued writes in the calling thread
+     *
+     * @return true if the writes were committed, or false if the
+     * delegate failed and they remain queued
+     */
+    bool flush();
+
+    /**
+     * Get the sequence number of the last write committed to the
+     * delegate
+     *
+     * @return the sequence number, as returned by enqueue
+     */
+    uint64_t get_committed() const { return committed; }
+
+    /**
+     * Get the number of bytes held by writes that are queued or
+     * being committed
+     */
+    size_t get_memory_usage() const { return pending_bytes; }
+
+    /**
+     * Get the approximate number of bytes held by a queued write
+     *
+     * @param key the key to write
+     * @param value the value to write
+     * @return the number of bytes
+     */
+    static size_t get_write_size(const std::string& key,
+                                 const versioned<std::string>& value);
+
+    /**
+     * The number of times a group fails the same way before its
+     * writes are committed one at a time
+     */
+    static const unsigned COMMIT_ATTEMPTS = 3;
+
+private:
+    typedef write_batch<std::string, std::string> batch_t;
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    store<std::string, std::string>& delegate;
+    durability_mode mode;
+    std::chrono::milliseconds commit_interval;
+    size_t queue_limit;
+
+    /**
+     * Protects the queue, the enqueued sequence number and the state
+     * for waking the commit thread
+     */
+    std::mutex queue_mutex;
+    std::condition_variable queue_cond;
+    batch_t queue;
+    uint64_t enqueued = 0;
+    size_t queue_bytes = 0;
+    time_point commit_at;
+    time_point retry_at;
+    bool retry_pending = false;
+    bool stopping = false;
+
+    /**
+     * Bytes held by queued writes and by groups not yet committed
+     */
+    std::atomic<size_t> pending_bytes { 0 };
+
+    /**
+     * Held while committing a group of writes
+     */
+    std::mutex commit_mutex;
+    std::atomic<uint64_t> committed { 0 };
+
+    /**
+     * A group that failed, to commit before any later writes, with
+     * the sequence number of its last write and its size.  Protected
+     * by commit_mutex.
+     */
+    batch_t retry;
+    uint64_t retry_through = 0;
+    size_t retry_bytes = 0;
+    unsigned retry_attempts = 0;
+
+    /**
+     * The error from the last failed commit.  Protected by
+     * commit_mutex.
+     */
+    std::string last_error;
+
+    /**
+     * For durability_mode::SYNC, the errors for discarded writes by
+     * sequence number, until the writers that queued them sync.
+     * Protected by commit_mutex.
+     */
+    std::map<uint64_t, std::string> failed_writes;
+
+    std::thread commit_thread;
+
+    void run_commits();
+    void schedule();
+    void schedule_retry();
+    bool commit();
+    bool write_group(const batch_t& group);
+    void fail_writes(const batch_t& group, uint64_t through);
+};
+
+} /* namespace internal */
+} /* namespace throng */
+
+#endif /* THRONG_WRITE_BEHIND_H */
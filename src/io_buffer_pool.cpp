@@ -0,0 +1,132 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for io_buffer_pool class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "io_buffer_pool.h"
+
+namespace throng {
+namespace internal {
+
+const size_t io_buffer_pool::MIN_BUFFER_SIZE;
+
+// Get the size class for a capacity, which is its base 2 logarithm
+// above the minimum, rounded up
+static size_t size_class(size_t size) {
+    size_t c = 0;
+    for (size_t cap = io_buffer_pool::MIN_BUFFER_SIZE; cap < size; cap <<= 1)
+        c += 1;
+    return c;
+}
+
+io_buffer_pool::buffer::buffer(buffer&& other)
+    : pool(std::move(other.pool)), block(other.block),
+      len(other.len), cap(other.cap) {
+    other.block = nullptr;
+    other.len = other.cap = 0;
+}
+
+io_buffer_pool::buffer&
+io_buffer_pool::buffer::operator=(buffer&& other) {
+    if (this != &other) {
+        reset();
+        pool = std::move(other.pool);
+        block = other.block;
+        len = other.len;
+        cap = other.cap;
+        other.block = nullptr;
+        other.len = other.cap = 0;
+    }
+    return *this;
+}
+
+void io_buffer_pool::buffer::reset() {
+    if (!block) return;
+    pool->release(block, cap);
+    pool.reset();
+    block = nullptr;
+    len = cap = 0;
+}
+
+io_buffer_pool::io_buffer_pool(size_t max_buffer_size_,
+                               size_t max_cached_bytes_)
+    : max_class(size_class(max_buffer_size_)),
+      max_cached_bytes(max_cached_bytes_),
+      free_lists(max_class + 1), counters() {
+}
+
+io_buffer_pool::~io_buffer_pool() {
+    for (auto& l : free_lists) {
+        for (uint8_t* b : l)
+            delete[] b;
+    }
+}
+
+io_buffer_pool::buffer io_buffer_pool::acquire(size_t size) {
+    size_t c = size_class(size);
+    buffer result;
+    result.len = size;
+    result.cap = c <= max_class ? MIN_BUFFER_SIZE << c : size;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (c <= max_class && !free_lists[c].empty()) {
+            result.block = free_lists[c].back();
+            free_lists[c].pop_back();
+            counters.reuses += 1;
+            counters.cached -= 1;
+            counters.cached_bytes -= result.cap;
+        } else {
+            counters.allocations += 1;
+        }
+        counters.outstanding += 1;
+        counters.outstanding_bytes += result.cap;
+    }
+    if (!result.block)
+        result.block = new uint8_t[result.cap];
+    result.pool = shared_from_this();
+    return result;
+}
+
+void io_buffer_pool::release(uint8_t* block, size_t cap) {
+    size_t c = size_class(cap);
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        counters.outstanding -= 1;
+        counters.outstanding_bytes -= cap;
+        if (c <= max_class &&
+            counters.cached_bytes + cap <= max_cached_bytes) {
+            free_lists[c].push_back(block);
+            counters.cached += 1;
+            counters.cached_bytes += cap;
+            return;
+        }
+        counters.discards += 1;
+    }
+    delete[] block;
+}
+
+io_buffer_pool::stats io_buffer_pool::get_stats() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return counters;
+}
+
+} /* namespace internal */
+} /* namespace throng */
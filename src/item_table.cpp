@@ -0,0 +1,551 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for item_table class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "item_table.h"
+
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+
+namespace throng {
+namespace internal {
+
+using std::vector;
+using std::string;
+using std::make_shared;
+
+static const size_t INITIAL_BUCKETS = 64;
+
+// *************
+// value codec
+// *************
+
+/*
+ * Values are encoded back-to-back after the key.  Each value is:
+ *
+ *   varint   0 for a tombstone, 1 for an interned value, otherwise
+ *            the value length plus two
+ *   bytes    the value, or for an interned value the address of its
+ *            value_pool entry
+ *   varint   zigzag-encoded clock timestamp
+ *   varint   number of clock entries
+ *   entries  for each: varint node ID length, varint for each node
+ *            ID component, varint version
+ */
+
+static size_t varint_size(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n += 1;
+    }
+    return n;
+}
+
+static char* write_varint(char* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (char)v;
+    return p;
+}
+
+static uint64_t read_varint(const char*& p) {
+    uint64_t v = 0;
+    unsigned shift = 0;
+    uint8_t b;
+    do {
+        b = (uint8_t)*p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static const uint64_t TOMBSTONE = 0;
+static const uint64_t POOLED = 1;
+static const uint64_t INLINE = 2;
+
+static size_t encoded_size(const versioned<string>& v, bool pooled) {
+    size_t size;
+    if (pooled) {
+        size = varint_size(POOLED) + sizeof(value_pool::entry*);
+    } else {
+        size_t len = v ? v.get().size() : 0;
+        size = varint_size(v ? len + INLINE : TOMBSTONE) + len;
+    }
+
+    const vector_clock& clock = v.get_version();
+    size += varint_size(zigzag(clock.get_timestamp()
+                               .time_since_epoch().count()));
+    size += varint_size(clock.get_entries().size());
+    for (auto& e : clock.get_entries()) {
+        size += varint_size(e.first.size());
+        for (uint32_t c : e.first)
+            size += varint_size(c);
+        size += varint_size(e.second);
+    }
+    return size;
+}
+
+static char* encode(char* p, const versioned<string>& v,
+                    value_pool::entry* e) {
+    if (e) {
+        p = write_varint(p, POOLED);
+        std::memcpy(p, &e, sizeof(e));
+        p += sizeof(e);
+    } else if (v) {
+        const string& s = v.get();
+        p = write_varint(p, s.size() + INLINE);
+        std::memcpy(p, s.data(), s.size());
+        p += s.size();
+    } else {
+        p = write_varint(p, TOMBSTONE);
+    }
+
+    const vector_clock& clock = v.get_version();
+    p = write_varint(p, zigzag(clock.get_timestamp()
+                               .time_since_epoch().count()));
+    p = write_varint(p, clock.get_entries().size());
+    for (auto& e : clock.get_entries()) {
+        p = write_varint(p, e.first.size());
+        for (uint32_t c : e.first)
+            p = write_varint(p, c);
+        p = write_varint(p, e.second);
+    }
+    return p;
+}
+
+// Read the value field of an encoded value, advancing past it
+static std::shared_ptr<const string> read_value(const char*& p) {
+    uint64_t len = read_varint(p);
+    if (len == TOMBSTONE) return nullptr;
+    if (len == POOLED) {
+        value_pool::entry* e;
+        std::memcpy(&e, p, sizeof(e));
+        p += sizeof(e);
+        return e->get_value();
+    }
+    auto value = make_shared<const string>(p, len - INLINE);
+    p += len - INLINE;
+    return value;
+}
+
+// Advance past the value field of an encoded value, returning its
+// value_pool entry if it is interned
+static value_pool::entry* skip_value(const char*& p) {
+    uint64_t len = read_varint(p);
+    if (len == POOLED) {
+        value_pool::entry* e;
+        std::memcpy(&e, p, sizeof(e));
+        p += sizeof(e);
+        return e;
+    }
+    if (len >= INLINE) p += len - INLINE;
+    return nullptr;
+}
+
+// Skip past the clock of an encoded value
+static void skip_clock(const char*& p) {
+    read_varint(p);
+    for (uint64_t n = read_varint(p); n > 0; n--) {
+        for (uint64_t l = read_varint(p); l > 0; l--)
+            read_varint(p);
+        read_varint(p);
+    }
+}
+
+/*
+ * Compare an encoded node ID to the given node ID, advancing past the
+ * encoded ID.  Node IDs order lexicographically.
+ */
+static int compare_node_id(const char*& p, const node_id& id) {
+    size_t len = read_varint(p);
+    int c = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t v = (uint32_t)read_varint(p);
+        if (c != 0) continue;
+        if (i >= id.size())
+            c = 1;
+        else if (v != id[i])
+            c = v < id[i] ? -1 : 1;
+    }
+    if (c == 0 && len < id.size())
+        c = -1;
+    return c;
+}
+
+vector<versioned<string>> item_table::record::get_values() const {
+    vector<versioned<string>> result;
+    result.reserve(value_count);
+
+    const char* p = value_data();
+    for (uint16_t i = 0; i < value_count; i++) {
+        std::shared_ptr<const string> value = read_value(p);
+
+        vector_clock::time_point timestamp
+            { vector_clock::time_point::duration(unzigzag(read_varint(p))) };
+        vector<vector_clock::clock_entry> entries(read_varint(p));
+        for (auto& e : entries) {
+            e.first.resize(read_varint(p));
+            for (auto& c : e.first)
+                c = (uint32_t)read_varint(p);
+            e.second = read_varint(p);
+        }
+
+        result.emplace_back(std::move(value),
+                            vector_clock(timestamp, std::move(entries)));
+    }
+    return result;
+}
+
+vector_clock::occurred
+item_table::record::compare_version(size_t i,
+                                    const vector_clock& clock) const {
+    const char* p = value_data();
+    for (size_t j = 0; j < i; j++) {
+        skip_value(p);
+        skip_clock(p);
+    }
+    skip_value(p);
+    read_varint(p);
+
+    // Same as vector_clock::compare, with the stored clock as the
+    // second clock
+    const vector<vector_clock::clock_entry>& entries = clock.get_entries();
+    bool c1bigger = false;
+    bool c2bigger = false;
+    size_t n = read_varint(p);
+    size_t p1 = 0;
+    size_t p2 = 0;
+    while (p1 < entries.size() && p2 < n) {
+        const char* start = p;
+        int c = compare_node_id(p, entries[p1].first);
+        uint64_t version = read_varint(p);
+        if (c == 0) {
+            if (entries[p1].second > version)
+                c1bigger = true;
+            else if (entries[p1].second < version)
+                c2bigger = true;
+            p1 += 1;
+            p2 += 1;
+        } else if (c < 0) {
+            c2bigger = true;
+            p2 += 1;
+        } else {
+            c1bigger = true;
+            p1 += 1;
+            p = start;
+        }
+    }
+
+    if (p1 < entries.size())
+        c1bigger = true;
+    else if (p2 < n)
+        c2bigger = true;
+
+    if (!c1bigger && !c2bigger)
+        return vector_clock::occurred::EQUAL;
+    else if (!c1bigger && c2bigger)
+        return vector_clock::occurred::BEFORE;
+    else if (c1bigger && !c2bigger)
+        return vector_clock::occurred::AFTER;
+    return vector_clock::occurred::CONCURRENT;
+}
+
+// **********
+// item_table
+// **********
+
+namespace {
+
+struct key_ref {
+    const string& key;
+    uint64_t hash;
+};
+
+struct key_ref_hash {
+    size_t operator()(const key_ref& k) const { return k.hash; }
+};
+
+struct key_ref_equal {
+    bool operator()(const key_ref& k, const item_table::record& r) const {
+        return k.hash == r.get_key_hash() && r.key_equals(k.key);
+    }
+};
+
+}
+
+item_table::item_table(key_index_type index_type, bool dedup)
+    : buckets(new index_t::bucket_type[INITIAL_BUCKETS]),
+      bucket_count(INITIAL_BUCKETS),
+      index(index_t::bucket_traits(buckets.get(), bucket_count)) {
+    if (index_type == key_index_type::RADIX_TREE)
+        tree.reset(new radix_tree(allocator, record_key));
+    if (dedup)
+        pool.reset(new value_pool());
+}
+
+item_table::~item_table() {
+    if (tree) {
+        vector<record*> records;
+        records.reserve(tree->size());
+        tree->for_each([&records](void* r) {
+                records.push_back(static_cast<record*>(r));
+            });
+        tree.reset();
+        for (record* r : records) free(r);
+    } else {
+        index.clear_and_dispose([this](record* r) { free(r); });
+    }
+}
+
+radix_tree::key_ref item_table::record_key(const void* p) {
+    const record* r = static_cast<const record*>(p);
+    return radix_tree::key_ref { r->key_data(), r->key_len };
+}
+
+item_table::record* item_table::allocate(uint64_t hash, const char* key,
+                                         uint32_t key_len, size_t data_len) {
+    size_t size = sizeof(record) + key_len + data_len;
+    size_t capacity = slab_allocator::block_size(size);
+    if (capacity > std::numeric_limits<uint32_t>::max())
+        throw std::bad_alloc();
+
+    void* block = allocator.allocate(capacity);
+    record* r = new (block) record(hash, key_len, (uint32_t)capacity);
+    std::memcpy(r->key_data(), key, key_len);
+    return r;
+}
+
+void item_table::free(record* r) {
+    size_t capacity = r->capacity;
+    r->~record();
+    allocator.deallocate(r, capacity);
+}
+
+void item_table::reserve(size_t count) {
+    if (tree || count <= bucket_count) return;
+    size_t new_count = bucket_count;
+    while (new_count < count)
+        new_count *= 2;
+    rehash(new_count);
+}
+
+void item_table::rehash(size_t new_count) {
+    std::unique_ptr<index_t::bucket_type[]>
+        new_buckets(new index_t::bucket_type[new_count]);
+    index.rehash(index_t::bucket_traits(new_buckets.get(), new_count));
+    buckets.swap(new_buckets);
+    bucket_count = new_count;
+}
+
+size_t item_table::get_memory_usage() const {
+    return allocator.get_used_bytes() +
+        bucket_count * sizeof(index_t::bucket_type) +
+        (pool ? pool->get_memory_usage() : 0);
+}
+
+bool item_table::is_pooled(const versioned_t& v) const {
+    return pool && v && pool->is_shareable(v.get());
+}
+
+size_t item_table::get_value_size(const versioned_t& v,
+                                  size_t& pooled) const {
+    if (!is_pooled(v))
+        return encoded_size(v, false);
+    pooled += pool->get_added_size(v.get());
+    return encoded_size(v, true);
+}
+
+size_t item_table::get_record_size(const string& key,
+                                   const vector<versioned_t>& values) const {
+    size_t size = sizeof(record) + key.size();
+    size_t pooled = 0;
+    for (auto& v : values)
+        size += get_value_size(v, pooled);
+    return slab_allocator::block_size(size) + pooled;
+}
+
+value_pool::entry* item_table::acquire(const versioned_t& v) {
+    return is_pooled(v) ? pool->acquire(v.get_ptr()) : nullptr;
+}
+
+void item_table::get_entries(const record* r,
+                             vector<value_pool::entry*>& entries) const {
+    if (!pool) return;
+    const char* p = r->value_data();
+    for (uint16_t i = 0; i < r->value_count; i++) {
+        value_pool::entry* e = skip_value(p);
+        if (e) entries.push_back(e);
+        skip_clock(p);
+    }
+}
+
+void item_table::release(const vector<value_pool::entry*>& entries) {
+    for (value_pool::entry* e : entries)
+        if (e) pool->release(e);
+}
+
+item_table::record* item_table::find(const string& key, uint64_t hash) {
+    if (tree)
+        return static_cast<record*>(tree->find(key.data(), key.size()));
+    auto it = index.find(key_ref{key, hash}, key_ref_hash(), key_ref_equal());
+    if (it == index.end()) return nullptr;
+    return &*it;
+}
+
+item_table::record* item_table::insert(const string& key, uint64_t hash) {
+    if (key.size() > std::numeric_limits<uint32_t>::max())
+        throw std::bad_alloc();
+    record* r = allocate(hash, key.data(), (uint32_t)key.size(), 0);
+    if (tree) {
+        tree->insert(r);
+        return r;
+    }
+    index.insert(*r);
+    if (index.size() > bucket_count)
+        rehash(bucket_count * 2);
+    return r;
+}
+
+size_t item_table::get_record_size(const string& key,
+                                   const versioned_t& value) const {
+    size_t pooled = 0;
+    size_t size = sizeof(record) + key.size() +
+        get_value_size(value, pooled);
+    return slab_allocator::block_size(size) + pooled;
+}
+
+item_table::record* item_table::resize(record* r, size_t data_len) {
+    size_t size = sizeof(record) + r->key_len + data_len;
+
+    if (slab_allocator::block_size(size) != r->capacity) {
+        record* nr = allocate(r->key_hash, r->key_data(), r->key_len,
+                              data_len);
+        nr->last_update = r->last_update;
+        nr->last_refresh = r->last_refresh;
+        nr->local = r->local;
+
+        if (tree) {
+            tree->replace(r, nr);
+        } else {
+            index.erase(index.iterator_to(*r));
+            index.insert(*nr);
+        }
+        free(r);
+        r = nr;
+    }
+    return r;
+}
+
+item_table::record*
+item_table::set_values(record* r, const vector<versioned_t>& values) {
+    if (values.size() > std::numeric_limits<uint16_t>::max())
+        throw std::length_error("Too many values for item");
+
+    // Take the new references before releasing the old ones, so that
+    // an unchanged value keeps its entry
+    vector<value_pool::entry*> entries, old;
+    size_t data_len = 0;
+    if (pool) {
+        entries.reserve(values.size());
+        try {
+            for (auto& v : values)
+                entries.push_back(acquire(v));
+        } catch (...) {
+            release(entries);
+            throw;
+        }
+        get_entries(r, old);
+    }
+    for (size_t i = 0; i < values.size(); i++)
+        data_len += encoded_size(values[i], pool && entries[i]);
+    try {
+        r = resize(r, data_len);
+    } catch (...) {
+        if (pool) release(entries);
+        throw;
+    }
+
+    char* p = r->value_data();
+    for (size_t i = 0; i < values.size(); i++)
+        p = encode(p, values[i], pool ? entries[i] : nullptr);
+    if (pool) release(old);
+    r->data_len = (uint32_t)data_len;
+    r->value_count = (uint16_t)values.size();
+    r->has_live_value = false;
+    for (auto& v : values) {
+        if (v) {
+            r->has_live_value = true;
+            break;
+        }
+    }
+    return r;
+}
+
+item_table::record* item_table::set_value(record* r, const versioned_t& value) {
+    vector<value_pool::entry*> old;
+    value_pool::entry* e = acquire(value);
+    get_entries(r, old);
+    size_t data_len = encoded_size(value, e != nullptr);
+    try {
+        r = resize(r, data_len);
+    } catch (...) {
+        if (e) pool->release(e);
+        throw;
+    }
+
+    encode(r->value_data(), value, e);
+    release(old);
+    r->data_len = (uint32_t)data_len;
+    r->value_count = 1;
+    r->has_live_value = (bool)value;
+    return r;
+}
+
+void item_table::erase(record* r) {
+    if (pool) {
+        vector<value_pool::entry*> entries;
+        get_entries(r, entries);
+        release(entries);
+    }
+    if (tree)
+        tree->erase(r->key_data(), r->key_len);
+    else
+        index.erase(index.iterator_to(*r));
+    free(r);
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -0,0 +1,327 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for key hash functions.  These are portable scalar
+ * implementations of the xxHash algorithms, following the xxHash
+ * specification by Yann Collet.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "key_hash.h"
+
+#include <cstring>
+
+namespace throng {
+namespace internal {
+
+static const uint64_t PRIME32_1 = 0x9E3779B1U;
+static const uint64_t PRIME32_2 = 0x85EBCA77U;
+static const uint64_t PRIME32_3 = 0xC2B2AE3DU;
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+static const uint64_t PRIME_MX1 = 0x165667919E3779F9ULL;
+static const uint64_t PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+static const size_t SECRET_SIZE = 192;
+static const uint8_t SECRET[SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe,
+    0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78,
+    0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e,
+    0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e,
+    0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f,
+    0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3,
+    0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49,
+    0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28,
+    0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t rotl64(uint64_t x, unsigned r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t mul128_fold64(uint64_t lhs, uint64_t rhs) {
+    unsigned __int128 product = (unsigned __int128)lhs * rhs;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t xxh64_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// ****
+// XXH3
+// ****
+
+static inline uint64_t xxh3_avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len) {
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= PRIME_MX2;
+    return h ^ (h >> 28);
+}
+
+static inline uint64_t xxh3_mix16(const uint8_t* in, const uint8_t* secret) {
+    return mul128_fold64(read64(in) ^ read64(secret),
+                         read64(in + 8) ^ read64(secret + 8));
+}
+
+static uint64_t xxh3_len_0to16(const uint8_t* in, size_t len) {
+    if (len > 8) {
+        uint64_t bitflip1 = read64(SECRET + 24) ^ read64(SECRET + 32);
+        uint64_t bitflip2 = read64(SECRET + 40) ^ read64(SECRET + 48);
+        uint64_t lo = read64(in) ^ bitflip1;
+        uint64_t hi = read64(in + len - 8) ^ bitflip2;
+        uint64_t acc = len + __builtin_bswap64(lo) + hi +
+            mul128_fold64(lo, hi);
+        return xxh3_avalanche(acc);
+    }
+    if (len >= 4) {
+        uint64_t in1 = read32(in);
+        uint64_t in2 = read32(in + len - 4);
+        uint64_t bitflip = read64(SECRET + 8) ^ read64(SECRET + 16);
+        uint64_t keyed = (in2 + (in1 << 32)) ^ bitflip;
+        return xxh3_rrmxmx(keyed, len);
+    }
+    if (len > 0) {
+        uint32_t combined = ((uint32_t)in[0] << 16) |
+            ((uint32_t)in[len >> 1] << 24) |
+            (uint32_t)in[len - 1] |
+            ((uint32_t)len << 8);
+        uint64_t bitflip = read32(SECRET) ^ read32(SECRET + 4);
+        return xxh64_avalanche((uint64_t)combined ^ bitflip);
+    }
+    return xxh64_avalanche(read64(SECRET + 56) ^ read64(SECRET + 64));
+}
+
+static uint64_t xxh3_len_17to128(const uint8_t* in, size_t len) {
+    uint64_t acc = len * PRIME64_1;
+    if (len > 32) {
+        if (len > 64) {
+            if (len > 96) {
+                acc += xxh3_mix16(in + 48, SECRET + 96);
+                acc += xxh3_mix16(in + len - 64, SECRET + 112);
+            }
+            acc += xxh3_mix16(in + 32, SECRET + 64);
+            acc += xxh3_mix16(in + len - 48, SECRET + 80);
+        }
+        acc += xxh3_mix16(in + 16, SECRET + 32);
+        acc += xxh3_mix16(in + len - 32, SECRET + 48);
+    }
+    acc += xxh3_mix16(in, SECRET);
+    acc += xxh3_mix16(in + len - 16, SECRET + 16);
+    return xxh3_avalanche(acc);
+}
+
+static uint64_t xxh3_len_129to240(const uint8_t* in, size_t len) {
+    static const size_t START_OFFSET = 3;
+    static const size_t LAST_OFFSET = 17;
+    static const size_t SECRET_SIZE_MIN = 136;
+
+    uint64_t acc = len * PRIME64_1;
+    size_t rounds = len / 16;
+    for (size_t i = 0; i < 8; i++)
+        acc += xxh3_mix16(in + 16 * i, SECRET + 16 * i);
+    acc = xxh3_avalanche(acc);
+    for (size_t i = 8; i < rounds; i++)
+        acc += xxh3_mix16(in + 16 * i, SECRET + 16 * (i - 8) + START_OFFSET);
+    acc += xxh3_mix16(in + len - 16, SECRET + SECRET_SIZE_MIN - LAST_OFFSET);
+    return xxh3_avalanche(acc);
+}
+
+static const size_t STRIPE_LEN = 64;
+static const size_t SECRET_CONSUME_RATE = 8;
+
+static inline void xxh3_accumulate_512(uint64_t* acc, const uint8_t* in,
+                                       const uint8_t* secret) {
+    for (size_t i = 0; i < 8; i++) {
+        uint64_t data_val = read64(in + 8 * i);
+        uint64_t data_key = data_val ^ read64(secret + 8 * i);
+        acc[i ^ 1] += data_val;
+        acc[i] += (data_key & 0xFFFFFFFFULL) * (data_key >> 32);
+    }
+}
+
+static inline void xxh3_scramble(uint64_t* acc, const uint8_t* secret) {
+    for (size_t i = 0; i < 8; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= read64(secret + 8 * i);
+        a *= PRIME32_1;
+        acc[i] = a;
+    }
+}
+
+static uint64_t xxh3_long(const uint8_t* in, size_t len) {
+    uint64_t acc[8] = { PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+                        PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1 };
+    size_t stripes_per_block = (SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE;
+    size_t block_len = STRIPE_LEN * stripes_per_block;
+    size_t blocks = (len - 1) / block_len;
+
+    for (size_t n = 0; n < blocks; n++) {
+        for (size_t s = 0; s < stripes_per_block; s++)
+            xxh3_accumulate_512(acc, in + n * block_len + s * STRIPE_LEN,
+                                SECRET + s * SECRET_CONSUME_RATE);
+        xxh3_scramble(acc, SECRET + SECRET_SIZE - STRIPE_LEN);
+    }
+
+    size_t stripes = ((len - 1) - block_len * blocks) / STRIPE_LEN;
+    for (size_t s = 0; s < stripes; s++)
+        xxh3_accumulate_512(acc, in + blocks * block_len + s * STRIPE_LEN,
+                            SECRET + s * SECRET_CONSUME_RATE);
+    xxh3_accumulate_512(acc, in + len - STRIPE_LEN,
+                        SECRET + SECRET_SIZE - STRIPE_LEN - 7);
+
+    uint64_t result = len * PRIME64_1;
+    for (size_t i = 0; i < 4; i++)
+        result += mul128_fold64(acc[2 * i] ^ read64(SECRET + 11 + 16 * i),
+                                acc[2 * i + 1] ^ read64(SECRET + 19 + 16 * i));
+    return xxh3_avalanche(result);
+}
+
+uint64_t xxh3_64(const void* data, size_t len) {
+    const uint8_t* in = static_cast<const uint8_t*>(data);
+    if (len <= 16) return xxh3_len_0to16(in, len);
+    if (len <= 128) return xxh3_len_17to128(in, len);
+    if (len <= 240) return xxh3_len_129to240(in, len);
+    return xxh3_long(in, len);
+}
+
+// *****
+// XXH64
+// *****
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t xxh64(const void* data, size_t len, uint64_t seed) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        do {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge_round(h, v1);
+        h = xxh64_merge_round(h, v2);
+        h = xxh64_merge_round(h, v3);
+        h = xxh64_merge_round(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+
+    h += len;
+
+    while (end - p >= 8) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p += 1;
+    }
+    return xxh64_avalanche(h);
+}
+
+uint64_t hash_key(key_hash_type type, const std::string& key) {
+    switch (type) {
+    case key_hash_type::XXH64:
+        return xxh64(key.data(), key.size());
+    case key_hash_type::XXH3:
+    default:
+        return xxh3_64(key.data(), key.size());
+    }
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -0,0 +1,221 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for leveldb_storage_engine class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "leveldb_storage_engine.h"
+#include "stored_values.h"
+#include "throng/error.h"
+
+#include <leveldb/db.h>
+#include <leveldb/write_batch.h>
+
+#include <unordered_map>
+
+namespace throng {
+namespace internal {
+
+using std::vector;
+using std::string;
+
+typedef versioned<string> versioned_t;
+
+static void check(const leveldb::Status& status, const string& name,
+                  const char* op) {
+    if (!status.ok())
+        throw error::storage(name, string("Could not ") + op + ": " +
+                             status.ToString());
+}
+
+// **********************
+// leveldb_storage_engine
+// **********************
+
+leveldb_storage_engine::leveldb_storage_engine(string name_,
+                                               const string& path,
+                                               bool sync_)
+    : name(std::move(name_)), sync(sync_) {
+    leveldb::Options options;
+    options.create_if_missing = true;
+    leveldb::DB* dbp = nullptr;
+    check(leveldb::DB::Open(options, path, &dbp), name, "open database");
+    db.reset(dbp);
+}
+
+leveldb_storage_engine::~leveldb_storage_engine() {
+
+}
+
+vector<versioned_t> leveldb_storage_engine::read(const string& key) {
+    string data;
+    leveldb::Status status = db->Get(leveldb::ReadOptions(), key, &data);
+    if (status.IsNotFound())
+        return vector<versioned_t>();
+    check(status, name, "read");
+    return decode_values(data.data(), data.size());
+}
+
+vector<versioned_t> leveldb_storage_engine::get(const string& key) {
+    return read(key);
+}
+
+bool leveldb_storage_engine::put(const string& key,
+                                 const versioned_t& value) {
+    std::lock_guard<std::mutex> guard(write_mutex);
+    vector<versioned_t> values = read(key);
+    if (!apply_write(values, value))
+        return false;
+
+    leveldb::WriteOptions options;
+    options.sync = sync;
+    check(db->Put(options, key, encode_values(values)), name, "write");
+    return true;
+}
+
+bool leveldb_storage_engine::erase(const string& key,
+                                   const vector_clock& version) {
+    std::lock_guard<std::mutex> guard(write_mutex);
+    vector<versioned_t> values = read(key);
+    if (!apply_erase(values, version))
+        return false;
+
+    leveldb::WriteOptions options;
+    options.sync = sync;
+    if (values.empty())
+        check(db->Delete(options, key), name, "delete");
+    else
+        check(db->Put(options, key, encode_values(values)), name, "write");
+    return true;
+}
+
+size_t
+leveldb_storage_engine::write(const write_batch<string, string>& writes) {
+    std::lock_guard<std::mutex> guard(write_mutex);
+
+    // Later writes to a key in the batch apply to the values left by
+    // the earlier ones
+    struct pending {
+        vector<versioned_t> values;
+        bool changed;
+    };
+    std::unordered_map<string, pending> updated;
+    size_t applied = 0;
+    for (auto& w : writes.get_operations()) {
+        auto it = updated.find(w.key);
+        if (it == updated.end())
+            it = updated.emplace(w.key,
+                                 pending { read(w.key), false }).first;
+        if (apply_operation(it->second.values, w)) {
+            it->second.changed = true;
+            applied += 1;
+        }
+    }
+    if (applied == 0) return 0;
+
+    leveldb::WriteBatch batch;
+    for (auto& u : updated) {
+        if (!u.second.changed) continue;
+        if (u.second.values.empty())
+            batch.Delete(u.first);
+        else
+            batch.Put(u.first, encode_values(u.second.values));
+    }
+    leveldb::WriteOptions options;
+    options.sync = sync;
+    check(db->Write(options, &batch), name, "write batch");
+    return applied;
+}
+
+const string& leveldb_storage_engine::get_name() const {
+    return name;
+}
+
+void leveldb_storage_engine::visit(store_visitor visitor) {
+    visit_prefix("", visitor);
+}
+
+void leveldb_storage_engine::visit_prefix(const string& prefix,
+                                          store_visitor visitor) {
+    // Iterate over an implicit snapshot of the database, without
+    // filling the block cache with data read only once
+    leveldb::ReadOptions options;
+    options.fill_cache = false;
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(options));
+    for (it->Seek(prefix); it->Valid(); it->Next()) {
+        if (!it->key().starts_with(prefix)) break;
+        visitor(it->key().ToString(), decode_values(it->value().data(), it->value().size()));
+    }
+    check(it->status(), name, "visit");
+}
+
+void leveldb_storage_engine::visit_range(const string& begin,
+                                         const string& end,
+                                         store_visitor visitor) {
+    leveldb::ReadOptions options;
+    options.fill_cache = false;
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(options));
+    for (it->Seek(begin); it->Valid(); it->Next()) {
+        if (!end.empty() && it->key().compare(end) >= 0) break;
+        visitor(it->key().ToString(),
+                decode_values(it->value().data(), it->value().size()));
+    }
+    check(it->status(), name, "visit");
+}
+
+void leveldb_storage_engine::visit_partition(size_t partition,
+                                             size_t partitions,
+                                             store_visitor visitor) {
+    string first, last;
+    {
+        std::unique_ptr<leveldb::Iterator>
+            it(db->NewIterator(leveldb::ReadOptions()));
+        it->SeekToFirst();
+        if (!it->Valid()) {
+            check(it->status(), name, "visit");
+            return;
+        }
+        first = it->key().ToString();
+        it->SeekToLast();
+        last = it->key().ToString();
+    }
+
+    // Every key shares the prefix common to the first and last keys,
+    // so split the key range evenly on the value of the byte that
+    // follows it.  The first and last partitions are unbounded below
+    // and above respectively, so every key lands in exactly one
+    // partition even if the database changes while we visit.
+    size_t common = 0;
+    while (common < first.size() && common < last.size() &&
+           first[common] == last[common])
+        common += 1;
+    size_t lo = common < first.size() ? (uint8_t)first[common] : 0;
+    size_t hi = common < last.size() ? (uint8_t)last[common] : 0;
+    auto bound = [&](size_t p) {
+        if (p == 0 || p >= partitions) return string();
+        string b(first, 0, common);
+        b.push_back((char)(lo + p * (hi - lo + 1) / partitions));
+        return b;
+    };
+    visit_range(bound(partition), bound(partition + 1), visitor);
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -0,0 +1,656 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for log_storage_engine class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "log_storage_engine.h"
+#include "stored_values.h"
+#include "logger.h"
+#include "throng/error.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/crc.hpp>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+namespace throng {
+namespace internal {
+
+using std::vector;
+using std::string;
+using std::make_shared;
+using boost::filesystem::path;
+
+LOGGER("store");
+
+/*
+ * Each record in a segment is:
+ *
+ *   uint32   CRC-32 of the rest of the record
+ *   uint32   key length
+ *   uint32   length of the encoded values
+ *   bytes    the key
+ *   bytes    the values, encoded with encode_values
+ *
+ * Integers are in host byte order.  The unused tail of a segment is
+ * zero, which never has a valid CRC.
+ *
+ * A record with no values deletes its key.  A delete record is
+ * copied forward by compaction for as long as an older segment
+ * exists, since that segment may still hold earlier records for the
+ * key that recovery would otherwise bring back.
+ *
+ * The records of an atomic batch are preceded by a batch header,
+ * which has BATCH_MARKER as its key length and the total size of the
+ * batch's records as its value length, and whose CRC covers all of
+ * them.  A batch whose CRC fails is discarded as a whole.
+ */
+static const size_t HEADER_SIZE = 12;
+static const uint32_t BATCH_MARKER = 0xffffffff;
+
+static uint32_t record_crc(const char* data, size_t size) {
+    boost::crc_32_type crc;
+    crc.process_bytes(data + 4, size - 4);
+    return crc.checksum();
+}
+
+static uint32_t get_u32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void put_u32(char* p, uint32_t v) {
+    std::memcpy(p, &v, sizeof(v));
+}
+
+[[noreturn]] static void fail(const string& name, const string& op,
+                              const path& file) {
+    throw error::storage(name, "Could not " + op + " " + file.string() +
+                         ": " + std::strerror(errno));
+}
+
+// Sync a directory so that files created or deleted in it stay that
+// way after a crash
+static void sync_directory(const string& name, const path& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd < 0) fail(name, "open", dir);
+    if (::fsync(fd) < 0) {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        fail(name, "sync", dir);
+    }
+    ::close(fd);
+}
+
+// *******
+// segment
+// *******
+
+/**
+ * A segment file, mapped into memory for reads.  Records are
+ * appended with ordinary writes, which the shared mapping sees.
+ */
+class log_storage_engine::segment {
+public:
+    segment(const string& name, path file_, uint32_t id_,
+            size_t size, bool create)
+        : id(id_), file(std::move(file_)) {
+        fd = ::open(file.c_str(), create ? O_RDWR | O_CREAT | O_EXCL
+                    : O_RDWR, 0644);
+        if (fd < 0) fail(name, "open", file);
+
+        if (create) {
+            if (::ftruncate(fd, (off_t)size) < 0) {
+                ::close(fd);
+                fail(name, "allocate", file);
+            }
+            capacity = size;
+        } else {
+            struct stat st;
+            if (::fstat(fd, &st) < 0) {
+                ::close(fd);
+                fail(name, "stat", file);
+            }
+            capacity = (size_t)st.st_size;
+        }
+
+        if (capacity > 0) {
+            void* m = ::mmap(nullptr, capacity, PROT_READ, MAP_SHARED, fd, 0);
+            if (m == MAP_FAILED) {
+                ::close(fd);
+                fail(name, "map", file);
+            }
+            data = static_cast<const char*>(m);
+        }
+    }
+
+    ~segment() {
+        if (data) ::munmap(const_cast<char*>(data), capacity);
+        ::close(fd);
+    }
+
+    /**
+     * Delete the file of a segment that is no longer needed.  Readers
+     * that hold a reference keep their mapping of it.
+     */
+    void unlink(const string& name) {
+        if (::unlink(file.c_str()) < 0 && errno != ENOENT)
+            fail(name, "remove", file);
+    }
+
+    void write(const string& name, const char* p, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t r = ::pwrite(fd, p + done, size - done,
+                                 (off_t)(end + done));
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                fail(name, "write", file);
+            }
+            done += (size_t)r;
+        }
+        end += size;
+    }
+
+    void sync(const string& name) {
+        if (::fdatasync(fd) < 0) fail(name, "sync", file);
+    }
+
+    const uint32_t id;
+    const path file;
+    int fd = -1;
+    const char* data = nullptr;
+    size_t capacity = 0;
+
+    /**
+     * The end of the records in the segment
+     */
+    size_t end = 0;
+
+    /**
+     * The number of bytes of records that are the latest for their
+     * key
+     */
+    size_t live = 0;
+};
+
+// ******************
+// log_storage_engine
+// ******************
+
+log_storage_engine::log_storage_engine(string name_, const string& path_,
+                                       size_t segment_size_,
+                                       double garbage_ratio_, bool sync_)
+    : name(std::move(name_)), dir(path_),
+      segment_size(std::min(segment_size_,
+                            (size_t)std::numeric_limits<uint32_t>::max())),
+      garbage_ratio(garbage_ratio_), sync(sync_) {
+    recover();
+    compact_thread = std::thread([this]() { run_compactions(); });
+}
+
+log_storage_engine::~log_storage_engine() {
+    {
+        std::lock_guard<std::mutex> guard(signal_mutex);
+        closing = true;
+    }
+    signal_cond.notify_all();
+    compact_thread.join();
+}
+
+void log_storage_engine::recover() {
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(dir, ec);
+    if (ec)
+        throw error::storage(name, "Could not create " + dir.string() +
+                             ": " + ec.message());
+
+    std::map<uint32_t, path> files;
+    for (boost::filesystem::directory_iterator it(dir), end;
+         it != end; ++it) {
+        string fname = it->path().filename().string();
+        unsigned int id;
+        char rest;
+        if (fname.size() == 12 &&
+            std::sscanf(fname.c_str(), "%8x.lo%c", &id, &rest) == 2 &&
+            rest == 'g')
+            files.emplace(id, it->path());
+    }
+
+    // Later records for a key replace earlier ones, so scanning the
+    // segments in order leaves the index pointing at the latest
+    for (auto& f : files) {
+        segment_p s = make_shared<segment>(name, f.second, f.first, 0, false);
+        segments.emplace(s->id, s);
+        size_t off = 0;
+        while (off + HEADER_SIZE <= s->capacity) {
+            const char* r = s->data + off;
+            size_t key_len = get_u32(r + 4);
+            if (key_len == BATCH_MARKER) {
+                size_t size = HEADER_SIZE + get_u32(r + 8);
+                if (size > s->capacity - off ||
+                    get_u32(r) != record_crc(r, size))
+                    break;
+                // The batch is intact, so read its records as usual
+                off += HEADER_SIZE;
+                continue;
+            }
+            size_t size = HEADER_SIZE + key_len + get_u32(r + 8);
+            if (size > s->capacity - off ||
+                get_u32(r) != record_crc(r, size))
+                break;
+
+            string key(r + HEADER_SIZE, key_len);
+            set_location(key, { s->id, (uint32_t)off, (uint32_t)size },
+                         size == HEADER_SIZE + key_len);
+            s->live += size;
+            off += size;
+        }
+        s->end = off;
+    }
+
+    // Segments with no live records can go right away
+    bool compact = false;
+    bool removed = false;
+    for (auto it = segments.begin(); it != segments.end(); ) {
+        if (it->second->live == 0) {
+            it->second->unlink(name);
+            removed = true;
+            it = segments.erase(it);
+        } else {
+            if (needs_compaction(*it->second))
+                compact = true;
+            ++it;
+        }
+    }
+    compact_pending = compact;
+    if (removed) sync_directory(name, dir);
+
+    LOG(INFO) << name << ": Recovered " << index.size() << " keys from "
+              << segments.size() << " log segments";
+}
+
+log_storage_engine::segment_p
+log_storage_engine::new_segment(size_t min_size) {
+    uint32_t id = segments.empty() ? 1 : segments.rbegin()->first + 1;
+    char fname[16];
+    std::snprintf(fname, sizeof(fname), "%08x.log", id);
+    segment_p s = make_shared<segment>(name, dir / fname, id,
+                                       std::max(segment_size, min_size),
+                                       true);
+    segments.emplace(id, s);
+    return s;
+}
+
+// must hold log_mutex when calling
+bool log_storage_engine::needs_compaction(const segment& s) const {
+    return &s != active.get() && s.end > 0 &&
+        (double)(s.end - s.live) >= garbage_ratio * s.end;
+}
+
+void log_storage_engine::request_compaction() {
+    {
+        std::lock_guard<std::mutex> guard(signal_mutex);
+        compact_pending = true;
+    }
+    signal_cond.notify_one();
+}
+
+// must hold log_mutex when calling
+log_storage_engine::location
+log_storage_engine::append(const char* data, size_t size) {
+    if (size > std::numeric_limits<uint32_t>::max())
+        throw error::storage(name, "Record too large");
+
+    if (!active || active->end + size > active->capacity) {
+        segment_p sealed = std::move(active);
+        active = new_segment(size);
+        if (sealed && needs_compaction(*sealed))
+            request_compaction();
+    }
+
+    location loc = { active->id, (uint32_t)active->end, (uint32_t)size };
+    active->write(name, data, size);
+    active->live += size;
+    return loc;
+}
+
+// must hold log_mutex when calling
+void log_storage_engine::release(const location& loc) {
+    segment& s = *segments.at(loc.segment_id);
+    s.live -= loc.size;
+    if (needs_compaction(s))
+        request_compaction();
+}
+
+// Point the index at a new record for a key, releasing the record it
+// replaces.  A delete record moves the key to the deleted index.
+// Must hold log_mutex when calling.
+void log_storage_engine::set_location(const string& key,
+                                      const location& loc, bool deletes) {
+    auto it = index.find(key);
+    auto dit = deleted.find(key);
+    if (it != index.end()) {
+        release(it->second);
+        index.erase(it);
+    }
+    if (dit != deleted.end()) {
+        release(dit->second);
+        deleted.erase(dit);
+    }
+    (deletes ? deleted : index).emplace(key, loc);
+}
+
+vector<versioned<string>>
+log_storage_engine::read(const segment& s, const location& loc) {
+    const char* r = s.data + loc.offset;
+    size_t key_len = get_u32(r + 4);
+    return decode_values(r + HEADER_SIZE + key_len,
+                         loc.size - HEADER_SIZE - key_len);
+}
+
+vector<versioned<string>> log_storage_engine::get(const string& key) {
+    location loc;
+    segment_p s;
+    {
+        std::lock_guard<std::mutex> guard(log_mutex);
+        auto it = index.find(key);
+        if (it == index.end())
+            return vector<versioned_t>();
+        loc = it->second;
+        s = segments.at(loc.segment_id);
+    }
+    // The reference keeps the segment mapped even if it is compacted
+    return read(*s, loc);
+}
+
+// Append a record for a key and its values to a buffer
+static void encode_record(string& buf, const string& key,
+                          const vector<versioned<string>>& values) {
+    string encoded = encode_values(values);
+    size_t start = buf.size();
+    buf.resize(start + HEADER_SIZE + key.size() + encoded.size());
+    char* record = &buf[start];
+    put_u32(record + 4, (uint32_t)key.size());
+    put_u32(record + 8, (uint32_t)encoded.size());
+    std::memcpy(record + HEADER_SIZE, key.data(), key.size());
+    std::memcpy(record + HEADER_SIZE + key.size(),
+                encoded.data(), encoded.size());
+    put_u32(record, record_crc(record, buf.size() - start));
+}
+
+bool log_storage_engine::put(const string& key, const versioned_t& value) {
+    std::lock_guard<std::mutex> guard(log_mutex);
+    auto it = index.find(key);
+    vector<versioned_t> values;
+    if (it != index.end())
+        values = read(*segments.at(it->second.segment_id), it->second);
+    if (!apply_write(values, value))
+        return false;
+
+    string record;
+    encode_record(record, key, values);
+    location loc = append(record.data(), record.size());
+    if (sync) active->sync(name);
+    set_location(key, loc, false);
+    return true;
+}
+
+bool log_storage_engine::erase(const string& key,
+                               const vector_clock& version) {
+    std::lock_guard<std::mutex> guard(log_mutex);
+    auto it = index.find(key);
+    if (it == index.end())
+        return false;
+    vector<versioned_t> values =
+        read(*segments.at(it->second.segment_id), it->second);
+    if (!apply_erase(values, version))
+        return false;
+
+    string record;
+    encode_record(record, key, values);
+    location loc = append(record.data(), record.size());
+    if (sync) active->sync(name);
+    set_location(key, loc, values.empty());
+    return true;
+}
+
+size_t log_storage_engine::write(const write_batch<string, string>& batch) {
+    std::lock_guard<std::mutex> guard(log_mutex);
+
+    // Apply the writes to the current values of each key, so that a
+    // key written more than once gets a single record
+    struct pending {
+        vector<versioned_t> values;
+        bool changed;
+    };
+    std::unordered_map<string, pending> updated;
+    vector<const string*> order;
+    size_t applied = 0;
+    for (auto& op : batch.get_operations()) {
+        auto it = updated.find(op.key);
+        if (it == updated.end()) {
+            vector<versioned_t> values;
+            auto iit = index.find(op.key);
+            if (iit != index.end())
+                values = read(*segments.at(iit->second.segment_id),
+                              iit->second);
+            it = updated.emplace(op.key,
+                                 pending { std::move(values), false }).first;
+        }
+        if (apply_operation(it->second.values, op)) {
+            if (!it->second.changed)
+                order.push_back(&it->first);
+            it->second.changed = true;
+            applied += 1;
+        }
+    }
+    if (order.empty()) return applied;
+
+    bool atomic = batch.is_atomic() && order.size() > 1;
+    string buf(atomic ? HEADER_SIZE : 0, '\0');
+    vector<std::pair<size_t, size_t>> records;
+    for (const string* key : order) {
+        size_t start = buf.size();
+        encode_record(buf, *key, updated.at(*key).values);
+        records.emplace_back(start, buf.size() - start);
+    }
+    if (atomic) {
+        put_u32(&buf[4], BATCH_MARKER);
+        put_u32(&buf[8], (uint32_t)(buf.size() - HEADER_SIZE));
+        put_u32(&buf[0], record_crc(buf.data(), buf.size()));
+    }
+
+    // The whole batch goes to one segment with a single write
+    location loc = append(buf.data(), buf.size());
+    if (sync) active->sync(name);
+    if (atomic) active->live -= HEADER_SIZE;
+    for (size_t i = 0; i < order.size(); ++i) {
+        location rloc = { loc.segment_id,
+                          loc.offset + (uint32_t)records[i].first,
+                          (uint32_t)records[i].second };
+        set_location(*order[i], rloc, updated.at(*order[i]).values.empty());
+    }
+    return applied;
+}
+
+const string& log_storage_engine::get_name() const {
+    return name;
+}
+
+void log_storage_engine::visit(store_visitor visitor) {
+    visit_prefix("", visitor);
+}
+
+void log_storage_engine::visit_prefix(const string& prefix,
+                                      store_visitor visitor) {
+    // Collect the locations under the lock, holding references to the
+    // segments, and read the values without it
+    vector<std::pair<string, location>> entries;
+    std::map<uint32_t, segment_p> segs;
+    {
+        std::lock_guard<std::mutex> guard(log_mutex);
+        for (auto& e : index) {
+            if (e.first.compare(0, prefix.size(), prefix) == 0)
+                entries.push_back(e);
+        }
+        segs = segments;
+    }
+    for (auto& e : entries)
+        visitor(e.first, read(*segs.at(e.second.segment_id), e.second));
+}
+
+void log_storage_engine::visit_partition(size_t partition,
+                                         size_t partitions,
+                                         store_visitor visitor) {
+    // The index is unordered, so partition by the hash of the key
+    std::hash<string> hasher;
+    vector<std::pair<string, location>> entries;
+    std::map<uint32_t, segment_p> segs;
+    {
+        std::lock_guard<std::mutex> guard(log_mutex);
+        for (auto& e : index) {
+            if (hasher(e.first) % partitions == partition)
+                entries.push_back(e);
+        }
+        segs = segments;
+    }
+    for (auto& e : entries)
+        visitor(e.first, read(*segs.at(e.second.segment_id), e.second));
+}
+
+size_t log_storage_engine::get_segment_count() {
+    std::lock_guard<std::mutex> guard(log_mutex);
+    return segments.size();
+}
+
+void log_storage_engine::run_compactions() {
+    std::unique_lock<std::mutex> guard(signal_mutex);
+    while (true) {
+        signal_cond.wait(guard, [this]() {
+                return compact_pending || closing;
+            });
+        if (closing) return;
+        compact_pending = false;
+
+        guard.unlock();
+        try {
+            compact();
+        } catch (const std::exception& e) {
+            LOG(ERROR) << name << ": Could not compact log: " << e.what();
+        }
+        guard.lock();
+    }
+}
+
+void log_storage_engine::compact() {
+    std::lock_guard<std::mutex> guard(compact_mutex);
+    vector<segment_p> eligible;
+    {
+        std::lock_guard<std::mutex> guard(log_mutex);
+        for (auto& s : segments) {
+            if (needs_compaction(*s.second))
+                eligible.push_back(s.second);
+        }
+    }
+    for (auto& s : eligible)
+        compact_segment(s);
+}
+
+void log_storage_engine::compact_segment(const segment_p& s) {
+    // The segment is full, so its records do not change.  Copy each
+    // record that is still the latest for its key to the end of the
+    // log, taking the lock for one record at a time.  Delete records
+    // are only needed while an older segment exists.
+    size_t copied = 0;
+    size_t off = 0;
+    while (off < s->end) {
+        const char* r = s->data + off;
+        size_t key_len = get_u32(r + 4);
+        if (key_len == BATCH_MARKER) {
+            off += HEADER_SIZE;
+            continue;
+        }
+        size_t size = HEADER_SIZE + key_len + get_u32(r + 8);
+        string key(r + HEADER_SIZE, key_len);
+        {
+            std::lock_guard<std::mutex> guard(log_mutex);
+            auto it = index.find(key);
+            bool deletes = it == index.end();
+            if (deletes) it = deleted.find(key);
+            if (it != (deletes ? deleted : index).end() &&
+                it->second.segment_id == s->id &&
+                it->second.offset == off) {
+                s->live -= size;
+                if (deletes && segments.begin()->first == s->id) {
+                    // No older segment holds records for the key
+                    deleted.erase(it);
+                } else {
+                    it->second = append(r, size);
+                    copied += 1;
+                }
+            }
+        }
+        {
+            std::lock_guard<std::mutex> guard(signal_mutex);
+            if (closing) return;
+        }
+        off += size;
+    }
+
+    // Before the segment is deleted, the copies must be durable, and
+    // so must the records that superseded the ones not copied.  Both
+    // are in later segments, which may not have been synced since.
+    vector<segment_p> later;
+    {
+        std::lock_guard<std::mutex> guard(log_mutex);
+        for (auto it = segments.upper_bound(s->id);
+             it != segments.end(); ++it)
+            later.push_back(it->second);
+    }
+    for (auto& l : later)
+        l->sync(name);
+
+    // The file must be gone for good before the segment leaves the
+    // map, since once a later segment is the oldest, compacting it
+    // drops the delete records that this one still needs
+    s->unlink(name);
+    sync_directory(name, dir);
+
+    std::lock_guard<std::mutex> guard(log_mutex);
+    segments.erase(s->id);
+    LOG(DEBUG) << name << ": Compacted log segment " << s->id
+               << ", copying " << copied << " records";
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -22,7 +22,17 @@
 #endif
 
 #include "processor.h"
+#include "key_hash.h"
 #include "logger.h"
+#include "stored_values.h"
+
+#include "throng/error.h"
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <unordered_set>
 
 namespace throng {
 namespace internal {
@@ -31,74 +41,583 @@ using std::vector;
 using std::string;
 using std::unique_ptr;
 using std::chrono::steady_clock;
-using std::chrono::milliseconds;
 using boost::asio::steady_timer;
 
 LOGGER("store");
 
 vector<versioned<string>> processor::get(const string& key) {
-    if (delegate) return delegate->get(key);
+    uint64_t hash = hash_key(config.key_hash, key);
+    {
+        // The in-memory state includes writes not yet committed to
+        // the delegate
+        std::lock_guard<std::mutex> guard(item_mutex);
+        record* r = items.find(key, hash);
+        if (r) {
+            stats.hits += 1;
+            touch(*r);
+            return r->get_values();
+        }
+        if (complete)
+            return vector<versioned<string>>();
+        if (key_filter_ready && !key_filter->may_contain(hash))
+            return vector<versioned<string>>();
+        if (delegate) stats.misses += 1;
+    }
+    if (!delegate) return vector<versioned<string>>();
+
+    vector<versioned_t> values = delegate->get(key);
+    if (tiered && !values.empty()) {
+        std::lock_guard<std::mutex> guard(item_mutex);
+        record* r = page_in(key, hash, values);
+        if (r) return r->get_values();
+    }
+    return values;
+}
+
+// must hold item_mutex when calling
+processor::record*
+processor::page_in(const string& key, uint64_t hash,
+                   const vector<versioned_t>& values) {
+    // A write made while the delegate was being read is kept, and
+    // merged with the values read
+    record* rec = items.find(key, hash);
+    vector<versioned_t> merged;
+    if (rec) {
+        merged = rec->get_values();
+        bool changed = false;
+        for (auto& v : values)
+            changed |= doput(merged, v);
+        if (!changed) return rec;
+    } else {
+        merged = values;
+    }
+
+    bool created = !rec;
+    if (created) rec = items.insert(key, hash);
+    if (!reserve(*rec, items.get_record_size(key, merged))) {
+        // The item stays in the delegate only
+        if (created) items.erase(rec);
+        return nullptr;
+    }
+    // An item read from the delegate unchanged is not a change to
+    // the store.  Only merging it with a write made in the meantime
+    // is.
+    uint64_t change = created ? change_seq : next_change(*rec);
+    rec = items.set_values(rec, merged);
+    rec->seq = change;
+    if (created) {
+        time_point now = steady_clock::now();
+        rec->last_update = now;
+        rec->last_refresh = now;
+        rec->local = false;
+    }
+    stats.admissions += 1;
+    touch(*rec);
+    reschedule(*rec);
+    if (rec->is_scheduled())
+        arm_proc_timer(rec->get_deadline());
+    return rec;
+}
 
+// Read an item of a tiered store back into memory before it is
+// written, so that the write is merged with its values in storage
+void processor::fault_in(const string& key, uint64_t hash) {
+    if (!tiered) return;
+    {
+        std::lock_guard<std::mutex> guard(item_mutex);
+        if (items.find(key, hash) || complete ||
+            (key_filter_ready && !key_filter->may_contain(hash)))
+            return;
+        stats.misses += 1;
+    }
+    vector<versioned_t> values = delegate->get(key);
+    if (values.empty()) return;
     std::lock_guard<std::mutex> guard(item_mutex);
-    auto& key_index = item_map.get<key_tag>();
-    auto kit = key_index.find(key);
+    page_in(key, hash, values);
+}
+
+// Record a group of writes queued for the delegate.  Must hold
+// item_mutex when calling.
+void processor::track_unflushed(uint64_t seq, uint64_t first_change) {
+    if (!writer || !seq || config.memory_limit == 0) return;
+    uint64_t committed = writer->get_committed();
+    while (!unflushed.empty() && unflushed.front().first <= committed)
+        unflushed.pop_front();
+    unflushed.emplace_back(seq, first_change);
+}
+
+// Check whether the delegate has the current values of an item, so
+// that it can be evicted.  Must hold item_mutex when calling.
+bool processor::is_clean(const record& r) {
+    // Without a writer, writes go straight to the delegate
+    if (!writer) return true;
+    uint64_t committed = writer->get_committed();
+    while (!unflushed.empty() && unflushed.front().first <= committed)
+        unflushed.pop_front();
+    return unflushed.empty() || r.seq < unflushed.front().second;
+}
+
+// Maximum number of items examined when looking for an item to evict
+// before committing queued writes
+static const size_t EVICT_SCAN_LIMIT = 64;
+
+// Maximum number of items processed in a single timer tick
+static const size_t PROCESS_BATCH_SIZE = 1024;
+
+// Number of items loaded per acquisition of item_mutex when loading
+// from the delegate or a snapshot file
+static const size_t LOAD_BATCH_SIZE = 256;
+
+// Number of items loaded from the delegate between progress reports
+static const size_t RESTORE_PROGRESS_INTERVAL = 100000;
+
+// Merge a batch of loaded items into the store, optionally writing
+// the changes through to the delegate.  Returns false if the memory
+// limit was reached, leaving the rest of the batch unloaded.
+bool processor::load_batch(vector<loaded_item>& batch, bool persist) {
+    bool result = true;
+    write_batch<string, string> writes;
+    std::shared_ptr<write_behind> w;
+    uint64_t seq = 0;
+    {
+        std::lock_guard<std::mutex> guard(item_mutex);
+        if (persist) w = writer;
+        uint64_t first_change = change_seq + 1;
+        if (key_filter) {
+            // Restored items are in the delegate, and loaded items
+            // are about to be
+            for (auto& i : batch)
+                key_filter->insert(i.hash);
+        }
+        time_point now = steady_clock::now();
+        vector<versioned_t> values;
+        for (auto& i : batch) {
+            record* rec = items.find(i.key, i.hash);
+            size_t unwritten = writes.size();
+            if (rec) {
+                // Keep writes made since the store was created
+                values = rec->get_values();
+                bool changed = false;
+                for (auto& v : i.values) {
+                    if (doput(values, v)) {
+                        changed = true;
+                        if (persist) writes.put(i.key, v);
+                    }
+                }
+                if (!changed) continue;
+            } else {
+                values = i.values;
+                if (persist) {
+                    for (auto& v : values)
+                        writes.put(i.key, v);
+                }
+            }
 
-    vector<versioned<string>> result;
-    if (kit == key_index.end()) return result;
-    for (auto& v : kit->details->values) {
-        result.push_back(v);
+            size_t size = items.get_record_size(i.key, values);
+            auto fits = [&]() {
+                return memory_used() - (rec ? rec->get_size() : 0) +
+                    size <= config.memory_limit;
+            };
+            if (config.memory_limit > 0 && !fits() &&
+                !(release_writes() && fits())) {
+                writes.truncate(unwritten);
+                result = false;
+                break;
+            }
+            if (!rec) rec = items.insert(i.key, i.hash);
+            uint64_t change = next_change(*rec);
+            rec = items.set_values(rec, values);
+            rec->seq = change;
+            rec->last_update = now;
+            rec->last_refresh = now;
+            rec->local = false;
+            touch(*rec);
+            reschedule(*rec);
+            if (rec->is_scheduled())
+                arm_proc_timer(rec->get_deadline());
+        }
+
+        // Queue the writes while still holding the lock, as for put
+        if (w && !writes.empty()) {
+            seq = w->enqueue(writes);
+            track_unflushed(seq, first_change);
+        }
+    }
+    batch.clear();
+
+    if (persist && delegate) {
+        if (!w) {
+            if (!writes.empty())
+                delegate->write(writes);
+        } else if (seq && config.durability == durability_mode::SYNC) {
+            w->sync(seq, writes.size());
+        }
     }
     return result;
 }
 
+size_t processor::load(store_snapshot<string, string>& source,
+                       size_t size_hint) {
+    {
+        // Size the index once up front rather than growing it
+        // repeatedly while loading
+        std::lock_guard<std::mutex> guard(item_mutex);
+        items.reserve(items.size() + size_hint);
+    }
+
+    size_t loaded = 0;
+    bool full = false;
+    vector<loaded_item> batch;
+    batch.reserve(LOAD_BATCH_SIZE);
+    source.visit([&](const string& key, const vector<versioned_t>& values) {
+            if (full || values.empty()) return;
+            batch.push_back({ key, hash_key(config.key_hash, key), values });
+            loaded += 1;
+            if (batch.size() >= LOAD_BATCH_SIZE && !load_batch(batch, true))
+                full = true;
+        });
+    if (!full && !load_batch(batch, true))
+        full = true;
+    if (full)
+        throw error::memory_limit_exceeded(name);
+    return loaded;
+}
+
+void processor::restore() {
+    if (restored || !delegate || config.restore_threads == 0) return;
+    restored = true;
+
+    LOG(DEBUG) << name << ": Restoring from storage using "
+               << config.restore_threads << " threads";
+    auto start_time = steady_clock::now();
+    std::atomic<size_t> loaded(0);
+    std::atomic<bool> full(false);
+    std::mutex error_mutex;
+    vector<string> errors;
+
+    // Once memory is full, the remaining keys are still added to the
+    // key filter so that it covers the whole delegate
+    auto filter_keys = [this](vector<uint64_t>& hashes) {
+        std::lock_guard<std::mutex> guard(item_mutex);
+        for (uint64_t h : hashes)
+            key_filter->insert(h);
+        hashes.clear();
+    };
+
+    auto load = [&](size_t partition) {
+        vector<loaded_item> batch;
+        vector<uint64_t> hashes;
+        try {
+            delegate->visit_partition
+                (partition, config.restore_threads,
+                 [&](const string& key, const vector<versioned_t>& values) {
+                    if (values.empty()) return;
+                    if (full) {
+                        if (!key_filter) return;
+                        hashes.push_back(hash_key(config.key_hash, key));
+                        if (hashes.size() >= LOAD_BATCH_SIZE)
+                            filter_keys(hashes);
+                        return;
+                    }
+                    // Hash the key outside the lock
+                    batch.push_back({ key, hash_key(config.key_hash, key),
+                                      values });
+                    if (batch.size() >= LOAD_BATCH_SIZE &&
+                        !load_batch(batch, false))
+                        full = true;
+                    size_t n = loaded.fetch_add(1) + 1;
+                    if (n % RESTORE_PROGRESS_INTERVAL == 0)
+                        LOG(INFO) << name << ": Restored " << n << " items";
+                });
+            if (!load_batch(batch, false))
+                full = true;
+            if (!hashes.empty())
+                filter_keys(hashes);
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> guard(error_mutex);
+            errors.push_back(e.what());
+        }
+    };
+
+    vector<std::thread> threads;
+    for (size_t i = 1; i < config.restore_threads; ++i)
+        threads.emplace_back(load, i);
+    load(0);
+    for (auto& t : threads)
+        t.join();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>
+        (steady_clock::now() - start_time);
+    for (auto& e : errors)
+        LOG(ERROR) << name << ": Could not restore from storage: " << e;
+    if (full)
+        LOG(WARNING) << name << ": Memory limit reached while restoring;"
+                     << " reads of items not in memory will use storage";
+
+    std::lock_guard<std::mutex> guard(item_mutex);
+    complete = errors.empty() && !full;
+    if (key_filter) {
+        // A filter missing keys would hide them, so it is only used
+        // if every key was seen
+        if (errors.empty()) {
+            key_filter_ready = true;
+            LOG(DEBUG) << name << ": Key filter holds " << key_filter->size()
+                       << " keys in " << key_filter->get_memory_usage()
+                       << " bytes";
+        } else {
+            key_filter.reset();
+        }
+    }
+    LOG(INFO) << name << ": Restored " << loaded << " items in "
+              << elapsed.count() << "ms";
+}
+
 void processor::start() {
     if (running) return;
+    restore();
     running = true;
 
+    std::lock_guard<std::mutex> guard(item_mutex);
     proc_timer =
         unique_ptr<steady_timer>(new steady_timer(ctx.get_io_service()));
-    proc_timer->expires_from_now(std::chrono::milliseconds(500));
-    proc_timer->async_wait(bind(&processor::on_proc_timer, this,
-                                std::placeholders::_1));
+    proc_timer_deadline = time_point::max();
+    arm_proc_timer(item_timers.next_deadline());
+
+    if (delegate) {
+        writer = std::make_shared<write_behind>(*delegate,
+                                                config.durability,
+                                                config.commit_interval,
+                                                config.write_queue_limit);
+    }
 }
 
 void processor::stop() {
     if (running) {
         running = false;
 
-        if (proc_timer)
-            proc_timer->cancel();
+        std::lock_guard<std::mutex> guard(item_mutex);
+        // The timer must not outlive the io_service, which the
+        // context may destroy before the store registry
+        proc_timer.reset();
+        proc_timer_deadline = time_point::max();
+
+        // Commit all queued writes and stop the commit thread
+        writer.reset();
+        unflushed.clear();
     }
 }
 
-void processor::process(item_map_by_time::iterator& it) {
+processor::time_point
+processor::get_next_time(const record& r) const {
+    if (r.is_tombstone())
+        return r.last_update + config.tombstone_timeout;
+    if (config.object_timeout == std::chrono::seconds::zero())
+        return time_point::max();
+    if (r.local)
+        return r.last_refresh + config.object_timeout / 2;
+    return r.last_update + config.object_timeout;
+}
 
+// must hold item_mutex when calling
+void processor::reschedule(record& r) {
+    time_point next_time = get_next_time(r);
+    if (next_time == time_point::max())
+        r.cancel();
+    else
+        item_timers.schedule(r, next_time);
 }
 
-void processor::on_proc_timer(const boost::system::error_code& ec) {
-    if (!running)
-        return;
+// must hold item_mutex when calling
+void processor::touch(record& r) {
+    if (config.memory_limit == 0) return;
+    // A tiered store can evict items owned by the local node unless
+    // they must stay in memory to be refreshed
+    bool pinned = r.local &&
+        (!tiered || config.object_timeout != std::chrono::seconds::zero());
+    if (pinned) {
+        r.item_table::lru_hook::unlink();
+    } else {
+        if (r.item_table::lru_hook::is_linked())
+            evictable.erase(evictable.iterator_to(r));
+        evictable.push_back(r);
+    }
+}
 
-    auto now = steady_clock::now();
-    static const time_point epoch;
+// Keep the current version of r for any snapshot that can see it,
+// before r is replaced or removed.  The version is visible to
+// snapshots before sequence number to.  Must hold item_mutex when
+// calling.
+void processor::keep_history(const record& r, uint64_t to) {
+    if (!snapshots.empty() && r.get_value_count() > 0 &&
+        r.seq <= *snapshots.rbegin()) {
+        string key = r.get_key();
+        history[key].push_back({ r.seq, to, r.get_values() });
+        history_order.emplace_back(to, std::move(key));
+    }
+}
 
-    while (running) {
-        std::lock_guard<std::mutex> guard(item_mutex);
+// Assign a sequence number for a change to r, first keeping the
+// current version of r if any snapshot can see it.  Must hold
+// item_mutex when calling.
+uint64_t processor::next_change(const record& r) {
+    change_seq += 1;
+    keep_history(r, change_seq);
 
-        if (item_map.size() == 0) break;
-        auto& next_index = item_map.get<next_time_tag>();
+    if (change_log.size() < config.change_log_size) {
+        change_log.emplace_back(change_seq, r.get_key());
+    } else if (config.change_log_size > 0) {
+        // Overwrite the oldest entry, reusing its key storage
+        auto& e = change_log[change_log_head];
+        truncated_seq = e.first;
+        e.first = change_seq;
+        r.get_key(e.second);
+        change_log_head = (change_log_head + 1) % change_log.size();
+    } else {
+        truncated_seq = change_seq;
+    }
+    return change_seq;
+}
 
-        auto it = next_index.begin();
-        if (it->next_time != epoch && now < it->next_time) break;
+// Get the memory counted against the memory limit.  Must hold
+// item_mutex when calling.
+size_t processor::memory_used() const {
+    return items.get_memory_usage() +
+        (writer ? writer->get_memory_usage() : 0);
+}
+
+// Commit the writes queued for the delegate to release their memory.
+// Returns false if there were none or they could not be committed.
+// Must hold item_mutex when calling.
+bool processor::release_writes() {
+    if (!writer || writer->get_memory_usage() == 0 || !writer->flush())
+        return false;
+    unflushed.clear();
+    return true;
+}
+
+// Evict items not owned by the local node until r can be resized to
+// the given size within the memory limit.  Must hold item_mutex when
+// calling.
+bool processor::reserve(const record& r, size_t size) {
+    if (config.memory_limit == 0) return true;
+
+    while (memory_used() - r.get_size() + size > config.memory_limit) {
+        // Look for the least recently used item whose writes have
+        // reached the delegate.  If none of the oldest items are
+        // clean, commit the queued writes and look again.
+        auto it = evictable.begin();
+        size_t scanned = 0;
+        while (it != evictable.end() &&
+               (&*it == &r || !is_clean(*it))) {
+            if (++scanned >= EVICT_SCAN_LIMIT) {
+                it = evictable.end();
+                break;
+            }
+            ++it;
+        }
+        if (it == evictable.end() && !unflushed.empty()) {
+            // Once the flush succeeds, every group queued so far has
+            // been committed
+            if (!writer->flush()) return false;
+            unflushed.clear();
+            continue;
+        }
+        if (it == evictable.end()) {
+            if (release_writes()) continue;
+            return false;
+        }
 
-        process(it);
+        // Evicting an item does not change the store, so it is not
+        // logged, but snapshots that can see it must still find it
+        LOG(DEBUG) << name << ": Evicting " << it->get_key();
+        complete = false;
+        stats.evictions += 1;
+        keep_history(*it, change_seq + 1);
+        items.erase(&*it);
     }
+    return true;
+}
+
+// must hold item_mutex when calling
+void processor::arm_proc_timer(time_point deadline) {
+    if (!running || !proc_timer) return;
+    if (deadline >= proc_timer_deadline) return;
 
-    proc_timer->expires_from_now(milliseconds(500));
+    // Rearming cancels any pending wait, whose handler will then
+    // be invoked with operation_aborted
+    proc_timer_deadline = deadline;
+    proc_timer->expires_at(deadline);
     proc_timer->async_wait(bind(&processor::on_proc_timer, this,
                                 std::placeholders::_1));
 }
 
+// must hold item_mutex when calling
+void processor::process(record& r, time_point now) {
+    if (r.is_tombstone()) {
+        if (now >= r.last_update + config.tombstone_timeout) {
+            // The tombstone has outlived the partition tolerance
+            // window and can be garbage-collected
+            LOG(DEBUG) << name << ": Removing tombstone for " << r.get_key();
+            next_change(r);
+            unstore(r);
+            items.erase(&r);
+            return;
+        }
+    } else if (config.object_timeout != std::chrono::seconds::zero()) {
+        if (r.local) {
+            // Objects owned by the local node are kept alive by
+            // notifying listeners as for a local write, so that the
+            // unchanged value is sent to remote replicas again.  They
+            // treat a write of an equal version as a keepalive, so
+            // the refresh interval is half the timeout.
+            r.last_refresh = now;
+            notify(r.get_key(), true);
+        } else if (now >= r.last_update + config.object_timeout) {
+            string key = r.get_key();
+            LOG(DEBUG) << name << ": Expiring stale object " << key;
+            next_change(r);
+            unstore(r);
+            items.erase(&r);
+            notify(key, false);
+            return;
+        }
+    }
+
+    reschedule(r);
+}
+
+// Erase the values of an expired item from the delegate, so that it
+// is not loaded again.  Must hold item_mutex when calling.
+void processor::unstore(const record& r) {
+    if (!delegate) return;
+    write_batch<string, string> batch;
+    string key = r.get_key();
+    for (auto& v : r.get_values())
+        batch.erase(key, v.get_version());
+    if (writer)
+        writer->enqueue(batch);
+    else
+        delegate->write(batch);
+}
+
+void processor::on_proc_timer(const boost::system::error_code& ec) {
+    if (!running || ec == boost::asio::error::operation_aborted)
+        return;
+
+    std::lock_guard<std::mutex> guard(item_mutex);
+    proc_timer_deadline = time_point::max();
+
+    auto now = steady_clock::now();
+    bool more =
+        item_timers.advance(now, [this, now](timing_wheel::entry& e) {
+                process(static_cast<record&>(e), now);
+            }, PROCESS_BATCH_SIZE);
+
+    // If the batch limit was reached, yield the lock and the worker
+    // thread but continue immediately
+    arm_proc_timer(more ? now : item_timers.next_deadline());
+}
+
 void processor::notify(const std::string& key, bool local) {
     for (auto& l : listeners) {
         try {
@@ -108,50 +627,378 @@ void processor::notify(const std::string& key, bool local) {
     }
 }
 
-bool processor::doput(item_details& rs,
+bool processor::doput(vector<versioned_t>& values,
                       const versioned<string>& value) {
-    std::vector<versioned_t> new_values;
-
-    for (auto vit = rs.values.begin(); vit != rs.values.end(); vit++) {
-        vector_clock::occurred o =
-            value.get_version().compare(vit->get_version());
-
-        switch (o) {
+    bool superseded = false;
+    for (auto& v : values) {
+        switch (value.get_version().compare(v.get_version())) {
         case vector_clock::occurred::BEFORE:
         case vector_clock::occurred::EQUAL:
             return false;
         case vector_clock::occurred::AFTER:
+            superseded = true;
             break;
         default:
-            new_values.push_back(*vit);
             break;
         }
     }
-    new_values.push_back({ value });
-    rs.values.swap(new_values);
+    if (!superseded) {
+        values.push_back(value);
+        return true;
+    }
+
+    // Copy the new value over the first value it supersedes, which
+    // reuses that value's storage, then drop the rest of the
+    // superseded values and move the new value to the end
+    auto after = [&value](const versioned_t& v) {
+        return value.get_version().compare(v.get_version()) ==
+            vector_clock::occurred::AFTER;
+    };
+    auto first = std::find_if(values.begin(), values.end(), after);
+    *first = value;
+    values.erase(std::remove_if(first + 1, values.end(), after),
+                 values.end());
+    std::rotate(first, first + 1, values.end());
+    return true;
+}
+
+void processor::set_resolver(ctx::raw_resolver_t resolver_) {
+    std::lock_guard<std::mutex> guard(item_mutex);
+    resolver = std::move(resolver_);
+}
+
+bool processor::compact(vector<versioned_t>& values) {
+    versioned_t merged { nullptr, {} };
+    try {
+        merged = resolver(values);
+    } catch (const std::exception& e) {
+        LOG(WARNING) << name << ": Could not compact values: " << e.what();
+        return false;
+    }
+
+    // The merged value must supersede every one of the values, so
+    // the clocks are merged with the latest timestamp.  The merged
+    // value is a new write by the local node, so its entry is
+    // incremented; otherwise two replicas resolving the same values
+    // differently would produce different values with equal
+    // versions, and each would discard the other's as obsolete.
+    vector_clock clock = merged.get_version();
+    vector_clock::time_point timestamp = clock.get_timestamp();
+    for (auto& v : values)
+        timestamp = std::max(timestamp, v.get_version().get_timestamp());
+    for (auto& v : values)
+        clock = clock.merge(v.get_version(), timestamp);
+    clock = clock.incremented(ctx.get_local_node_id(), timestamp);
+
+    values.clear();
+    values.emplace_back(merged.get_ptr(), clock);
     return true;
 }
 
 bool processor::put(const string& key,
                     const versioned<string>& value) {
-    std::lock_guard<std::mutex> guard(item_mutex);
-    auto& key_index = item_map.get<key_tag>();
-    auto kit = key_index.find(key);
+    return put(key, value, true);
+}
+
+// must hold item_mutex when calling
+bool processor::apply_put(const string& key, uint64_t hash,
+                          const versioned<string>& value, bool local,
+                          versioned<string>& written) {
+    record* rec = items.find(key, hash);
+    bool created = false;
+    if (!rec) {
+        rec = items.insert(key, hash);
+        created = true;
+    }
+
+    time_point now = steady_clock::now();
+    vector<versioned_t> values;
+    vector_clock::occurred o = vector_clock::occurred::CONCURRENT;
+    if (rec->get_value_count() == 1)
+        o = rec->compare_version(0, value.get_version());
 
-    time_point next_time;
-    if (kit == key_index.end()) {
-        auto r = key_index.insert(item(key, next_time));
-        kit = r.first;
+    // When the item has a single value that the write supersedes or
+    // is superseded by, which is the common case, work on the
+    // encoded record directly rather than decoding its values
+    bool single = o != vector_clock::occurred::CONCURRENT;
+    bool r;
+    bool compacted = false;
+    if (single) {
+        r = o == vector_clock::occurred::AFTER;
+    } else {
+        values = rec->get_values();
+        r = doput(values, value);
+        if (r && resolver && values.size() > config.sibling_limit)
+            compacted = compact(values);
     }
 
-    bool r = doput(*(kit->details), value);
+    if (r) {
+        size_t size = single
+            ? items.get_record_size(key, value)
+            : items.get_record_size(key, values);
+        // The write is queued for the delegate too, which holds
+        // memory until it is committed
+        size_t queued = writer ? write_behind::get_write_size(key, value)
+            : 0;
+        if (!reserve(*rec, size + queued)) {
+            if (created) items.erase(rec);
+            throw error::memory_limit_exceeded(name);
+        }
+        uint64_t seq = next_change(*rec);
+        rec = single
+            ? items.set_value(rec, value)
+            : items.set_values(rec, values);
+        rec->seq = seq;
+        rec->last_update = now;
+        rec->last_refresh = now;
+        rec->local = local;
+    } else if (!local && !rec->local &&
+               o == vector_clock::occurred::EQUAL &&
+               value.get_version() == rec->get_values()[0].get_version()) {
+        // a remote owner refreshing an unchanged object
+        rec->last_update = now;
+    }
+
+    touch(*rec);
+    reschedule(*rec);
+    if (rec->is_scheduled())
+        arm_proc_timer(rec->get_deadline());
+
+    // A compacted value supersedes both the written value and the
+    // values it was merged with, so it is what the delegate stores
+    if (r) {
+        written = compacted ? values[0] : value;
+        if (key_filter) key_filter->insert(hash);
+    }
+    return r;
+}
+
+// Wait for the writer to commit its queue if it is full, before
+// taking item_mutex so that readers are not held up by the commit
+void processor::wait_for_writer() {
+    if (!delegate) return;
+    std::shared_ptr<write_behind> w;
+    {
+        std::lock_guard<std::mutex> guard(item_mutex);
+        w = writer;
+    }
+    if (w) w->wait_for_space();
+}
+
+bool processor::put(const string& key,
+                    const versioned<string>& value,
+                    bool local) {
+    // Hash the key once, outside the lock; the hash is kept with the
+    // item and reused for every later lookup
+    uint64_t hash = hash_key(config.key_hash, key);
+    fault_in(key, hash);
+    wait_for_writer();
+    std::unique_lock<std::mutex> guard(item_mutex);
+    uint64_t first_change = change_seq + 1;
+    versioned_t written { nullptr, {} };
+    bool r = apply_put(key, hash, value, local, written);
+
+    // Queue the write for the delegate while still holding the lock
+    // so that writes reach it in the order they were applied
+    std::shared_ptr<write_behind> w = writer;
+    uint64_t seq = 0;
+    if (w && r) {
+        seq = w->enqueue(key, written);
+        track_unflushed(seq, first_change);
+    }
+    notify(key, local);
+    guard.unlock();
+
     if (delegate && r) {
-        r = delegate->put(key, value);
+        if (!w)
+            delegate->put(key, written);
+        else if (config.durability == durability_mode::SYNC)
+            w->sync(seq);
     }
-    notify(key, true);
     return r;
 }
 
+// Remove the values of an item up to a version.  Must hold
+// item_mutex when calling.
+bool processor::apply_erase(const string& key, uint64_t hash,
+                            const vector_clock& version) {
+    record* rec = items.find(key, hash);
+    if (!rec) return false;
+    vector<versioned_t> values = rec->get_values();
+    if (!internal::apply_erase(values, version)) return false;
+
+    uint64_t seq = next_change(*rec);
+    if (values.empty()) {
+        items.erase(rec);
+        return true;
+    }
+    rec = items.set_values(rec, values);
+    rec->seq = seq;
+    rec->last_update = steady_clock::now();
+    touch(*rec);
+    reschedule(*rec);
+    if (rec->is_scheduled())
+        arm_proc_timer(rec->get_deadline());
+    return true;
+}
+
+bool processor::erase(const string& key, const vector_clock& version) {
+    uint64_t hash = hash_key(config.key_hash, key);
+    fault_in(key, hash);
+    wait_for_writer();
+    std::unique_lock<std::mutex> guard(item_mutex);
+    uint64_t first_change = change_seq + 1;
+    if (!apply_erase(key, hash, version)) return false;
+
+    write_batch<string, string> batch;
+    batch.erase(key, version);
+    std::shared_ptr<write_behind> w = writer;
+    uint64_t seq = 0;
+    if (w) {
+        seq = w->enqueue(batch);
+        track_unflushed(seq, first_change);
+    }
+    notify(key, true);
+    guard.unlock();
+
+    if (delegate) {
+        if (!w)
+            delegate->write(batch);
+        else if (config.durability == durability_mode::SYNC)
+            w->sync(seq);
+    }
+    return true;
+}
+
+// Save the state of an item before a write in an atomic batch.  Must
+// hold item_mutex when calling.
+processor::saved_item processor::save_item(const string& key,
+                                           uint64_t hash) {
+    saved_item s { key, hash, false, {}, {}, {}, false };
+    const record* rec = items.find(key, hash);
+    if (rec) {
+        s.existed = true;
+        s.values = rec->get_values();
+        s.last_update = rec->last_update;
+        s.last_refresh = rec->last_refresh;
+        s.local = rec->local;
+    }
+    return s;
+}
+
+// Put an item back as it was before a write in an atomic batch.  The
+// restored values are logged as a new change, since the write was
+// logged too.  Must hold item_mutex when calling.
+void processor::restore_item(const saved_item& s) {
+    record* rec = items.find(s.key, s.hash);
+    if (!s.existed) {
+        if (rec) {
+            next_change(*rec);
+            items.erase(rec);
+        }
+        return;
+    }
+    if (!rec) rec = items.insert(s.key, s.hash);
+    uint64_t seq = next_change(*rec);
+    rec = items.set_values(rec, s.values);
+    rec->seq = seq;
+    rec->last_update = s.last_update;
+    rec->last_refresh = s.last_refresh;
+    rec->local = s.local;
+    touch(*rec);
+    reschedule(*rec);
+    if (rec->is_scheduled())
+        arm_proc_timer(rec->get_deadline());
+}
+
+size_t processor::write(const write_batch<string, string>& batch) {
+    vector<uint64_t> hashes;
+    hashes.reserve(batch.size());
+    for (auto& op : batch.get_operations()) {
+        hashes.push_back(hash_key(config.key_hash, op.key));
+        fault_in(op.key, hashes.back());
+    }
+    wait_for_writer();
+
+    // Apply the whole batch under one acquisition of the lock, so
+    // readers see all of it or none of it
+    write_batch<string, string> applied(batch.is_atomic());
+    std::shared_ptr<write_behind> w;
+    uint64_t seq = 0;
+    {
+        std::lock_guard<std::mutex> guard(item_mutex);
+        w = writer;
+        uint64_t first_change = change_seq + 1;
+        auto queue = [&]() {
+            if (w && !applied.empty()) {
+                seq = w->enqueue(applied);
+                track_unflushed(seq, first_change);
+            }
+        };
+        bool atomic = batch.is_atomic();
+        vector<saved_item> saved;
+        size_t i = 0;
+        try {
+            for (auto& op : batch.get_operations()) {
+                uint64_t hash = hashes[i++];
+                saved_item before;
+                if (atomic) before = save_item(op.key, hash);
+                versioned_t written { nullptr, {} };
+                bool r;
+                if (op.erase) {
+                    r = apply_erase(op.key, hash, op.value.get_version());
+                    if (r) applied.erase(op.key, op.value.get_version());
+                } else {
+                    r = apply_put(op.key, hash, op.value, true, written);
+                    if (r) applied.put(op.key, std::move(written));
+                }
+                if (atomic) {
+                    if (r) saved.push_back(std::move(before));
+                } else {
+                    notify(op.key, true);
+                }
+            }
+        } catch (...) {
+            if (atomic) {
+                // Undo the writes already applied, latest first, so
+                // that none of the batch is visible
+                for (auto it = saved.rbegin(); it != saved.rend(); ++it)
+                    restore_item(*it);
+                throw;
+            }
+            // The writes already applied stay applied, so they must
+            // still reach the delegate
+            queue();
+            if (delegate && !w && !applied.empty())
+                delegate->write(applied);
+            throw;
+        }
+        queue();
+        if (atomic) {
+            for (auto& op : batch.get_operations())
+                notify(op.key, true);
+        }
+    }
+
+    if (delegate && !applied.empty()) {
+        if (!w)
+            delegate->write(applied);
+        else if (config.durability == durability_mode::SYNC)
+            w->sync(seq, applied.size());
+    }
+    return applied.size();
+}
+
+size_t processor::get_memory_usage() {
+    std::lock_guard<std::mutex> guard(item_mutex);
+    return memory_used();
+}
+
+cache_stats processor::get_cache_stats() {
+    std::lock_guard<std::mutex> guard(item_mutex);
+    return stats;
+}
+
 const string& processor::get_name() const {
     if (delegate)
         return delegate->get_name();
@@ -159,10 +1006,218 @@ const string& processor::get_name() const {
 }
 
 void processor::visit(store_visitor visitor) {
+    if (tiered) return visit_tiered("", visitor);
+    std::lock_guard<std::mutex> guard(item_mutex);
+    items.for_each([&visitor](const record& r) {
+            visitor(r.get_key(), r.get_values());
+        });
+}
+
+void processor::visit_prefix(const string& prefix, store_visitor visitor) {
+    if (tiered) return visit_tiered(prefix, visitor);
     std::lock_guard<std::mutex> guard(item_mutex);
-    auto& key_index = item_map.get<key_tag>();
-    for (auto& i : key_index) {
-        visitor(i.key, i.details->values);
+    items.for_each_prefix(prefix, [&visitor](const record& r) {
+            visitor(r.get_key(), r.get_values());
+        });
+}
+
+// Visit the items of a tiered store in memory, and then the items
+// in the delegate that were not in memory.  Evicted items are clean,
+// so the delegate has their current values.
+void processor::visit_tiered(const string& prefix, store_visitor& visitor) {
+    std::unordered_set<string> visited;
+    {
+        std::lock_guard<std::mutex> guard(item_mutex);
+        items.for_each_prefix(prefix, [&](const record& r) {
+                string key = r.get_key();
+                visitor(key, r.get_values());
+                visited.insert(std::move(key));
+            });
+    }
+    delegate->visit_prefix(prefix, [&](const string& key,
+                                       const vector<versioned_t>& values) {
+            if (!visited.count(key))
+                visitor(key, values);
+        });
+}
+
+// *********
+// snapshots
+// *********
+
+class processor::snapshot_impl : public store_snapshot<string, string> {
+public:
+    snapshot_impl(processor& p_, uint64_t seq_) : p(p_), seq(seq_) { }
+    virtual ~snapshot_impl() {
+        p.release_snapshot(seq);
+    }
+
+    virtual vector<versioned_t> get(const string& key) override {
+        uint64_t hash = hash_key(p.config.key_hash, key);
+        std::lock_guard<std::mutex> guard(p.item_mutex);
+        return p.get_at(key, hash, seq);
+    }
+
+    virtual void visit(store_visitor visitor) override {
+        p.visit_at(seq, visitor);
+    }
+
+    virtual void visit_sorted(store_visitor visitor) override {
+        p.visit_at(seq, visitor, true);
+    }
+
+private:
+    processor& p;
+    uint64_t seq;
+};
+
+unique_ptr<store_snapshot<string, string>> processor::snapshot() {
+    std::lock_guard<std::mutex> guard(item_mutex);
+    snapshots.insert(change_seq);
+    return unique_ptr<store_snapshot<string, string>>
+        (new snapshot_impl(*this, change_seq));
+}
+
+void processor::release_snapshot(uint64_t seq) {
+    std::lock_guard<std::mutex> guard(item_mutex);
+    snapshots.erase(snapshots.find(seq));
+
+    // Versions superseded at or before the oldest live snapshot can
+    // no longer be seen
+    uint64_t oldest = snapshots.empty() ? change_seq : *snapshots.begin();
+    while (!history_order.empty() && history_order.front().first <= oldest) {
+        auto it = history.find(history_order.front().second);
+        it->second.pop_front();
+        if (it->second.empty())
+            history.erase(it);
+        history_order.pop_front();
+    }
+}
+
+// must hold item_mutex when calling
+vector<versioned<string>> processor::get_at(const string& key,
+                                            uint64_t hash, uint64_t seq) {
+    record* r = items.find(key, hash);
+    if (r && r->seq <= seq)
+        return r->get_values();
+
+    auto it = history.find(key);
+    if (it != history.end()) {
+        for (auto& v : it->second) {
+            if (v.from <= seq && seq < v.to)
+                return v.values;
+        }
+    }
+    return vector<versioned<string>>();
+}
+
+uint64_t processor::new_epoch() {
+    std::random_device rd;
+    uint64_t epoch = 0;
+    while (epoch == 0)
+        epoch = ((uint64_t)rd() << 32) | rd();
+    return epoch;
+}
+
+store_changes<string, string>
+processor::changes_since(uint64_t epoch, uint64_t seq, size_t limit) {
+    store_changes<string, string> result;
+    result.epoch = change_epoch;
+    std::unique_lock<std::mutex> guard(item_mutex);
+
+    bool same_run = epoch == change_epoch || (epoch == 0 && seq == 0);
+    if (!same_run || seq < truncated_seq || seq > change_seq) {
+        // The consumer is too far behind, or the sequence number is
+        // from an earlier run; resynchronize it from a snapshot
+        uint64_t snap = change_seq;
+        snapshots.insert(snap);
+        guard.unlock();
+
+        result.reset = true;
+        result.next_seq = snap;
+        visit_at(snap, [&result](const string& key,
+                                 const vector<versioned_t>& values) {
+                result.changes.emplace_back(key, values);
+            });
+        release_snapshot(snap);
+        return result;
+    }
+
+    // The log has no gaps, so the change after seq is at a fixed
+    // offset from the start
+    result.next_seq = seq;
+    std::unordered_set<string> seen;
+    size_t i = seq - truncated_seq;
+    for (; i < change_log.size() && result.changes.size() < limit; i++) {
+        auto& e = change_log[(change_log_head + i) % change_log.size()];
+        if (seen.insert(e.second).second) {
+            record* r = items.find(e.second,
+                                   hash_key(config.key_hash, e.second));
+            result.changes.emplace_back(e.second, r ? r->get_values()
+                                        : vector<versioned_t>());
+        }
+        result.next_seq = e.first;
+    }
+    result.more = i < change_log.size();
+    return result;
+}
+
+// Maximum number of keys resolved in a snapshot visit for each
+// acquisition of item_mutex
+static const size_t VISIT_BATCH_SIZE = 256;
+
+void processor::visit_at(uint64_t seq, store_visitor visitor,
+                         bool sorted) {
+    // Only the keys are collected while holding the lock over the
+    // whole store; values are resolved in batches and the visitor
+    // runs without the lock.
+    vector<std::pair<string, uint64_t>> keys;
+    size_t in_memory;
+    {
+        std::lock_guard<std::mutex> guard(item_mutex);
+        items.for_each([&keys, seq](const record& r) {
+                if (r.seq <= seq)
+                    keys.emplace_back(r.get_key(), r.get_key_hash());
+            });
+        in_memory = keys.size();
+        for (auto& h : history) {
+            // An item that was evicted and read back in may be both
+            // in memory and in the history
+            uint64_t hash = hash_key(config.key_hash, h.first);
+            const record* r = items.find(h.first, hash);
+            if (r && r->seq <= seq) continue;
+            for (auto& v : h.second) {
+                if (v.from <= seq && seq < v.to) {
+                    keys.emplace_back(h.first, hash);
+                    break;
+                }
+            }
+        }
+    }
+
+    if (sorted) {
+        // A radix tree index already visits the items in memory in
+        // key order, so only the keys from the history need sorting
+        auto middle = keys.begin() + in_memory;
+        if (config.key_index != key_index_type::RADIX_TREE)
+            std::sort(keys.begin(), middle);
+        std::sort(middle, keys.end());
+        std::inplace_merge(keys.begin(), middle, keys.end());
+    }
+
+    vector<vector<versioned_t>> values;
+    for (size_t i = 0; i < keys.size(); i += VISIT_BATCH_SIZE) {
+        size_t end = std::min(keys.size(), i + VISIT_BATCH_SIZE);
+        values.clear();
+        {
+            std::lock_guard<std::mutex> guard(item_mutex);
+            for (size_t j = i; j < end; j++)
+                values.push_back(get_at(keys[j].first, keys[j].second, seq));
+        }
+        for (size_t j = i; j < end; j++) {
+            if (!values[j - i].empty())
+                visitor(keys[j].first, values[j - i]);
+        }
     }
 }
 
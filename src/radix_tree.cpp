@@ -0,0 +1,684 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for radix_tree class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "radix_tree.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace throng {
+namespace internal {
+
+/*
+ * Number of prefix bytes stored in each inner node.  Longer prefixes
+ * are still skipped in a single step, but the bytes beyond this are
+ * checked against the key of any value below the node.
+ */
+static const uint32_t MAX_PREFIX = 8;
+
+enum node_type : uint8_t {
+    NODE4,
+    NODE16,
+    NODE48,
+    NODE256
+};
+
+/*
+ * Inner nodes.  Besides its children, each node has a terminal slot
+ * for the value whose key ends at the node, which lets one key be a
+ * prefix of another without a terminator byte.  Node4 and node16
+ * keep their keys sorted; node48 maps each byte to a slot in its
+ * child array, offset by one so that zero means no child.
+ */
+struct radix_tree::node {
+    uint8_t type;
+    uint16_t num_children;
+    uint32_t prefix_len;
+    char prefix[MAX_PREFIX];
+    child_t terminal;
+};
+
+struct radix_tree::node4 : public node {
+    uint8_t keys[4];
+    child_t children[4];
+};
+
+struct radix_tree::node16 : public node {
+    uint8_t keys[16];
+    child_t children[16];
+};
+
+struct radix_tree::node48 : public node {
+    uint8_t index[256];
+    child_t children[48];
+};
+
+struct radix_tree::node256 : public node {
+    child_t children[256];
+};
+
+static bool is_leaf(uintptr_t c) {
+    return c & 1;
+}
+
+static void* to_value(uintptr_t c) {
+    return reinterpret_cast<void*>(c & ~(uintptr_t)1);
+}
+
+static uintptr_t from_value(const void* v) {
+    return reinterpret_cast<uintptr_t>(v) | 1;
+}
+
+static bool key_equals(const radix_tree::key_ref& k,
+                       const char* key, size_t len) {
+    return k.size == len && std::memcmp(k.data, key, len) == 0;
+}
+
+radix_tree::radix_tree(slab_allocator& allocator_, key_fn get_key_)
+    : allocator(allocator_), get_key(get_key_) { }
+
+radix_tree::~radix_tree() {
+    destroy(root);
+}
+
+size_t radix_tree::node_size(uint8_t type) {
+    switch (type) {
+    case NODE4: return sizeof(node4);
+    case NODE16: return sizeof(node16);
+    case NODE48: return sizeof(node48);
+    default: return sizeof(node256);
+    }
+}
+
+radix_tree::node* radix_tree::new_node(uint8_t type) {
+    size_t size = node_size(type);
+    void* p = allocator.allocate(size);
+    std::memset(p, 0, size);
+    node* n = static_cast<node*>(p);
+    n->type = type;
+    return n;
+}
+
+void radix_tree::free_node(node* n) {
+    allocator.deallocate(n, node_size(n->type));
+}
+
+void radix_tree::destroy(child_t c) {
+    if (!c || is_leaf(c)) return;
+    node* n = reinterpret_cast<node*>(c);
+    uint8_t byte;
+    while (n->num_children > 0) {
+        destroy(first_child(n, &byte));
+        remove_child(n, byte);
+    }
+    free_node(n);
+}
+
+radix_tree::child_t* radix_tree::find_child(node* n, uint8_t byte) {
+    switch (n->type) {
+    case NODE4: {
+        node4* n4 = static_cast<node4*>(n);
+        for (unsigned i = 0; i < n->num_children; i++)
+            if (n4->keys[i] == byte) return &n4->children[i];
+        return nullptr;
+    }
+    case NODE16: {
+        node16* n16 = static_cast<node16*>(n);
+        for (unsigned i = 0; i < n->num_children; i++)
+            if (n16->keys[i] == byte) return &n16->children[i];
+        return nullptr;
+    }
+    case NODE48: {
+        node48* n48 = static_cast<node48*>(n);
+        uint8_t i = n48->index[byte];
+        return i ? &n48->children[i - 1] : nullptr;
+    }
+    default: {
+        node256* n256 = static_cast<node256*>(n);
+        return n256->children[byte] ? &n256->children[byte] : nullptr;
+    }
+    }
+}
+
+radix_tree::child_t radix_tree::first_child(const node* n, uint8_t* byte) {
+    switch (n->type) {
+    case NODE4: {
+        const node4* n4 = static_cast<const node4*>(n);
+        *byte = n4->keys[0];
+        return n4->children[0];
+    }
+    case NODE16: {
+        const node16* n16 = static_cast<const node16*>(n);
+        *byte = n16->keys[0];
+        return n16->children[0];
+    }
+    case NODE48: {
+        const node48* n48 = static_cast<const node48*>(n);
+        for (unsigned b = 0; b < 256; b++) {
+            if (n48->index[b]) {
+                *byte = (uint8_t)b;
+                return n48->children[n48->index[b] - 1];
+            }
+        }
+        return 0;
+    }
+    default: {
+        const node256* n256 = static_cast<const node256*>(n);
+        for (unsigned b = 0; b < 256; b++) {
+            if (n256->children[b]) {
+                *byte = (uint8_t)b;
+                return n256->children[b];
+            }
+        }
+        return 0;
+    }
+    }
+}
+
+void radix_tree::remove_child(node* n, uint8_t byte) {
+    switch (n->type) {
+    case NODE4:
+    case NODE16: {
+        uint8_t* keys;
+        child_t* children;
+        if (n->type == NODE4) {
+            keys = static_cast<node4*>(n)->keys;
+            children = static_cast<node4*>(n)->children;
+        } else {
+            keys = static_cast<node16*>(n)->keys;
+            children = static_cast<node16*>(n)->children;
+        }
+        unsigned i = 0;
+        while (keys[i] != byte) i += 1;
+        unsigned rest = n->num_children - i - 1;
+        std::memmove(keys + i, keys + i + 1, rest);
+        std::memmove(children + i, children + i + 1, rest * sizeof(child_t));
+        break;
+    }
+    case NODE48: {
+        node48* n48 = static_cast<node48*>(n);
+        n48->children[n48->index[byte] - 1] = 0;
+        n48->index[byte] = 0;
+        break;
+    }
+    default:
+        static_cast<node256*>(n)->children[byte] = 0;
+        break;
+    }
+    n->num_children -= 1;
+}
+
+// Insert into the sorted key array of a node4 or node16 with room
+static void insert_sorted(uint8_t* keys, uintptr_t* children,
+                          unsigned count, uint8_t byte, uintptr_t child) {
+    unsigned i = 0;
+    while (i < count && keys[i] < byte) i += 1;
+    std::memmove(keys + i + 1, keys + i, count - i);
+    std::memmove(children + i + 1, children + i,
+                 (count - i) * sizeof(uintptr_t));
+    keys[i] = byte;
+    children[i] = child;
+}
+
+void radix_tree::add_child(child_t* ref, uint8_t byte, child_t child) {
+    node* n = reinterpret_cast<node*>(*ref);
+    switch (n->type) {
+    case NODE4: {
+        node4* n4 = static_cast<node4*>(n);
+        if (n->num_children < 4) {
+            insert_sorted(n4->keys, n4->children, n->num_children,
+                          byte, child);
+            break;
+        }
+        node16* nn = static_cast<node16*>(new_node(NODE16));
+        static_cast<node&>(*nn) = *n;
+        nn->type = NODE16;
+        std::memcpy(nn->keys, n4->keys, sizeof(n4->keys));
+        std::memcpy(nn->children, n4->children, sizeof(n4->children));
+        free_node(n);
+        *ref = reinterpret_cast<child_t>(nn);
+        add_child(ref, byte, child);
+        return;
+    }
+    case NODE16: {
+        node16* n16 = static_cast<node16*>(n);
+        if (n->num_children < 16) {
+            insert_sorted(n16->keys, n16->children, n->num_children,
+                          byte, child);
+            break;
+        }
+        node48* nn = static_cast<node48*>(new_node(NODE48));
+        static_cast<node&>(*nn) = *n;
+        nn->type = NODE48;
+        for (unsigned i = 0; i < 16; i++) {
+            nn->index[n16->keys[i]] = (uint8_t)(i + 1);
+            nn->children[i] = n16->children[i];
+        }
+        free_node(n);
+        *ref = reinterpret_cast<child_t>(nn);
+        add_child(ref, byte, child);
+        return;
+    }
+    case NODE48: {
+        node48* n48 = static_cast<node48*>(n);
+        if (n->num_children < 48) {
+            unsigned i = 0;
+            while (n48->children[i]) i += 1;
+            n48->children[i] = child;
+            n48->index[byte] = (uint8_t)(i + 1);
+            break;
+        }
+        node256* nn = static_cast<node256*>(new_node(NODE256));
+        static_cast<node&>(*nn) = *n;
+        nn->type = NODE256;
+        for (unsigned b = 0; b < 256; b++) {
+            if (n48->index[b])
+                nn->children[b] = n48->children[n48->index[b] - 1];
+        }
+        free_node(n);
+        *ref = reinterpret_cast<child_t>(nn);
+        add_child(ref, byte, child);
+        return;
+    }
+    default:
+        static_cast<node256*>(n)->children[byte] = child;
+        break;
+    }
+    n->num_children += 1;
+}
+
+// Collapse or downsize a node after removing an entry from it
+void radix_tree::shrink(child_t* ref) {
+    node* n = reinterpret_cast<node*>(*ref);
+
+    if (n->num_children == 0) {
+        *ref = n->terminal;
+        free_node(n);
+        return;
+    }
+    if (n->num_children == 1 && !n->terminal) {
+        uint8_t byte;
+        child_t c = first_child(n, &byte);
+        if (!is_leaf(c)) {
+            // fold this node's prefix and the edge byte into the
+            // child's prefix
+            node* cn = reinterpret_cast<node*>(c);
+            char buf[MAX_PREFIX];
+            uint32_t k = 0;
+            for (uint32_t i = 0;
+                 i < std::min(n->prefix_len, MAX_PREFIX) && k < MAX_PREFIX;
+                 i++)
+                buf[k++] = n->prefix[i];
+            if (k < MAX_PREFIX)
+                buf[k++] = (char)byte;
+            for (uint32_t i = 0;
+                 i < std::min(cn->prefix_len, MAX_PREFIX) && k < MAX_PREFIX;
+                 i++)
+                buf[k++] = cn->prefix[i];
+            std::memcpy(cn->prefix, buf, k);
+            cn->prefix_len += n->prefix_len + 1;
+        }
+        *ref = c;
+        free_node(n);
+        return;
+    }
+
+    // Downsize with some hysteresis relative to the growth
+    // thresholds so that a node at a boundary does not flap
+    switch (n->type) {
+    case NODE16:
+        if (n->num_children <= 3) {
+            node16* n16 = static_cast<node16*>(n);
+            node4* nn = static_cast<node4*>(new_node(NODE4));
+            static_cast<node&>(*nn) = *n;
+            nn->type = NODE4;
+            std::memcpy(nn->keys, n16->keys, n->num_children);
+            std::memcpy(nn->children, n16->children,
+                        n->num_children * sizeof(child_t));
+            free_node(n);
+            *ref = reinterpret_cast<child_t>(nn);
+        }
+        break;
+    case NODE48:
+        if (n->num_children <= 12) {
+            node48* n48 = static_cast<node48*>(n);
+            node16* nn = static_cast<node16*>(new_node(NODE16));
+            static_cast<node&>(*nn) = *n;
+            nn->type = NODE16;
+            unsigned j = 0;
+            for (unsigned b = 0; b < 256; b++) {
+                if (n48->index[b]) {
+                    nn->keys[j] = (uint8_t)b;
+                    nn->children[j] = n48->children[n48->index[b] - 1];
+                    j += 1;
+                }
+            }
+            free_node(n);
+            *ref = reinterpret_cast<child_t>(nn);
+        }
+        break;
+    case NODE256:
+        if (n->num_children <= 37) {
+            node256* n256 = static_cast<node256*>(n);
+            node48* nn = static_cast<node48*>(new_node(NODE48));
+            static_cast<node&>(*nn) = *n;
+            nn->type = NODE48;
+            unsigned j = 0;
+            for (unsigned b = 0; b < 256; b++) {
+                if (n256->children[b]) {
+                    nn->index[b] = (uint8_t)(j + 1);
+                    nn->children[j] = n256->children[b];
+                    j += 1;
+                }
+            }
+            free_node(n);
+            *ref = reinterpret_cast<child_t>(nn);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+radix_tree::child_t radix_tree::minimum(child_t c) const {
+    uint8_t byte;
+    while (!is_leaf(c)) {
+        const node* n = reinterpret_cast<const node*>(c);
+        // the terminal key is a prefix of every key below the node
+        if (n->terminal) return n->terminal;
+        c = first_child(n, &byte);
+    }
+    return c;
+}
+
+radix_tree::key_ref radix_tree::key_of(child_t c) const {
+    return get_key(to_value(minimum(c)));
+}
+
+// Returns the number of bytes of the node prefix that match the key
+// starting at depth, which is less than the prefix length if there is
+// a mismatch or the key ends within the prefix
+uint32_t radix_tree::prefix_mismatch(const node* n,
+                                     const char* key, size_t len,
+                                     size_t depth) const {
+    uint32_t limit = n->prefix_len;
+    if (depth + limit > len) limit = (uint32_t)(len - depth);
+
+    uint32_t i = 0;
+    uint32_t stored = std::min(limit, MAX_PREFIX);
+    for (; i < stored; i++) {
+        if (n->prefix[i] != key[depth + i]) return i;
+    }
+    if (i < limit) {
+        key_ref m = key_of(reinterpret_cast<child_t>(n));
+        for (; i < limit; i++) {
+            if (m.data[depth + i] != key[depth + i]) return i;
+        }
+    }
+    return i;
+}
+
+radix_tree::child_t* radix_tree::find_slot(const char* key,
+                                           size_t len) const {
+    child_t* ref = const_cast<child_t*>(&root);
+    size_t depth = 0;
+    while (*ref) {
+        child_t c = *ref;
+        if (is_leaf(c))
+            return key_equals(get_key(to_value(c)), key, len) ? ref : nullptr;
+
+        node* n = reinterpret_cast<node*>(c);
+        if (n->prefix_len) {
+            if (prefix_mismatch(n, key, len, depth) != n->prefix_len)
+                return nullptr;
+            depth += n->prefix_len;
+        }
+        if (depth == len)
+            return n->terminal ? &n->terminal : nullptr;
+
+        ref = find_child(n, (uint8_t)key[depth]);
+        if (!ref) return nullptr;
+        depth += 1;
+    }
+    return nullptr;
+}
+
+void* radix_tree::find(const char* key, size_t len) const {
+    child_t* slot = find_slot(key, len);
+    return slot ? to_value(*slot) : nullptr;
+}
+
+void radix_tree::insert(void* value) {
+    key_ref k = get_key(value);
+    child_t leaf = from_value(value);
+    child_t* ref = &root;
+    size_t depth = 0;
+
+    for (;;) {
+        child_t c = *ref;
+        if (!c) {
+            *ref = leaf;
+            break;
+        }
+
+        if (is_leaf(c)) {
+            // lazy expansion: split the leaf into a node at the
+            // first byte where the keys differ
+            key_ref e = get_key(to_value(c));
+            size_t i = depth;
+            while (i < e.size && i < k.size && e.data[i] == k.data[i])
+                i += 1;
+
+            node* n = new_node(NODE4);
+            n->prefix_len = (uint32_t)(i - depth);
+            std::memcpy(n->prefix, k.data + depth,
+                        std::min(n->prefix_len, MAX_PREFIX));
+            *ref = reinterpret_cast<child_t>(n);
+            if (i == e.size)
+                n->terminal = c;
+            else
+                add_child(ref, (uint8_t)e.data[i], c);
+            if (i == k.size)
+                n->terminal = leaf;
+            else
+                add_child(ref, (uint8_t)k.data[i], leaf);
+            break;
+        }
+
+        node* n = reinterpret_cast<node*>(c);
+        if (n->prefix_len) {
+            uint32_t p = prefix_mismatch(n, k.data, k.size, depth);
+            if (p < n->prefix_len) {
+                // split the prefix with a new node at the mismatch
+                node* nn = new_node(NODE4);
+                nn->prefix_len = p;
+                std::memcpy(nn->prefix, n->prefix, std::min(p, MAX_PREFIX));
+
+                uint8_t byte;
+                if (n->prefix_len <= MAX_PREFIX) {
+                    byte = (uint8_t)n->prefix[p];
+                    n->prefix_len -= p + 1;
+                    std::memmove(n->prefix, n->prefix + p + 1,
+                                 n->prefix_len);
+                } else {
+                    key_ref m = key_of(c);
+                    byte = (uint8_t)m.data[depth + p];
+                    n->prefix_len -= p + 1;
+                    std::memcpy(n->prefix, m.data + depth + p + 1,
+                                std::min(n->prefix_len, MAX_PREFIX));
+                }
+
+                *ref = reinterpret_cast<child_t>(nn);
+                add_child(ref, byte, c);
+                if (depth + p == k.size)
+                    nn->terminal = leaf;
+                else
+                    add_child(ref, (uint8_t)k.data[depth + p], leaf);
+                break;
+            }
+            depth += n->prefix_len;
+        }
+
+        if (depth == k.size) {
+            n->terminal = leaf;
+            break;
+        }
+        child_t* next = find_child(n, (uint8_t)k.data[depth]);
+        if (!next) {
+            add_child(ref, (uint8_t)k.data[depth], leaf);
+            break;
+        }
+        ref = next;
+        depth += 1;
+    }
+    count += 1;
+}
+
+void radix_tree::replace(const void* old_value, void* new_value) {
+    key_ref k = get_key(old_value);
+    child_t* slot = find_slot(k.data, k.size);
+    if (slot) *slot = from_value(new_value);
+}
+
+bool radix_tree::erase(child_t* ref, const char* key, size_t len,
+                       size_t depth) {
+    child_t c = *ref;
+    if (!c) return false;
+    if (is_leaf(c)) {
+        if (!key_equals(get_key(to_value(c)), key, len)) return false;
+        *ref = 0;
+        return true;
+    }
+
+    node* n = reinterpret_cast<node*>(c);
+    if (n->prefix_len) {
+        if (prefix_mismatch(n, key, len, depth) != n->prefix_len)
+            return false;
+        depth += n->prefix_len;
+    }
+    if (depth == len) {
+        if (!n->terminal) return false;
+        n->terminal = 0;
+        shrink(ref);
+        return true;
+    }
+
+    uint8_t byte = (uint8_t)key[depth];
+    child_t* next = find_child(n, byte);
+    if (!next) return false;
+    if (is_leaf(*next)) {
+        if (!key_equals(get_key(to_value(*next)), key, len)) return false;
+        remove_child(n, byte);
+        shrink(ref);
+        return true;
+    }
+    return erase(next, key, len, depth + 1);
+}
+
+bool radix_tree::erase(const char* key, size_t len) {
+    if (!erase(&root, key, len, 0)) return false;
+    count -= 1;
+    return true;
+}
+
+void radix_tree::visit(child_t c, const visit_fn& fn) const {
+    if (is_leaf(c)) {
+        fn(to_value(c));
+        return;
+    }
+
+    const node* n = reinterpret_cast<const node*>(c);
+    if (n->terminal) fn(to_value(n->terminal));
+    switch (n->type) {
+    case NODE4: {
+        const node4* n4 = static_cast<const node4*>(n);
+        for (unsigned i = 0; i < n->num_children; i++)
+            visit(n4->children[i], fn);
+        break;
+    }
+    case NODE16: {
+        const node16* n16 = static_cast<const node16*>(n);
+        for (unsigned i = 0; i < n->num_children; i++)
+            visit(n16->children[i], fn);
+        break;
+    }
+    case NODE48: {
+        const node48* n48 = static_cast<const node48*>(n);
+        for (unsigned b = 0; b < 256; b++) {
+            if (n48->index[b])
+                visit(n48->children[n48->index[b] - 1], fn);
+        }
+        break;
+    }
+    default: {
+        const node256* n256 = static_cast<const node256*>(n);
+        for (unsigned b = 0; b < 256; b++) {
+            if (n256->children[b])
+                visit(n256->children[b], fn);
+        }
+        break;
+    }
+    }
+}
+
+void radix_tree::for_each(const visit_fn& fn) const {
+    if (root) visit(root, fn);
+}
+
+void radix_tree::for_each_prefix(const char* prefix, size_t len,
+                                 const visit_fn& fn) const {
+    child_t c = root;
+    size_t depth = 0;
+    while (c) {
+        if (is_leaf(c)) {
+            key_ref k = get_key(to_value(c));
+            if (k.size >= len && std::memcmp(k.data, prefix, len) == 0)
+                fn(to_value(c));
+            return;
+        }
+
+        node* n = reinterpret_cast<node*>(c);
+        if (n->prefix_len) {
+            uint32_t p = prefix_mismatch(n, prefix, len, depth);
+            if (depth + p == len) {
+                // the prefix ends within this node's prefix
+                visit(c, fn);
+                return;
+            }
+            if (p < n->prefix_len) return;
+            depth += n->prefix_len;
+        }
+        if (depth == len) {
+            visit(c, fn);
+            return;
+        }
+
+        child_t* next = find_child(n, (uint8_t)prefix[depth]);
+        if (!next) return;
+        c = *next;
+        depth += 1;
+    }
+}
+
+} /* namespace internal */
+} /* namespace throng */
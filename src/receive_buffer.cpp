@@ -0,0 +1,102 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for receive_buffer class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "receive_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace throng {
+namespace internal {
+
+const size_t receive_buffer::HEADER_SIZE;
+
+receive_buffer::receive_buffer(std::shared_ptr<io_buffer_pool> pool_,
+                               size_t max_frame_size_, size_t read_size_)
+    : pool(std::move(pool_)), max_frame_size(max_frame_size_),
+      read_size(read_size_) {
+}
+
+size_t receive_buffer::frame_size() const {
+    const uint8_t* p = storage.data() + begin;
+    return ((size_t)p[0] << 24) | ((size_t)p[1] << 16) |
+        ((size_t)p[2] << 8) | (size_t)p[3];
+}
+
+boost::asio::mutable_buffers_1 receive_buffer::prepare() {
+    if (begin == end)
+        begin = end = 0;
+
+    // Leave room for the rest of a frame that is larger than a read,
+    // so that it needs no further compaction
+    size_t needed = read_size;
+    if (size() >= HEADER_SIZE) {
+        size_t total = HEADER_SIZE + std::min(frame_size(), max_frame_size);
+        if (total > size())
+            needed = std::max(needed, total - size());
+    }
+
+    // Give back the memory held for an earlier large frame once the
+    // buffer is more than twice the size it needs
+    size_t wanted = std::max(size() + needed, io_buffer_pool::MIN_BUFFER_SIZE);
+    if (capacity() > 2 * wanted) {
+        reallocate(wanted);
+    } else if (capacity() - end < needed) {
+        if (begin > 0) {
+            std::memmove(storage.data(), storage.data() + begin, size());
+            end -= begin;
+            begin = 0;
+        }
+        if (capacity() - end < needed)
+            reallocate(end + needed);
+    }
+    return boost::asio::buffer(storage.data() + end, capacity() - end);
+}
+
+void receive_buffer::reallocate(size_t new_size) {
+    io_buffer_pool::buffer b = pool->acquire(new_size);
+    if (size() > 0)
+        std::memcpy(b.data(), storage.data() + begin, size());
+    end -= begin;
+    begin = 0;
+    storage = std::move(b);
+}
+
+receive_buffer::frame_status
+receive_buffer::next_frame(const uint8_t*& data, size_t& len) {
+    if (size() < HEADER_SIZE)
+        return frame_status::INCOMPLETE;
+    size_t body = frame_size();
+    if (body > max_frame_size)
+        return frame_status::OVERSIZED;
+    if (size() < HEADER_SIZE + body)
+        return frame_status::INCOMPLETE;
+
+    data = storage.data() + begin + HEADER_SIZE;
+    len = body;
+    begin += HEADER_SIZE + body;
+    return frame_status::COMPLETE;
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -27,7 +27,6 @@
 #include "throng_messages.pb.h"
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 
-#include <boost/asio/read.hpp>
 #include <boost/asio/write.hpp>
 #include <boost/asio/connect.hpp>
 
@@ -54,11 +53,15 @@ LOGGER("rpc");
 rpc_connection::rpc_connection(ctx_internal& ctx_,
                                uint64_t conn_id_,
                                std::shared_ptr<rpc_handler> handler_,
-                               stop_handler_type stop_handler_) :
+                               std::shared_ptr<io_buffer_pool> buffer_pool_,
+                               stop_handler_type stop_handler_,
+                               write_options options_) :
     ctx(ctx_), conn_id(conn_id_), handler(std::move(handler_)),
     stop_handler(std::move(stop_handler_)),
     strand(ctx.get_io_service()), socket(ctx.get_io_service()),
-    resolver(ctx.get_io_service()), next_xid(0) {
+    resolver(ctx.get_io_service()), next_xid(0),
+    buffer_pool(std::move(buffer_pool_)), read_buffer(buffer_pool),
+    options(options_), write_timer(ctx.get_io_service()) {
 
 }
 
@@ -151,6 +154,7 @@ void rpc_connection::stop() {
             LOG(INFO) << ctx.get_local_node_id() << ":" << get_conn_id()
                       << " Closing connection";
             socket.close();
+            write_timer.cancel();
             stop_handler(self);
         });
 }
@@ -158,21 +162,122 @@ void rpc_connection::stop() {
 void rpc_connection::send_message(message::rpc_message& m) {
     if (!m.has_xid()) m.set_xid(next_xid++);
 
-    auto writebuf = make_shared<vector<uint8_t>>();
     uint32_t msg_len = m.ByteSize();
-    writebuf->resize(4 + msg_len);
-    *((uint32_t*)&(*writebuf)[0]) = htonl(msg_len);
-    m.SerializeToArray(&(*writebuf)[4], msg_len);
+    frame_t frame = buffer_pool->acquire(4 + msg_len);
+    *((uint32_t*)frame.data()) = htonl(msg_len);
+    m.SerializeToArray(frame.data() + 4, msg_len);
+
+    // Only start the writer if it is idle; otherwise it takes the
+    // frame from the queue when the current write completes
+    bool start_writer = false;
+    bool batch_full = false;
+    {
+        std::lock_guard<std::mutex> guard(write_mutex);
+        if (write_queue.empty())
+            oldest_queued = steady_clock::now();
+        batch_full = queued_bytes < options.max_batch_size &&
+            queued_bytes + frame.size() >= options.max_batch_size;
+        queued_bytes += frame.size();
+        write_queue.push_back(std::move(frame));
+        start_writer = !write_active;
+        write_active = true;
+    }
+    if (start_writer) {
+        auto self = shared_from_this();
+        strand.dispatch([self, this]() { schedule_write(); });
+    } else if (batch_full && options.max_latency.count() > 0) {
+        // The writer may be waiting for more messages to join the
+        // batch; wake it now that the batch is full
+        auto self = shared_from_this();
+        strand.dispatch([self, this]() {
+                if (write_waiting) {
+                    write_waiting = false;
+                    write_timer.cancel();
+                }
+            });
+    }
+}
+
+void rpc_connection::schedule_write() {
+    time_point deadline;
+    {
+        std::lock_guard<std::mutex> guard(write_mutex);
+        if (write_queue.empty()) {
+            write_active = false;
+            return;
+        }
+        deadline = oldest_queued + options.max_latency;
+        if (queued_bytes >= options.max_batch_size ||
+            steady_clock::now() >= deadline) {
+            take_batch();
+            deadline = time_point();
+        }
+    }
+
+    if (deadline != time_point()) {
+        auto self = shared_from_this();
+        write_waiting = true;
+        write_timer.expires_at(deadline);
+        write_timer.async_wait(strand.wrap([self, this](const error_code& ec) {
+                    // The timer is also cancelled to write a batch
+                    // that filled up, rather than to stop
+                    bool woken = !write_waiting;
+                    write_waiting = false;
+                    if (ec && !woken) {
+                        clear_write_queue();
+                        return;
+                    }
+                    schedule_write();
+                }));
+        return;
+    }
+
+    vector<ba::const_buffer> buffers;
+    buffers.reserve(writing.size());
+    for (const frame_t& f : writing)
+        buffers.push_back(ba::buffer(f.data(), f.size()));
 
     auto self = shared_from_this();
-    auto do_write = [self, this, writebuf]() {
-        ba::async_write(socket, ba::buffer(*writebuf),
-                        [self, this, writebuf](const error_code& ec,
-                                               size_t bytes_transferred) {
-                            if (!ec) last_write = steady_clock::now();
-                        });
+    auto handle_write = [self, this](const error_code& ec, size_t len) {
+        // Returns the frames to the pool
+        writing.clear();
+        if (ec) {
+            if (ec != ba::error::operation_aborted && socket.is_open()) {
+                LOG(ERROR) << ctx.get_local_node_id() << ":" << get_conn_id()
+                           << " Could not write to socket: "
+                           << ec.message();
+                stop();
+            }
+            clear_write_queue();
+            return;
+        }
+        last_write = steady_clock::now();
+        schedule_write();
     };
-    strand.dispatch(do_write);
+    ba::async_write(socket, buffers, strand.wrap(handle_write));
+}
+
+void rpc_connection::take_batch() {
+    // Take whole frames up to the batch size, but always at least one
+    size_t bytes = 0;
+    while (!write_queue.empty() &&
+           (writing.empty() ||
+            bytes + write_queue.front().size() <= options.max_batch_size)) {
+        bytes += write_queue.front().size();
+        writing.push_back(std::move(write_queue.front()));
+        write_queue.pop_front();
+    }
+    queued_bytes -= bytes;
+}
+
+void rpc_connection::clear_write_queue() {
+    std::deque<frame_t> dropped;
+    {
+        std::lock_guard<std::mutex> guard(write_mutex);
+        dropped.swap(write_queue);
+        queued_bytes = 0;
+        write_active = false;
+    }
 }
 
 void rpc_connection::send_error_message(uint64_t xid,
@@ -192,49 +297,53 @@ void rpc_connection::send_error_message(uint64_t xid,
 
 void rpc_connection::read_message() {
     auto self = shared_from_this();
-    buffer.resize(4);
-    auto handle_size = [self, this](const error_code& ec, size_t len) {
+    auto handle_read = [self, this](const error_code& ec, size_t len) {
         if (ec) {
             if (ec != ba::error::operation_aborted) {
                 LOG(ERROR) << ctx.get_local_node_id() << ":" << get_conn_id()
-                          << " Could not read from socket: "
-                          << ec.message();
+                           << " Could not read from socket: "
+                           << ec.message();
                 stop();
             }
             return;
         }
 
-        size_t msg_len = ntohl(*(uint32_t*)(&buffer[0]));
-        if (len > 1024*1024*64) {
+        read_buffer.commit(len);
+        last_read = steady_clock::now();
+        if (handle_frames())
+            read_message();
+    };
+    socket.async_read_some(read_buffer.prepare(), strand.wrap(handle_read));
+}
+
+bool rpc_connection::handle_frames() {
+    const uint8_t* data;
+    size_t len;
+    while (true) {
+        switch (read_buffer.next_frame(data, len)) {
+        case receive_buffer::frame_status::INCOMPLETE:
+            return true;
+        case receive_buffer::frame_status::OVERSIZED:
             LOG(ERROR) << ctx.get_local_node_id() << ":" << get_conn_id()
-                       << " Invalid message length: " << msg_len;
+                       << " Invalid message length";
             stop();
-            return;
+            return false;
+        case receive_buffer::frame_status::COMPLETE:
+            break;
         }
-        buffer.resize(msg_len);
 
-        auto handle_body = [self, this](const error_code& ec, size_t len) {
-            if (ec) {
-                if (ec != ba::error::operation_aborted) {
-                    LOG(ERROR) << ctx.get_local_node_id() << ":" << get_conn_id()
-                               << " Could not read from socket: "
-                               << ec.message();
-                    stop();
-                }
-                return;
-            }
-
-            message::rpc_message m;
-            google::protobuf::io::ArrayInputStream s(&buffer[0], buffer.size());
-            m.ParseFromZeroCopyStream(&s);
-            handler->handle_message(*this, m);
-            last_read = steady_clock::now();
-            read_message();
-        };
-
-        ba::async_read(socket, ba::buffer(buffer), strand.wrap(handle_body));
-    };
-    ba::async_read(socket, ba::buffer(buffer), strand.wrap(handle_size));
+        read_msg.Clear();
+        google::protobuf::io::ArrayInputStream s(data, len);
+        if (!read_msg.ParseFromZeroCopyStream(&s)) {
+            LOG(ERROR) << ctx.get_local_node_id() << ":" << get_conn_id()
+                       << " Could not parse message of length " << len;
+            stop();
+            return false;
+        }
+        handler->handle_message(*this, read_msg);
+        // The handler may have stopped the connection
+        if (!socket.is_open()) return false;
+    }
 }
 
 } /* namespace internal */
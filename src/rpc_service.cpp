@@ -41,6 +41,7 @@ static const singleton_task::duration_type MANAGE_CONNS_INTERVAL(3000);
 rpc_service::rpc_service(ctx_internal& ctx_,
                          handler_factory_t& handler_factory_)
     : ctx(ctx_), handler_factory(handler_factory_),
+      buffer_pool(make_shared<io_buffer_pool>()),
       running(false), next_conn_id(0), acceptor(ctx.get_io_service()),
       manage_conns_task(ctx.get_io_service(),
                      std::bind(&rpc_service::manage_conns, this)) {
@@ -128,7 +129,9 @@ rpc_connection_p rpc_service::new_conn(const node_id& remote_node_id) {
     handler->add_ready_listener(handle_ready);
     auto conn = make_shared<rpc_connection>(ctx, next_conn_id++,
                                             std::move(handler),
-                                            std::move(handle_stop));
+                                            buffer_pool,
+                                            std::move(handle_stop),
+                                            write_options);
     return conn;
 }
 
@@ -36,7 +36,9 @@ using boost::system::error_code;
 
 singleton_task::singleton_task(boost::asio::io_service& io_service_,
                                std::function<void()> task)
-    : task(std::move(task)), task_timer(io_service_) { }
+    : state(make_shared<task_state>()), task_timer(io_service_) {
+    state->task = std::move(task);
+}
 singleton_task::~singleton_task() {
     cancel();
 }
@@ -44,20 +46,21 @@ singleton_task::~singleton_task() {
 singleton_task::task_instance::task_instance(singleton_task& parent_,
                                              time_point first_sched_,
                                              time_point next_sched_)
-    : parent(parent_), first_sched(first_sched_),
+    : parent(parent_), state(parent_.state), first_sched(first_sched_),
       next_sched(next_sched_) { }
 
 void singleton_task::task_instance::run() {
     {
-        std::lock_guard<std::mutex> guard(parent.task_mutex);
-        if (canceled || !parent.task_should_run)
+        std::lock_guard<std::mutex> guard(state->task_mutex);
+        if (canceled || !state->task_should_run)
             return;
 
-        parent.task_running = true;
-        parent.task_should_run = false;
+        state->task_running = true;
+        state->task_should_run = false;
+        state->task_thread = std::this_thread::get_id();
     }
     try {
-        parent.task();
+        state->task();
     } catch (const std::exception& e) {
         LOG(ERROR) << "Exception while running task: "
                    << e.what();
@@ -66,10 +69,14 @@ void singleton_task::task_instance::run() {
     }
 
     {
-        std::lock_guard<std::mutex> guard(parent.task_mutex);
-
-        parent.task_running = false;
-        if (parent.task_should_run) {
+        std::lock_guard<std::mutex> guard(state->task_mutex);
+
+        state->task_running = false;
+        state->task_thread = std::thread::id();
+        state->task_done.notify_all();
+        // cancel() waits for the running instance, so the parent is
+        // still alive here
+        if (state->task_should_run && !state->task_canceling) {
             first_sched = steady_clock::now();
             sched();
         }
@@ -86,14 +93,14 @@ void singleton_task::task_instance::sched() {
 
 void singleton_task::schedule(duration_type delay, duration_type max_delay) {
     {
-        std::lock_guard<std::mutex> guard(task_mutex);
+        std::lock_guard<std::mutex> guard(state->task_mutex);
         bool need_queue = true;
         time_point now = steady_clock::now();
         time_point next_sched = now + delay;
         time_point first_sched = now;
 
-        if (task_running || task_should_run) {
-            if (task_running) {
+        if (state->task_running || state->task_should_run) {
+            if (state->task_running) {
                 // reschedule task to run again after current instance
                 // finishes
                 instance->next_sched = next_sched;
@@ -110,7 +117,7 @@ void singleton_task::schedule(duration_type delay, duration_type max_delay) {
             }
         }
 
-        task_should_run = true;
+        state->task_should_run = true;
 
         if (need_queue) {
             instance = make_shared<task_instance>(*this,
@@ -121,12 +128,25 @@ void singleton_task::schedule(duration_type delay, duration_type max_delay) {
 }
 
 void singleton_task::cancel() {
-    std::lock_guard<std::mutex> guard(task_mutex);
-    if (task_should_run) {
+    std::unique_lock<std::mutex> guard(state->task_mutex);
+    if (state->task_should_run) {
         instance->canceled = true;
     }
-    task_should_run = false;
+    state->task_should_run = false;
     task_timer.cancel();
+
+    // a running instance must not queue another once it finishes,
+    // even if it schedules the task again.  The task itself may
+    // cancel without waiting on itself.
+    if (state->task_running &&
+        state->task_thread != std::this_thread::get_id()) {
+        state->task_canceling = true;
+        state->task_done.wait(guard, [this]() {
+                return !state->task_running;
+            });
+        state->task_canceling = false;
+        state->task_should_run = false;
+    }
 }
 
 } /* namespace internal */
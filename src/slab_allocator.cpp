@@ -0,0 +1,201 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for slab_allocator class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "slab_allocator.h"
+
+#include <new>
+
+namespace throng {
+namespace internal {
+
+static const size_t GRANULARITY = 8;
+static const size_t NUM_SLOTS = slab_allocator::MAX_BLOCK_SIZE / GRANULARITY;
+
+namespace {
+
+/**
+ * Size classes are spaced by 8 bytes up to 128 bytes and then by
+ * four classes for each power of two, which bounds the internal
+ * fragmentation to 25% for larger blocks.
+ */
+struct class_table {
+    class_table() {
+        for (size_t s = GRANULARITY; s <= 128; s += GRANULARITY)
+            sizes.push_back(s);
+        for (size_t base = 128; base < slab_allocator::MAX_BLOCK_SIZE;
+             base *= 2) {
+            for (size_t i = 1; i <= 4; i++)
+                sizes.push_back(base + i * base / 4);
+        }
+
+        unsigned c = 0;
+        for (size_t slot = 0; slot <= NUM_SLOTS; slot++) {
+            while (sizes[c] < slot * GRANULARITY) c += 1;
+            index[slot] = c;
+        }
+    }
+
+    // index by the request size rounded up to the granularity
+    unsigned lookup(size_t size) const {
+        return index[(size + GRANULARITY - 1) / GRANULARITY];
+    }
+
+    std::vector<size_t> sizes;
+    uint8_t index[NUM_SLOTS + 1];
+};
+
+}
+
+static const class_table& get_classes() {
+    static const class_table table;
+    return table;
+}
+
+slab_allocator::slab_allocator(size_t slab_size_)
+    : slab_size(slab_size_),
+      classes(get_classes().sizes.size()) {
+    if (slab_size < MAX_BLOCK_SIZE)
+        slab_size = MAX_BLOCK_SIZE;
+}
+
+slab_allocator::~slab_allocator() { }
+
+size_t slab_allocator::block_size(size_t size) {
+    if (size > MAX_BLOCK_SIZE) return size;
+    const class_table& table = get_classes();
+    return table.sizes[table.lookup(size)];
+}
+
+void slab_allocator::link_available(slab* s) {
+    size_class& sc = classes[s->size_class];
+    s->prev_available = nullptr;
+    s->next_available = sc.available;
+    if (sc.available) sc.available->prev_available = s;
+    sc.available = s;
+}
+
+void slab_allocator::unlink_available(slab* s) {
+    if (s->prev_available)
+        s->prev_available->next_available = s->next_available;
+    else
+        classes[s->size_class].available = s->next_available;
+    if (s->next_available)
+        s->next_available->prev_available = s->prev_available;
+    s->prev_available = s->next_available = nullptr;
+}
+
+slab_allocator::slab* slab_allocator::new_slab(unsigned c) {
+    std::unique_ptr<slab> s(new slab());
+    if (spare) {
+        s->memory = std::move(spare);
+    } else {
+        s->memory.reset(new char[slab_size]);
+        reserved_bytes += slab_size;
+    }
+    s->size_class = c;
+    s->next = s->memory.get();
+    // The tail of the slab, if any, is smaller than a block and is
+    // never used
+    s->end = s->next + slab_size;
+
+    slab* result = s.get();
+    slabs.emplace(result->next, std::move(s));
+    link_available(result);
+    return result;
+}
+
+void slab_allocator::free_slab(std::map<const char*,
+                               std::unique_ptr<slab>>::iterator it) {
+    // Keep one empty slab so that a size class that repeatedly
+    // empties and refills does not go to the heap each time
+    if (!spare) {
+        spare = std::move(it->second->memory);
+    } else {
+        reserved_bytes -= slab_size;
+    }
+    slabs.erase(it);
+}
+
+void* slab_allocator::allocate(size_t size) {
+    if (size > MAX_BLOCK_SIZE) {
+        void* p = ::operator new(size);
+        reserved_bytes += size;
+        used_bytes += size;
+        return p;
+    }
+
+    const class_table& table = get_classes();
+    unsigned c = table.lookup(size);
+    size_t bsize = table.sizes[c];
+    slab* s = classes[c].available;
+    if (!s) s = new_slab(c);
+    used_bytes += bsize;
+    s->live += 1;
+
+    void* p;
+    if (s->free_list) {
+        free_block* b = s->free_list;
+        s->free_list = b->next;
+        p = b;
+    } else {
+        p = s->next;
+        s->next += bsize;
+    }
+    if (!s->free_list && s->next + bsize > s->end)
+        unlink_available(s);
+    return p;
+}
+
+void slab_allocator::deallocate(void* p, size_t size) {
+    if (!p) return;
+    if (size > MAX_BLOCK_SIZE) {
+        ::operator delete(p);
+        reserved_bytes -= size;
+        used_bytes -= size;
+        return;
+    }
+
+    const class_table& table = get_classes();
+    size_t bsize = table.sizes[table.lookup(size)];
+    used_bytes -= bsize;
+
+    // The slab holding the block is the one starting at or before it
+    auto it = slabs.upper_bound(static_cast<const char*>(p));
+    --it;
+    slab* s = it->second.get();
+    bool full = !s->free_list && s->next + bsize > s->end;
+    s->live -= 1;
+    if (s->live == 0) {
+        if (!full) unlink_available(s);
+        free_slab(it);
+        return;
+    }
+
+    free_block* b = static_cast<free_block*>(p);
+    b->next = s->free_list;
+    s->free_list = b;
+    if (full) link_available(s);
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -0,0 +1,591 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for snapshot files.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "snapshot_file.h"
+#include "stored_values.h"
+#include "key_hash.h"
+#include "throng/error.h"
+
+#include <boost/crc.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+namespace throng {
+namespace internal {
+
+using std::vector;
+using std::string;
+using std::shared_ptr;
+
+typedef versioned<string> versioned_t;
+
+/*
+ * A snapshot file is:
+ *
+ *   header   8-byte magic, uint32 format version, uint32 flags
+ *   blocks   each a uint32 stored size, uint32 uncompressed size,
+ *            uint32 CRC-32 of the stored bytes, then the stored bytes
+ *   shared   a block holding the values shared by several items
+ *   index    for each block, a uint32 key length, the first key in
+ *            the block, the uint64 offset and uint32 size of the block
+ *   footer   uint64 index offset, uint32 index size, uint32 CRC-32 of
+ *            the index, uint64 item count, uint64 shared block offset,
+ *            uint32 shared block size, uint32 shared value count,
+ *            8-byte magic
+ *
+ * An uncompressed block is a sequence of items sorted by key, each a
+ * uint32 key length, a uint32 values length, a uint32 reference
+ * count, the key, the values encoded with encode_values, and the
+ * references.  A value written once in the shared block for all the
+ * items holding it is encoded as a tombstone, with a reference of
+ * the uint32 index of the value and the uint64 xxh3 hash of the
+ * shared value.  The uncompressed shared block is a sequence of
+ * shared values, each a uint64 hash, a uint32 length and the value.
+ * The shared block is found through the footer, and may also come
+ * before the blocks of items, as in files from earlier releases.
+ *
+ * Version 1 files have no shared block, no reference counts in the
+ * items, and a footer without the shared block fields.
+ */
+static const char MAGIC[8] = { 'T', 'H', 'R', 'N', 'G', 'S', 'N', 'P' };
+static const uint32_t FORMAT_VERSION = 2;
+static const uint32_t FLAG_ZLIB = 1;
+static const size_t HEADER_SIZE = 16;
+static const size_t BLOCK_HEADER_SIZE = 12;
+static const size_t FOOTER_SIZE_V1 = 32;
+static const size_t FOOTER_SIZE = 48;
+static const size_t REF_SIZE = 12;
+
+// Values smaller than this are written in full even when repeated
+static const size_t MIN_SHARED_SIZE = 32;
+
+typedef std::map<uint64_t, shared_ptr<const string>> shared_values_t;
+
+// Uncompressed size at which a block is closed
+static const size_t BLOCK_SIZE = 64 * 1024;
+
+// deflate never compresses by more than this ratio, which bounds the
+// raw size stored in a block header outside the CRC
+static const size_t MAX_DEFLATE_RATIO = 1032;
+
+static void put_u32(string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        out.push_back((char)(v >> (8 * i)));
+}
+
+static void put_u64(string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i)
+        out.push_back((char)(v >> (8 * i)));
+}
+
+static uint32_t get_u32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i)
+        v |= (uint32_t)(uint8_t)p[i] << (8 * i);
+    return v;
+}
+
+static uint64_t get_u64(const char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i)
+        v |= (uint64_t)(uint8_t)p[i] << (8 * i);
+    return v;
+}
+
+static uint32_t crc32(const char* data, size_t size) {
+    boost::crc_32_type crc;
+    crc.process_bytes(data, size);
+    return crc.checksum();
+}
+
+static error::storage file_error(const string& path, const string& op) {
+    return error::storage(path, "Could not " + op + ": " +
+                          std::strerror(errno));
+}
+
+// *******************
+// write_snapshot_file
+// *******************
+
+namespace {
+
+class snapshot_file_writer {
+public:
+    snapshot_file_writer(string path_, bool compress_)
+        : path(std::move(path_)), tmp_path(path + ".tmp"),
+          compress(compress_) {
+        fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw file_error(tmp_path, "create snapshot file");
+
+        string header(MAGIC, sizeof(MAGIC));
+        put_u32(header, FORMAT_VERSION);
+        put_u32(header, compress ? FLAG_ZLIB : 0);
+        write(header);
+    }
+
+    ~snapshot_file_writer() {
+        if (fd >= 0) {
+            ::close(fd);
+            ::unlink(tmp_path.c_str());
+        }
+    }
+
+    // Set the hashes of the values held by more than one item
+    void set_repeated(std::unordered_set<uint64_t> repeated_) {
+        repeated = std::move(repeated_);
+    }
+
+    void add(const string& key, const vector<versioned_t>& values) {
+        if (block.empty())
+            first_key = key;
+
+        refs.clear();
+        uint32_t ref_count = 0;
+        const vector<versioned_t>* written = &values;
+        if (!repeated.empty()) {
+            stripped.clear();
+            for (size_t i = 0; i < values.size(); ++i) {
+                const versioned_t& v = values[i];
+                if (!v || v.get().size() < MIN_SHARED_SIZE) continue;
+                uint64_t hash = xxh3_64(v.get().data(), v.get().size());
+                if (!repeated.count(hash)) continue;
+                // The first value seen with a repeated hash is the
+                // one shared.  Values with the same hash but
+                // different contents are written in full.
+                auto it = shared.find(hash);
+                if (it == shared.end())
+                    it = shared.emplace(hash, v.get_ptr()).first;
+                else if (*it->second != v.get())
+                    continue;
+                if (stripped.empty()) stripped = values;
+                stripped[i] = versioned_t(nullptr, v.get_version());
+                put_u32(refs, (uint32_t)i);
+                put_u64(refs, hash);
+                ref_count += 1;
+            }
+            if (ref_count) written = &stripped;
+        }
+
+        string encoded = encode_values(*written);
+        put_u32(block, (uint32_t)key.size());
+        put_u32(block, (uint32_t)encoded.size());
+        put_u32(block, ref_count);
+        block.append(key);
+        block.append(encoded);
+        block.append(refs);
+        if (block.size() >= BLOCK_SIZE)
+            flush_block();
+    }
+
+    void finish(uint64_t item_count) {
+        flush_block();
+
+        // The shared values follow the items they are referred to by
+        if (!shared.empty()) {
+            string data;
+            for (auto& v : shared) {
+                put_u64(data, v.first);
+                put_u32(data, (uint32_t)v.second->size());
+                data.append(*v.second);
+            }
+            shared_offset = offset;
+            shared_size = write_block(data);
+        }
+
+        string footer;
+        put_u64(footer, offset);
+        put_u32(footer, (uint32_t)index.size());
+        put_u32(footer, crc32(index.data(), index.size()));
+        put_u64(footer, item_count);
+        put_u64(footer, shared_offset);
+        put_u32(footer, shared_size);
+        put_u32(footer, (uint32_t)shared.size());
+        footer.append(MAGIC, sizeof(MAGIC));
+        write(index);
+        write(footer);
+
+        if (::fdatasync(fd) != 0)
+            throw file_error(tmp_path, "sync snapshot file");
+        if (::close(fd) != 0) {
+            fd = -1;
+            throw file_error(tmp_path, "close snapshot file");
+        }
+        fd = -1;
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+            throw file_error(path, "rename snapshot file");
+    }
+
+private:
+    string path;
+    string tmp_path;
+    bool compress;
+    int fd = -1;
+    uint64_t offset = 0;
+    string block;
+    string first_key;
+    string stored;
+    string index;
+    std::unordered_set<uint64_t> repeated;
+    shared_values_t shared;
+    uint64_t shared_offset = 0;
+    uint32_t shared_size = 0;
+    vector<versioned_t> stripped;
+    string refs;
+
+    void write(const string& data) {
+        const char* p = data.data();
+        size_t left = data.size();
+        while (left > 0) {
+            ssize_t n = ::write(fd, p, left);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw file_error(tmp_path, "write snapshot file");
+            }
+            p += n;
+            left -= n;
+        }
+        offset += data.size();
+    }
+
+    // Write a block, returning its size in the file
+    uint32_t write_block(const string& data) {
+        const string* body = &data;
+        if (compress) {
+            namespace io = boost::iostreams;
+            stored.clear();
+            {
+                io::filtering_ostream out;
+                out.push(io::zlib_compressor());
+                out.push(io::back_inserter(stored));
+                out.write(data.data(), data.size());
+            }
+            body = &stored;
+        }
+
+        string header;
+        put_u32(header, (uint32_t)body->size());
+        put_u32(header, (uint32_t)data.size());
+        put_u32(header, crc32(body->data(), body->size()));
+        write(header);
+        write(*body);
+        return (uint32_t)(header.size() + body->size());
+    }
+
+    void flush_block() {
+        if (block.empty()) return;
+
+        uint64_t block_offset = offset;
+        uint32_t size = write_block(block);
+        put_u32(index, (uint32_t)first_key.size());
+        index.append(first_key);
+        put_u64(index, block_offset);
+        put_u32(index, size);
+        block.clear();
+    }
+};
+
+} /* anonymous namespace */
+
+size_t write_snapshot_file(const string& path,
+                           store_snapshot<string, string>& source,
+                           bool compress) {
+    // Count the large values by hash, stopping at two, and keep the
+    // hashes seen more than once
+    std::unordered_map<uint64_t, uint8_t> counts;
+    source.visit([&counts](const string&, const vector<versioned_t>& values) {
+            for (auto& v : values) {
+                if (!v || v.get().size() < MIN_SHARED_SIZE) continue;
+                uint8_t& c = counts[xxh3_64(v.get().data(), v.get().size())];
+                if (c < 2) c += 1;
+            }
+        });
+    std::unordered_set<uint64_t> repeated;
+    for (auto& c : counts) {
+        if (c.second > 1) repeated.insert(c.first);
+    }
+    counts = std::unordered_map<uint64_t, uint8_t>();
+
+    // The items are written as they are visited, in key order
+    snapshot_file_writer writer(path, compress);
+    writer.set_repeated(std::move(repeated));
+    size_t count = 0;
+    source.visit_sorted([&writer, &count](const string& key,
+                                          const vector<versioned_t>& values) {
+            if (values.empty()) return;
+            writer.add(key, values);
+            count += 1;
+        });
+    writer.finish(count);
+    return count;
+}
+
+// ********************
+// snapshot_file_reader
+// ********************
+
+snapshot_file_reader::snapshot_file_reader(string path_)
+    : path(std::move(path_)) {
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw file_error(path, "open snapshot file");
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw file_error(path, "open snapshot file");
+    }
+    try {
+        uint64_t file_size = (uint64_t)st.st_size;
+        if (file_size < HEADER_SIZE + FOOTER_SIZE_V1)
+            throw error::storage(path, "Not a snapshot file");
+
+        char header[HEADER_SIZE];
+        read_at(0, header, HEADER_SIZE);
+        if (std::memcmp(header, MAGIC, sizeof(MAGIC)) != 0)
+            throw error::storage(path, "Not a snapshot file");
+        version = get_u32(header + 8);
+        if (version < 1 || version > FORMAT_VERSION)
+            throw error::storage(path, "Unsupported snapshot file version " +
+                                 std::to_string(version));
+        compressed = (get_u32(header + 12) & FLAG_ZLIB) != 0;
+
+        size_t footer_size = version == 1 ? FOOTER_SIZE_V1 : FOOTER_SIZE;
+        if (file_size < HEADER_SIZE + footer_size)
+            throw error::storage(path, "Snapshot file is truncated");
+        char footer[FOOTER_SIZE];
+        read_at(file_size - footer_size, footer, footer_size);
+        if (std::memcmp(footer + footer_size - sizeof(MAGIC), MAGIC,
+                        sizeof(MAGIC)) != 0)
+            throw error::storage(path, "Snapshot file is truncated");
+        uint64_t index_offset = get_u64(footer);
+        uint32_t index_size = get_u32(footer + 8);
+        uint32_t index_crc = get_u32(footer + 12);
+        item_count = get_u64(footer + 16);
+        if (index_offset < HEADER_SIZE ||
+            index_offset + index_size != file_size - footer_size)
+            throw error::storage(path, "Corrupt snapshot file index");
+        if (version > 1) {
+            block_ref b { string(), get_u64(footer + 24),
+                          get_u32(footer + 32) };
+            uint32_t shared_count = get_u32(footer + 36);
+            if (b.size > 0) {
+                if (b.offset < HEADER_SIZE || b.size < BLOCK_HEADER_SIZE ||
+                    b.offset + b.size > index_offset)
+                    throw error::storage(path, "Corrupt snapshot file"
+                                         " shared values");
+                read_shared(b, shared_count);
+            }
+        }
+
+        string index(index_size, '\0');
+        read_at(index_offset, &index[0], index_size);
+        if (crc32(index.data(), index.size()) != index_crc)
+            throw error::storage(path, "Corrupt snapshot file index");
+
+        const char* p = index.data();
+        const char* end = p + index.size();
+        while (p < end) {
+            if (end - p < 4) break;
+            uint32_t key_len = get_u32(p);
+            if ((size_t)(end - p) < 4 + (size_t)key_len + 12) break;
+            block_ref b;
+            b.first_key.assign(p + 4, key_len);
+            b.offset = get_u64(p + 4 + key_len);
+            b.size = get_u32(p + 12 + key_len);
+            if (b.offset < HEADER_SIZE || b.size < BLOCK_HEADER_SIZE ||
+                b.offset + b.size > index_offset)
+                break;
+            blocks.push_back(std::move(b));
+            p += 4 + key_len + 12;
+        }
+        if (p != end)
+            throw error::storage(path, "Corrupt snapshot file index");
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+snapshot_file_reader::~snapshot_file_reader() {
+    ::close(fd);
+}
+
+void snapshot_file_reader::read_at(uint64_t offset, char* data,
+                                   size_t size) {
+    while (size > 0) {
+        ssize_t n = ::pread(fd, data, size, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw file_error(path, "read snapshot file");
+        }
+        if (n == 0)
+            throw error::storage(path, "Snapshot file is truncated");
+        data += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+void snapshot_file_reader::read_block(const block_ref& b, string& data) {
+    string stored(b.size, '\0');
+    read_at(b.offset, &stored[0], b.size);
+    uint32_t stored_size = get_u32(stored.data());
+    uint32_t raw_size = get_u32(stored.data() + 4);
+    uint32_t crc = get_u32(stored.data() + 8);
+    const char* body = stored.data() + BLOCK_HEADER_SIZE;
+    if (stored_size != b.size - BLOCK_HEADER_SIZE ||
+        crc32(body, stored_size) != crc)
+        throw error::storage(path, "Corrupt snapshot file block at " +
+                             std::to_string(b.offset));
+
+    if (!compressed) {
+        data.assign(body, stored_size);
+        return;
+    }
+
+    if (raw_size > (size_t)stored_size * MAX_DEFLATE_RATIO + 64)
+        throw error::storage(path, "Corrupt snapshot file block at " +
+                             std::to_string(b.offset));
+
+    namespace io = boost::iostreams;
+    data.resize(raw_size);
+    try {
+        io::filtering_istream in;
+        in.push(io::zlib_decompressor());
+        in.push(io::array_source(body, stored_size));
+        in.read(&data[0], raw_size);
+        if ((size_t)in.gcount() != raw_size)
+            throw error::storage(path, "Corrupt snapshot file block at " +
+                                 std::to_string(b.offset));
+    } catch (const io::zlib_error& e) {
+        throw error::storage(path, "Could not decompress block at " +
+                             std::to_string(b.offset) + ": " + e.what());
+    }
+}
+
+void snapshot_file_reader::read_shared(const block_ref& b, uint32_t count) {
+    string data;
+    read_block(b, data);
+    shared.reserve(count);
+    const char* p = data.data();
+    const char* end = p + data.size();
+    while (p < end) {
+        if (end - p < 12 || (size_t)(end - p) < 12 + (size_t)get_u32(p + 8))
+            throw error::storage(path, "Corrupt snapshot file shared values");
+        uint32_t len = get_u32(p + 8);
+        shared[get_u64(p)] = std::make_shared<const string>(p + 12, len);
+        p += 12 + len;
+    }
+    if (shared.size() != count)
+        throw error::storage(path, "Corrupt snapshot file shared values");
+}
+
+vector<versioned_t> snapshot_file_reader::decode_item(const item& i) {
+    vector<versioned_t> values = decode_values(i.values, i.values_len);
+    for (uint32_t r = 0; r < i.ref_count; ++r) {
+        const char* ref = i.refs + r * REF_SIZE;
+        uint32_t index = get_u32(ref);
+        auto it = shared.find(get_u64(ref + 4));
+        if (index >= values.size() || it == shared.end())
+            throw error::storage(path, "Corrupt snapshot file item");
+        values[index] = versioned_t(it->second,
+                                    values[index].get_version());
+    }
+    return values;
+}
+
+template <typename F>
+void snapshot_file_reader::for_each_item(const string& data, F fn) {
+    size_t item_header = version == 1 ? 8 : 12;
+    const char* p = data.data();
+    const char* end = p + data.size();
+    while (p < end) {
+        if ((size_t)(end - p) < item_header)
+            throw error::storage(path, "Corrupt snapshot file item");
+        item i;
+        i.key_len = get_u32(p);
+        i.values_len = get_u32(p + 4);
+        i.ref_count = version == 1 ? 0 : get_u32(p + 8);
+        if ((size_t)(end - p) < item_header + (size_t)i.key_len +
+            i.values_len + (size_t)i.ref_count * REF_SIZE)
+            throw error::storage(path, "Corrupt snapshot file item");
+        i.key = p + item_header;
+        i.values = i.key + i.key_len;
+        i.refs = i.values + i.values_len;
+        // Stop early if the function returns false
+        if (!fn(i))
+            return;
+        p = i.refs + (size_t)i.ref_count * REF_SIZE;
+    }
+}
+
+vector<versioned_t> snapshot_file_reader::get(const string& key) {
+    // The block that can hold the key is the last one whose first
+    // key is not greater than it
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), key,
+                               [](const string& k, const block_ref& b) {
+                                   return k < b.first_key;
+                               });
+    if (it == blocks.begin())
+        return vector<versioned_t>();
+
+    string data;
+    read_block(*(it - 1), data);
+    vector<versioned_t> result;
+    for_each_item(data, [&](const item& i) {
+            int c = key.compare(0, string::npos, i.key, i.key_len);
+            if (c == 0)
+                result = decode_item(i);
+            return c > 0;
+        });
+    return result;
+}
+
+void snapshot_file_reader::visit(store_visitor visitor) {
+    string data;
+    string key;
+    for (auto& b : blocks) {
+        read_block(b, data);
+        for_each_item(data, [&](const item& i) {
+                key.assign(i.key, i.key_len);
+                visitor(key, decode_item(i));
+                return true;
+            });
+    }
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -23,6 +23,9 @@
 
 #include "store_registry.h"
 #include "in_memory_storage_engine.h"
+#include "leveldb_storage_engine.h"
+#include "log_storage_engine.h"
+#include "value_compressor.h"
 #include "throng/error.h"
 
 namespace throng {
@@ -37,28 +40,66 @@ using boost::filesystem::canonical;
 store_registry::store_registry(ctx_internal& ctx_, const string db_path_)
     : ctx(ctx_) {
     boost::filesystem::create_directory(db_path_);
-    db_path = canonical(db_path);
+    db_path = canonical(db_path_);
 }
 
 void store_registry::register_store(const std::string& name,
                                     const store_config& config) {
-    //typedef std::unique_ptr<store<std::string, std::string>> storage_engine_p;
+    typedef std::unique_ptr<store<std::string, std::string>> storage_engine_p;
     typedef std::unique_ptr<processor> processor_p;
 
     processor_p storage;
     if (config.persistent) {
-        // XXX - TODO replace with persistent storage engine
-        //storage_engine_p delegate =
-        //    storage_engine_p{ new in_memory_storage_engine(name) };
-        //storage = processor_p{ new processor(ctx, std::move(delegate), config) };
-        storage = processor_p{ new processor(ctx, name, config) };
+        // Every commit except in ASYNC mode is a whole group of
+        // writes, so syncing each one costs one fsync per group
+        bool sync = config.durability != durability_mode::ASYNC;
+        string store_path = get_store_path(name).string();
+        storage_engine_p delegate;
+        switch (config.storage_engine) {
+        case storage_engine_type::LOG:
+            delegate = storage_engine_p{
+                new log_storage_engine(name, store_path,
+                                       config.log_segment_size,
+                                       config.log_garbage_ratio, sync) };
+            break;
+        case storage_engine_type::LEVELDB:
+        default:
+            delegate = storage_engine_p{
+                new leveldb_storage_engine(name, store_path, sync) };
+            break;
+        }
+        storage = processor_p{ new processor(ctx, std::move(delegate), config) };
     } else {
         storage = processor_p{ new processor(ctx, name, config) };
     }
 
+    if (config.compression == value_compression::ZLIB) {
+        // Dictionaries are kept beside the store's data, since values
+        // in storage cannot be read without them
+        path dict_path;
+        if (config.persistent)
+            dict_path = get_store_path(name).string() + ".dict";
+        codecs[name] = std::make_shared<value_compressor>
+            (name, dict_path, config.compression_training_samples,
+             config.compression_dictionary_size);
+    }
+
     stores.emplace(name, std::move(storage));
 }
 
+path store_registry::get_store_path(const string& name) const {
+    // Store names are not restricted, so they are hex-encoded to
+    // make a safe directory name
+    static const char HEX[] = "0123456789abcdef";
+    string dir;
+    dir.reserve(name.size() * 2);
+    for (unsigned char c : name) {
+        dir.push_back(HEX[c >> 4]);
+        dir.push_back(HEX[c & 0xf]);
+    }
+    return db_path / ("store-" + dir);
+}
+
 processor& store_registry::get(const std::string& name) {
     auto it = stores.find(name);
     if (it == stores.end())
@@ -66,6 +107,13 @@ processor& store_registry::get(const std::string& name) {
     return *it->second.get();
 }
 
+std::shared_ptr<value_codec> store_registry::get_codec(const string& name) {
+    if (stores.find(name) == stores.end())
+        throw error::unknown_store(name);
+    auto it = codecs.find(name);
+    return it == codecs.end() ? nullptr : it->second;
+}
+
 void store_registry::start() {
     for (auto& s : stores) {
         s.second->start();
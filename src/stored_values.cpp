@@ -0,0 +1,132 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Encoding and update of the values stored by persistent storage
+ * engines.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "stored_values.h"
+#include "throng_messages.pb.h"
+#include "throng/error.h"
+
+#include <algorithm>
+
+namespace throng {
+namespace internal {
+
+using std::vector;
+using std::string;
+using std::make_shared;
+
+typedef versioned<string> versioned_t;
+
+string encode_values(const vector<versioned_t>& values) {
+    message::keyed_values kv;
+    for (auto& v : values) {
+        message::versioned* mv = kv.add_values();
+        if (v) mv->set_value(v.get());
+
+        const vector_clock& clock = v.get_version();
+        message::vector_clock* mc = mv->mutable_version();
+        mc->set_timestamp((uint64_t)clock.get_timestamp()
+                          .time_since_epoch().count());
+        for (auto& e : clock.get_entries()) {
+            message::clock_entry* me = mc->add_entries();
+            for (uint32_t c : e.first)
+                me->mutable_id()->add_id(c);
+            me->set_version(e.second);
+        }
+    }
+    return kv.SerializeAsString();
+}
+
+vector<versioned_t> decode_values(const char* data, size_t size) {
+    message::keyed_values kv;
+    if (!kv.ParseFromArray(data, (int)size))
+        throw error::serialization("Could not parse stored values");
+
+    vector<versioned_t> result;
+    result.reserve(kv.values_size());
+    for (auto& mv : kv.values()) {
+        std::shared_ptr<const string> value;
+        if (mv.has_value())
+            value = make_shared<const string>(mv.value());
+
+        const message::vector_clock& mc = mv.version();
+        vector<vector_clock::clock_entry> entries;
+        entries.reserve(mc.entries_size());
+        for (auto& me : mc.entries()) {
+            entries.emplace_back(node_id(me.id().id().begin(),
+                                         me.id().id().end()),
+                                 me.version());
+        }
+        vector_clock::time_point timestamp
+            { vector_clock::time_point::duration
+                    ((vector_clock::time_point::rep)mc.timestamp()) };
+        result.emplace_back(std::move(value),
+                            vector_clock(timestamp, std::move(entries)));
+    }
+    return result;
+}
+
+bool apply_write(vector<versioned_t>& values,
+                 const versioned_t& value) {
+    for (auto& v : values) {
+        switch (value.get_version().compare(v.get_version())) {
+        case vector_clock::occurred::BEFORE:
+        case vector_clock::occurred::EQUAL:
+            return false;
+        default:
+            break;
+        }
+    }
+    values.erase(std::remove_if(values.begin(), values.end(),
+                                [&value](const versioned_t& v) {
+                return value.get_version().compare(v.get_version()) ==
+                    vector_clock::occurred::AFTER;
+            }), values.end());
+    values.push_back(value);
+    return true;
+}
+
+bool apply_erase(vector<versioned_t>& values, const vector_clock& version) {
+    size_t size = values.size();
+    values.erase(std::remove_if(values.begin(), values.end(),
+                                [&version](const versioned_t& v) {
+                switch (v.get_version().compare(version)) {
+                case vector_clock::occurred::BEFORE:
+                case vector_clock::occurred::EQUAL:
+                    return true;
+                default:
+                    return false;
+                }
+            }), values.end());
+    return values.size() != size;
+}
+
+bool apply_operation(vector<versioned_t>& values,
+                     const write_batch<string, string>::operation& op) {
+    return op.erase
+        ? apply_erase(values, op.value.get_version())
+        : apply_write(values, op.value);
+}
+
+} /* namespace internal */
+} /* namespace throng */
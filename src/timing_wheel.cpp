@@ -0,0 +1,183 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for timing_wheel class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "timing_wheel.h"
+
+#include <limits>
+
+namespace throng {
+namespace internal {
+
+static const uint64_t NO_TICK = std::numeric_limits<uint64_t>::max();
+
+timing_wheel::timing_wheel(duration resolution_, time_point origin_)
+    : resolution(resolution_), origin(origin_) { }
+
+timing_wheel::~timing_wheel() {
+    for (auto& level : slots)
+        for (auto& slot : level)
+            slot.clear();
+    overflow.clear();
+}
+
+uint64_t timing_wheel::to_tick(time_point t) const {
+    if (t <= origin) return 0;
+    duration d = t - origin;
+    uint64_t tick = d / resolution;
+    // round up so that an entry never expires before its deadline
+    if (d % resolution != duration::zero()) tick += 1;
+    return tick;
+}
+
+timing_wheel::time_point timing_wheel::to_time(uint64_t tick) const {
+    uint64_t max_tick =
+        (time_point::max() - origin) / resolution;
+    if (tick >= max_tick) return time_point::max();
+    return origin + resolution * tick;
+}
+
+void timing_wheel::insert(entry& e, uint64_t tick) {
+    if (tick < current_tick) tick = current_tick;
+
+    // Place the entry in the finest level where it shares all
+    // higher-order digits with the current tick
+    for (unsigned level = 0; level < LEVELS; level++) {
+        unsigned shift = SLOT_BITS * (level + 1);
+        if ((tick >> shift) == (current_tick >> shift)) {
+            unsigned slot = (tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+            slots[level][slot].push_back(e);
+            occupied[level] |= (uint64_t)1 << slot;
+            return;
+        }
+    }
+    overflow.push_back(e);
+}
+
+void timing_wheel::schedule(entry& e, time_point deadline) {
+    e.unlink();
+    e.deadline = deadline;
+    insert(e, to_tick(deadline));
+}
+
+void timing_wheel::cascade(slot_list& list) {
+    slot_list pending;
+    pending.splice(pending.end(), list);
+    while (!pending.empty()) {
+        entry& e = pending.front();
+        pending.pop_front();
+        insert(e, to_tick(e.deadline));
+    }
+}
+
+uint64_t timing_wheel::next_event_tick() {
+    for (unsigned level = 0; level < LEVELS; level++) {
+        unsigned shift = SLOT_BITS * level;
+        unsigned digit = (current_tick >> shift) & (SLOTS - 1);
+
+        // The slot for the current tick can only be occupied at the
+        // finest level; coarser slots have already been cascaded.
+        uint64_t mask;
+        if (level == 0)
+            mask = ~(uint64_t)0 << digit;
+        else if (digit == SLOTS - 1)
+            mask = 0;
+        else
+            mask = ~(uint64_t)0 << (digit + 1);
+
+        uint64_t candidates = occupied[level] & mask;
+        while (candidates) {
+            unsigned slot = __builtin_ctzll(candidates);
+            uint64_t bit = (uint64_t)1 << slot;
+            if (slots[level][slot].empty()) {
+                occupied[level] &= ~bit;
+                candidates &= ~bit;
+                continue;
+            }
+            unsigned block = shift + SLOT_BITS;
+            return ((current_tick >> block) << block) |
+                ((uint64_t)slot << shift);
+        }
+    }
+    if (!overflow.empty()) {
+        unsigned block = SLOT_BITS * LEVELS;
+        return ((current_tick >> block) + 1) << block;
+    }
+    return NO_TICK;
+}
+
+timing_wheel::time_point timing_wheel::next_deadline() {
+    uint64_t tick = next_event_tick();
+    if (tick == NO_TICK) return time_point::max();
+    return to_time(tick);
+}
+
+bool timing_wheel::advance(time_point now, const expire_fn& callback,
+                           size_t limit) {
+    if (now < origin) return false;
+    uint64_t target = (now - origin) / resolution;
+    size_t count = 0;
+
+    while (true) {
+        uint64_t tick = next_event_tick();
+        if (tick == NO_TICK || tick > target) {
+            if (target > current_tick) current_tick = target;
+            return false;
+        }
+        current_tick = tick;
+
+        // Cascade coarser slots whose range begins at this tick,
+        // starting with the coarsest
+        unsigned top = SLOT_BITS * LEVELS;
+        if ((tick & (((uint64_t)1 << top) - 1)) == 0)
+            cascade(overflow);
+        for (unsigned level = LEVELS - 1; level > 0; level--) {
+            unsigned shift = SLOT_BITS * level;
+            if ((tick & (((uint64_t)1 << shift) - 1)) != 0)
+                continue;
+            unsigned slot = (tick >> shift) & (SLOTS - 1);
+            cascade(slots[level][slot]);
+        }
+
+        slot_list& slot = slots[0][tick & (SLOTS - 1)];
+        slot_list expired;
+        expired.splice(expired.end(), slot);
+        while (!expired.empty()) {
+            if (count >= limit) {
+                slot.splice(slot.begin(), expired);
+                return true;
+            }
+            entry& e = expired.front();
+            expired.pop_front();
+            count += 1;
+            callback(e);
+        }
+
+        // Entries rescheduled into the past by the callback will be
+        // handled on the next call
+        if (!slot.empty())
+            return true;
+    }
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -0,0 +1,556 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for value_compressor class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "value_compressor.h"
+#include "key_hash.h"
+#include "logger.h"
+#include "throng/error.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iterator>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace throng {
+namespace internal {
+
+using std::string;
+using std::vector;
+using std::shared_ptr;
+using std::make_shared;
+using boost::filesystem::path;
+
+LOGGER("store");
+
+// ****************
+// train_dictionary
+// ****************
+
+// Length of the substrings counted across samples
+static const size_t KMER_SIZE = 8;
+
+// Length of the candidate segments and the distance between them
+static const size_t SEGMENT_SIZE = 64;
+static const size_t SEGMENT_STEP = 16;
+
+static uint64_t kmer(const string& s, size_t pos) {
+    uint64_t k;
+    std::memcpy(&k, s.data() + pos, sizeof(k));
+    return k;
+}
+
+string train_dictionary(const vector<string>& samples, size_t size) {
+    // Count the samples in which each substring appears
+    std::unordered_map<uint64_t, uint32_t> freq;
+    std::unordered_set<uint64_t> seen;
+    for (auto& s : samples) {
+        seen.clear();
+        for (size_t i = 0; i + KMER_SIZE <= s.size(); ++i)
+            seen.insert(kmer(s, i));
+        for (uint64_t k : seen)
+            freq[k] += 1;
+    }
+
+    // A segment is worth the number of samples sharing each of its
+    // substrings not already covered by the dictionary
+    struct segment {
+        uint64_t score;
+        size_t sample;
+        size_t pos;
+        size_t len;
+        bool operator<(const segment& o) const { return score < o.score; }
+    };
+    auto score = [&](const segment& seg) {
+        uint64_t result = 0;
+        const string& s = samples[seg.sample];
+        for (size_t i = seg.pos; i + KMER_SIZE <= seg.pos + seg.len; ++i) {
+            auto it = freq.find(kmer(s, i));
+            if (it != freq.end() && it->second > 1)
+                result += it->second;
+        }
+        return result;
+    };
+
+    std::priority_queue<segment> candidates;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const string& s = samples[i];
+        for (size_t pos = 0; pos + KMER_SIZE <= s.size();
+             pos += SEGMENT_STEP) {
+            segment seg { 0, i, pos, std::min(SEGMENT_SIZE, s.size() - pos) };
+            seg.score = score(seg);
+            if (seg.score > 0) candidates.push(seg);
+        }
+    }
+
+    // Choose segments greedily.  Choosing a segment lowers the value
+    // of others sharing its substrings, so a segment's score is
+    // recomputed when it reaches the top, and it is chosen only if it
+    // is still the best.
+    vector<segment> chosen;
+    size_t total = 0;
+    while (!candidates.empty() && total < size) {
+        segment seg = candidates.top();
+        candidates.pop();
+        seg.score = score(seg);
+        if (seg.score == 0) continue;
+        if (!candidates.empty() && seg.score < candidates.top().score) {
+            candidates.push(seg);
+            continue;
+        }
+        chosen.push_back(seg);
+        total += seg.len;
+        const string& s = samples[seg.sample];
+        for (size_t i = seg.pos; i + KMER_SIZE <= seg.pos + seg.len; ++i)
+            freq.erase(kmer(s, i));
+    }
+
+    string dictionary;
+    dictionary.reserve(total);
+    for (auto it = chosen.rbegin(); it != chosen.rend(); ++it)
+        dictionary.append(samples[it->sample], it->pos, it->len);
+    if (dictionary.size() > size)
+        dictionary.erase(0, dictionary.size() - size);
+    return dictionary;
+}
+
+// ****************
+// value_compressor
+// ****************
+
+static const unsigned char MAGIC0 = 0xf7;
+static const unsigned char MAGIC1 = 'Z';
+static const unsigned char METHOD_STORED = 0;
+static const unsigned char METHOD_DEFLATE = 1;
+
+// Values shorter than this are not worth compressing
+static const size_t MIN_COMPRESS_SIZE = 32;
+
+// Samples are truncated to this size
+static const size_t MAX_SAMPLE_SIZE = 64 * 1024;
+
+// Maximum number of idle zlib streams of each kind kept for reuse
+static const size_t MAX_IDLE_STREAMS = 8;
+
+// deflate never compresses by more than this ratio
+static const size_t MAX_DEFLATE_RATIO = 1032;
+
+// Size of the checksum of the value in a deflated value's header
+static const size_t CHECKSUM_SIZE = 4;
+
+static bool has_magic(const string& v) {
+    return v.size() >= 3 &&
+        (unsigned char)v[0] == MAGIC0 && (unsigned char)v[1] == MAGIC1 &&
+        (unsigned char)v[2] <= METHOD_DEFLATE;
+}
+
+static void put_varint(string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static bool get_varint(const string& in, size_t& pos, uint64_t& v) {
+    v = 0;
+    for (unsigned shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        unsigned char b = in[pos++];
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static void put_u32(string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        out.push_back((char)(v >> (8 * i)));
+}
+
+static uint32_t get_u32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i)
+        v = (v << 8) | (unsigned char)p[i];
+    return v;
+}
+
+static uint32_t checksum(const string& value) {
+    return (uint32_t)adler32(adler32(0, Z_NULL, 0),
+                             (const Bytef*)value.data(), (uInt)value.size());
+}
+
+uint32_t value_compressor::dictionary_id(const string& dictionary) {
+    uint32_t id = (uint32_t)xxh3_64(dictionary.data(), dictionary.size());
+    return id ? id : 1;
+}
+
+value_compressor::value_compressor(string store_name_, path dir_,
+                                   size_t training_samples_,
+                                   size_t dictionary_size_)
+    : store_name(std::move(store_name_)), dir(std::move(dir_)),
+      training_samples(training_samples_),
+      dictionary_size(std::min(dictionary_size_, (size_t)32 * 1024)) {
+    if (!dir.empty())
+        load_dictionaries();
+    training_done = training_samples == 0 || current_id != 0;
+}
+
+value_compressor::~value_compressor() {
+    for (z_stream* s : deflaters) {
+        deflateEnd(s);
+        delete s;
+    }
+    for (z_stream* s : inflaters) {
+        inflateEnd(s);
+        delete s;
+    }
+}
+
+void value_compressor::load_dictionaries() {
+    boost::system::error_code ec;
+    if (!boost::filesystem::exists(dir, ec)) return;
+    for (boost::filesystem::directory_iterator it(dir, ec), end;
+         !ec && it != end; it.increment(ec)) {
+        string fname = it->path().filename().string();
+        unsigned int seq, id;
+        char rest;
+        if (fname.size() != 22 ||
+            std::sscanf(fname.c_str(), "%8x-%8x.dic%c",
+                        &seq, &id, &rest) != 3 ||
+            rest != 't' || id == 0)
+            continue;
+        boost::filesystem::ifstream f(it->path(), std::ios::binary);
+        string data((std::istreambuf_iterator<char>(f)),
+                    std::istreambuf_iterator<char>());
+        if (!f && !f.eof())
+            throw error::storage(store_name, "Could not read " +
+                                 it->path().string());
+        if (dictionary_id(data) != id)
+            throw error::storage(store_name, "Corrupt dictionary " +
+                                 it->path().string());
+        dictionaries[id] = make_shared<const string>(std::move(data));
+        if (seq >= next_seq) {
+            next_seq = seq + 1;
+            current_id = id;
+        }
+    }
+    if (ec)
+        throw error::storage(store_name, "Could not read " + dir.string() +
+                             ": " + ec.message());
+}
+
+uint32_t value_compressor::get_dictionary_id() {
+    std::lock_guard<std::mutex> guard(dict_mutex);
+    return current_id;
+}
+
+void value_compressor::write_file(const path& file, const string& data) {
+    int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw error::storage(store_name, "Could not write " +
+                             file.string() + ": " + std::strerror(errno));
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            int err = errno;
+            ::close(fd);
+            throw error::storage(store_name, "Could not write " +
+                                 file.string() + ": " + std::strerror(err));
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+    int r = ::fdatasync(fd);
+    int err = errno;
+    if (::close(fd) != 0 && r == 0) {
+        r = -1;
+        err = errno;
+    }
+    if (r != 0)
+        throw error::storage(store_name, "Could not sync " +
+                             file.string() + ": " + std::strerror(err));
+}
+
+uint32_t value_compressor::add_dictionary(string dictionary) {
+    // The file is written without holding dict_mutex, so that values
+    // are encoded and decoded meanwhile with the current dictionary
+    std::lock_guard<std::mutex> save_guard(save_mutex);
+    // Dictionaries are named by their content, so a number in a value
+    // written on any node names the same dictionary everywhere
+    uint32_t id = dictionary_id(dictionary);
+    {
+        std::lock_guard<std::mutex> guard(dict_mutex);
+        auto it = dictionaries.find(id);
+        if (it != dictionaries.end() && *it->second != dictionary)
+            throw error::storage(store_name, "Compression dictionary " +
+                                 std::to_string(id) + " already exists");
+    }
+    if (!dir.empty()) {
+        // Write to a temporary file and rename it, so a dictionary
+        // file is always complete.  The sequence number in the name
+        // records which dictionary is current.
+        char fname[32];
+        std::snprintf(fname, sizeof(fname), "%08x-%08x.dict",
+                      next_seq, id);
+        path file = dir / fname;
+        path tmp = file;
+        tmp += ".tmp";
+        boost::system::error_code ec;
+        boost::filesystem::create_directories(dir, ec);
+        write_file(tmp, dictionary);
+        boost::filesystem::rename(tmp, file, ec);
+        if (ec)
+            throw error::storage(store_name, "Could not write " +
+                                 file.string() + ": " + ec.message());
+
+        // Sync the directory so the rename survives a crash before
+        // any value compressed with the dictionary is stored
+        int fd = ::open(dir.c_str(), O_RDONLY);
+        if (fd < 0 || ::fsync(fd) != 0) {
+            int err = errno;
+            if (fd >= 0) ::close(fd);
+            throw error::storage(store_name, "Could not sync " +
+                                 dir.string() + ": " + std::strerror(err));
+        }
+        ::close(fd);
+    }
+    std::lock_guard<std::mutex> guard(dict_mutex);
+    next_seq += 1;
+    dictionaries[id] = make_shared<const string>(std::move(dictionary));
+    current_id = id;
+    return id;
+}
+
+// must hold dict_mutex when calling
+vector<string> value_compressor::sample(const string& value) {
+    vector<string> training;
+    samples.push_back(value.substr(0, MAX_SAMPLE_SIZE));
+    if (samples.size() < training_samples) return training;
+
+    training_done = true;
+    training.swap(samples);
+    return training;
+}
+
+// must not hold dict_mutex when calling
+void value_compressor::train(const vector<string>& training) {
+    string dictionary = train_dictionary(training, dictionary_size);
+    if (dictionary.empty()) {
+        LOG(INFO) << store_name << ": Values have too little in common"
+                  << " for a compression dictionary";
+        return;
+    }
+
+    size_t dict_size = dictionary.size();
+    uint32_t id;
+    try {
+        id = add_dictionary(std::move(dictionary));
+    } catch (const std::exception& e) {
+        LOG(ERROR) << store_name << ": Could not save compression"
+                   << " dictionary: " << e.what();
+        return;
+    }
+    LOG(INFO) << store_name << ": Trained compression dictionary " << id
+              << " of " << dict_size << " bytes from " << training.size()
+              << " values";
+}
+
+z_stream* value_compressor::get_stream(bool deflate) const {
+    {
+        std::lock_guard<std::mutex> guard(stream_mutex);
+        auto& pool = deflate ? deflaters : inflaters;
+        if (!pool.empty()) {
+            z_stream* s = pool.back();
+            pool.pop_back();
+            return s;
+        }
+    }
+    z_stream* s = new z_stream();
+    int r = deflate
+        ? deflateInit2(s, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                       Z_DEFAULT_STRATEGY)
+        : inflateInit2(s, -15);
+    if (r != Z_OK) {
+        delete s;
+        throw std::bad_alloc();
+    }
+    return s;
+}
+
+void value_compressor::release_stream(z_stream* s, bool deflate) const {
+    {
+        std::lock_guard<std::mutex> guard(stream_mutex);
+        auto& pool = deflate ? deflaters : inflaters;
+        if (pool.size() < MAX_IDLE_STREAMS) {
+            pool.push_back(s);
+            return;
+        }
+    }
+    if (deflate) deflateEnd(s); else inflateEnd(s);
+    delete s;
+}
+
+shared_ptr<const string>
+value_compressor::encode(const shared_ptr<const string>& value) {
+    return encode(value, true);
+}
+
+shared_ptr<const string>
+value_compressor::encode_nonblocking(const shared_ptr<const string>& value) {
+    return encode(value, false);
+}
+
+shared_ptr<const string>
+value_compressor::encode(const shared_ptr<const string>& value,
+                         bool sample_value) {
+    if (!value) return value;
+
+    dictionary_p dict;
+    uint32_t id;
+    vector<string> training;
+    {
+        std::lock_guard<std::mutex> guard(dict_mutex);
+        if (sample_value && !training_done)
+            training = sample(*value);
+        id = current_id;
+        if (id) dict = dictionaries.at(id);
+    }
+    if (!training.empty())
+        train(training);
+
+    if (value->size() >= MIN_COMPRESS_SIZE) {
+        string out;
+        out.push_back((char)MAGIC0);
+        out.push_back((char)MAGIC1);
+        out.push_back((char)METHOD_DEFLATE);
+        put_varint(out, id);
+        put_varint(out, value->size());
+        put_u32(out, checksum(*value));
+        size_t header = out.size();
+
+        z_stream* s = get_stream(true);
+        deflateReset(s);
+        if (dict)
+            deflateSetDictionary(s, (const Bytef*)dict->data(),
+                                 (uInt)dict->size());
+        out.resize(header + deflateBound(s, value->size()));
+        s->next_in = (Bytef*)value->data();
+        s->avail_in = (uInt)value->size();
+        s->next_out = (Bytef*)&out[header];
+        s->avail_out = (uInt)(out.size() - header);
+        int r = ::deflate(s, Z_FINISH);
+        size_t produced = s->total_out;
+        release_stream(s, true);
+
+        if (r == Z_STREAM_END && header + produced < value->size()) {
+            out.resize(header + produced);
+            return make_shared<const string>(std::move(out));
+        }
+    }
+
+    // A value kept uncompressed needs a header only if it could be
+    // mistaken for a compressed one
+    if (!has_magic(*value)) return value;
+    string out;
+    out.push_back((char)MAGIC0);
+    out.push_back((char)MAGIC1);
+    out.push_back((char)METHOD_STORED);
+    put_varint(out, 0);
+    put_varint(out, value->size());
+    out += *value;
+    return make_shared<const string>(std::move(out));
+}
+
+shared_ptr<const string>
+value_compressor::decode(const shared_ptr<const string>& value) const {
+    if (!value || !has_magic(*value)) return value;
+
+    const string& in = *value;
+    size_t pos = 3;
+    uint64_t id, size;
+    if (!get_varint(in, pos, id) || !get_varint(in, pos, size))
+        throw error::serialization(store_name + ": Corrupt compressed value");
+    size_t body = in.size() - pos;
+
+    if ((unsigned char)in[2] == METHOD_STORED) {
+        if (size != body)
+            throw error::serialization(store_name +
+                                       ": Corrupt compressed value");
+        return make_shared<const string>(in, pos);
+    }
+
+    if (body < CHECKSUM_SIZE ||
+        size > (body - CHECKSUM_SIZE) * MAX_DEFLATE_RATIO + 64)
+        throw error::serialization(store_name + ": Corrupt compressed value");
+    uint32_t sum = get_u32(&in[pos]);
+    pos += CHECKSUM_SIZE;
+    body -= CHECKSUM_SIZE;
+    dictionary_p dict;
+    if (id) {
+        std::lock_guard<std::mutex> guard(dict_mutex);
+        auto it = dictionaries.find((uint32_t)id);
+        if (it == dictionaries.end())
+            throw error::serialization(store_name +
+                                       ": Unknown compression dictionary " +
+                                       std::to_string(id));
+        dict = it->second;
+    }
+
+    string out(size, '\0');
+    z_stream* s = get_stream(false);
+    inflateReset(s);
+    if (dict)
+        inflateSetDictionary(s, (const Bytef*)dict->data(),
+                             (uInt)dict->size());
+    s->next_in = (Bytef*)&in[pos];
+    s->avail_in = (uInt)body;
+    s->next_out = (Bytef*)&out[0];
+    s->avail_out = (uInt)out.size();
+    int r = inflate(s, Z_FINISH);
+    size_t produced = s->total_out;
+    release_stream(s, false);
+    if (r != Z_STREAM_END || produced != size)
+        throw error::serialization(store_name + ": Corrupt compressed value");
+    // A different dictionary under the same number, or a damaged
+    // value, can still inflate to the right length
+    if (checksum(out) != sum)
+        throw error::serialization(store_name + ": Compressed value does"
+                                   " not match its checksum");
+    return make_shared<const string>(std::move(out));
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -0,0 +1,116 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for value_pool class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "value_pool.h"
+#include "key_hash.h"
+
+namespace throng {
+namespace internal {
+
+using std::string;
+using std::shared_ptr;
+
+static const size_t INITIAL_BUCKETS = 64;
+
+// Approximate size of the control block of a value's shared_ptr
+static const size_t CONTROL_BLOCK_SIZE = 4 * sizeof(void*);
+
+namespace {
+
+struct value_ref {
+    const string& value;
+    uint64_t hash;
+};
+
+struct value_ref_hash {
+    size_t operator()(const value_ref& v) const { return v.hash; }
+};
+
+}
+
+value_pool::value_pool(size_t min_size_)
+    : min_size(min_size_),
+      buckets(new index_t::bucket_type[INITIAL_BUCKETS]),
+      bucket_count(INITIAL_BUCKETS),
+      index(index_t::bucket_traits(buckets.get(), bucket_count)),
+      memory_usage(bucket_count * sizeof(index_t::bucket_type)) {
+}
+
+value_pool::~value_pool() {
+    index.clear_and_dispose([](entry* e) { delete e; });
+}
+
+size_t value_pool::entry_size(const string& value) {
+    return sizeof(entry) + sizeof(string) + CONTROL_BLOCK_SIZE +
+        value.size();
+}
+
+const value_pool::entry* value_pool::find(const string& value,
+                                          uint64_t hash) const {
+    auto it = index.find(value_ref{value, hash}, value_ref_hash(),
+                         [](const value_ref& v, const entry& e) {
+                             return v.hash == e.hash &&
+                                 *e.value == v.value;
+                         });
+    return it == index.end() ? nullptr : &*it;
+}
+
+size_t value_pool::get_added_size(const string& value) const {
+    if (find(value, xxh3_64(value.data(), value.size())))
+        return 0;
+    return entry_size(value);
+}
+
+value_pool::entry* value_pool::acquire(const shared_ptr<const string>& value) {
+    uint64_t hash = xxh3_64(value->data(), value->size());
+    entry* e = const_cast<entry*>(find(*value, hash));
+    if (!e) {
+        e = new entry(value, hash);
+        index.insert(*e);
+        memory_usage += entry_size(*value);
+        if (index.size() > bucket_count)
+            rehash(bucket_count * 2);
+    }
+    e->refs += 1;
+    return e;
+}
+
+void value_pool::release(entry* e) {
+    if (--e->refs > 0) return;
+    memory_usage -= entry_size(*e->value);
+    index.erase(index.iterator_to(*e));
+    delete e;
+}
+
+void value_pool::rehash(size_t new_count) {
+    std::unique_ptr<index_t::bucket_type[]>
+        new_buckets(new index_t::bucket_type[new_count]);
+    index.rehash(index_t::bucket_traits(new_buckets.get(), new_count));
+    buckets.swap(new_buckets);
+    memory_usage += (new_count - bucket_count) *
+        sizeof(index_t::bucket_type);
+    bucket_count = new_count;
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -0,0 +1,276 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Implementation for write_behind class.
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "write_behind.h"
+#include "logger.h"
+
+#include "throng/error.h"
+
+namespace throng {
+namespace internal {
+
+using std::string;
+using std::chrono::steady_clock;
+
+LOGGER("store");
+
+// Delay before the background thread retries a failed commit
+static const std::chrono::milliseconds COMMIT_RETRY_DELAY(1000);
+
+// Maximum number of discarded writes remembered for writers that
+// have not synced yet
+static const size_t MAX_FAILED_WRITES = 1024;
+
+size_t write_behind::get_write_size(const string& key,
+                                    const versioned<string>& value) {
+    return sizeof(batch_t::operation) + key.size() +
+        (value ? value.get().size() : 0);
+}
+
+write_behind::write_behind(store<string, string>& delegate_,
+                           durability_mode mode_,
+                           std::chrono::milliseconds commit_interval_,
+                           size_t queue_limit_)
+    : delegate(delegate_), mode(mode_), commit_interval(commit_interval_),
+      queue_limit(queue_limit_) {
+    if (mode != durability_mode::SYNC)
+        commit_thread = std::thread([this]() { run_commits(); });
+}
+
+write_behind::~write_behind() {
+    {
+        std::lock_guard<std::mutex> guard(queue_mutex);
+        stopping = true;
+        queue_cond.notify_all();
+    }
+    if (commit_thread.joinable())
+        commit_thread.join();
+
+    std::lock_guard<std::mutex> guard(commit_mutex);
+    if (!commit()) {
+        LOG(ERROR) << delegate.get_name() << ": Discarding "
+                   << retry.size() + queue.size() << " uncommitted writes";
+    }
+}
+
+void write_behind::run_commits() {
+    std::unique_lock<std::mutex> guard(queue_mutex);
+    while (!stopping) {
+        if (queue.empty() && !retry_pending) {
+            queue_cond.wait(guard);
+            continue;
+        }
+        time_point at = retry_pending ? std::max(commit_at, retry_at)
+            : commit_at;
+        if (steady_clock::now() < at) {
+            queue_cond.wait_until(guard, at);
+            continue;
+        }
+        guard.unlock();
+        flush();
+        guard.lock();
+    }
+}
+
+// must hold queue_mutex when calling
+void write_behind::schedule() {
+    switch (mode) {
+    case durability_mode::ASYNC:
+        commit_at = steady_clock::now();
+        break;
+    case durability_mode::BATCHED:
+        commit_at = steady_clock::now() + commit_interval;
+        break;
+    case durability_mode::SYNC:
+        return;
+    }
+    queue_cond.notify_one();
+}
+
+// must hold commit_mutex when calling
+void write_behind::schedule_retry() {
+    if (mode == durability_mode::SYNC) return;
+    std::lock_guard<std::mutex> guard(queue_mutex);
+    retry_pending = true;
+    retry_at = steady_clock::now() + COMMIT_RETRY_DELAY;
+    queue_cond.notify_one();
+}
+
+uint64_t write_behind::enqueue(const string& key,
+                               const versioned<string>& value) {
+    std::lock_guard<std::mutex> guard(queue_mutex);
+    bool first = queue.empty();
+    queue.put(key, value);
+    enqueued += 1;
+    size_t size = get_write_size(key, value);
+    queue_bytes += size;
+    pending_bytes += size;
+
+    // A commit takes the whole queue, so the commit thread only
+    // needs to be woken for the first write of each group
+    if (first) schedule();
+    return enqueued;
+}
+
+uint64_t write_behind::enqueue(const write_batch<string, string>& batch) {
+    std::lock_guard<std::mutex> guard(queue_mutex);
+    bool first = queue.empty();
+    // An atomic batch makes the group it is committed in atomic, so
+    // that the delegate applies all of it or none of it
+    queue.append(batch);
+    if (batch.is_atomic()) queue.set_atomic(true);
+    enqueued += batch.size();
+    size_t size = 0;
+    for (auto& op : batch.get_operations())
+        size += get_write_size(op.key, op.value);
+    queue_bytes += size;
+    pending_bytes += size;
+    if (first && !queue.empty()) schedule();
+    return enqueued;
+}
+
+void write_behind::wait_for_space() {
+    if (queue_limit == 0 || pending_bytes < queue_limit) return;
+    std::lock_guard<std::mutex> guard(commit_mutex);
+    if (pending_bytes < queue_limit) return;
+    if (!commit())
+        throw error::storage(delegate.get_name(),
+                             "Write queue is full: " + last_error);
+}
+
+// Write a group to the delegate, recording the error if it fails.
+// Must hold commit_mutex when calling.
+bool write_behind::write_group(const batch_t& group) {
+    try {
+        delegate.write(group);
+        return true;
+    } catch (const std::exception& e) {
+        LOG(ERROR) << delegate.get_name() << ": Could not commit "
+                   << group.size() << " writes: " << e.what();
+        last_error = e.what();
+        return false;
+    }
+}
+
+// Commit the writes of a group that keeps failing one at a time,
+// discarding those that the delegate rejects.  Must hold
+// commit_mutex when calling.
+void write_behind::fail_writes(const batch_t& group, uint64_t through) {
+    uint64_t seq = through - group.size();
+    for (auto& op : group.get_operations()) {
+        seq += 1;
+        if (!group.is_atomic()) {
+            batch_t one;
+            if (op.erase)
+                one.erase(op.key, op.value.get_version());
+            else
+                one.put(op.key, op.value);
+            if (write_group(one)) continue;
+        }
+        LOG(ERROR) << delegate.get_name() << ": Discarding write to "
+                   << op.key << ": " << last_error;
+        if (mode == durability_mode::SYNC) {
+            failed_writes[seq] = last_error;
+            if (failed_writes.size() > MAX_FAILED_WRITES)
+                failed_writes.erase(failed_writes.begin());
+        }
+    }
+}
+
+// must hold commit_mutex when calling
+bool write_behind::commit() {
+    if (!retry.empty()) {
+        // Writes queued since the group failed are held back, so that
+        // writes still reach the delegate in order
+        string previous = last_error;
+        if (!write_group(retry)) {
+            if (last_error != previous) retry_attempts = 0;
+            if (++retry_attempts < COMMIT_ATTEMPTS) {
+                schedule_retry();
+                return false;
+            }
+            // The same failure every time most likely comes from
+            // writes the delegate rejects, rather than from the
+            // delegate itself
+            fail_writes(retry, retry_through);
+        }
+        committed = retry_through;
+        pending_bytes -= retry_bytes;
+        retry = batch_t();
+        retry_attempts = 0;
+        if (mode != durability_mode::SYNC) {
+            std::lock_guard<std::mutex> guard(queue_mutex);
+            retry_pending = false;
+        }
+    }
+
+    batch_t group;
+    uint64_t through;
+    size_t bytes;
+    {
+        std::lock_guard<std::mutex> guard(queue_mutex);
+        std::swap(group, queue);
+        through = enqueued;
+        bytes = queue_bytes;
+        queue_bytes = 0;
+    }
+
+    if (!group.empty() && !write_group(group)) {
+        retry = std::move(group);
+        retry_through = through;
+        retry_bytes = bytes;
+        retry_attempts = 1;
+        schedule_retry();
+        return false;
+    }
+    committed = through;
+    pending_bytes -= bytes;
+    return true;
+}
+
+void write_behind::sync(uint64_t seq, size_t count) {
+    // Writers that queued while another writer was committing find
+    // their writes committed by the time they acquire the lock, or
+    // commit them along with everything else queued
+    std::lock_guard<std::mutex> guard(commit_mutex);
+    if (committed < seq && !commit())
+        throw error::storage(delegate.get_name(),
+                             "Could not commit writes: " + last_error);
+
+    auto first = failed_writes.lower_bound(seq - count + 1);
+    auto last = failed_writes.upper_bound(seq);
+    if (first != last) {
+        string e = first->second;
+        failed_writes.erase(first, last);
+        throw error::storage(delegate.get_name(),
+                             "Could not commit writes: " + e);
+    }
+}
+
+bool write_behind::flush() {
+    std::lock_guard<std::mutex> guard(commit_mutex);
+    return commit();
+}
+
+} /* namespace internal */
+} /* namespace throng */
@@ -0,0 +1,91 @@
+/*
+ * Test suite for bloom_filter
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bloom_filter.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(bloom_filter_test)
+
+using throng::internal::bloom_filter;
+
+// Count the false positives among keys that were never added
+static size_t false_positives(const bloom_filter& f, uint64_t start,
+                              size_t n) {
+    size_t result = 0;
+    for (uint64_t k = start; k < start + n; ++k) {
+        if (f.may_contain(k)) result += 1;
+    }
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(basic) {
+    bloom_filter f(1000, 0.01, 1024 * 1024);
+    BOOST_CHECK(!f.may_contain(1));
+    for (uint64_t k = 0; k < 1000; ++k)
+        f.insert(k);
+    // a key that is a false positive for the keys before it is not
+    // counted
+    size_t n = f.size();
+    BOOST_CHECK(n <= 1000 && n > 980);
+    for (uint64_t k = 0; k < 1000; ++k)
+        BOOST_CHECK(f.may_contain(k));
+
+    // nor are keys added again
+    for (uint64_t k = 0; k < 1000; ++k)
+        f.insert(k);
+    BOOST_CHECK_EQUAL(n, f.size());
+    BOOST_CHECK(false_positives(f, 1000000, 100000) < 1000);
+    BOOST_CHECK(!f.is_saturated());
+}
+
+BOOST_AUTO_TEST_CASE(grow) {
+    bloom_filter f(100, 0.01, 1024 * 1024);
+    size_t initial = f.get_memory_usage();
+    for (uint64_t k = 0; k < 100000; ++k)
+        f.insert(k * 7919);
+    BOOST_CHECK(f.get_memory_usage() > initial);
+    for (uint64_t k = 0; k < 100000; ++k)
+        BOOST_REQUIRE(f.may_contain(k * 7919));
+
+    // the layers keep the overall rate within the target
+    BOOST_CHECK(false_positives(f, 1ULL << 40, 100000) < 1000);
+    BOOST_CHECK(!f.is_saturated());
+}
+
+BOOST_AUTO_TEST_CASE(memory_limit) {
+    bloom_filter f(100, 0.01, 4096);
+    for (uint64_t k = 0; k < 20000; ++k)
+        f.insert(k);
+    BOOST_CHECK(f.get_memory_usage() <= 4096);
+    BOOST_CHECK(f.is_saturated());
+    for (uint64_t k = 0; k < 20000; ++k)
+        BOOST_REQUIRE(f.may_contain(k));
+
+    // a limit below the size of the first layer shrinks it
+    bloom_filter small(100000, 0.01, 1000);
+    BOOST_CHECK(small.get_memory_usage() <= 1000);
+    small.insert(5);
+    BOOST_CHECK(small.may_contain(5));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
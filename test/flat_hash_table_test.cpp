@@ -0,0 +1,117 @@
+/*
+ * Test suite for flat_hash_table
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "flat_hash_table.h"
+#include "key_hash.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <map>
+
+BOOST_AUTO_TEST_SUITE(flat_hash_table_test)
+
+using throng::internal::flat_hash_table;
+using throng::internal::xxh3_64;
+using std::string;
+
+static uint64_t good_hash(const string& key) {
+    return xxh3_64(key.data(), key.size());
+}
+
+static uint64_t bad_hash(const string& key) {
+    // force collisions in both the group and the control bits
+    return key.size();
+}
+
+static void check_table(flat_hash_table<int>& table,
+                        const std::map<string, int>& expected,
+                        uint64_t (*hash)(const string&)) {
+    BOOST_CHECK_EQUAL(expected.size(), table.size());
+    for (auto& e : expected) {
+        int* v = table.find(e.first, hash(e.first));
+        BOOST_REQUIRE(v);
+        BOOST_CHECK_EQUAL(e.second, *v);
+    }
+    size_t count = 0;
+    table.for_each([&](const string& key, const int& value) {
+            BOOST_CHECK_EQUAL(expected.at(key), value);
+            count += 1;
+        });
+    BOOST_CHECK_EQUAL(expected.size(), count);
+}
+
+BOOST_AUTO_TEST_CASE(insert_find_erase) {
+    for (auto hash : { good_hash, bad_hash }) {
+        flat_hash_table<int> table;
+        std::map<string, int> expected;
+        BOOST_CHECK(!table.find("missing", hash("missing")));
+        BOOST_CHECK(!table.erase("missing", hash("missing")));
+
+        // the table grows many times, with lookups, updates and
+        // removals made while items are being moved
+        for (int i = 0; i < 20000; i++) {
+            string key = "key" + std::to_string(i);
+            auto r = table.insert(key, hash(key));
+            BOOST_CHECK(r.second);
+            *r.first = i;
+            expected[key] = i;
+
+            if (i % 3 == 0) {
+                string old = "key" + std::to_string(i / 2);
+                auto u = table.insert(old, hash(old));
+                BOOST_CHECK(!u.second);
+                BOOST_CHECK_EQUAL(expected[old], *u.first);
+                *u.first = -i;
+                expected[old] = -i;
+            }
+            if (i % 5 == 0) {
+                string old = "key" + std::to_string(i / 3);
+                BOOST_CHECK_EQUAL(expected.erase(old) > 0,
+                                  table.erase(old, hash(old)));
+            }
+            if (hash == bad_hash && i == 2000) break;
+        }
+        check_table(table, expected, hash);
+        BOOST_CHECK(!table.find("key20000", hash("key20000")));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(churn) {
+    // repeatedly inserting and removing keys leaves deleted slots,
+    // which are reclaimed without the table growing without bound
+    flat_hash_table<int> table;
+    std::map<string, int> expected;
+    for (int i = 0; i < 100000; i++) {
+        string key = "key" + std::to_string(i);
+        *table.insert(key, good_hash(key)).first = i;
+        expected[key] = i;
+        if (i >= 100) {
+            string old = "key" + std::to_string(i - 100);
+            BOOST_CHECK(table.erase(old, good_hash(old)));
+            expected.erase(old);
+        }
+    }
+    check_table(table, expected, good_hash);
+    BOOST_CHECK(table.capacity() <= 1024);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
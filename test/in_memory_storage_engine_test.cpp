@@ -24,16 +24,108 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <atomic>
+#include <set>
+#include <thread>
+
 BOOST_AUTO_TEST_SUITE(in_memory_storage_engine_test)
 
 using throng::internal::in_memory_storage_engine;
+using throng::versioned;
+using throng::vector_clock;
 using std::string;
+using std::vector;
 using std::shared_ptr;
 using std::make_shared;
 
-//BOOST_AUTO_TEST_CASE(basic) {
-//    in_memory_storage_engine e {"test"};
-//    // XXX TODO
-//}
+BOOST_AUTO_TEST_CASE(basic) {
+    in_memory_storage_engine e {"test"};
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = vector_clock().incremented({2});
+    vector_clock v3 = v1.merge(v2).incremented({1});
+
+    BOOST_CHECK_EQUAL("test", e.get_name());
+    BOOST_CHECK_EQUAL(0, e.get("a").size());
+    BOOST_CHECK(e.put("a", { make_shared<string>("1"), v1 }));
+    BOOST_CHECK(!e.put("a", { make_shared<string>("1"), v1 }));
+    BOOST_CHECK(e.put("a", { make_shared<string>("2"), v2 }));
+    BOOST_CHECK_EQUAL(2, e.get("a").size());
+    BOOST_CHECK(e.put("a", { make_shared<string>("3"), v3 }));
+    auto values = e.get("a");
+    BOOST_REQUIRE_EQUAL(1, values.size());
+    BOOST_CHECK_EQUAL("3", values[0].get());
+    BOOST_CHECK_EQUAL(1, e.size());
+}
+
+BOOST_AUTO_TEST_CASE(visit) {
+    in_memory_storage_engine e {"test"};
+    vector_clock v1 = vector_clock().incremented({1});
+    for (int i = 0; i < 1000; i++) {
+        string key = (i % 2 ? "odd/" : "even/") + std::to_string(i);
+        e.put(key, { make_shared<string>(key), v1 });
+    }
+
+    std::multiset<string> keys;
+    auto visitor = [&keys](const string& key,
+                           const vector<versioned<string>>& values) {
+        BOOST_CHECK_EQUAL(key, values.at(0).get());
+        keys.insert(key);
+    };
+    e.visit(visitor);
+    BOOST_CHECK_EQUAL(1000, keys.size());
+
+    keys.clear();
+    e.visit_prefix("odd/", visitor);
+    BOOST_CHECK_EQUAL(500, keys.size());
+
+    keys.clear();
+    for (size_t p = 0; p < 3; p++)
+        e.visit_partition(p, 3, visitor);
+    BOOST_CHECK_EQUAL(1000, keys.size());
+    BOOST_CHECK_EQUAL(1000, std::set<string>(keys.begin(), keys.end()).size());
+}
+
+BOOST_AUTO_TEST_CASE(write_batch) {
+    in_memory_storage_engine e {"test"};
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = v1.incremented({1});
+    e.put("a", { make_shared<string>("old"), v2 });
+
+    for (bool atomic : { false, true }) {
+        throng::write_batch<string, string> batch(atomic);
+        batch.put("a", { make_shared<string>("obsolete"), v1 });
+        for (int i = 0; i < 100; i++)
+            batch.put(std::to_string(i), { make_shared<string>("1"), v1 });
+        batch.put("0", { make_shared<string>("2"), v2 });
+        batch.remove("b", v1);
+        BOOST_CHECK_EQUAL(atomic ? 0 : 102, e.write(batch));
+    }
+    BOOST_CHECK_EQUAL("old", e.get("a").at(0).get());
+    BOOST_CHECK_EQUAL("2", e.get("0").at(0).get());
+    BOOST_CHECK_EQUAL("1", e.get("99").at(0).get());
+    BOOST_CHECK(!e.get("b").at(0));
+    BOOST_CHECK_EQUAL(102, e.size());
+}
+
+BOOST_AUTO_TEST_CASE(concurrent) {
+    in_memory_storage_engine e {"test"};
+    vector_clock v1 = vector_clock().incremented({1});
+    std::atomic<size_t> missing(0);
+    vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&e, &v1, &missing, t]() {
+                for (int i = 0; i < 5000; i++) {
+                    string key = std::to_string(t) + "/" + std::to_string(i);
+                    e.put(key, { make_shared<string>(key), v1 });
+                    if (e.get(key).size() != 1)
+                        missing += 1;
+                }
+            });
+    }
+    for (auto& t : threads)
+        t.join();
+    BOOST_CHECK_EQUAL(0, missing);
+    BOOST_CHECK_EQUAL(20000, e.size());
+}
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,438 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file engine_conformance.h
+ * @brief Conformance checks for storage engines
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_TEST_ENGINE_CONFORMANCE_H
+#define THRONG_TEST_ENGINE_CONFORMANCE_H
+
+#include "throng/store.h"
+#include "stored_values.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace throng {
+namespace test {
+
+/**
+ * A storage engine to run through the conformance checks
+ */
+struct engine_under_test {
+    typedef store<std::string, std::string> store_t;
+
+    /**
+     * The name of the engine, used in failure messages
+     */
+    std::string name;
+
+    /**
+     * Open the engine with its data in the given directory, which
+     * might not exist yet
+     */
+    std::function<std::unique_ptr<store_t>(const boost::filesystem::path&)>
+    open;
+
+    /**
+     * True if reopening a directory recovers the data written to it
+     */
+    bool persistent = false;
+
+    /**
+     * True if a copy of the engine's directory taken while it is open
+     * is a valid image of its state after a crash, because every
+     * write it has acknowledged is in its files.  The copy sees what
+     * the engine has written to the operating system, not what has
+     * reached the disk, so these checks cannot catch a missing fsync.
+     */
+    bool crash_images = false;
+
+    /**
+     * If set, damage the last write in a crash image, as if the
+     * process had been killed partway through writing it
+     */
+    std::function<void(const boost::filesystem::path&)> tear;
+};
+
+typedef std::vector<versioned<std::string>> engine_values_t;
+
+/**
+ * The expected contents of a store
+ */
+typedef std::map<std::string, engine_values_t> engine_model_t;
+
+/**
+ * Compare two sets of values for a key, ignoring their order
+ */
+inline bool same_values(const engine_values_t& a, const engine_values_t& b) {
+    if (a.size() != b.size()) return false;
+    for (auto& va : a) {
+        auto it = std::find_if(b.begin(), b.end(),
+                               [&va](const versioned<std::string>& vb) {
+            return va.get_version() == vb.get_version() &&
+                (bool)va == (bool)vb && (!va || va.get() == vb.get());
+        });
+        if (it == b.end()) return false;
+    }
+    return true;
+}
+
+/**
+ * Check that a store holds exactly the given contents, read both
+ * with get and with visit
+ */
+inline void check_contents(engine_under_test::store_t& s,
+                           const engine_model_t& model,
+                           const std::string& what) {
+    for (auto& m : model) {
+        BOOST_CHECK_MESSAGE(same_values(s.get(m.first), m.second),
+                            what << ": wrong values for " << m.first);
+    }
+    std::set<std::string> seen;
+    s.visit([&](const std::string& key, const engine_values_t& values) {
+            auto it = model.find(key);
+            BOOST_CHECK_MESSAGE(it != model.end() &&
+                                same_values(values, it->second),
+                                what << ": visited wrong values for " << key);
+            BOOST_CHECK_MESSAGE(seen.insert(key).second,
+                                what << ": visited " << key << " twice");
+        });
+    BOOST_CHECK_MESSAGE(seen.size() == model.size(),
+                        what << ": visited " << seen.size() << " of "
+                        << model.size() << " keys");
+}
+
+/**
+ * A deterministic random sequence of writes and batches, with the
+ * contents the store should have after them.  The writes include
+ * superseding, concurrent and obsolete versions, tombstones and
+ * erases.
+ */
+class engine_workload {
+public:
+    /**
+     * @param seed the random seed
+     * @param atomic_batches_ true to make every batch atomic
+     * @param key_count the number of keys written
+     */
+    explicit engine_workload(uint32_t seed, bool atomic_batches_ = false,
+                             size_t key_count = 50)
+        : rng(seed), atomic_batches(atomic_batches_) {
+        for (size_t i = 0; i < key_count; ++i)
+            keys.push_back("key" + std::to_string(i));
+    }
+
+    /**
+     * Apply the next write or batch to the store, checking the
+     * result against the model
+     *
+     * @param s the store
+     * @return true if the store changed
+     */
+    bool step(engine_under_test::store_t& s, const std::string& what) {
+        if (pick(10) == 0) {
+            write_batch<std::string, std::string>
+                batch(atomic_batches || pick(2) == 0);
+            size_t expected = 0;
+            for (size_t n = 1 + pick(8); n > 0; --n) {
+                std::string key = keys[pick(keys.size())];
+                if (pick(6) == 0) {
+                    vector_clock clock = erase_version(key);
+                    batch.erase(key, clock);
+                    if (internal::apply_erase(model[key], clock))
+                        expected += 1;
+                    continue;
+                }
+                versioned<std::string> v = next_value(key);
+                batch.put(key, v);
+                if (internal::apply_write(model[key], v)) expected += 1;
+            }
+            size_t applied = s.write(batch);
+            BOOST_CHECK_MESSAGE(applied == expected,
+                                what << ": batch applied " << applied
+                                << " writes, expected " << expected);
+            prune();
+            return expected > 0;
+        }
+
+        std::string key = keys[pick(keys.size())];
+        if (pick(10) == 0) {
+            vector_clock clock = erase_version(key);
+            bool expected = internal::apply_erase(model[key], clock);
+            BOOST_CHECK_MESSAGE(s.erase(key, clock) == expected,
+                                what << ": erase of " << key << " returned "
+                                << !expected);
+            prune();
+            return expected;
+        }
+        versioned<std::string> v = next_value(key);
+        bool expected = internal::apply_write(model[key], v);
+        BOOST_CHECK_MESSAGE(s.put(key, v) == expected,
+                            what << ": put to " << key << " returned "
+                            << !expected);
+        prune();
+        return expected;
+    }
+
+    /**
+     * The expected contents of the store
+     */
+    engine_model_t model;
+
+private:
+    std::mt19937 rng;
+    bool atomic_batches;
+    std::vector<std::string> keys;
+    uint64_t counter = 0;
+
+    size_t pick(size_t n) {
+        return std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+    }
+
+    versioned<std::string> next_value(const std::string& key) {
+        const engine_values_t& current = model[key];
+        vector_clock clock;
+        size_t kind = pick(10);
+        if (!current.empty() && kind == 0) {
+            // an obsolete write of a version already present
+            clock = current[pick(current.size())].get_version();
+        } else if (!current.empty() && kind < 3) {
+            // concurrent with some of the current values
+            clock = current[pick(current.size())].get_version()
+                .incremented({ (uint32_t)(10 + pick(3)) });
+        } else {
+            // supersedes all the current values
+            for (auto& v : current)
+                clock = clock.merge(v.get_version());
+            clock = clock.incremented({ (uint32_t)(1 + pick(3)) });
+        }
+        if (pick(6) == 0)
+            return { nullptr, clock };
+        counter += 1;
+        return { std::make_shared<std::string>
+                 (key + "/" + std::to_string(counter) +
+                  std::string(pick(100), 'v')), clock };
+    }
+
+    vector_clock erase_version(const std::string& key) {
+        const engine_values_t& current = model[key];
+        if (current.empty() || pick(3) == 0)
+            return vector_clock().incremented({ (uint32_t)(1 + pick(3)) });
+        if (pick(2) == 0) {
+            // through one of the values, keeping any concurrent ones
+            return current[pick(current.size())].get_version();
+        }
+        vector_clock clock;
+        for (auto& v : current)
+            clock = clock.merge(v.get_version());
+        return clock;
+    }
+
+    void prune() {
+        for (auto it = model.begin(); it != model.end(); ) {
+            if (it->second.empty()) it = model.erase(it);
+            else ++it;
+        }
+    }
+};
+
+/**
+ * Check the handling of concurrent values, obsolete writes and
+ * tombstones for a single key
+ */
+inline void check_engine_versions(engine_under_test::store_t& s,
+                                  const std::string& what) {
+    using std::make_shared;
+    using std::string;
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = vector_clock().incremented({2});
+    vector_clock v12 = v1.merge(v2).incremented({1});
+
+    BOOST_CHECK_MESSAGE(s.get("k").empty(), what);
+    BOOST_CHECK_MESSAGE(s.put("k", { make_shared<string>("1"), v1 }), what);
+    // an equal version is obsolete
+    BOOST_CHECK_MESSAGE(!s.put("k", { make_shared<string>("x"), v1 }), what);
+    // a concurrent version is kept alongside
+    BOOST_CHECK_MESSAGE(s.put("k", { make_shared<string>("2"), v2 }), what);
+    BOOST_CHECK_MESSAGE(same_values(s.get("k"),
+                                    { { make_shared<string>("1"), v1 },
+                                      { make_shared<string>("2"), v2 } }),
+                        what << ": siblings");
+    // an earlier version is obsolete
+    BOOST_CHECK_MESSAGE(!s.put("k", { make_shared<string>("x"),
+                                      vector_clock() }), what);
+    // a later version supersedes both
+    BOOST_CHECK_MESSAGE(s.put("k", { nullptr, v12 }), what);
+    engine_values_t values = s.get("k");
+    BOOST_CHECK_MESSAGE(values.size() == 1 && !values[0] &&
+                        values[0].get_version() == v12,
+                        what << ": tombstone");
+    // the tombstone supersedes earlier writes
+    BOOST_CHECK_MESSAGE(!s.put("k", { make_shared<string>("x"), v2 }), what);
+    vector_clock v3 = v12.incremented({3});
+    BOOST_CHECK_MESSAGE(s.put("k", { make_shared<string>("3"), v3 }), what);
+    BOOST_CHECK_MESSAGE(same_values(s.get("k"),
+                                    { { make_shared<string>("3"), v3 } }),
+                        what << ": write after tombstone");
+
+    // an erase removes the values up to its version, and keeps any
+    // concurrent ones
+    BOOST_CHECK_MESSAGE(s.put("e", { make_shared<string>("1"), v1 }), what);
+    BOOST_CHECK_MESSAGE(s.put("e", { make_shared<string>("2"), v2 }), what);
+    BOOST_CHECK_MESSAGE(s.erase("e", v1), what);
+    BOOST_CHECK_MESSAGE(same_values(s.get("e"),
+                                    { { make_shared<string>("2"), v2 } }),
+                        what << ": partial erase");
+    BOOST_CHECK_MESSAGE(!s.erase("e", v1), what);
+    BOOST_CHECK_MESSAGE(s.erase("e", v12), what);
+    BOOST_CHECK_MESSAGE(s.get("e").empty(), what << ": erase");
+    BOOST_CHECK_MESSAGE(!s.erase("e", v12), what);
+    BOOST_CHECK_MESSAGE(s.put("e", { make_shared<string>("3"), v1 }), what);
+}
+
+/**
+ * Check visiting all keys, keys with a prefix, and partitions
+ */
+inline void check_engine_visit(engine_under_test::store_t& s,
+                               const std::string& what) {
+    vector_clock v1 = vector_clock().incremented({1});
+    for (int i = 0; i < 500; i++) {
+        std::string key = (i % 2 ? "odd/" : "even/") + std::to_string(i);
+        s.put(key, { std::make_shared<std::string>(key), v1 });
+    }
+    std::multiset<std::string> keys;
+    auto visitor = [&](const std::string& key,
+                       const engine_values_t& values) {
+        BOOST_CHECK_MESSAGE(values.size() == 1 && values[0] &&
+                            values[0].get() == key, what << ": " << key);
+        keys.insert(key);
+    };
+    s.visit(visitor);
+    BOOST_CHECK_MESSAGE(keys.size() == 500, what << ": visit");
+    keys.clear();
+    s.visit_prefix("odd/", visitor);
+    BOOST_CHECK_MESSAGE(keys.size() == 250, what << ": visit_prefix");
+    keys.clear();
+    for (size_t p = 0; p < 3; p++)
+        s.visit_partition(p, 3, visitor);
+    BOOST_CHECK_MESSAGE(keys.size() == 500 &&
+                        std::set<std::string>(keys.begin(), keys.end())
+                        .size() == 500, what << ": visit_partition");
+}
+
+/**
+ * Copy a directory, as an image of an engine's files
+ */
+inline void copy_engine_files(const boost::filesystem::path& from,
+                              const boost::filesystem::path& to) {
+    namespace fs = boost::filesystem;
+    fs::create_directories(to);
+    for (fs::directory_iterator it(from), end; it != end; ++it) {
+        if (fs::is_directory(it->status()))
+            copy_engine_files(it->path(), to / it->path().filename());
+        else
+            fs::copy_file(it->path(), to / it->path().filename());
+    }
+}
+
+/**
+ * Run an engine through all the checks that apply to it
+ *
+ * @param e the engine
+ * @param dir a directory for the engine's files
+ */
+inline void check_engine(const engine_under_test& e,
+                         const boost::filesystem::path& dir) {
+    BOOST_TEST_CHECKPOINT(e.name);
+    check_engine_versions(*e.open(dir / "versions"), e.name);
+    check_engine_visit(*e.open(dir / "visit"), e.name);
+
+    // A random sequence of writes matches the model, and again after
+    // the engine is reopened
+    engine_workload w(42);
+    {
+        auto s = e.open(dir / "random");
+        for (int i = 0; i < 2000; i++)
+            w.step(*s, e.name);
+        check_contents(*s, w.model, e.name + " random writes");
+    }
+    if (e.persistent) {
+        auto s = e.open(dir / "random");
+        check_contents(*s, w.model, e.name + " reopened");
+        for (int i = 0; i < 500; i++)
+            w.step(*s, e.name);
+        check_contents(*s, w.model, e.name + " written after reopen");
+    }
+    if (!e.crash_images) return;
+
+    // Kill the engine at several points by copying its files while
+    // it is open.  Each image holds every write acknowledged before
+    // the kill, and a torn last write loses only that write.  Batches
+    // are atomic, so that a torn batch is lost as a whole.
+    static const std::set<int> kill_points = { 1, 7, 40, 150, 400 };
+    engine_workload k(7, true);
+    std::map<int, engine_model_t> killed, before_last;
+    {
+        engine_model_t previous;
+        auto s = e.open(dir / "live");
+        for (int i = 1; i <= *kill_points.rbegin(); i++) {
+            engine_model_t saved = k.model;
+            if (k.step(*s, e.name))
+                previous = std::move(saved);
+            if (kill_points.count(i)) {
+                copy_engine_files(dir / "live",
+                                  dir / ("kill" + std::to_string(i)));
+                killed[i] = k.model;
+                before_last[i] = previous;
+            }
+        }
+    }
+    for (int i : kill_points) {
+        std::string name = "kill" + std::to_string(i);
+        std::string what = e.name + " killed after write " +
+            std::to_string(i);
+        // Copy the image before opening it, since recovery or a
+        // background compaction can rewrite the files it opens
+        boost::filesystem::path torn = dir / (name + "-torn");
+        if (e.tear)
+            copy_engine_files(dir / name, torn);
+        {
+            auto s = e.open(dir / name);
+            check_contents(*s, killed[i], what);
+        }
+        if (!e.tear) continue;
+        e.tear(torn);
+        auto s = e.open(torn);
+        check_contents(*s, before_last[i], what + " with a torn write");
+    }
+}
+
+} /* namespace test */
+} /* namespace throng */
+
+#endif /* THRONG_TEST_ENGINE_CONFORMANCE_H */
@@ -0,0 +1,168 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*!
+ * @file map_store.h
+ * @brief A simple store for use as a delegate in tests
+ */
+/* Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#pragma once
+#ifndef THRONG_TEST_MAP_STORE_H
+#define THRONG_TEST_MAP_STORE_H
+
+#include "throng/store.h"
+#include "throng/error.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace throng {
+namespace test {
+
+/**
+ * A store that keeps the last value written for each key in a map
+ * and counts the writes made to it
+ */
+class map_store : public store<std::string, std::string> {
+public:
+    map_store(std::string name_ = "map") : name(std::move(name_)) { }
+
+    virtual std::vector<versioned_t> get(const std::string& key) override {
+        std::lock_guard<std::mutex> guard(lock);
+        gets += 1;
+        auto it = data.find(key);
+        if (it == data.end()) return std::vector<versioned_t>();
+        return { it->second };
+    }
+
+    virtual bool put(const std::string& key,
+                     const versioned_t& value) override {
+        std::lock_guard<std::mutex> guard(lock);
+        data.erase(key);
+        data.emplace(key, value);
+        puts += 1;
+        return true;
+    }
+
+    virtual bool erase(const std::string& key,
+                       const vector_clock& version) override {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = data.find(key);
+        if (it == data.end() ||
+            it->second.get_version().compare(version) ==
+            vector_clock::occurred::AFTER)
+            return false;
+        data.erase(it);
+        return true;
+    }
+
+    virtual size_t
+    write(const write_batch<std::string, std::string>& batch) override {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (failing)
+                throw error::storage(name, "Simulated write failure");
+            for (auto& op : batch.get_operations()) {
+                if (op.key == failing_key)
+                    throw error::storage(name, "Simulated write failure");
+            }
+            batches += 1;
+            if (batch.is_atomic()) atomic_batches += 1;
+        }
+        return store::write(batch);
+    }
+
+    virtual void visit(store_visitor visitor) override {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto& d : data)
+            visitor(d.first, { d.second });
+    }
+
+    virtual const std::string& get_name() const override { return name; }
+
+    /**
+     * Get the number of keys in the store
+     */
+    size_t size() {
+        std::lock_guard<std::mutex> guard(lock);
+        return data.size();
+    }
+
+    /**
+     * Get the number of reads made from the store
+     */
+    size_t get_get_count() {
+        std::lock_guard<std::mutex> guard(lock);
+        return gets;
+    }
+
+    /**
+     * Get the number of writes made to the store
+     */
+    size_t get_put_count() {
+        std::lock_guard<std::mutex> guard(lock);
+        return puts;
+    }
+
+    /**
+     * Make batch writes fail, or succeed again
+     */
+    void set_failing(bool failing_) {
+        std::lock_guard<std::mutex> guard(lock);
+        failing = failing_;
+    }
+
+    /**
+     * Make batch writes that contain the given key fail, or with an
+     * empty key, succeed again
+     */
+    void set_failing_key(std::string key) {
+        std::lock_guard<std::mutex> guard(lock);
+        failing_key = std::move(key);
+    }
+
+    /**
+     * Get the number of write batches applied to the store
+     */
+    size_t get_batch_count() {
+        std::lock_guard<std::mutex> guard(lock);
+        return batches;
+    }
+
+    /**
+     * Get the number of atomic write batches applied to the store
+     */
+    size_t get_atomic_batch_count() {
+        std::lock_guard<std::mutex> guard(lock);
+        return atomic_batches;
+    }
+
+private:
+    std::string name;
+    std::mutex lock;
+    std::map<std::string, versioned_t> data;
+    size_t gets = 0;
+    size_t puts = 0;
+    size_t batches = 0;
+    size_t atomic_batches = 0;
+    bool failing = false;
+    std::string failing_key;
+};
+
+} /* namespace test */
+} /* namespace throng */
+
+#endif /* THRONG_TEST_MAP_STORE_H */
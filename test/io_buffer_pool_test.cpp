@@ -0,0 +1,123 @@
+/*
+ * Test suite for io_buffer_pool
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "io_buffer_pool.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include <cstring>
+
+BOOST_AUTO_TEST_SUITE(io_buffer_pool_test)
+
+using std::vector;
+using throng::internal::io_buffer_pool;
+typedef io_buffer_pool::buffer buffer;
+
+BOOST_AUTO_TEST_CASE(reuse) {
+    auto pool = std::make_shared<io_buffer_pool>();
+    uint8_t* first;
+    {
+        buffer b = pool->acquire(100);
+        BOOST_CHECK_EQUAL(100, b.size());
+        BOOST_CHECK_EQUAL(io_buffer_pool::MIN_BUFFER_SIZE, b.capacity());
+        std::memset(b.data(), 'x', b.capacity());
+        first = b.data();
+
+        auto s = pool->get_stats();
+        BOOST_CHECK_EQUAL(1, s.allocations);
+        BOOST_CHECK_EQUAL(1, s.outstanding);
+        BOOST_CHECK_EQUAL(0, s.cached);
+    }
+    auto s = pool->get_stats();
+    BOOST_CHECK_EQUAL(0, s.outstanding);
+    BOOST_CHECK_EQUAL(1, s.cached);
+    BOOST_CHECK_EQUAL(io_buffer_pool::MIN_BUFFER_SIZE, s.cached_bytes);
+
+    // A buffer from the same size class is reused
+    buffer b = pool->acquire(200);
+    BOOST_CHECK(first == b.data());
+    // A buffer from another class is not
+    buffer c = pool->acquire(300);
+    BOOST_CHECK_EQUAL(512, c.capacity());
+    BOOST_CHECK(first != c.data());
+
+    s = pool->get_stats();
+    BOOST_CHECK_EQUAL(2, s.allocations);
+    BOOST_CHECK_EQUAL(1, s.reuses);
+    BOOST_CHECK_EQUAL(2, s.outstanding);
+    BOOST_CHECK_EQUAL(256 + 512, s.outstanding_bytes);
+    BOOST_CHECK_EQUAL(0, s.cached);
+}
+
+BOOST_AUTO_TEST_CASE(move) {
+    auto pool = std::make_shared<io_buffer_pool>();
+    buffer a = pool->acquire(1000);
+    uint8_t* data = a.data();
+    buffer b(std::move(a));
+    BOOST_CHECK(a.data() == nullptr);
+    BOOST_CHECK(b.data() == data);
+
+    vector<buffer> v;
+    v.push_back(std::move(b));
+    v.push_back(pool->acquire(1000));
+    BOOST_CHECK_EQUAL(2, pool->get_stats().outstanding);
+    v[1] = std::move(v[0]);
+    BOOST_CHECK_EQUAL(1, pool->get_stats().outstanding);
+    v.clear();
+    BOOST_CHECK_EQUAL(0, pool->get_stats().outstanding);
+    BOOST_CHECK_EQUAL(2, pool->get_stats().cached);
+}
+
+BOOST_AUTO_TEST_CASE(limits) {
+    auto pool = std::make_shared<io_buffer_pool>(4096, 8192);
+
+    // Buffers above the largest class are never kept
+    pool->acquire(5000).reset();
+    auto s = pool->get_stats();
+    BOOST_CHECK_EQUAL(1, s.discards);
+    BOOST_CHECK_EQUAL(0, s.cached);
+
+    // Only as many buffers are kept as fit in the cache
+    vector<buffer> v;
+    for (int i = 0; i < 4; ++i)
+        v.push_back(pool->acquire(4096));
+    v.clear();
+    s = pool->get_stats();
+    BOOST_CHECK_EQUAL(2, s.cached);
+    BOOST_CHECK_EQUAL(8192, s.cached_bytes);
+    BOOST_CHECK_EQUAL(3, s.discards);
+}
+
+BOOST_AUTO_TEST_CASE(outlives_pool) {
+    buffer b;
+    {
+        auto pool = std::make_shared<io_buffer_pool>();
+        b = pool->acquire(10);
+    }
+    // The buffer keeps its pool alive until it is released
+    std::memset(b.data(), 0, b.size());
+    b.reset();
+    BOOST_CHECK(b.data() == nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,263 @@
+/*
+ * Test suite for item_table
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "item_table.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <vector>
+#include <map>
+
+BOOST_AUTO_TEST_SUITE(item_table_test)
+
+using throng::internal::item_table;
+using throng::versioned;
+using throng::vector_clock;
+using throng::node_id;
+using std::string;
+using std::vector;
+using std::make_shared;
+
+typedef item_table::versioned_t versioned_t;
+
+static uint64_t bad_hash(const string& key) {
+    // force collisions in the index
+    return key.size();
+}
+
+BOOST_AUTO_TEST_CASE(insert_find_erase) {
+    item_table table;
+    std::map<string, item_table::record*> records;
+    for (int i = 0; i < 1000; i++) {
+        string key = "key" + std::to_string(i);
+        records[key] = table.insert(key, bad_hash(key));
+    }
+    BOOST_CHECK_EQUAL(1000, table.size());
+
+    for (auto& r : records) {
+        BOOST_REQUIRE(r.second == table.find(r.first, bad_hash(r.first)));
+        BOOST_CHECK_EQUAL(r.first, r.second->get_key());
+        BOOST_CHECK(r.second->is_tombstone());
+        BOOST_CHECK_EQUAL(0, r.second->get_values().size());
+    }
+    BOOST_CHECK(!table.find("key1000", bad_hash("key1000")));
+
+    table.erase(records["key10"]);
+    BOOST_CHECK(!table.find("key10", bad_hash("key10")));
+    BOOST_CHECK(table.find("key11", bad_hash("key11")));
+    BOOST_CHECK_EQUAL(999, table.size());
+
+    size_t count = 0;
+    table.for_each([&count](const item_table::record&) { count += 1; });
+    BOOST_CHECK_EQUAL(999, count);
+}
+
+BOOST_AUTO_TEST_CASE(reserve) {
+    item_table table;
+    table.insert("a", 1);
+    auto index_usage = [&table]() {
+        return table.get_memory_usage() -
+            table.get_allocator().get_used_bytes();
+    };
+    size_t initial = index_usage();
+    table.reserve(5000);
+    size_t reserved = index_usage();
+    BOOST_CHECK(reserved > initial);
+    BOOST_CHECK(table.find("a", 1));
+
+    // the index does not grow again before it holds the reserved
+    // number of items
+    for (int i = 0; i < 4999; i++) {
+        string key = "key" + std::to_string(i);
+        table.insert(key, std::hash<string>()(key));
+    }
+    BOOST_CHECK_EQUAL(5000, table.size());
+    BOOST_CHECK_EQUAL(reserved, index_usage());
+}
+
+BOOST_AUTO_TEST_CASE(values) {
+    item_table table;
+    node_id n1 = {1, 2, 3};
+    node_id n2 = {300, 70000};
+    vector_clock v1 = vector_clock().incremented(n1);
+    vector_clock v2 = v1.incremented(n2).incremented(n2);
+
+    vector<versioned_t> values = {
+        { make_shared<string>("value1"), v1 },
+        { nullptr, v2 },
+        { make_shared<string>(string("\0\1\2", 3)), vector_clock() },
+    };
+
+    item_table::record* r = table.insert("key", 42);
+    r->local = true;
+    r = table.set_values(r, values);
+    BOOST_CHECK(!r->is_tombstone());
+    BOOST_CHECK(r->local);
+    BOOST_CHECK_EQUAL(3, r->get_value_count());
+    BOOST_CHECK(r == table.find("key", 42));
+
+    vector<versioned_t> result = r->get_values();
+    BOOST_REQUIRE_EQUAL(3, result.size());
+    for (size_t i = 0; i < 3; i++) {
+        BOOST_CHECK_EQUAL((bool)values[i], (bool)result[i]);
+        if (values[i])
+            BOOST_CHECK_EQUAL(values[i].get(), result[i].get());
+        BOOST_CHECK_EQUAL(values[i].get_version(), result[i].get_version());
+        BOOST_CHECK(values[i].get_version().get_timestamp() ==
+                    result[i].get_version().get_timestamp());
+    }
+
+    // a large value moves the record out of the slabs
+    string large(10000, 'x');
+    r = table.set_values(r, { { make_shared<string>(large), v2 } });
+    BOOST_CHECK(r == table.find("key", 42));
+    BOOST_CHECK_EQUAL(large, r->get_values().at(0).get());
+
+    r = table.set_values(r, { { nullptr, v2 } });
+    BOOST_CHECK(r->is_tombstone());
+    BOOST_CHECK_EQUAL(1, table.size());
+}
+
+BOOST_AUTO_TEST_CASE(compare_version) {
+    item_table table;
+    node_id n1 = {1, 2};
+    node_id n2 = {1, 2, 3};
+    node_id n3 = {2};
+    vector_clock v1 = vector_clock().incremented(n1);
+    vector_clock v2 = v1.incremented(n2);
+    vector_clock v3 = vector_clock().incremented(n3);
+    vector<vector_clock> clocks = {
+        vector_clock(), v1, v2, v3, v2.incremented(n3), v3.incremented(n1),
+        v2.incremented(n1)
+    };
+
+    item_table::record* r = table.insert("key", 42);
+    r = table.set_values(r, { { make_shared<string>("a"), v3 },
+                              { nullptr, v2 } });
+    for (auto& c : clocks) {
+        BOOST_CHECK_EQUAL(c.compare(v3), r->compare_version(0, c));
+        BOOST_CHECK_EQUAL(c.compare(v2), r->compare_version(1, c));
+    }
+
+    r = table.set_value(r, { make_shared<string>("b"), v1 });
+    BOOST_CHECK_EQUAL(1, r->get_value_count());
+    BOOST_CHECK(!r->is_tombstone());
+    BOOST_CHECK_EQUAL("b", r->get_values().at(0).get());
+    for (auto& c : clocks)
+        BOOST_CHECK_EQUAL(c.compare(v1), r->compare_version(0, c));
+
+    r = table.set_value(r, { nullptr, v2 });
+    BOOST_CHECK(r->is_tombstone());
+}
+
+BOOST_AUTO_TEST_CASE(dedup) {
+    item_table plain;
+    item_table table(throng::key_index_type::HASH, true);
+    BOOST_CHECK(!plain.get_value_pool());
+    const throng::internal::value_pool* pool = table.get_value_pool();
+    BOOST_REQUIRE(pool);
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = v1.incremented({2});
+    string contract(1000, 'c');
+
+    // many keys holding the same large value share a copy
+    for (int i = 0; i < 1000; i++) {
+        string key = "ep" + std::to_string(i);
+        vector<versioned_t> values =
+            { { make_shared<string>(contract), v1 },
+              { make_shared<string>("small"), v2 } };
+        size_t size = table.get_record_size(key, values);
+        plain.set_values(plain.insert(key, i), values);
+        item_table::record* r = table.insert(key, i);
+        size_t before = table.get_memory_usage();
+        r = table.set_values(r, values);
+        BOOST_CHECK(table.get_memory_usage() - before <= size);
+    }
+    BOOST_CHECK_EQUAL(1, pool->size());
+    BOOST_CHECK(table.get_memory_usage() * 5 < plain.get_memory_usage());
+
+    item_table::record* r = table.find("ep7", 7);
+    BOOST_REQUIRE(r);
+    vector<versioned_t> values = r->get_values();
+    BOOST_REQUIRE_EQUAL(2, values.size());
+    BOOST_CHECK_EQUAL(contract, values[0].get());
+    BOOST_CHECK_EQUAL("small", values[1].get());
+    BOOST_CHECK(values[0].get_ptr() ==
+                table.find("ep8", 8)->get_values()[0].get_ptr());
+    BOOST_CHECK_EQUAL(v1.compare(v2), r->compare_version(1, v1));
+
+    // the shared value is released when the last key holding it
+    // changes
+    string other(1000, 'o');
+    for (int i = 0; i < 1000; i++) {
+        string key = "ep" + std::to_string(i);
+        r = table.find(key, i);
+        if (i % 2)
+            table.set_value(r, { make_shared<string>(other), v2 });
+        else
+            table.erase(r);
+        BOOST_CHECK_EQUAL(i > 0 && i < 999 ? 2 : 1, pool->size());
+    }
+    BOOST_CHECK_EQUAL(other, table.find("ep1", 1)->get_values()[0].get());
+    BOOST_CHECK_EQUAL(500, table.size());
+}
+
+BOOST_AUTO_TEST_CASE(radix_tree_index) {
+    item_table table(throng::key_index_type::RADIX_TREE);
+    vector_clock v1 = vector_clock().incremented({1});
+
+    for (int i = 0; i < 100; i++) {
+        string key = "group" + std::to_string(i % 4) + "/ep" +
+            std::to_string(i);
+        item_table::record* r = table.insert(key, bad_hash(key));
+        table.set_values(r, { { make_shared<string>(key), v1 } });
+    }
+    BOOST_CHECK_EQUAL(100, table.size());
+
+    item_table::record* r = table.find("group1/ep1", 0);
+    BOOST_REQUIRE(r);
+    BOOST_CHECK_EQUAL("group1/ep1", r->get_values().at(0).get());
+
+    // grow the record so it moves to a new block
+    string large(1000, 'x');
+    r = table.set_values(r, { { make_shared<string>(large), v1 } });
+    BOOST_CHECK(r == table.find("group1/ep1", 0));
+
+    vector<string> keys;
+    table.for_each_prefix("group2/", [&keys](const item_table::record& r) {
+            keys.push_back(r.get_key());
+        });
+    BOOST_CHECK_EQUAL(25, keys.size());
+    BOOST_CHECK(std::is_sorted(keys.begin(), keys.end()));
+
+    table.erase(r);
+    BOOST_CHECK(!table.find("group1/ep1", 0));
+    size_t count = 0;
+    table.for_each_prefix("group1/", [&count](const item_table::record&) {
+            count += 1;
+        });
+    BOOST_CHECK_EQUAL(24, count);
+    BOOST_CHECK_EQUAL(99, table.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,71 @@
+/*
+ * Test suite for key hash functions
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "key_hash.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+BOOST_AUTO_TEST_SUITE(key_hash_test)
+
+using namespace throng::internal;
+using throng::key_hash_type;
+using std::string;
+
+static string repeat(size_t len) {
+    string s;
+    while (s.size() < len)
+        s += "0123456789abcdef";
+    s.resize(len);
+    return s;
+}
+
+// Expected values are from the reference xxHash implementation
+
+BOOST_AUTO_TEST_CASE(xxh3) {
+    BOOST_CHECK_EQUAL(0x2d06800538d394c2ull, xxh3_64("", 0));
+    BOOST_CHECK_EQUAL(0x1037c11c879bb429ull, xxh3_64("throng", 6));
+
+    string key("tenant/epg/endpoint-0001");
+    BOOST_CHECK_EQUAL(0x679fde960d0350cbull, xxh3_64(key.data(), key.size()));
+
+    // medium and long inputs
+    string s = repeat(300);
+    BOOST_CHECK_EQUAL(0x2c587795c48b11bfull, xxh3_64(s.data(), 200));
+    BOOST_CHECK_EQUAL(0xadf9a0438f0698b4ull, xxh3_64(s.data(), s.size()));
+}
+
+BOOST_AUTO_TEST_CASE(xxh64_vectors) {
+    BOOST_CHECK_EQUAL(0xef46db3751d8e999ull, xxh64("", 0));
+    BOOST_CHECK_EQUAL(0x3552bc9a11e76022ull, xxh64("throng", 6));
+}
+
+BOOST_AUTO_TEST_CASE(hash_key_type) {
+    string key("throng");
+    BOOST_CHECK_EQUAL(xxh3_64(key.data(), key.size()),
+                      hash_key(key_hash_type::XXH3, key));
+    BOOST_CHECK_EQUAL(xxh64(key.data(), key.size()),
+                      hash_key(key_hash_type::XXH64, key));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
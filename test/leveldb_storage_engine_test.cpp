@@ -0,0 +1,156 @@
+/*
+ * Test suite for leveldb_storage_engine
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "leveldb_storage_engine.h"
+#include "temp_path.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <map>
+
+BOOST_AUTO_TEST_SUITE(leveldb_storage_engine_test)
+
+using throng::internal::leveldb_storage_engine;
+using throng::test::temp_dir;
+using throng::versioned;
+using throng::vector_clock;
+using throng::node_id;
+using std::string;
+using std::vector;
+using std::make_shared;
+
+BOOST_AUTO_TEST_CASE(basic) {
+    temp_dir dir;
+    string path = (dir.path() / "db").string();
+    node_id n1 = {1, 2, 3};
+    node_id n2 = {4};
+    vector_clock v1 = vector_clock().incremented(n1);
+    vector_clock v2 = vector_clock().incremented(n2);
+    vector_clock v3 = v1.merge(v2).incremented(n1);
+
+    {
+        leveldb_storage_engine e("test", path);
+        BOOST_CHECK_EQUAL("test", e.get_name());
+        BOOST_CHECK_EQUAL(0, e.get("a").size());
+
+        BOOST_CHECK(e.put("a", { make_shared<string>("1"), v1 }));
+        BOOST_CHECK(!e.put("a", { make_shared<string>("1"), v1 }));
+        BOOST_CHECK(e.put("a", { make_shared<string>("2"), v2 }));
+        BOOST_CHECK_EQUAL(2, e.get("a").size());
+
+        BOOST_CHECK(e.put("b", { make_shared<string>("1"), v1 }));
+        BOOST_CHECK(e.put("b", { nullptr, v3 }));
+    }
+
+    // the data is still there when the database is reopened
+    leveldb_storage_engine e("test", path);
+    auto values = e.get("a");
+    BOOST_REQUIRE_EQUAL(2, values.size());
+    BOOST_CHECK_EQUAL("1", values[0].get());
+    BOOST_CHECK_EQUAL(v1, values[0].get_version());
+    BOOST_CHECK_EQUAL("2", values[1].get());
+    BOOST_CHECK_EQUAL(v2, values[1].get_version());
+
+    values = e.get("b");
+    BOOST_REQUIRE_EQUAL(1, values.size());
+    BOOST_CHECK(!values[0]);
+    BOOST_CHECK_EQUAL(v3, values[0].get_version());
+
+    BOOST_CHECK(e.put("a", { make_shared<string>("3"), v3 }));
+    values = e.get("a");
+    BOOST_REQUIRE_EQUAL(1, values.size());
+    BOOST_CHECK_EQUAL("3", values[0].get());
+}
+
+BOOST_AUTO_TEST_CASE(visit) {
+    temp_dir dir;
+    leveldb_storage_engine e("test", (dir.path() / "db").string());
+    vector_clock v1 = vector_clock().incremented({1});
+
+    for (string key : { "b/2", "a/1", "b/1", "c", "b" })
+        e.put(key, { make_shared<string>(key), v1 });
+
+    vector<string> keys;
+    auto visitor = [&keys](const string& key,
+                           const vector<versioned<string>>& values) {
+        BOOST_CHECK_EQUAL(key, values.at(0).get());
+        keys.push_back(key);
+    };
+    e.visit(visitor);
+    vector<string> expected = { "a/1", "b", "b/1", "b/2", "c" };
+    BOOST_CHECK(keys == expected);
+
+    keys.clear();
+    e.visit_prefix("b/", visitor);
+    expected = { "b/1", "b/2" };
+    BOOST_CHECK(keys == expected);
+}
+
+BOOST_AUTO_TEST_CASE(visit_partition) {
+    temp_dir dir;
+    leveldb_storage_engine e("test", (dir.path() / "db").string());
+    vector_clock v1 = vector_clock().incremented({1});
+
+    std::map<string, int> seen;
+    auto visitor = [&seen](const string& key,
+                           const vector<versioned<string>>&) {
+        seen[key] += 1;
+    };
+    e.visit_partition(0, 4, visitor);
+    BOOST_CHECK(seen.empty());
+
+    for (int i = 0; i < 500; ++i)
+        e.put("prefix/" + std::to_string(i * 7),
+              { make_shared<string>("v"), v1 });
+
+    size_t largest = 0;
+    for (size_t p = 0; p < 4; ++p) {
+        size_t before = seen.size();
+        e.visit_partition(p, 4, visitor);
+        largest = std::max(largest, seen.size() - before);
+    }
+    BOOST_CHECK_EQUAL(500, seen.size());
+    for (auto& s : seen)
+        BOOST_CHECK_EQUAL(1, s.second);
+    BOOST_CHECK(largest < 500);
+}
+
+BOOST_AUTO_TEST_CASE(write_batch) {
+    temp_dir dir;
+    leveldb_storage_engine e("test", (dir.path() / "db").string());
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = v1.incremented({1});
+
+    e.put("a", { make_shared<string>("old"), v2 });
+    throng::write_batch<string, string> batch;
+    batch.put("a", { make_shared<string>("obsolete"), v1 });
+    batch.put("b", { make_shared<string>("1"), v1 });
+    batch.put("b", { make_shared<string>("2"), v2 });
+    batch.remove("c", v1);
+    BOOST_CHECK_EQUAL(3, e.write(batch));
+    BOOST_CHECK_EQUAL("old", e.get("a").at(0).get());
+    BOOST_CHECK_EQUAL(1, e.get("b").size());
+    BOOST_CHECK_EQUAL("2", e.get("b").at(0).get());
+    BOOST_CHECK(!e.get("c").at(0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
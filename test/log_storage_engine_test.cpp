@@ -0,0 +1,304 @@
+/*
+ * Test suite for log_storage_engine
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "log_storage_engine.h"
+#include "temp_path.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <set>
+
+BOOST_AUTO_TEST_SUITE(log_storage_engine_test)
+
+using throng::internal::log_storage_engine;
+using throng::test::temp_dir;
+using throng::versioned;
+using throng::vector_clock;
+using throng::node_id;
+using std::string;
+using std::vector;
+using std::make_shared;
+
+BOOST_AUTO_TEST_CASE(basic) {
+    temp_dir dir;
+    string path = (dir.path() / "log").string();
+    node_id n1 = {1, 2, 3};
+    node_id n2 = {4};
+    vector_clock v1 = vector_clock().incremented(n1);
+    vector_clock v2 = vector_clock().incremented(n2);
+    vector_clock v3 = v1.merge(v2).incremented(n1);
+
+    {
+        log_storage_engine e("test", path);
+        BOOST_CHECK_EQUAL("test", e.get_name());
+        BOOST_CHECK_EQUAL(0, e.get("a").size());
+
+        BOOST_CHECK(e.put("a", { make_shared<string>("1"), v1 }));
+        BOOST_CHECK(!e.put("a", { make_shared<string>("1"), v1 }));
+        BOOST_CHECK(e.put("a", { make_shared<string>("2"), v2 }));
+        BOOST_CHECK_EQUAL(2, e.get("a").size());
+
+        BOOST_CHECK(e.put("b", { make_shared<string>("1"), v1 }));
+        BOOST_CHECK(e.put("b", { nullptr, v3 }));
+    }
+
+    // the index is rebuilt from the log when it is reopened
+    log_storage_engine e("test", path);
+    auto values = e.get("a");
+    BOOST_REQUIRE_EQUAL(2, values.size());
+    BOOST_CHECK_EQUAL("1", values[0].get());
+    BOOST_CHECK_EQUAL(v1, values[0].get_version());
+    BOOST_CHECK_EQUAL("2", values[1].get());
+    BOOST_CHECK_EQUAL(v2, values[1].get_version());
+
+    values = e.get("b");
+    BOOST_REQUIRE_EQUAL(1, values.size());
+    BOOST_CHECK(!values[0]);
+
+    BOOST_CHECK(e.put("a", { make_shared<string>("3"), v3 }));
+    values = e.get("a");
+    BOOST_REQUIRE_EQUAL(1, values.size());
+    BOOST_CHECK_EQUAL("3", values[0].get());
+
+    std::set<string> keys;
+    e.visit_prefix("a", [&keys](const string& key,
+                                const vector<versioned<string>>&) {
+            keys.insert(key);
+        });
+    BOOST_CHECK(keys == std::set<string>{"a"});
+}
+
+BOOST_AUTO_TEST_CASE(torn_write) {
+    temp_dir dir;
+    boost::filesystem::path path = dir.path() / "log";
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = v1.incremented({1});
+
+    {
+        log_storage_engine e("test", path.string(), 4096);
+        e.put("a", { make_shared<string>("1"), v1 });
+        e.put("b", { make_shared<string>("1"), v1 });
+        e.put("a", { make_shared<string>("2"), v2 });
+    }
+
+    // Corrupt the last record, as if the write had been interrupted
+    boost::filesystem::path segment = path / "00000001.log";
+    {
+        boost::filesystem::fstream f(segment, std::ios::in |
+                                     std::ios::out | std::ios::binary);
+        std::vector<char> data(4096);
+        f.read(data.data(), data.size());
+        size_t end = 4096;
+        while (end > 0 && data[end - 1] == 0) end -= 1;
+        f.seekp(end - 1);
+        f.put('X');
+    }
+
+    log_storage_engine e("test", path.string(), 4096);
+    BOOST_CHECK_EQUAL("1", e.get("a").at(0).get());
+    BOOST_CHECK_EQUAL("1", e.get("b").at(0).get());
+    e.put("a", { make_shared<string>("3"), v2 });
+    BOOST_CHECK_EQUAL("3", e.get("a").at(0).get());
+}
+
+BOOST_AUTO_TEST_CASE(write_batch) {
+    temp_dir dir;
+    boost::filesystem::path path = dir.path() / "log";
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = v1.incremented({1});
+    vector_clock v3 = v2.incremented({1});
+
+    {
+        log_storage_engine e("test", path.string(), 4096);
+        e.put("a", { make_shared<string>("old"), v2 });
+
+        throng::write_batch<string, string> batch(true);
+        batch.put("a", { make_shared<string>("obsolete"), v1 });
+        batch.put("b", { make_shared<string>("1"), v1 });
+        batch.put("b", { make_shared<string>("2"), v2 });
+        batch.remove("c", v1);
+        BOOST_CHECK_EQUAL(3, e.write(batch));
+        BOOST_CHECK_EQUAL("2", e.get("b").at(0).get());
+
+        // an atomic batch whose last record is torn is discarded
+        // whole on recovery
+        throng::write_batch<string, string> torn(true);
+        torn.put("a", { make_shared<string>("new"), v3 });
+        torn.put("b", { make_shared<string>("3"), v3 });
+        BOOST_CHECK_EQUAL(2, e.write(torn));
+    }
+
+    boost::filesystem::path segment = path / "00000001.log";
+    {
+        boost::filesystem::fstream f(segment, std::ios::in |
+                                     std::ios::out | std::ios::binary);
+        std::vector<char> data(4096);
+        f.read(data.data(), data.size());
+        size_t end = 4096;
+        while (end > 0 && data[end - 1] == 0) end -= 1;
+        f.seekp(end - 1);
+        f.put('X');
+    }
+
+    log_storage_engine e("test", path.string(), 4096);
+    BOOST_CHECK_EQUAL("old", e.get("a").at(0).get());
+    BOOST_CHECK_EQUAL("2", e.get("b").at(0).get());
+    BOOST_CHECK(!e.get("c").at(0));
+
+    // batches survive compaction
+    for (int i = 0; i < 100; ++i) {
+        throng::write_batch<string, string> batch(true);
+        vector_clock v = vector_clock().incremented({(uint32_t)(i + 2)});
+        batch.put("x", { make_shared<string>("x"), v });
+        batch.put("y", { make_shared<string>(std::to_string(i)), v3 });
+        e.write(batch);
+        v3 = v3.incremented({1});
+    }
+    e.compact();
+    BOOST_CHECK_EQUAL("99", e.get("y").at(0).get());
+    BOOST_CHECK_EQUAL(100, e.get("x").size());
+}
+
+BOOST_AUTO_TEST_CASE(visit_partition) {
+    temp_dir dir;
+    log_storage_engine e("test", (dir.path() / "log").string());
+    vector_clock v1 = vector_clock().incremented({1});
+    for (int i = 0; i < 200; ++i)
+        e.put(std::to_string(i), { make_shared<string>("v"), v1 });
+
+    std::multiset<string> seen;
+    for (size_t p = 0; p < 3; ++p)
+        e.visit_partition(p, 3, [&seen](const string& key,
+                                        const vector<versioned<string>>&) {
+                seen.insert(key);
+            });
+    BOOST_CHECK_EQUAL(200, seen.size());
+    BOOST_CHECK_EQUAL(200, std::set<string>(seen.begin(), seen.end()).size());
+}
+
+BOOST_AUTO_TEST_CASE(compaction) {
+    temp_dir dir;
+    string path = (dir.path() / "log").string();
+    vector_clock clock;
+    string value(100, 'v');
+
+    {
+        log_storage_engine e("test", path, 4096, 0.5);
+        for (int i = 0; i < 200; i++) {
+            clock = clock.incremented({1});
+            for (int k = 0; k < 4; k++)
+                e.put("key" + std::to_string(k),
+                      { make_shared<string>(value + std::to_string(i)),
+                        clock });
+        }
+        e.compact();
+
+        // only the latest records for the four keys remain, in at most
+        // the active segment and the segment the copies went to
+        BOOST_CHECK(e.get_segment_count() <= 2);
+        for (int k = 0; k < 4; k++) {
+            auto values = e.get("key" + std::to_string(k));
+            BOOST_REQUIRE_EQUAL(1, values.size());
+            BOOST_CHECK_EQUAL(value + "199", values[0].get());
+        }
+    }
+
+    log_storage_engine e("test", path, 4096, 0.5);
+    for (int k = 0; k < 4; k++) {
+        auto values = e.get("key" + std::to_string(k));
+        BOOST_REQUIRE_EQUAL(1, values.size());
+        BOOST_CHECK_EQUAL(value + "199", values[0].get());
+    }
+    size_t files = std::distance(boost::filesystem::directory_iterator(path),
+                                 boost::filesystem::directory_iterator());
+    BOOST_CHECK_EQUAL(e.get_segment_count(), files);
+}
+
+BOOST_AUTO_TEST_CASE(compact_while_visiting) {
+    temp_dir dir;
+    string path = (dir.path() / "log").string();
+    vector_clock clock;
+    string value(100, 'v');
+
+    log_storage_engine e("test", path, 4096, 0.5);
+    for (int i = 0; i < 100; i++) {
+        clock = clock.incremented({1});
+        for (int k = 0; k < 4; k++)
+            e.put("key" + std::to_string(k),
+                  { make_shared<string>(value), clock });
+    }
+
+    // The files of compacted segments are deleted while a visitor
+    // still holds the segments, and the visitor still reads them
+    size_t keys = 0;
+    e.visit([&](const string&, const vector<versioned<string>>& values) {
+            if (keys++ == 0) {
+                e.compact();
+                size_t files =
+                    std::distance(boost::filesystem::directory_iterator(path),
+                                  boost::filesystem::directory_iterator());
+                BOOST_CHECK_EQUAL(e.get_segment_count(), files);
+            }
+            BOOST_CHECK_EQUAL(1, values.size());
+        });
+    BOOST_CHECK_EQUAL(4, keys);
+}
+
+BOOST_AUTO_TEST_CASE(erase) {
+    temp_dir dir;
+    string path = (dir.path() / "log").string();
+    vector_clock clock;
+    string value(100, 'v');
+
+    {
+        log_storage_engine e("test", path, 4096, 0.5);
+        clock = clock.incremented({1});
+        e.put("gone", { make_shared<string>(value), clock });
+        for (int i = 0; i < 100; i++) {
+            clock = clock.incremented({1});
+            e.put("key", { make_shared<string>(value), clock });
+        }
+        BOOST_CHECK(e.erase("gone", clock));
+        BOOST_CHECK(e.get("gone").empty());
+
+        // The delete record is copied forward while the segment with
+        // the erased record remains
+        for (int i = 0; i < 100; i++) {
+            clock = clock.incremented({1});
+            e.put("key", { make_shared<string>(value), clock });
+        }
+        e.compact();
+    }
+
+    // The key stays erased when the log is recovered
+    log_storage_engine e("test", path, 4096, 0.5);
+    BOOST_CHECK(e.get("gone").empty());
+    BOOST_CHECK_EQUAL(1, e.get("key").size());
+    size_t keys = 0;
+    e.visit([&keys](const string&, const vector<versioned<string>>&) {
+            keys += 1;
+        });
+    BOOST_CHECK_EQUAL(1, keys);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,700 @@
+/*
+ * Test suite for processor
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ctx_fixture.h"
+#include "test_util.h"
+#include "map_store.h"
+
+#include "processor.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <map>
+#include <set>
+
+BOOST_AUTO_TEST_SUITE(processor_test)
+
+using std::string;
+using std::make_shared;
+using throng::versioned;
+using throng::vector_clock;
+using throng::node_id;
+using throng::store_config;
+using throng::internal::processor;
+using throng::internal::ctx_internal;
+
+BOOST_FIXTURE_TEST_CASE(tombstone_timeout, throng::test::ctx_fixture) {
+    store_config config;
+    config.tombstone_timeout = std::chrono::seconds(1);
+    processor p(dynamic_cast<ctx_internal&>(*context), "expire", config);
+    p.start();
+
+    node_id n1 = {1, 2, 3};
+    vector_clock v1 = vector_clock().incremented(n1);
+    vector_clock v2 = v1.incremented(n1);
+
+    p.put("live", { make_shared<string>("value"), v1 });
+    p.put("deleted", { make_shared<string>("value"), v1 });
+    p.put("deleted", { nullptr, v2 });
+    BOOST_CHECK_EQUAL(1, p.get("deleted").size());
+
+    WAIT_FOR(p.get("deleted").size() == 0, 300);
+    BOOST_CHECK_EQUAL(1, p.get("live").size());
+    p.stop();
+}
+
+BOOST_FIXTURE_TEST_CASE(expire_delegate, throng::test::ctx_fixture) {
+    store_config config;
+    config.tombstone_timeout = std::chrono::seconds(1);
+    config.object_timeout = std::chrono::seconds(1);
+    auto d = new throng::test::map_store("delegate");
+    std::unique_ptr<throng::store<string, string>> delegate(d);
+    processor p(dynamic_cast<ctx_internal&>(*context),
+                std::move(delegate), config);
+    p.start();
+
+    node_id n1 = {1, 2, 3};
+    vector_clock v1 = vector_clock().incremented(n1);
+    vector_clock v2 = v1.incremented(n1);
+
+    p.put("local", { make_shared<string>("value"), v1 }, true);
+    p.put("remote", { make_shared<string>("value"), v1 }, false);
+    p.put("deleted", { nullptr, v2 }, true);
+    WAIT_FOR(d->size() == 3, 300);
+
+    // Expired items are erased from the delegate as well
+    WAIT_FOR(d->size() == 1, 300);
+    BOOST_CHECK_EQUAL(1, d->get("local").size());
+    p.stop();
+}
+
+BOOST_FIXTURE_TEST_CASE(object_timeout, throng::test::ctx_fixture) {
+    store_config config;
+    config.object_timeout = std::chrono::seconds(1);
+    processor p(dynamic_cast<ctx_internal&>(*context), "expire", config);
+
+    std::atomic_int remote_notifications(0);
+    std::atomic_int local_notifications(0);
+    p.add_listener([&](const string& key, bool local) {
+            if (!local && key == "remote")
+                remote_notifications += 1;
+            if (local && key == "local")
+                local_notifications += 1;
+        });
+    p.start();
+
+    node_id n1 = {1, 2, 3};
+    node_id n2 = {2, 1, 4};
+    vector_clock v1 = vector_clock().incremented(n1);
+    vector_clock v2 = vector_clock().incremented(n2);
+
+    p.put("local", { make_shared<string>("value"), v1 }, true);
+    p.put("remote", { make_shared<string>("value"), v2 }, false);
+    BOOST_CHECK_EQUAL(1, remote_notifications.load());
+
+    WAIT_FOR(p.get("remote").size() == 0, 300);
+    BOOST_CHECK_EQUAL(2, remote_notifications.load());
+    BOOST_CHECK_EQUAL(1, p.get("local").size());
+
+    // The local object is refreshed by notifying listeners again
+    WAIT_FOR(local_notifications.load() >= 2, 300);
+    BOOST_CHECK(local_notifications.load() >= 2);
+    p.stop();
+}
+
+BOOST_FIXTURE_TEST_CASE(visit_prefix, throng::test::ctx_fixture) {
+    for (auto index : { throng::key_index_type::HASH,
+                        throng::key_index_type::RADIX_TREE }) {
+        store_config config;
+        config.key_index = index;
+        processor p(dynamic_cast<ctx_internal&>(*context), "prefix", config);
+
+        vector_clock v1 = vector_clock().incremented({1, 2, 3});
+        for (string key : { "tenant1/epg1/ep1", "tenant1/epg1/ep2",
+                            "tenant1/epg2/ep1", "tenant2/epg1/ep1" })
+            p.put(key, { make_shared<string>("value"), v1 });
+
+        std::set<string> keys;
+        p.visit_prefix("tenant1/epg1/",
+                       [&keys](const string& key,
+                               const std::vector<versioned<string>>& vs) {
+                           BOOST_CHECK_EQUAL(1, vs.size());
+                           keys.insert(key);
+                       });
+        std::set<string> expected = { "tenant1/epg1/ep1",
+                                      "tenant1/epg1/ep2" };
+        BOOST_CHECK(keys == expected);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(memory_limit, throng::test::ctx_fixture) {
+    vector_clock v1 = vector_clock().incremented({1, 2, 3});
+    string value(100, 'v');
+
+    // measure the cost of an item in an unlimited store; all keys
+    // have the same length so items have the same size
+    size_t empty, per_item;
+    {
+        processor p(dynamic_cast<ctx_internal&>(*context), "limit",
+                    store_config());
+        empty = p.get_memory_usage();
+        p.put("remoteX", { make_shared<string>(value), v1 }, false);
+        per_item = p.get_memory_usage() - empty;
+    }
+
+    store_config config;
+    config.memory_limit = empty + 4 * per_item;
+    processor p(dynamic_cast<ctx_internal&>(*context), "limit", config);
+
+    p.put("remote0", { make_shared<string>(value), v1 }, false);
+    p.put("remote1", { make_shared<string>(value), v1 }, false);
+    p.put("owned_0", { make_shared<string>(value), v1 }, true);
+    p.put("owned_1", { make_shared<string>(value), v1 }, true);
+    BOOST_CHECK(p.get_memory_usage() <= config.memory_limit);
+
+    // reading remote0 makes remote1 the least recently used
+    BOOST_CHECK_EQUAL(1, p.get("remote0").size());
+    p.put("owned_2", { make_shared<string>(value), v1 }, true);
+    BOOST_CHECK_EQUAL(0, p.get("remote1").size());
+    BOOST_CHECK_EQUAL(1, p.get("remote0").size());
+
+    p.put("owned_3", { make_shared<string>(value), v1 }, true);
+    BOOST_CHECK_EQUAL(0, p.get("remote0").size());
+    BOOST_CHECK(p.get_memory_usage() <= config.memory_limit);
+
+    // only owned data remains
+    BOOST_CHECK_THROW(p.put("owned_4", { make_shared<string>(value), v1 },
+                            true),
+                      throng::error::memory_limit_exceeded);
+    BOOST_CHECK_EQUAL(0, p.get("owned_4").size());
+    for (string key : { "owned_0", "owned_1", "owned_2", "owned_3" })
+        BOOST_CHECK_EQUAL(1, p.get(key).size());
+
+    BOOST_CHECK(context->get_memory_usage("test") > 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(evict_persistent, throng::test::ctx_fixture) {
+    vector_clock v1 = vector_clock().incremented({1, 2, 3});
+    string value(100, 'v');
+
+    size_t empty, per_item;
+    {
+        processor p(dynamic_cast<ctx_internal&>(*context), "limit",
+                    store_config());
+        empty = p.get_memory_usage();
+        p.put("remote0", { make_shared<string>(value), v1 }, false);
+        per_item = p.get_memory_usage() - empty;
+    }
+
+    store_config config;
+    config.memory_limit = empty + 4 * per_item;
+    config.commit_interval = std::chrono::seconds(60);
+    auto d = new throng::test::map_store("delegate");
+    std::unique_ptr<throng::store<string, string>> delegate(d);
+    processor p(dynamic_cast<ctx_internal&>(*context),
+                std::move(delegate), config);
+    p.start();
+
+    // remote items are evicted only once their writes have been
+    // committed to the delegate
+    for (int i = 0; i < 10; ++i)
+        p.put("remote" + std::to_string(i),
+              { make_shared<string>(value), v1 }, false);
+    BOOST_CHECK(p.get_cache_stats().evictions > 0);
+    BOOST_CHECK(p.get_memory_usage() <= config.memory_limit);
+    for (int i = 0; i < 10; ++i) {
+        string key = "remote" + std::to_string(i);
+        BOOST_CHECK(p.get(key).size() == 1 || d->get(key).size() == 1);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(atomic_rollback, throng::test::ctx_fixture) {
+    vector_clock v1 = vector_clock().incremented({1, 2, 3});
+    vector_clock v2 = v1.incremented({1, 2, 3});
+    string old_value(100, 'o');
+    string new_value(100, 'n');
+
+    size_t empty, per_item;
+    {
+        processor p(dynamic_cast<ctx_internal&>(*context), "limit",
+                    store_config());
+        empty = p.get_memory_usage();
+        p.put("key0", { make_shared<string>(old_value), v1 });
+        per_item = p.get_memory_usage() - empty;
+    }
+
+    store_config config;
+    config.memory_limit = empty + 2 * per_item;
+    auto d = new throng::test::map_store("delegate");
+    std::unique_ptr<throng::store<string, string>> delegate(d);
+    processor p(dynamic_cast<ctx_internal&>(*context),
+                std::move(delegate), config);
+    p.start();
+    p.put("key0", { make_shared<string>(old_value), v1 });
+
+    std::vector<string> notified;
+    p.add_listener([&notified](const string& key, bool) {
+            notified.push_back(key);
+        });
+
+    // The third item exceeds the memory limit, so the whole batch is
+    // rolled back
+    throng::write_batch<string, string> batch(true);
+    batch.put("key0", { make_shared<string>(new_value), v2 });
+    batch.put("key1", { make_shared<string>(new_value), v1 });
+    batch.put("key2", { make_shared<string>(new_value), v1 });
+    BOOST_CHECK_THROW(p.write(batch), throng::error::memory_limit_exceeded);
+    BOOST_REQUIRE_EQUAL(1, p.get("key0").size());
+    BOOST_CHECK_EQUAL(old_value, p.get("key0")[0].get());
+    BOOST_CHECK_EQUAL(v1, p.get("key0")[0].get_version());
+    BOOST_CHECK_EQUAL(0, p.get("key1").size());
+    BOOST_CHECK_EQUAL(0, p.get("key2").size());
+    BOOST_CHECK(notified.empty());
+
+    p.stop();
+    BOOST_CHECK_EQUAL(1, d->size());
+    BOOST_CHECK_EQUAL(old_value, d->get("key0").at(0).get());
+}
+
+BOOST_FIXTURE_TEST_CASE(write_behind, throng::test::ctx_fixture) {
+    vector_clock v1 = vector_clock().incremented({1, 2, 3});
+    for (auto mode : { throng::durability_mode::ASYNC,
+                       throng::durability_mode::BATCHED,
+                       throng::durability_mode::SYNC }) {
+        store_config config;
+        config.durability = mode;
+        config.commit_interval = std::chrono::milliseconds(20);
+        auto d = new throng::test::map_store("delegate");
+        std::unique_ptr<throng::store<string, string>> delegate(d);
+        processor p(dynamic_cast<ctx_internal&>(*context),
+                    std::move(delegate), config);
+        p.start();
+
+        p.put("key1", { make_shared<string>("value"), v1 });
+        BOOST_CHECK_EQUAL(1, p.get("key1").size());
+        if (mode == throng::durability_mode::SYNC)
+            BOOST_CHECK_EQUAL(1, d->size());
+        else
+            WAIT_FOR(d->size() == 1, 300);
+
+        // remaining writes are committed when the processor stops
+        p.put("key2", { make_shared<string>("value"), v1 });
+        p.stop();
+        BOOST_CHECK_EQUAL(2, d->size());
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(write_batch, throng::test::ctx_fixture) {
+    vector_clock v1 = vector_clock().incremented({1, 2, 3});
+    vector_clock v2 = v1.incremented({1, 2, 3});
+    for (auto mode : { throng::durability_mode::ASYNC,
+                       throng::durability_mode::SYNC }) {
+        store_config config;
+        config.durability = mode;
+        auto d = new throng::test::map_store("delegate");
+        std::unique_ptr<throng::store<string, string>> delegate(d);
+        processor p(dynamic_cast<ctx_internal&>(*context),
+                    std::move(delegate), config);
+        p.start();
+        p.put("a", { make_shared<string>("old"), v2 });
+
+        std::vector<string> notified;
+        p.add_listener([&notified](const string& key, bool) {
+                notified.push_back(key);
+            });
+
+        throng::write_batch<string, string> batch(true);
+        batch.put("a", { make_shared<string>("obsolete"), v1 });
+        batch.put("b", { make_shared<string>("1"), v1 });
+        batch.remove("c", v1);
+        BOOST_CHECK_EQUAL(2, p.write(batch));
+        BOOST_CHECK_EQUAL("old", p.get("a").at(0).get());
+        BOOST_CHECK_EQUAL("1", p.get("b").at(0).get());
+        BOOST_CHECK(!p.get("c").at(0));
+        BOOST_CHECK_EQUAL(3, notified.size());
+
+        // the applied writes reach the delegate together
+        if (mode == throng::durability_mode::SYNC) {
+            BOOST_CHECK_EQUAL(3, d->size());
+            BOOST_CHECK_EQUAL(2, d->get_batch_count());
+        } else {
+            WAIT_FOR(d->size() == 3, 300);
+        }
+        p.stop();
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(restore, throng::test::ctx_fixture) {
+    vector_clock v1 = vector_clock().incremented({1, 2, 3});
+    vector_clock v2 = v1.incremented({1, 2, 3});
+    auto d = new throng::test::map_store("delegate");
+    std::unique_ptr<throng::store<string, string>> delegate(d);
+    for (int i = 0; i < 1000; ++i) {
+        string key = "key" + std::to_string(i);
+        d->put(key, { make_shared<string>(key), v1 });
+    }
+
+    store_config config;
+    config.restore_threads = 3;
+    processor p(dynamic_cast<ctx_internal&>(*context),
+                std::move(delegate), config);
+
+    // a write made before the store starts is not replaced by the
+    // older value in storage
+    p.put("key0", { make_shared<string>("new"), v2 });
+    p.start();
+
+    size_t count = 0;
+    p.visit([&count](const string&, const std::vector<versioned<string>>&) {
+            count += 1;
+        });
+    BOOST_CHECK_EQUAL(1000, count);
+    BOOST_CHECK_EQUAL("new", p.get("key0").at(0).get());
+    BOOST_CHECK_EQUAL("key999", p.get("key999").at(0).get());
+
+    // reads are served from memory, including for missing keys
+    size_t gets = d->get_get_count();
+    BOOST_CHECK_EQUAL(0, p.get("missing").size());
+    BOOST_CHECK_EQUAL(gets, d->get_get_count());
+
+    // consumers starting from nothing see the restored items
+    auto changes = p.changes_since(0, 0, 2000);
+    BOOST_CHECK_EQUAL(1000, changes.changes.size());
+    p.stop();
+}
+
+BOOST_FIXTURE_TEST_CASE(key_filter, throng::test::ctx_fixture) {
+    vector_clock v1 = vector_clock().incremented({1, 2, 3});
+    auto d = new throng::test::map_store("delegate");
+    std::unique_ptr<throng::store<string, string>> delegate(d);
+    for (int i = 0; i < 1000; ++i) {
+        string key = "key" + std::to_string(i);
+        d->put(key, { make_shared<string>(key), v1 });
+    }
+
+    // the store does not fit in memory, so reads of keys not in
+    // memory could need the delegate
+    store_config config;
+    config.memory_limit = 16 * 1024;
+    processor p(dynamic_cast<ctx_internal&>(*context),
+                std::move(delegate), config);
+    p.start();
+
+    // every key is found, either in memory or in the delegate
+    for (int i = 0; i < 1000; ++i)
+        BOOST_CHECK_EQUAL(1, p.get("key" + std::to_string(i)).size());
+
+    // absent keys rarely reach the delegate
+    size_t gets = d->get_get_count();
+    for (int i = 0; i < 1000; ++i)
+        BOOST_CHECK_EQUAL(0, p.get("missing" + std::to_string(i)).size());
+    BOOST_CHECK(d->get_get_count() - gets < 50);
+
+    // keys written after the store starts are added to the filter
+    for (int i = 0; i < 100; ++i)
+        p.put("new" + std::to_string(i), { make_shared<string>("v"), v1 },
+              false);
+    p.stop();
+    for (int i = 0; i < 100; ++i)
+        BOOST_CHECK_EQUAL(1, p.get("new" + std::to_string(i)).size());
+}
+
+BOOST_FIXTURE_TEST_CASE(tiered, throng::test::ctx_fixture) {
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = vector_clock().incremented({2});
+    auto d = new throng::test::map_store("delegate");
+    std::unique_ptr<throng::store<string, string>> delegate(d);
+
+    store_config config;
+    config.memory_limit = 16 * 1024;
+    config.tiered = true;
+    processor p(dynamic_cast<ctx_internal&>(*context),
+                std::move(delegate), config);
+    p.start();
+
+    // items owned by the local node are evicted once they are in the
+    // delegate, rather than the writes failing
+    for (int i = 0; i < 2000; ++i) {
+        string key = "key" + std::to_string(i);
+        p.put(key, { make_shared<string>(key), v1 });
+    }
+    BOOST_CHECK(p.get_memory_usage() <= config.memory_limit);
+    throng::cache_stats stats = p.get_cache_stats();
+    BOOST_CHECK(stats.evictions > 0);
+    BOOST_CHECK_EQUAL(0, stats.admissions);
+
+    // evicted items are read back into memory, and neither the
+    // evictions nor the reads are logged as changes
+    auto changes = p.changes_since(0, 0, 5000);
+    BOOST_CHECK(!changes.more);
+    BOOST_CHECK_EQUAL(2000, changes.changes.size());
+    BOOST_CHECK_EQUAL(2000, changes.next_seq);
+    for (int i = 0; i < 2000; ++i) {
+        string key = "key" + std::to_string(i);
+        BOOST_CHECK_EQUAL(key, p.get(key).at(0).get());
+    }
+    BOOST_CHECK(p.changes_since(changes.epoch, changes.next_seq, 10)
+                .changes.empty());
+    stats = p.get_cache_stats();
+    BOOST_CHECK(stats.misses > 0);
+    BOOST_CHECK_EQUAL(stats.misses, stats.admissions);
+    BOOST_CHECK_EQUAL(2000, stats.hits + stats.misses);
+    BOOST_CHECK(p.get_memory_usage() <= config.memory_limit);
+
+    // a write to an evicted item is merged with its stored values
+    BOOST_CHECK(p.put("key0", { make_shared<string>("other"), v2 }));
+    BOOST_CHECK_EQUAL(2, p.get("key0").size());
+    BOOST_CHECK(!p.put("key1", { make_shared<string>("key1"), v1 }));
+
+    size_t count = 0;
+    p.visit([&count](const string&, const std::vector<versioned<string>>&) {
+            count += 1;
+        });
+    BOOST_CHECK_EQUAL(2000, count);
+
+    // the delegate uses the default prefix visit, which filters visit
+    count = 0;
+    p.visit_prefix("key1", [&count](const string& key,
+                                    const std::vector<versioned<string>>&) {
+            BOOST_CHECK_EQUAL(0, key.compare(0, 4, "key1"));
+            count += 1;
+        });
+    BOOST_CHECK_EQUAL(1111, count);
+    p.stop();
+    BOOST_CHECK_EQUAL(2000, d->size());
+}
+
+BOOST_FIXTURE_TEST_CASE(snapshot, throng::test::ctx_fixture) {
+    processor p(dynamic_cast<ctx_internal&>(*context), "snapshot",
+                store_config());
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = v1.incremented({1});
+
+    p.put("changed", { make_shared<string>("old"), v1 });
+    p.put("deleted", { make_shared<string>("old"), v1 });
+    p.put("same", { make_shared<string>("old"), v1 });
+
+    auto s1 = p.snapshot();
+    p.put("changed", { make_shared<string>("new"), v2 });
+    p.put("deleted", { nullptr, v2 });
+    p.put("added", { make_shared<string>("new"), v1 });
+    auto s2 = p.snapshot();
+    p.put("changed", { make_shared<string>("newer"),
+                       v2.incremented({1}) });
+
+    BOOST_CHECK_EQUAL("old", s1->get("changed").at(0).get());
+    BOOST_CHECK_EQUAL("old", s1->get("deleted").at(0).get());
+    BOOST_CHECK_EQUAL("old", s1->get("same").at(0).get());
+    BOOST_CHECK_EQUAL(0, s1->get("added").size());
+    BOOST_CHECK_EQUAL("new", s2->get("changed").at(0).get());
+    BOOST_CHECK(!s2->get("deleted").at(0));
+    BOOST_CHECK_EQUAL("new", s2->get("added").at(0).get());
+    BOOST_CHECK_EQUAL("newer", p.get("changed").at(0).get());
+
+    std::map<string, string> seen;
+    s1->visit([&seen, &p](const string& key,
+                          const std::vector<versioned<string>>& vs) {
+            seen[key] = vs.at(0).get();
+            // writes can proceed while visiting
+            p.put("during", { make_shared<string>("value"),
+                              vector_clock().incremented({1}) });
+        });
+    std::map<string, string> expected =
+        {{"changed", "old"}, {"deleted", "old"}, {"same", "old"}};
+    BOOST_CHECK(seen == expected);
+
+    s1.reset();
+    BOOST_CHECK_EQUAL("new", s2->get("changed").at(0).get());
+    s2.reset();
+
+    // a new snapshot sees the current state
+    auto s3 = p.snapshot();
+    BOOST_CHECK_EQUAL("newer", s3->get("changed").at(0).get());
+    BOOST_CHECK_EQUAL(1, s3->get("during").size());
+}
+
+BOOST_FIXTURE_TEST_CASE(siblings, throng::test::ctx_fixture) {
+    processor p(dynamic_cast<ctx_internal&>(*context), "siblings",
+                store_config());
+    node_id n1 = {1};
+    node_id n2 = {2};
+    node_id n3 = {3};
+    vector_clock v1 = vector_clock().incremented(n1);
+    vector_clock v2 = vector_clock().incremented(n2);
+    vector_clock v3 = vector_clock().incremented(n3);
+
+    BOOST_CHECK(p.put("a", { make_shared<string>("1"), v1 }));
+    BOOST_CHECK(!p.put("a", { make_shared<string>("1"), v1 }));
+    BOOST_CHECK(p.put("a", { make_shared<string>("2"), v2 }));
+    BOOST_CHECK(p.put("a", { make_shared<string>("3"), v3 }));
+    BOOST_CHECK(!p.put("a", { make_shared<string>("2"), v2 }));
+
+    // a value superseding some of the siblings replaces them and is
+    // kept last
+    vector_clock v4 = v1.merge(v3).incremented(n1);
+    BOOST_CHECK(p.put("a", { make_shared<string>("4"), v4 }));
+    auto values = p.get("a");
+    BOOST_REQUIRE_EQUAL(2, values.size());
+    BOOST_CHECK_EQUAL("2", values[0].get());
+    BOOST_CHECK_EQUAL("4", values[1].get());
+
+    vector_clock v5 = v4.merge(v2).incremented(n2);
+    BOOST_CHECK(p.put("a", { make_shared<string>("5"), v5 }));
+    values = p.get("a");
+    BOOST_REQUIRE_EQUAL(1, values.size());
+    BOOST_CHECK_EQUAL("5", values[0].get());
+
+    // a single value is replaced in place
+    BOOST_CHECK(!p.put("a", { make_shared<string>("4"), v4 }));
+    BOOST_CHECK(p.put("a", { nullptr, v5.incremented(n3) }));
+    values = p.get("a");
+    BOOST_REQUIRE_EQUAL(1, values.size());
+    BOOST_CHECK(!values[0]);
+}
+
+BOOST_FIXTURE_TEST_CASE(compaction, throng::test::ctx_fixture) {
+    store_config config;
+    config.sibling_limit = 2;
+    processor p(dynamic_cast<ctx_internal&>(*context), "compaction", config);
+
+    bool fail = false;
+    p.set_resolver([&fail](const std::vector<versioned<string>>& vs) {
+            if (fail) throw std::runtime_error("failed");
+            string merged;
+            for (auto& v : vs)
+                if (v) merged += v.get();
+            return versioned<string>(make_shared<string>(merged),
+                                     vs.at(0).get_version());
+        });
+
+    auto now = std::chrono::system_clock::now();
+    node_id n1 = {1};
+    node_id n2 = {2};
+    node_id n3 = {3};
+    vector_clock v1 { now, { {n1, 1} } };
+    vector_clock v2 { now + std::chrono::seconds(1), { {n2, 1} } };
+    vector_clock v3 { now, { {n3, 1} } };
+
+    p.put("a", { make_shared<string>("a"), v1 });
+    p.put("a", { make_shared<string>("b"), v2 });
+    BOOST_CHECK_EQUAL(2, p.get("a").size());
+
+    p.put("a", { make_shared<string>("c"), v3 });
+    auto values = p.get("a");
+    BOOST_REQUIRE_EQUAL(1, values.size());
+    BOOST_CHECK_EQUAL("abc", values[0].get());
+    // the merged clock is incremented for the local node
+    vector_clock expected = vector_clock
+        { now + std::chrono::seconds(1), { {n1, 1}, {n2, 1}, {n3, 1} } }
+        .incremented(context->get_local_node_id(),
+                     now + std::chrono::seconds(1));
+    BOOST_CHECK_EQUAL(expected, values[0].get_version());
+    BOOST_CHECK(vector_clock::occurred::AFTER ==
+                values[0].get_version().compare(v2));
+
+    // the merged value supersedes each of the values it replaced
+    BOOST_CHECK(!p.put("a", { make_shared<string>("b"), v2 }));
+
+    // values are kept if the resolver fails
+    fail = true;
+    p.put("b", { make_shared<string>("a"), v1 });
+    p.put("b", { make_shared<string>("b"), v2 });
+    p.put("b", { make_shared<string>("c"), v3 });
+    BOOST_CHECK_EQUAL(3, p.get("b").size());
+}
+
+BOOST_FIXTURE_TEST_CASE(changes_since, throng::test::ctx_fixture) {
+    store_config config;
+    config.change_log_size = 4;
+    processor p(dynamic_cast<ctx_internal&>(*context), "changes", config);
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = v1.incremented({1});
+
+    auto c = p.changes_since(0, 0, 10);
+    BOOST_CHECK(!c.reset);
+    BOOST_CHECK(c.epoch != 0);
+    uint64_t epoch = c.epoch;
+    BOOST_CHECK(!c.more);
+    BOOST_CHECK_EQUAL(0, c.next_seq);
+    BOOST_CHECK_EQUAL(0, c.changes.size());
+
+    p.put("a", { make_shared<string>("1"), v1 });
+    p.put("b", { make_shared<string>("1"), v1 });
+    p.put("a", { make_shared<string>("2"), v2 });
+
+    // each key is reported once with its current value
+    c = p.changes_since(epoch, 0, 10);
+    BOOST_CHECK(!c.reset);
+    BOOST_CHECK(!c.more);
+    BOOST_CHECK_EQUAL(3, c.next_seq);
+    BOOST_REQUIRE_EQUAL(2, c.changes.size());
+    BOOST_CHECK_EQUAL("a", c.changes[0].first);
+    BOOST_CHECK_EQUAL("2", c.changes[0].second.at(0).get());
+    BOOST_CHECK_EQUAL("b", c.changes[1].first);
+
+    // limit the number of keys
+    c = p.changes_since(epoch, 0, 1);
+    BOOST_CHECK(c.more);
+    BOOST_CHECK_EQUAL(1, c.next_seq);
+    BOOST_CHECK_EQUAL(1, c.changes.size());
+    c = p.changes_since(epoch, c.next_seq, 1);
+    BOOST_CHECK(c.more);
+    BOOST_CHECK_EQUAL(2, c.next_seq);
+    BOOST_CHECK_EQUAL("b", c.changes.at(0).first);
+
+    uint64_t seq = p.changes_since(epoch, 0, 10).next_seq;
+    p.put("b", { nullptr, v2 });
+    c = p.changes_since(epoch, seq, 10);
+    BOOST_CHECK(!c.reset);
+    BOOST_REQUIRE_EQUAL(1, c.changes.size());
+    BOOST_CHECK(!c.changes[0].second.at(0));
+    BOOST_CHECK_EQUAL(seq + 1, c.next_seq);
+    BOOST_CHECK_EQUAL(0, p.changes_since(epoch, c.next_seq, 10)
+                      .changes.size());
+
+    // a consumer that falls too far behind gets a snapshot
+    for (int i = 0; i < 4; i++)
+        p.put("c" + std::to_string(i), { make_shared<string>("1"), v1 });
+    c = p.changes_since(epoch, seq, 10);
+    BOOST_CHECK(c.reset);
+    BOOST_CHECK_EQUAL(seq + 5, c.next_seq);
+    BOOST_CHECK_EQUAL(6, c.changes.size());
+    BOOST_CHECK_EQUAL(0, p.changes_since(epoch, c.next_seq, 10)
+                      .changes.size());
+
+    // as does one with a sequence number ahead of the log
+    BOOST_CHECK(p.changes_since(epoch, c.next_seq + 1, 10).reset);
+
+    // or one from a previous run, even though the new run has made
+    // as many changes
+    processor p2(dynamic_cast<ctx_internal&>(*context), "changes", config);
+    for (int i = 0; i < 9; i++)
+        p2.put("d" + std::to_string(i), { make_shared<string>("1"), v1 });
+    c = p2.changes_since(epoch, c.next_seq, 10);
+    BOOST_CHECK(c.reset);
+    BOOST_CHECK(c.epoch != epoch);
+    BOOST_CHECK_EQUAL(9, c.changes.size());
+    BOOST_CHECK(!p2.changes_since(c.epoch, c.next_seq, 10).reset);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,194 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Test suite for radix_tree
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "radix_tree.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(radix_tree_test)
+
+using throng::internal::radix_tree;
+using throng::internal::slab_allocator;
+using std::string;
+using std::vector;
+using std::map;
+
+static radix_tree::key_ref string_key(const void* v) {
+    const string* s = static_cast<const string*>(v);
+    return radix_tree::key_ref { s->data(), s->size() };
+}
+
+static vector<string> collect(const radix_tree& tree) {
+    vector<string> result;
+    tree.for_each([&result](void* v) {
+            result.push_back(*static_cast<string*>(v));
+        });
+    return result;
+}
+
+static vector<string> collect(const radix_tree& tree, const string& prefix) {
+    vector<string> result;
+    tree.for_each_prefix(prefix.data(), prefix.size(), [&result](void* v) {
+            result.push_back(*static_cast<string*>(v));
+        });
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(prefix_keys) {
+    slab_allocator allocator;
+    radix_tree tree(allocator, string_key);
+
+    // keys that are prefixes of each other, including the empty key
+    vector<string> keys = { "", "a", "ab", "abc", "abd", "b" };
+    for (auto& k : keys) tree.insert(&k);
+    BOOST_CHECK_EQUAL(6, tree.size());
+
+    for (auto& k : keys)
+        BOOST_CHECK(tree.find(k.data(), k.size()) == &k);
+    BOOST_CHECK(!tree.find("abcd", 4));
+    BOOST_CHECK(!tree.find("aa", 2));
+
+    BOOST_CHECK(collect(tree) == keys);
+    vector<string> ab = { "ab", "abc", "abd" };
+    BOOST_CHECK(collect(tree, "ab") == ab);
+    BOOST_CHECK(collect(tree, "") == keys);
+    BOOST_CHECK(collect(tree, "abe").empty());
+
+    BOOST_CHECK(tree.erase("ab", 2));
+    BOOST_CHECK(!tree.erase("ab", 2));
+    BOOST_CHECK(!tree.find("ab", 2));
+    BOOST_CHECK(tree.find("abc", 3) == &keys[3]);
+    BOOST_CHECK(tree.erase("", 0));
+    BOOST_CHECK(tree.erase("a", 1));
+    vector<string> rest = { "abc", "abd", "b" };
+    BOOST_CHECK(collect(tree) == rest);
+}
+
+BOOST_AUTO_TEST_CASE(long_prefix) {
+    slab_allocator allocator;
+    radix_tree tree(allocator, string_key);
+
+    // shared prefixes longer than the bytes stored in a node
+    string base = "tenant-0001/epg-0001/endpoint-";
+    vector<string> keys = { base + "1", base + "2", base + "10",
+                            "tenant-0001/epg-0002/endpoint-1" };
+    for (auto& k : keys) tree.insert(&k);
+    for (auto& k : keys)
+        BOOST_CHECK(tree.find(k.data(), k.size()) == &k);
+    BOOST_CHECK(!tree.find(base.data(), base.size()));
+
+    string other = "tenant-0001/epg-0001/endpoinX-1";
+    BOOST_CHECK(!tree.find(other.data(), other.size()));
+    BOOST_CHECK(collect(tree, "tenant-0001/epg-0001/endpoinX").empty());
+
+    vector<string> epg1 = { base + "1", base + "10", base + "2" };
+    BOOST_CHECK(collect(tree, "tenant-0001/epg-0001/") == epg1);
+    BOOST_CHECK(collect(tree, "tenant-0001/epg-0001/e") == epg1);
+
+    // split a long compressed prefix
+    string split = "tenant-0001/epg-0001/endXYZ";
+    tree.insert(&split);
+    for (auto& k : keys)
+        BOOST_CHECK(tree.find(k.data(), k.size()) == &k);
+    BOOST_CHECK(tree.find(split.data(), split.size()) == &split);
+
+    // collapse it again
+    BOOST_CHECK(tree.erase(keys[3].data(), keys[3].size()));
+    BOOST_CHECK(tree.erase(split.data(), split.size()));
+    BOOST_CHECK(collect(tree) == epg1);
+    BOOST_CHECK(collect(tree, base) == epg1);
+}
+
+BOOST_AUTO_TEST_CASE(replace) {
+    slab_allocator allocator;
+    radix_tree tree(allocator, string_key);
+
+    string a1 = "a", a2 = "a", b = "ab";
+    tree.insert(&a1);
+    tree.insert(&b);
+    tree.replace(&a1, &a2);
+    BOOST_CHECK(tree.find("a", 1) == &a2);
+    BOOST_CHECK(tree.find("ab", 2) == &b);
+}
+
+BOOST_AUTO_TEST_CASE(random) {
+    slab_allocator allocator;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> len_dist(0, 12);
+    // a small alphabet and a full byte range to exercise every node
+    // size and many shared prefixes
+    std::uniform_int_distribution<int> byte_dist(0, 255);
+    std::uniform_int_distribution<int> small_dist('a', 'd');
+
+    map<string, std::unique_ptr<string>> expected;
+    {
+        radix_tree tree(allocator, string_key);
+        for (int round = 0; round < 20000; round++) {
+            string key;
+            int len = len_dist(gen);
+            bool wide = round % 3 == 0;
+            for (int i = 0; i < len; i++)
+                key.push_back((char)(wide && i == len - 1 ?
+                                     byte_dist(gen) : small_dist(gen)));
+
+            auto it = expected.find(key);
+            if (it == expected.end()) {
+                std::unique_ptr<string> v(new string(key));
+                tree.insert(v.get());
+                expected[key] = std::move(v);
+            } else if (round % 2 == 0) {
+                BOOST_REQUIRE(tree.erase(key.data(), key.size()));
+                expected.erase(it);
+            } else {
+                BOOST_REQUIRE(tree.find(key.data(), key.size()) ==
+                              it->second.get());
+            }
+        }
+        BOOST_CHECK_EQUAL(expected.size(), tree.size());
+
+        vector<string> all;
+        for (auto& e : expected) all.push_back(e.first);
+        BOOST_CHECK(collect(tree) == all);
+
+        for (string prefix : { "a", "ab", "abc", "dddd", "cab" }) {
+            vector<string> matching;
+            for (auto& k : all)
+                if (k.compare(0, prefix.size(), prefix) == 0)
+                    matching.push_back(k);
+            BOOST_CHECK(collect(tree, prefix) == matching);
+        }
+
+        for (auto& k : all)
+            BOOST_REQUIRE(tree.erase(k.data(), k.size()));
+        BOOST_CHECK_EQUAL(0, tree.size());
+        BOOST_CHECK(collect(tree).empty());
+    }
+    BOOST_CHECK_EQUAL(0, allocator.get_used_bytes());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
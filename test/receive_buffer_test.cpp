@@ -0,0 +1,157 @@
+/*
+ * Test suite for receive_buffer
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "receive_buffer.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <algorithm>
+#include <cstring>
+
+BOOST_AUTO_TEST_SUITE(receive_buffer_test)
+
+using std::string;
+using throng::internal::receive_buffer;
+using throng::internal::io_buffer_pool;
+typedef receive_buffer::frame_status frame_status;
+
+static string frame(const string& body) {
+    string f(4, '\0');
+    uint32_t len = body.size();
+    f[0] = (char)(len >> 24);
+    f[1] = (char)(len >> 16);
+    f[2] = (char)(len >> 8);
+    f[3] = (char)len;
+    return f + body;
+}
+
+// Copy up to max bytes of the stream into the buffer as one read
+static size_t feed(receive_buffer& b, const string& stream, size_t& pos,
+                   size_t max) {
+    auto space = b.prepare();
+    size_t n = std::min(std::min(max, stream.size() - pos),
+                        boost::asio::buffer_size(space));
+    std::memcpy(boost::asio::buffer_cast<uint8_t*>(space),
+                stream.data() + pos, n);
+    b.commit(n);
+    pos += n;
+    return n;
+}
+
+BOOST_AUTO_TEST_CASE(many_per_read) {
+    receive_buffer b(std::make_shared<io_buffer_pool>(),
+                     1024, 4096);
+    string stream;
+    for (int i = 0; i < 100; ++i)
+        stream += frame("message " + std::to_string(i));
+
+    size_t pos = 0;
+    BOOST_CHECK_EQUAL(stream.size(), feed(b, stream, pos, stream.size()));
+
+    const uint8_t* data;
+    size_t len;
+    for (int i = 0; i < 100; ++i) {
+        BOOST_REQUIRE(frame_status::COMPLETE == b.next_frame(data, len));
+        BOOST_CHECK_EQUAL("message " + std::to_string(i),
+                          string((const char*)data, len));
+    }
+    BOOST_CHECK(frame_status::INCOMPLETE == b.next_frame(data, len));
+    BOOST_CHECK_EQUAL(0, b.size());
+}
+
+BOOST_AUTO_TEST_CASE(split) {
+    receive_buffer b(std::make_shared<io_buffer_pool>(),
+                     1024 * 1024, 64);
+    string stream;
+    for (size_t i = 0; i < 50; ++i)
+        stream += frame(string(i * 37, (char)('a' + i % 26)));
+    stream += frame("");
+
+    // Deliver the stream in awkward pieces, including splits inside
+    // the length prefix
+    size_t pos = 0;
+    size_t found = 0;
+    size_t chunk = 1;
+    while (pos < stream.size()) {
+        feed(b, stream, pos, chunk);
+        chunk = chunk % 13 + 2;
+
+        const uint8_t* data;
+        size_t len;
+        while (b.next_frame(data, len) == frame_status::COMPLETE) {
+            if (found < 50) {
+                BOOST_CHECK_EQUAL(string(found * 37,
+                                         (char)('a' + found % 26)),
+                                  string((const char*)data, len));
+            } else {
+                BOOST_CHECK_EQUAL(0, len);
+            }
+            found += 1;
+        }
+    }
+    BOOST_CHECK_EQUAL(51, found);
+    BOOST_CHECK_EQUAL(0, b.size());
+    // The buffer only grows to hold the largest frame
+    BOOST_CHECK(b.capacity() < 2 * (4 + 49 * 37) + 64);
+}
+
+BOOST_AUTO_TEST_CASE(large_frame) {
+    receive_buffer b(std::make_shared<io_buffer_pool>(),
+                     1024 * 1024, 256);
+    string body(100000, 'x');
+    string stream = frame("small") + frame(body);
+
+    size_t pos = 0;
+    feed(b, stream, pos, 256);
+    const uint8_t* data;
+    size_t len;
+    BOOST_REQUIRE(frame_status::COMPLETE == b.next_frame(data, len));
+    BOOST_CHECK_EQUAL("small", string((const char*)data, len));
+    BOOST_CHECK(frame_status::INCOMPLETE == b.next_frame(data, len));
+
+    // Once the length is known, the rest of the frame fits in one read
+    BOOST_CHECK(boost::asio::buffer_size(b.prepare()) >=
+                stream.size() - pos);
+    feed(b, stream, pos, stream.size());
+    BOOST_REQUIRE(frame_status::COMPLETE == b.next_frame(data, len));
+    BOOST_CHECK(body == string((const char*)data, len));
+
+    // The memory for the large frame is given back
+    BOOST_CHECK(b.capacity() >= 100000);
+    b.prepare();
+    BOOST_CHECK(b.capacity() <= 512);
+}
+
+BOOST_AUTO_TEST_CASE(oversized) {
+    receive_buffer b(std::make_shared<io_buffer_pool>(),
+                     1000, 256);
+    string stream = frame(string(1001, 'x'));
+    size_t pos = 0;
+    feed(b, stream, pos, 256);
+    const uint8_t* data;
+    size_t len;
+    BOOST_CHECK(frame_status::OVERSIZED == b.next_frame(data, len));
+    BOOST_CHECK(b.capacity() < 1000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,167 @@
+/*
+ * Test suite for rpc_connection
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ctx_fixture.h"
+#include "ctx_internal.h"
+#include "rpc_connection.h"
+#include "rpc_handler.h"
+#include "throng_messages.pb.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/asio.hpp>
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <thread>
+
+BOOST_AUTO_TEST_SUITE(rpc_connection_test)
+
+using throng::internal::rpc_connection;
+using throng::internal::rpc_handler;
+using throng::internal::ctx_internal;
+using throng::internal::io_buffer_pool;
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+namespace ba = boost::asio;
+namespace message = throng::message;
+
+static const uint16_t PORT = 17191;
+
+/**
+ * A handler that sends nothing on connect, so the peer sees only the
+ * messages sent by the test
+ */
+class quiet_handler : public rpc_handler {
+public:
+    quiet_handler(ctx_internal& ctx) : rpc_handler(ctx) { }
+
+    virtual bool handle_connect(rpc_connection&) override { return true; }
+};
+
+/**
+ * Connects an rpc_connection from the context to a plain socket
+ * accepted by the test, which reads the frames written to it
+ */
+class connection_fixture : public throng::test::ctx_fixture {
+public:
+    connection_fixture()
+        : ictx(dynamic_cast<ctx_internal&>(*context)),
+          acceptor(io, ba::ip::tcp::endpoint(ba::ip::tcp::v4(), PORT)),
+          peer(io) { }
+
+    ~connection_fixture() {
+        if (conn) conn->stop();
+    }
+
+    void connect(rpc_connection::write_options options) {
+        conn = std::make_shared<rpc_connection>
+            (ictx, 1, std::make_shared<quiet_handler>(ictx),
+             std::make_shared<io_buffer_pool>(),
+             rpc_connection::stop_handler_type{}, options);
+        conn->start("127.0.0.1", PORT);
+        acceptor.accept(peer);
+    }
+
+    void send(uint64_t xid, size_t size) {
+        message::rpc_message m;
+        m.set_xid(xid);
+        m.set_method(message::METHOD_HELLO);
+        m.mutable_rep()->set_status_message(std::string(size, 'x'));
+        conn->send_message(m);
+    }
+
+    // Read one frame from the peer socket and return its transaction
+    // ID
+    uint64_t receive() {
+        uint32_t len;
+        ba::read(peer, ba::buffer(&len, sizeof(len)));
+        std::string data(ntohl(len), '\0');
+        ba::read(peer, ba::buffer(&data[0], data.size()));
+        message::rpc_message m;
+        BOOST_REQUIRE(m.ParseFromString(data));
+        return m.xid();
+    }
+
+    ctx_internal& ictx;
+    ba::io_service io;
+    ba::ip::tcp::acceptor acceptor;
+    ba::ip::tcp::socket peer;
+    std::shared_ptr<rpc_connection> conn;
+};
+
+BOOST_FIXTURE_TEST_CASE(ordering, connection_fixture) {
+    rpc_connection::write_options options;
+    options.max_batch_size = 4096;
+    connect(options);
+
+    // messages sent from several threads while writes are in
+    // progress arrive whole, and in order for each sender
+    const int THREADS = 4;
+    const int COUNT = 500;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([this, t]() {
+                for (int i = 0; i < COUNT; i++)
+                    send((uint64_t)t * COUNT + i, 100);
+            });
+    }
+
+    std::vector<uint64_t> last(THREADS, 0);
+    std::vector<bool> seen(THREADS, false);
+    for (int i = 0; i < THREADS * COUNT; i++) {
+        uint64_t xid = receive();
+        size_t t = xid / COUNT;
+        BOOST_REQUIRE(t < (size_t)THREADS);
+        BOOST_REQUIRE(!seen[t] || xid > last[t]);
+        seen[t] = true;
+        last[t] = xid;
+    }
+    for (auto& t : threads)
+        t.join();
+}
+
+BOOST_FIXTURE_TEST_CASE(coalesce, connection_fixture) {
+    rpc_connection::write_options options;
+    options.max_batch_size = 4096;
+    options.max_latency = std::chrono::duration_cast
+        <std::chrono::microseconds>(seconds(30));
+    connect(options);
+
+    // small messages wait for more to join their batch
+    for (uint64_t i = 0; i < 10; i++)
+        send(i, 100);
+    std::this_thread::sleep_for(milliseconds(200));
+    BOOST_CHECK_EQUAL(0, peer.available());
+
+    // and are written as soon as a batch is full, rather than when
+    // the latency runs out.  About 36 messages fill the batch; the
+    // rest wait for the next one.
+    auto start = steady_clock::now();
+    for (uint64_t i = 10; i < 40; i++)
+        send(i, 100);
+    for (uint64_t i = 0; i < 30; i++)
+        BOOST_CHECK_EQUAL(i, receive());
+    BOOST_CHECK(steady_clock::now() - start < seconds(10));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -133,4 +133,35 @@ BOOST_AUTO_TEST_CASE(reschedule_while_running) {
     BOOST_CHECK_EQUAL(2, run_count.load());
 }
 
+BOOST_AUTO_TEST_CASE(destroy_while_running) {
+    io_service io;
+    std::unique_ptr<io_service::work> work;
+    work.reset(new io_service::work(io));
+    std::thread worker([&io]() { io.run(); });
+
+    // destroying the task waits for the running instance, which
+    // reschedules itself, and nothing runs afterwards
+    std::atomic_bool started(false);
+    std::atomic_uint_fast64_t run_count(0);
+    {
+        singleton_task* s = nullptr;
+        s = new singleton_task(io, [&]() {
+                started = true;
+                std::this_thread::sleep_for(milliseconds(30));
+                s->schedule();
+                run_count += 1;
+            });
+        s->schedule();
+        while (!started)
+            std::this_thread::sleep_for(milliseconds(1));
+        delete s;
+        BOOST_CHECK_EQUAL(1, run_count.load());
+    }
+
+    std::this_thread::sleep_for(milliseconds(20));
+    work.reset();
+    worker.join();
+    BOOST_CHECK_EQUAL(1, run_count.load());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
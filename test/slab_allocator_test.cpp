@@ -0,0 +1,116 @@
+/*
+ * Test suite for slab_allocator
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "slab_allocator.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include <set>
+#include <cstring>
+
+BOOST_AUTO_TEST_SUITE(slab_allocator_test)
+
+using throng::internal::slab_allocator;
+
+BOOST_AUTO_TEST_CASE(block_size) {
+    BOOST_CHECK_EQUAL(8, slab_allocator::block_size(0));
+    BOOST_CHECK_EQUAL(8, slab_allocator::block_size(1));
+    BOOST_CHECK_EQUAL(16, slab_allocator::block_size(9));
+    BOOST_CHECK_EQUAL(128, slab_allocator::block_size(128));
+    BOOST_CHECK_EQUAL(160, slab_allocator::block_size(129));
+    BOOST_CHECK_EQUAL(4096, slab_allocator::block_size(4000));
+    BOOST_CHECK_EQUAL(5000, slab_allocator::block_size(5000));
+
+    // no more than 25% rounding above 128 bytes
+    for (size_t s = 129; s <= slab_allocator::MAX_BLOCK_SIZE; s++) {
+        size_t b = slab_allocator::block_size(s);
+        BOOST_REQUIRE(b >= s);
+        BOOST_REQUIRE(b - s < s / 4 + 8);
+        BOOST_REQUIRE(b % 8 == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(allocate) {
+    slab_allocator alloc(8192);
+    std::set<char*> blocks;
+    for (int i = 0; i < 1000; i++) {
+        char* p = static_cast<char*>(alloc.allocate(40));
+        BOOST_REQUIRE(((uintptr_t)p % 8) == 0);
+        std::memset(p, i, 40);
+        BOOST_REQUIRE(blocks.insert(p).second);
+    }
+    BOOST_CHECK_EQUAL(40 * 1000, alloc.get_used_bytes());
+    size_t reserved = alloc.get_reserved_bytes();
+    BOOST_CHECK(reserved >= 40 * 1000);
+    BOOST_CHECK(reserved < 40 * 1000 + 2 * 8192);
+
+    // freed blocks are reused before allocating new slabs
+    std::vector<char*> freed;
+    bool odd = false;
+    for (char* p : blocks) {
+        if ((odd = !odd)) {
+            alloc.deallocate(p, 40);
+            freed.push_back(p);
+        }
+    }
+    BOOST_CHECK_EQUAL(40 * 500, alloc.get_used_bytes());
+    for (size_t i = 0; i < freed.size(); i++)
+        BOOST_CHECK(blocks.count(static_cast<char*>(alloc.allocate(33))));
+    BOOST_CHECK_EQUAL(reserved, alloc.get_reserved_bytes());
+
+    // empty slabs are released, except for one spare
+    for (char* p : blocks)
+        alloc.deallocate(p, 40);
+    BOOST_CHECK_EQUAL(0, alloc.get_used_bytes());
+    BOOST_CHECK_EQUAL(8192, alloc.get_reserved_bytes());
+    reserved = alloc.get_reserved_bytes();
+
+    void* large = alloc.allocate(10000);
+    BOOST_CHECK_EQUAL(reserved + 10000, alloc.get_reserved_bytes());
+    alloc.deallocate(large, 10000);
+    BOOST_CHECK_EQUAL(reserved, alloc.get_reserved_bytes());
+}
+
+BOOST_AUTO_TEST_CASE(churn) {
+    slab_allocator alloc(8192);
+
+    // moving blocks from one size class to another does not leave
+    // the memory of the first reserved
+    std::vector<void*> blocks;
+    for (int i = 0; i < 1000; i++)
+        blocks.push_back(alloc.allocate(40));
+    for (size_t size = 48; size <= 128; size += 8) {
+        for (auto& p : blocks) {
+            void* n = alloc.allocate(size);
+            alloc.deallocate(p, size - 8);
+            p = n;
+        }
+        BOOST_CHECK_EQUAL(size * 1000, alloc.get_used_bytes());
+        BOOST_CHECK(alloc.get_reserved_bytes() < size * 1000 + 3 * 8192);
+    }
+    for (auto p : blocks)
+        alloc.deallocate(p, 128);
+    BOOST_CHECK_EQUAL(8192, alloc.get_reserved_bytes());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,250 @@
+/*
+ * Test suite for snapshot files
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "snapshot_file.h"
+#include "temp_path.h"
+#include "throng/ctx.h"
+#include "throng/error.h"
+#include "throng/store_client.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include <map>
+#include <set>
+#include <fstream>
+
+BOOST_AUTO_TEST_SUITE(snapshot_file_test)
+
+using throng::internal::write_snapshot_file;
+using throng::internal::snapshot_file_reader;
+using throng::test::temp_dir;
+using throng::versioned;
+using throng::vector_clock;
+using throng::store_client;
+using std::string;
+using std::vector;
+using std::make_shared;
+
+typedef vector<versioned<string>> values_t;
+
+/**
+ * A snapshot of a fixed map of items
+ */
+class map_snapshot : public throng::store_snapshot<string, string> {
+public:
+    std::map<string, values_t> data;
+
+    virtual values_t get(const string& key) override {
+        auto it = data.find(key);
+        return it == data.end() ? values_t() : it->second;
+    }
+
+    virtual void visit(store_visitor visitor) override {
+        for (auto& d : data)
+            visitor(d.first, d.second);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(roundtrip) {
+    temp_dir dir;
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = vector_clock().incremented({2});
+
+    map_snapshot source;
+    for (int i = 0; i < 5000; ++i) {
+        string key = "key" + std::to_string(i);
+        source.data[key] = { { make_shared<string>(string(50, 'v') + key),
+                               v1 } };
+    }
+    source.data["siblings"] = { { make_shared<string>("1"), v1 },
+                                { make_shared<string>("2"), v2 } };
+    source.data["tombstone"] = { { nullptr, v2 } };
+
+    for (bool compress : { false, true }) {
+        string path = (dir.path() / (compress ? "z" : "raw")).string();
+        BOOST_CHECK_EQUAL(5002, write_snapshot_file(path, source, compress));
+        BOOST_CHECK(!boost::filesystem::exists(path + ".tmp"));
+
+        snapshot_file_reader reader(path);
+        BOOST_CHECK_EQUAL(5002, reader.get_item_count());
+
+        values_t values = reader.get("key1234");
+        BOOST_REQUIRE_EQUAL(1, values.size());
+        BOOST_CHECK_EQUAL(string(50, 'v') + "key1234", values[0].get());
+        BOOST_CHECK_EQUAL(v1, values[0].get_version());
+        BOOST_CHECK_EQUAL(2, reader.get("siblings").size());
+        BOOST_CHECK(!reader.get("tombstone").at(0));
+        BOOST_CHECK_EQUAL(0, reader.get("a").size());
+        BOOST_CHECK_EQUAL(0, reader.get("key12345").size());
+        BOOST_CHECK_EQUAL(0, reader.get("zzz").size());
+
+        vector<string> keys;
+        reader.visit([&keys](const string& key, const values_t& values) {
+                BOOST_CHECK(!values.empty());
+                keys.push_back(key);
+            });
+        BOOST_CHECK_EQUAL(5002, keys.size());
+        BOOST_CHECK(std::is_sorted(keys.begin(), keys.end()));
+    }
+
+    // the repetitive values compress
+    BOOST_CHECK(boost::filesystem::file_size(dir.path() / "z") <
+                boost::filesystem::file_size(dir.path() / "raw") / 2);
+}
+
+BOOST_AUTO_TEST_CASE(shared_values) {
+    temp_dir dir;
+    vector_clock v1 = vector_clock().incremented({1});
+    vector_clock v2 = vector_clock().incremented({2});
+    string contract(1000, 'c');
+    string policy(200, 'p');
+
+    map_snapshot source;
+    for (int i = 0; i < 1000; ++i) {
+        string key = "ep" + std::to_string(i);
+        source.data[key] = { { make_shared<string>(contract), v1 },
+                             { make_shared<string>(key), v2 } };
+        if (i % 10 == 0)
+            source.data[key].push_back({ make_shared<string>(policy), v2 });
+    }
+    source.data["unique"] = { { make_shared<string>(string(500, 'u')), v1 } };
+
+    string path = (dir.path() / "snap").string();
+    BOOST_CHECK_EQUAL(1001, write_snapshot_file(path, source, false));
+    // each repeated value is written once
+    BOOST_CHECK(boost::filesystem::file_size(path) < 100000);
+
+    snapshot_file_reader reader(path);
+    BOOST_CHECK_EQUAL(2, reader.get_shared_count());
+    values_t values = reader.get("ep10");
+    BOOST_REQUIRE_EQUAL(3, values.size());
+    BOOST_CHECK_EQUAL(contract, values[0].get());
+    BOOST_CHECK_EQUAL(v1, values[0].get_version());
+    BOOST_CHECK_EQUAL("ep10", values[1].get());
+    BOOST_CHECK_EQUAL(policy, values[2].get());
+    BOOST_CHECK_EQUAL(string(500, 'u'), reader.get("unique").at(0).get());
+
+    // the items read share a single copy
+    std::set<const string*> copies;
+    size_t count = 0;
+    reader.visit([&](const string& key, const values_t& values) {
+            if (key == "unique") return;
+            BOOST_CHECK_EQUAL(contract, values.at(0).get());
+            copies.insert(values[0].get_ptr().get());
+            count += 1;
+        });
+    BOOST_CHECK_EQUAL(1000, count);
+    BOOST_CHECK_EQUAL(1, copies.size());
+}
+
+BOOST_AUTO_TEST_CASE(corrupt) {
+    temp_dir dir;
+    string path = (dir.path() / "snap").string();
+    map_snapshot source;
+    for (int i = 0; i < 100; ++i) {
+        string key = std::to_string(i);
+        source.data[key] = { { make_shared<string>(key),
+                               vector_clock().incremented({1}) } };
+    }
+    write_snapshot_file(path, source);
+    size_t size = boost::filesystem::file_size(path);
+
+    // an impossible uncompressed size in a block header is rejected
+    // rather than allocated
+    {
+        std::fstream f(path, std::ios::in | std::ios::out |
+                       std::ios::binary);
+        f.seekp(20);
+        f.write("\xff\xff\xff\x7f", 4);
+    }
+    {
+        snapshot_file_reader reader(path);
+        BOOST_CHECK_THROW(reader.visit([](const string&,
+                                          const values_t&) { }),
+                          throng::error::storage);
+    }
+    write_snapshot_file(path, source);
+
+    // a damaged block is detected when it is read
+    {
+        std::fstream f(path, std::ios::in | std::ios::out |
+                       std::ios::binary);
+        f.seekp(40);
+        f.put('\xff');
+    }
+    snapshot_file_reader reader(path);
+    BOOST_CHECK_THROW(reader.visit([](const string&, const values_t&) { }),
+                      throng::error::storage);
+
+    // a truncated file is rejected when it is opened
+    boost::filesystem::resize_file(path, size - 1);
+    BOOST_CHECK_THROW(snapshot_file_reader r(path), throng::error::storage);
+
+    {
+        std::ofstream f(path, std::ios::binary);
+        f << string(100, 'x');
+    }
+    BOOST_CHECK_THROW(snapshot_file_reader r(path), throng::error::storage);
+    BOOST_CHECK_THROW(snapshot_file_reader r((dir.path() / "x").string()),
+                      throng::error::storage);
+}
+
+BOOST_AUTO_TEST_CASE(ctx_dump_load) {
+    temp_dir dir;
+    string path = (dir.path() / "snap").string();
+    auto context = throng::ctx::new_ctx((dir.path() / "db").string());
+    context->configure_local({1}, "localhost", 17171);
+    context->register_store("source");
+    context->register_store("target");
+    context->start();
+
+    auto source = store_client<string, string>::
+        new_store_client(*context, "source");
+    auto target = store_client<string, string>::
+        new_store_client(*context, "target");
+    for (int i = 0; i < 1000; ++i) {
+        string key = std::to_string(i);
+        source->update(key, source->get(key), key);
+    }
+    target->update("0", target->get("0"), "existing");
+
+    auto written = context->write_snapshot_file("source", path);
+    // writes after the call are not in the file
+    source->update("late", source->get("late"), "late");
+    BOOST_CHECK_EQUAL(1000, written.get());
+
+    BOOST_CHECK_EQUAL(1000, context->load_snapshot_file("target", path));
+    BOOST_CHECK_EQUAL("999", target->get("999").get());
+    BOOST_CHECK(!target->get("late"));
+
+    // both nodes wrote the same version, so the value already there
+    // is kept
+    BOOST_CHECK_EQUAL("existing", target->get("0").get());
+
+    BOOST_CHECK_THROW(context->load_snapshot_file("target",
+                                                  path + ".missing"),
+                      throng::error::storage);
+    context->stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,116 @@
+/*
+ * Conformance tests run on every storage engine
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "engine_conformance.h"
+#include "in_memory_storage_engine.h"
+#include "leveldb_storage_engine.h"
+#include "log_storage_engine.h"
+#include "temp_path.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+BOOST_AUTO_TEST_SUITE(storage_engine_conformance_test)
+
+using throng::internal::in_memory_storage_engine;
+using throng::internal::leveldb_storage_engine;
+using throng::internal::log_storage_engine;
+using throng::test::engine_under_test;
+using throng::test::temp_dir;
+using boost::filesystem::path;
+using std::string;
+using std::unique_ptr;
+
+typedef unique_ptr<engine_under_test::store_t> store_p;
+
+// Damage the last byte written to the newest log segment
+static void tear_log(const path& dir) {
+    path newest;
+    for (boost::filesystem::directory_iterator it(dir), end;
+         it != end; ++it) {
+        if (it->path().extension() == ".log" && newest < it->path())
+            newest = it->path();
+    }
+    BOOST_REQUIRE(!newest.empty());
+    boost::filesystem::fstream f(newest, std::ios::in | std::ios::out |
+                                 std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(f)),
+                     std::istreambuf_iterator<char>());
+    size_t end = data.size();
+    while (end > 0 && data[end - 1] == 0) end -= 1;
+    BOOST_REQUIRE(end > 0);
+    f.clear();
+    f.seekp(end - 1);
+    f.put(data[end - 1] == 'X' ? 'Y' : 'X');
+}
+
+BOOST_AUTO_TEST_CASE(in_memory) {
+    temp_dir dir;
+    engine_under_test e;
+    e.name = "in_memory";
+    e.open = [](const path&) {
+        return store_p(new in_memory_storage_engine("test"));
+    };
+    throng::test::check_engine(e, dir.path());
+}
+
+BOOST_AUTO_TEST_CASE(leveldb) {
+    temp_dir dir;
+    engine_under_test e;
+    e.name = "leveldb";
+    e.open = [](const path& p) {
+        return store_p(new leveldb_storage_engine("test", p.string()));
+    };
+    e.persistent = true;
+    e.crash_images = true;
+    throng::test::check_engine(e, dir.path());
+}
+
+BOOST_AUTO_TEST_CASE(log) {
+    temp_dir dir;
+    engine_under_test e;
+    e.name = "log";
+    e.open = [](const path& p) {
+        return store_p(new log_storage_engine("test", p.string(),
+                                              1024 * 1024, 0.5, true));
+    };
+    e.persistent = true;
+    e.crash_images = true;
+    e.tear = tear_log;
+    throng::test::check_engine(e, dir.path());
+}
+
+BOOST_AUTO_TEST_CASE(log_small_segments) {
+    // Writes span many segments and compaction runs while they are
+    // made
+    temp_dir dir;
+    engine_under_test e;
+    e.name = "log with small segments";
+    e.open = [](const path& p) {
+        return store_p(new log_storage_engine("test", p.string(),
+                                              4096, 0.3, false));
+    };
+    e.persistent = true;
+    throng::test::check_engine(e, dir.path());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -81,6 +81,49 @@ BOOST_FIXTURE_TEST_CASE(visitor, throng::test::string_store_fixture) {
     BOOST_CHECK_EQUAL(3, count);
 }
 
+BOOST_FIXTURE_TEST_CASE(snapshot, throng::test::string_store_fixture) {
+    client->update("1", client->get("1"), "one");
+    client->update("2", client->get("2"), "two");
+
+    auto snap = client->snapshot();
+    client->update("1", client->get("1"), "uno");
+    client->delete_key("2", client->get("2").get_version());
+    client->update("3", client->get("3"), "three");
+
+    BOOST_CHECK_EQUAL("one", snap->get("1").get());
+    BOOST_CHECK_EQUAL("two", snap->get("2").get());
+    BOOST_CHECK(!snap->get("3"));
+    BOOST_CHECK_EQUAL("uno", client->get("1").get());
+
+    unordered_map<string, string> seen;
+    snap->visit([&seen](string k, versioned<string> v) {
+            BOOST_REQUIRE(v);
+            seen[k] = v.get();
+        });
+    unordered_map<string, string> expected = {{"1", "one"}, {"2", "two"}};
+    BOOST_CHECK(seen == expected);
+}
+
+BOOST_FIXTURE_TEST_CASE(changes_since, throng::test::string_store_fixture) {
+    client->update("1", client->get("1"), "one");
+    client->update("2", client->get("2"), "two");
+
+    auto c = client->changes_since(0, 0);
+    BOOST_CHECK(!c.reset);
+    BOOST_CHECK(!c.more);
+    BOOST_REQUIRE_EQUAL(2, c.changes.size());
+    BOOST_CHECK_EQUAL("1", c.changes[0].first);
+    BOOST_CHECK_EQUAL("one", c.changes[0].second.get());
+
+    client->delete_key("2", client->get("2").get_version());
+    c = client->changes_since(c.epoch, c.next_seq);
+    BOOST_REQUIRE_EQUAL(1, c.changes.size());
+    BOOST_CHECK_EQUAL("2", c.changes[0].first);
+    BOOST_CHECK(!c.changes[0].second);
+    BOOST_CHECK_EQUAL(0, client->changes_since(c.epoch, c.next_seq)
+                      .changes.size());
+}
+
 BOOST_FIXTURE_TEST_CASE(inconsistency, throng::test::string_store_fixture) {
     auto union_resolver =
         [](const vector<versioned<string>>& items) -> versioned<string> {
@@ -143,6 +186,52 @@ BOOST_FIXTURE_TEST_CASE(inconsistency, throng::test::string_store_fixture) {
     BOOST_CHECK_EQUAL("abcdefghi", val.get());
 }
 
+BOOST_FIXTURE_TEST_CASE(register_resolver,
+                        throng::test::string_store_fixture) {
+    client->register_resolver();
+    auto& raw = context->get_raw_store("test");
+
+    auto now = std::chrono::system_clock::now();
+    for (uint32_t i = 0; i < 5; i++) {
+        node_id n = {i};
+        vector_clock v { now + std::chrono::seconds(i), { {n, 1} } };
+        raw.put("a", { make_shared<string>(std::to_string(i)), v });
+    }
+
+    // the concurrent values are merged once there are more than
+    // the sibling limit
+    auto values = raw.get("a");
+    BOOST_REQUIRE_EQUAL(1, values.size());
+    BOOST_CHECK_EQUAL("4", values[0].get());
+    BOOST_CHECK_EQUAL(5, values[0].get_version().get_entries().size());
+    BOOST_CHECK_EQUAL("4", client->get("a").get());
+}
+
+BOOST_AUTO_TEST_CASE(persistent) {
+    throng::test::temp_dir storage;
+    throng::store_config config;
+    config.persistent = true;
+
+    for (int i = 0; i < 2; i++) {
+        auto context = throng::ctx::new_ctx(storage.path().string());
+        context->configure_local({1}, "localhost", 17171);
+        context->register_store("persistent", config);
+        context->start();
+        auto c = store_client<string, string>::
+            new_store_client(*context, "persistent");
+        if (i == 0) {
+            c->update("a", c->get("a"), "value");
+        } else {
+            // the value was written to storage and is read back
+            // after a restart
+            auto v = c->get("a");
+            BOOST_REQUIRE(v);
+            BOOST_CHECK_EQUAL("value", v.get());
+        }
+        context->stop();
+    }
+}
+
 BOOST_FIXTURE_TEST_CASE(protobuf, throng::test::ctx_fixture) {
     using throng::message::node;
 
@@ -0,0 +1,150 @@
+/*
+ * Test suite for timing_wheel
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "timing_wheel.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(timing_wheel_test)
+
+using throng::internal::timing_wheel;
+using std::vector;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::chrono::hours;
+
+struct test_entry : public timing_wheel::entry {
+    test_entry(int id_) : id(id_) { }
+    int id;
+};
+
+static vector<int> expire(timing_wheel& wheel,
+                          timing_wheel::time_point now,
+                          size_t limit = SIZE_MAX) {
+    vector<int> result;
+    wheel.advance(now, [&result](timing_wheel::entry& e) {
+            result.push_back(static_cast<test_entry&>(e).id);
+        }, limit);
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(basic) {
+    auto origin = timing_wheel::clock::now();
+    timing_wheel wheel(milliseconds(10), origin);
+    BOOST_CHECK(timing_wheel::time_point::max() == wheel.next_deadline());
+
+    test_entry e1(1), e2(2), e3(3);
+    wheel.schedule(e1, origin + milliseconds(25));
+    wheel.schedule(e2, origin + milliseconds(5));
+    wheel.schedule(e3, origin + milliseconds(25));
+    BOOST_CHECK(e1.is_scheduled());
+    BOOST_CHECK(origin + milliseconds(10) == wheel.next_deadline());
+
+    BOOST_CHECK(expire(wheel, origin + milliseconds(9)).empty());
+    BOOST_CHECK(vector<int>({2}) == expire(wheel, origin + milliseconds(10)));
+    BOOST_CHECK(!e2.is_scheduled());
+    BOOST_CHECK(origin + milliseconds(30) == wheel.next_deadline());
+
+    // deadlines are never rounded down
+    BOOST_CHECK(expire(wheel, origin + milliseconds(25)).empty());
+    BOOST_CHECK(vector<int>({1, 3}) ==
+                expire(wheel, origin + milliseconds(30)));
+    BOOST_CHECK(timing_wheel::time_point::max() == wheel.next_deadline());
+}
+
+BOOST_AUTO_TEST_CASE(cancel) {
+    auto origin = timing_wheel::clock::now();
+    timing_wheel wheel(milliseconds(10), origin);
+
+    test_entry e1(1), e2(2);
+    wheel.schedule(e1, origin + milliseconds(50));
+    wheel.schedule(e2, origin + milliseconds(50));
+    e1.cancel();
+    BOOST_CHECK(!e1.is_scheduled());
+    {
+        test_entry e3(3);
+        wheel.schedule(e3, origin + milliseconds(50));
+    }
+    // moving an entry cancels the previous deadline
+    wheel.schedule(e2, origin + seconds(100));
+    BOOST_CHECK(expire(wheel, origin + seconds(99)).empty());
+    BOOST_CHECK(vector<int>({2}) == expire(wheel, origin + seconds(100)));
+}
+
+BOOST_AUTO_TEST_CASE(cascade) {
+    auto origin = timing_wheel::clock::now();
+    timing_wheel wheel(milliseconds(100), origin);
+
+    vector<test_entry> entries;
+    entries.reserve(6);
+    for (int i = 0; i < 6; i++)
+        entries.emplace_back(i);
+
+    // one deadline for each level of the wheel, plus the overflow list
+    wheel.schedule(entries[5], origin + hours(24 * 30));
+    wheel.schedule(entries[4], origin + hours(24));
+    wheel.schedule(entries[3], origin + seconds(1000));
+    wheel.schedule(entries[2], origin + seconds(60));
+    wheel.schedule(entries[1], origin + seconds(5));
+    wheel.schedule(entries[0], origin + milliseconds(200));
+
+    vector<int> order;
+    auto now = origin;
+    while (true) {
+        auto next = wheel.next_deadline();
+        if (next == timing_wheel::time_point::max()) break;
+        BOOST_REQUIRE(next >= now);
+        now = next;
+        for (int id : expire(wheel, now)) {
+            order.push_back(id);
+            BOOST_CHECK(now >= entries[id].get_deadline());
+            BOOST_CHECK(now - entries[id].get_deadline() < milliseconds(100));
+        }
+    }
+    BOOST_CHECK(vector<int>({0, 1, 2, 3, 4, 5}) == order);
+}
+
+BOOST_AUTO_TEST_CASE(limit) {
+    auto origin = timing_wheel::clock::now();
+    timing_wheel wheel(milliseconds(10), origin);
+
+    vector<test_entry> entries;
+    entries.reserve(10);
+    for (int i = 0; i < 10; i++) {
+        entries.emplace_back(i);
+        wheel.schedule(entries.back(), origin + milliseconds(i));
+    }
+
+    auto now = origin + seconds(1);
+    BOOST_CHECK_EQUAL(4, expire(wheel, now, 4).size());
+    BOOST_CHECK(wheel.next_deadline() <= now);
+    BOOST_CHECK_EQUAL(6, expire(wheel, now).size());
+    BOOST_CHECK(timing_wheel::time_point::max() == wheel.next_deadline());
+
+    // deadlines in the past expire on the next advance
+    wheel.schedule(entries[0], origin);
+    BOOST_CHECK(vector<int>({0}) == expire(wheel, now));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
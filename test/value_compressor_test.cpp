@@ -0,0 +1,220 @@
+/*
+ * Test suite for value_compressor
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "value_compressor.h"
+#include "temp_path.h"
+#include "throng/ctx.h"
+#include "throng/error.h"
+#include "throng/store_client.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(value_compressor_test)
+
+using throng::internal::value_compressor;
+using throng::test::temp_dir;
+using throng::store_client;
+using std::string;
+using std::vector;
+using std::shared_ptr;
+using std::make_shared;
+
+typedef shared_ptr<const string> value_p;
+
+// Values with a shared structure, like serialized records
+static string record(int i) {
+    return "{\"id\":" + std::to_string(i) +
+        ",\"type\":\"endpoint\",\"state\":\"active\",\"tenant\":\"common\","
+        "\"labels\":[\"web\",\"frontend\"],\"seq\":" +
+        std::to_string(i * 7919 % 10007) + "}";
+}
+
+static void check_roundtrip(value_compressor& c, const value_p& v) {
+    value_p e = c.encode(v);
+    value_p d = c.decode(e);
+    BOOST_REQUIRE(d);
+    BOOST_CHECK_EQUAL(*v, *d);
+}
+
+BOOST_AUTO_TEST_CASE(roundtrip) {
+    value_compressor c("test", "", 0, 1024);
+    BOOST_CHECK(!c.encode(nullptr));
+    BOOST_CHECK(!c.decode(nullptr));
+
+    // short values and values that do not compress are kept as they
+    // are
+    value_p small = make_shared<string>("hello");
+    BOOST_CHECK(c.encode(small) == small);
+    value_p random = make_shared<string>();
+    for (int i = 0; i < 200; i++)
+        const_cast<string&>(*random).push_back((char)(i * 7919 % 251));
+    check_roundtrip(c, random);
+    check_roundtrip(c, make_shared<string>());
+
+    value_p repetitive = make_shared<string>(4096, 'x');
+    value_p e = c.encode(repetitive);
+    BOOST_CHECK(e->size() < 100);
+    check_roundtrip(c, repetitive);
+    check_roundtrip(c, make_shared<string>(record(1)));
+
+    // raw values that look like encoded ones are wrapped
+    for (string s : { string("\xf7Z"), string("\xf7Z\x00", 3),
+                      string("\xf7Z\x01garbage") }) {
+        value_p v = make_shared<string>(s);
+        BOOST_CHECK(c.encode(v) != v || s.size() < 3);
+        check_roundtrip(c, v);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(dictionary) {
+    temp_dir dir;
+    auto c = std::make_shared<value_compressor>("test", dir.path(), 100,
+                                                4096);
+    BOOST_CHECK_EQUAL(0, c->get_dictionary_id());
+
+    vector<value_p> raw, encoded;
+    for (int i = 0; i < 200; i++) {
+        raw.push_back(make_shared<string>(record(i)));
+        encoded.push_back(c->encode(raw.back()));
+    }
+    uint32_t id = c->get_dictionary_id();
+    BOOST_CHECK(id != 0);
+
+    // values encoded with the trained dictionary are smaller than
+    // those encoded before it
+    size_t before = 0, after = 0;
+    for (int i = 0; i < 100; i++) {
+        before += encoded[i]->size();
+        after += encoded[i + 100]->size();
+    }
+    BOOST_CHECK_MESSAGE(after * 2 < before,
+                        "with dictionary " << after << " without " << before);
+    BOOST_CHECK(after < 100 * raw[150]->size() / 2);
+    for (size_t i = 0; i < raw.size(); i++)
+        BOOST_CHECK_EQUAL(*raw[i], *c->decode(encoded[i]));
+
+    // the dictionary is loaded by a new compressor for the same
+    // directory, which does not train another
+    c.reset();
+    value_compressor c2("test", dir.path(), 100, 4096);
+    BOOST_CHECK_EQUAL(id, c2.get_dictionary_id());
+    for (size_t i = 0; i < raw.size(); i++)
+        BOOST_CHECK_EQUAL(*raw[i], *c2.decode(encoded[i]));
+    uint32_t other = c2.add_dictionary("another dictionary");
+    BOOST_CHECK_EQUAL(value_compressor::dictionary_id("another dictionary"),
+                      other);
+    BOOST_CHECK(other != id);
+    check_roundtrip(c2, raw[0]);
+
+    // the newest dictionary stays current when the directory is
+    // loaded again
+    value_compressor c4("test", dir.path(), 100, 4096);
+    BOOST_CHECK_EQUAL(other, c4.get_dictionary_id());
+
+    // a compressor without the dictionary cannot decode the values
+    value_compressor c3("test", "", 0, 4096);
+    BOOST_CHECK_THROW(c3.decode(encoded[150]),
+                      throng::error::serialization);
+    BOOST_CHECK_EQUAL(*raw[0], *c3.decode(encoded[0]));
+
+    // nor can one with a different dictionary
+    c3.add_dictionary("another dictionary");
+    BOOST_CHECK_THROW(c3.decode(encoded[150]),
+                      throng::error::serialization);
+}
+
+BOOST_AUTO_TEST_CASE(nonblocking) {
+    temp_dir dir;
+    value_compressor c("test", dir.path(), 100, 4096);
+
+    // values encoded without blocking are not sampled for training
+    for (int i = 0; i < 200; i++) {
+        value_p v = make_shared<string>(record(i));
+        BOOST_CHECK_EQUAL(*v, *c.decode(c.encode_nonblocking(v)));
+    }
+    BOOST_CHECK_EQUAL(0, c.get_dictionary_id());
+    for (int i = 0; i < 100; i++)
+        c.encode(make_shared<string>(record(i)));
+    BOOST_CHECK(c.get_dictionary_id() != 0);
+}
+
+BOOST_AUTO_TEST_CASE(corrupt) {
+    value_compressor c("test", "", 0, 1024);
+    value_p e = c.encode(make_shared<string>(1000, 'y'));
+    BOOST_REQUIRE(e->size() > 8);
+    value_p truncated = make_shared<string>(*e, 0, e->size() - 2);
+    BOOST_CHECK_THROW(c.decode(truncated), throng::error::serialization);
+    value_p header = make_shared<string>(*e, 0, 4);
+    BOOST_CHECK_THROW(c.decode(header), throng::error::serialization);
+
+    // a value that inflates to the right length but not to the value
+    // that was compressed fails its checksum
+    string bad = *e;
+    bad[6] ^= 1;
+    BOOST_CHECK_THROW(c.decode(make_shared<string>(bad)),
+                      throng::error::serialization);
+}
+
+BOOST_AUTO_TEST_CASE(store) {
+    temp_dir storage;
+    throng::store_config config;
+    config.persistent = true;
+    config.compression = throng::value_compression::ZLIB;
+    config.compression_training_samples = 50;
+
+    for (int i = 0; i < 2; i++) {
+        auto context = throng::ctx::new_ctx(storage.path().string());
+        context->configure_local({1}, "localhost", 17171);
+        context->register_store("compressed", config);
+        context->start();
+        BOOST_REQUIRE(context->get_value_codec("compressed"));
+        auto c = store_client<string, string>::
+            new_store_client(*context, "compressed");
+        if (i == 0) {
+            for (int j = 0; j < 100; j++) {
+                string key = std::to_string(j);
+                c->update(key, c->get(key), record(j));
+            }
+        }
+        // values are kept compressed, and read back through the
+        // client after a restart
+        auto& raw = context->get_raw_store("compressed");
+        for (int j = 0; j < 100; j++) {
+            string key = std::to_string(j);
+            auto rv = raw.get(key);
+            BOOST_REQUIRE_EQUAL(1, rv.size());
+            BOOST_CHECK(rv[0].get().size() < record(j).size());
+            auto v = c->get(key);
+            BOOST_REQUIRE(v);
+            BOOST_CHECK_EQUAL(record(j), v.get());
+        }
+        context->stop();
+    }
+
+    auto context = throng::ctx::new_ctx(storage.path().string());
+    context->register_store("plain");
+    BOOST_CHECK(!context->get_value_codec("plain"));
+    BOOST_CHECK_THROW(context->get_value_codec("missing"),
+                      throng::error::unknown_store);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,84 @@
+/*
+ * Test suite for value_pool
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "value_pool.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(value_pool_test)
+
+using throng::internal::value_pool;
+using std::string;
+using std::vector;
+using std::make_shared;
+
+BOOST_AUTO_TEST_CASE(acquire_release) {
+    value_pool pool(16);
+    size_t empty = pool.get_memory_usage();
+    BOOST_CHECK(!pool.is_shareable("short"));
+    BOOST_CHECK(pool.is_shareable(string(16, 'a')));
+
+    auto a = make_shared<const string>(100, 'a');
+    auto a2 = make_shared<const string>(100, 'a');
+    auto b = make_shared<const string>(100, 'b');
+    BOOST_CHECK(pool.get_added_size(*a) > 100);
+
+    // identical values share the entry and the first copy
+    value_pool::entry* ea = pool.acquire(a);
+    BOOST_CHECK_EQUAL(0, pool.get_added_size(*a2));
+    value_pool::entry* ea2 = pool.acquire(a2);
+    BOOST_CHECK(ea == ea2);
+    BOOST_CHECK(ea->get_value() == a);
+    BOOST_CHECK_EQUAL(2, ea->get_refs());
+    value_pool::entry* eb = pool.acquire(b);
+    BOOST_CHECK(ea != eb);
+    BOOST_CHECK_EQUAL(2, pool.size());
+    BOOST_CHECK(pool.get_memory_usage() > empty + 200);
+
+    // entries are removed with their last reference
+    pool.release(ea);
+    BOOST_CHECK_EQUAL(2, pool.size());
+    pool.release(ea2);
+    pool.release(eb);
+    BOOST_CHECK_EQUAL(0, pool.size());
+    BOOST_CHECK_EQUAL(empty, pool.get_memory_usage());
+}
+
+BOOST_AUTO_TEST_CASE(many) {
+    value_pool pool(16);
+    vector<value_pool::entry*> entries;
+    for (int i = 0; i < 10000; i++) {
+        auto v = make_shared<const string>(string(20, 'x') +
+                                           std::to_string(i % 1000));
+        entries.push_back(pool.acquire(v));
+    }
+    BOOST_CHECK_EQUAL(1000, pool.size());
+    for (int i = 0; i < 1000; i++)
+        BOOST_CHECK_EQUAL(10, entries[i]->get_refs());
+    for (auto e : entries)
+        pool.release(e);
+    BOOST_CHECK_EQUAL(0, pool.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,228 @@
+/* -*- C++ -*-; c-basic-offset: 4; indent-tabs-mode: nil */
+/*
+ * Test suite for write_behind
+ *
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you
+ * may not use this file except in compliance with the License. You
+ * may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "test_util.h"
+#include "map_store.h"
+
+#include "write_behind.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <thread>
+
+BOOST_AUTO_TEST_SUITE(write_behind_test)
+
+using std::string;
+using std::vector;
+using std::make_shared;
+using throng::versioned;
+using throng::vector_clock;
+using throng::durability_mode;
+using throng::internal::write_behind;
+using throng::test::map_store;
+
+static versioned<string> make_value(const string& v) {
+    return { make_shared<string>(v), vector_clock().incremented({1}) };
+}
+
+BOOST_AUTO_TEST_CASE(async) {
+    map_store delegate;
+    write_behind w(delegate, durability_mode::ASYNC,
+                   std::chrono::milliseconds(0));
+    for (int i = 0; i < 100; i++)
+        w.enqueue("key" + std::to_string(i), make_value("value"));
+    WAIT_FOR(delegate.size() == 100, 300);
+}
+
+BOOST_AUTO_TEST_CASE(batched) {
+    map_store delegate;
+    write_behind w(delegate, durability_mode::BATCHED,
+                   std::chrono::milliseconds(50));
+    w.enqueue("key1", make_value("value"));
+    w.enqueue("key2", make_value("value"));
+    BOOST_CHECK_EQUAL(0, delegate.size());
+    WAIT_FOR(delegate.size() == 2, 300);
+}
+
+BOOST_AUTO_TEST_CASE(sync) {
+    map_store delegate;
+    write_behind w(delegate, durability_mode::SYNC,
+                   std::chrono::milliseconds(0));
+
+    uint64_t seq1 = w.enqueue("key1", make_value("value"));
+    uint64_t seq2 = w.enqueue("key2", make_value("value"));
+    BOOST_CHECK_EQUAL(0, delegate.size());
+    w.sync(seq1);
+    // both writes were committed in the same group
+    BOOST_CHECK_EQUAL(2, delegate.size());
+    w.sync(seq2);
+    BOOST_CHECK_EQUAL(2, delegate.get_put_count());
+    BOOST_CHECK_EQUAL(1, delegate.get_batch_count());
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; t++) {
+        writers.emplace_back([&w, t]() {
+                for (int i = 0; i < 100; i++) {
+                    string key = std::to_string(t) + "/" + std::to_string(i);
+                    w.sync(w.enqueue(key, make_value("value")));
+                }
+            });
+    }
+    for (auto& t : writers) t.join();
+    BOOST_CHECK_EQUAL(402, delegate.size());
+}
+
+BOOST_AUTO_TEST_CASE(enqueue_batch) {
+    map_store delegate;
+    write_behind w(delegate, durability_mode::SYNC,
+                   std::chrono::milliseconds(0));
+
+    throng::write_batch<string, string> batch;
+    batch.put("key1", make_value("value"));
+    batch.put("key2", make_value("value"));
+    batch.remove("key3", vector_clock().incremented({1}));
+    uint64_t seq = w.enqueue(batch);
+    BOOST_CHECK_EQUAL(3, seq);
+    w.sync(seq);
+    BOOST_CHECK_EQUAL(3, delegate.size());
+    BOOST_CHECK_EQUAL(1, delegate.get_batch_count());
+    BOOST_CHECK_EQUAL(0, delegate.get_atomic_batch_count());
+    BOOST_CHECK(!delegate.get("key3").at(0));
+
+    // An atomic batch is committed in an atomic group, even after
+    // the group fails and is retried
+    delegate.set_failing(true);
+    throng::write_batch<string, string> atomic(true);
+    atomic.put("key4", make_value("value"));
+    atomic.put("key5", make_value("value"));
+    seq = w.enqueue(atomic);
+    BOOST_CHECK_THROW(w.sync(seq), throng::error::storage);
+    delegate.set_failing(false);
+    w.sync(seq);
+    BOOST_CHECK_EQUAL(5, delegate.size());
+    BOOST_CHECK_EQUAL(1, delegate.get_atomic_batch_count());
+}
+
+BOOST_AUTO_TEST_CASE(sync_failure) {
+    map_store delegate;
+    write_behind w(delegate, durability_mode::SYNC,
+                   std::chrono::milliseconds(0));
+
+    delegate.set_failing(true);
+    uint64_t seq1 = w.enqueue("key1", make_value("value"));
+    BOOST_CHECK_THROW(w.sync(seq1), throng::error::storage);
+    BOOST_CHECK_EQUAL(0, w.get_committed());
+
+    // The failed write is retried before the next group
+    uint64_t seq2 = w.enqueue("key2", make_value("value"));
+    BOOST_CHECK_THROW(w.sync(seq2), throng::error::storage);
+    delegate.set_failing(false);
+    w.sync(seq2);
+    BOOST_CHECK_EQUAL(seq2, w.get_committed());
+    BOOST_CHECK_EQUAL(2, delegate.size());
+    BOOST_CHECK_EQUAL(2, delegate.get_batch_count());
+}
+
+BOOST_AUTO_TEST_CASE(discard) {
+    map_store delegate;
+    write_behind w(delegate, durability_mode::SYNC,
+                   std::chrono::milliseconds(0));
+
+    delegate.set_failing_key("bad");
+    uint64_t seq1 = w.enqueue("good1", make_value("value"));
+    uint64_t seq2 = w.enqueue("bad", make_value("value"));
+    BOOST_CHECK_THROW(w.sync(seq2), throng::error::storage);
+    uint64_t seq3 = w.enqueue("good2", make_value("value"));
+    BOOST_CHECK_THROW(w.sync(seq3), throng::error::storage);
+    BOOST_CHECK_EQUAL(0, w.get_committed());
+
+    // Once the group has failed the same way three times, its writes
+    // are committed one at a time and the rejected one is discarded,
+    // so that the writes queued since are committed too
+    BOOST_CHECK_THROW(w.sync(seq2), throng::error::storage);
+    BOOST_CHECK_EQUAL(seq3, w.get_committed());
+    w.sync(seq1);
+    w.sync(seq3);
+    BOOST_CHECK_EQUAL(2, delegate.size());
+    BOOST_CHECK(delegate.get("bad").empty());
+}
+
+BOOST_AUTO_TEST_CASE(queue_limit) {
+    map_store delegate;
+    write_behind w(delegate, durability_mode::BATCHED,
+                   std::chrono::seconds(60), 1024);
+
+    // Writers commit the queue once it is full, rather than waiting
+    // for the commit interval
+    for (int i = 0; i < 100; i++) {
+        w.wait_for_space();
+        w.enqueue("key" + std::to_string(i), make_value(string(100, 'x')));
+    }
+    BOOST_CHECK(delegate.size() > 0);
+    BOOST_CHECK(w.get_memory_usage() > 0);
+    BOOST_CHECK(w.get_memory_usage() < 2048);
+
+    // and fail if it cannot be committed
+    delegate.set_failing(true);
+    bool full = false;
+    for (int i = 0; i < 100 && !full; i++) {
+        try {
+            w.wait_for_space();
+            w.enqueue("key" + std::to_string(i),
+                      make_value(string(100, 'x')));
+        } catch (const throng::error::storage&) {
+            full = true;
+        }
+    }
+    BOOST_CHECK(full);
+    delegate.set_failing(false);
+    BOOST_CHECK(w.flush());
+    BOOST_CHECK_EQUAL(0, w.get_memory_usage());
+}
+
+BOOST_AUTO_TEST_CASE(async_retry) {
+    map_store delegate;
+    write_behind w(delegate, durability_mode::ASYNC,
+                   std::chrono::milliseconds(0));
+
+    delegate.set_failing(true);
+    w.enqueue("key1", make_value("value"));
+    BOOST_CHECK(!w.flush());
+    BOOST_CHECK_EQUAL(0, w.get_committed());
+    delegate.set_failing(false);
+    // The commit thread retries without any further writes
+    WAIT_FOR(delegate.size() == 1, 300);
+    BOOST_CHECK_EQUAL(1, w.get_committed());
+}
+
+BOOST_AUTO_TEST_CASE(flush_on_destroy) {
+    map_store delegate;
+    {
+        write_behind w(delegate, durability_mode::BATCHED,
+                       std::chrono::seconds(60));
+        w.enqueue("key1", make_value("value"));
+    }
+    BOOST_CHECK_EQUAL(1, delegate.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()